@@ -24,6 +24,16 @@
 #include <time.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "debug_helpers.h"
 
@@ -42,6 +52,7 @@
 #include "mutex.h"
 #include "threads.h"
 #include "timer.h"
+#include "ti_semaphore.h"
 
 #include "stream.h"
 #include "stream_socket.h"
@@ -54,8 +65,6 @@
 
 
 struct appsrv_connection {
-    /*! Is this item busy (broadcasting) */
-    bool is_busy;
     /*! If something has gone wrong this is set to true */
     bool is_dead;
     /*! Name for us in debug logs */
@@ -67,13 +76,157 @@ struct appsrv_connection {
     /*! The socket interface to the gateway */
     struct mt_msg_interface socket_interface;
 
+    /*! Protects the tx queue below */
+    intptr_t txq_mutex;
+    /*! Posted when a frame is added to the tx queue */
+    intptr_t txq_sem;
+    /*! Outbound frames (ring buffer), drained by the writer thread */
+    struct appsrv_frame **ppTxq;
+    /*! Index of the oldest frame in the tx queue */
+    int txq_head;
+    /*! Number of frames in the tx queue */
+    int txq_count;
+    /*! Queue statistics, logged when the connection goes away and
+      sent on APPSRV_GET_TXQ_STATS_REQ */
+    struct appsrv_txq_stats txq_stats;
+
     /*! Thread id for the socket interface */
     intptr_t thread_id_s2appsrv;
+    /*! Thread id for the writer thread */
+    intptr_t thread_id_writer;
+
+    /*! Socket, only used in epoll server mode (else -1) */
+    int fd;
+    /*! epoll mode: frames being written, and how much of the first went out */
+    struct appsrv_frame *ppTxCur[APPSRV_TX_IOV_MAX];
+    int tx_ncur;
+    size_t tx_offset;
+    /*! epoll mode: partial incoming frame */
+    uint8_t *pRxBuf;
+    size_t rx_len;
+    size_t rx_size;
+    /*! epoll mode: next connection owned by the event loop */
+    struct appsrv_connection *pNextLoop;
+
+    /*! Gateway asked for batched data indications */
+    bool rx_batch;
+    /*! Batch being filled, records are written straight into the frame
+      (under txq_mutex) */
+    struct appsrv_frame *pBatch;
+    int batch_len;
+    int batch_count;
+
+    /*! What this gateway subscribed to, NULL means everything */
+    struct appsrv_filter *pFilter;
+
+    /*! Device delta cursor: the next_since last sent, tombstones up
+      to here may be dropped (under devtab_mutex) */
+    bool has_devtab_cursor;
+    uint32_t devtab_cursor;
+
+    /*! Not a socket: frames are appended to the shared memory ring */
+    struct appsrv_ring_hdr *pRing;
+};
+
+/*! The published set of gateway connections.
+  Never changed in place: adding or removing a connection publishes
+  a new copy, see appsrv_conn_set_update(). Readers use it inside
+  appsrv_read_enter()/appsrv_read_exit() without taking any lock. */
+struct appsrv_conn_set {
+    int n;
+    struct appsrv_connection *ppCONN[];
+};
+
+/*! Per connection subscription, see APPSRV_SUBSCRIBE_REQ */
+struct appsrv_filter {
+    /*! bit N set: wants APPSRV_* indication N */
+    uint32_t event_mask;
+    /*! bit N set: wants data with Smsgs cmdId N (31 and up share bit 31) */
+    uint32_t cmdid_mask;
+    /*! Wanted devices, both sorted, both empty means all devices */
+    int n_short;
+    uint16_t *pShort;
+    int n_ext;
+    uint8_t *pExt;
+};
+
+/*! What a broadcast is about, matched against struct appsrv_filter */
+struct appsrv_event {
+    /*! The APPSRV_* indication */
+    int cmd1;
+    /*! Smsgs cmdId for data indications, else -1 */
+    int cmdId;
+    /*! Device the event is about, if any */
+    bool has_short;
+    uint16_t shortAddr;
+    const uint8_t *pExtAddr;
+    /*! Extended address looked up for the short one, see match_event() */
+    bool ext_looked_up;
+    ApiMac_sAddrExt_t ext_addr;
+};
+
+/*! One device in the versioned device table */
+struct appsrv_devtab_entry {
+    /*! What the gateway sees for this device */
+    Csf_deviceInformation_t info;
+    /*! Table version when it was added, and when it last changed */
+    uint32_t added_version;
+    uint32_t version;
+    /*! Removed from the network, kept so deltas can report it */
+    bool is_removed;
+    /*! Neighbours in version order (indexes, -1 at the ends) */
+    int older;
+    int newer;
+    /*! Next entry in the same extended address bucket, -1: last */
+    int next_hash;
+};
+
+/*! One remembered data indication, see APPSRV_REPLAY_REQ */
+struct appsrv_hist_rec {
+    /*! The APPSRV_DEVICE_DATA_RX_IND frame, we hold a reference */
+    struct appsrv_frame *pFrame;
+    /*! Smsgs cmdId of the msdu */
+    int cmdId;
+    /*! When it arrived (CLOCK_MONOTONIC) */
+    uint64_t when_mSecs;
+    /*! Arrival order over all devices, the replay cursor */
+    uint32_t seq;
+};
+
+/*! An indication picked for a replay */
+struct appsrv_replay_pick {
+    uint32_t seq;
+    struct appsrv_frame *pFrame;
+};
+
+/*! The last replay_depth data indications of one device */
+struct appsrv_hist {
+    /*! Next device in the same hash bucket */
+    struct appsrv_hist *pNext;
+    uint16_t shortAddr;
+    /*! Oldest record, and number of records */
+    int head;
+    int count;
+    struct appsrv_hist_rec recs[];
+};
 
-    /*! Next connection in the list */
-    struct appsrv_connection *pNext;
+/*! Most connections a snapshot holds without allocating */
+#define APPSRV_SNAPSHOT_INLINE 16
+
+/*! Connections picked for one broadcast, see appsrv_snapshot_take() */
+struct appsrv_snapshot {
+    /*! Read side epoch, keeps the connections below allocated */
+    unsigned epoch;
+    /*! Number of connections */
+    int n;
+    /*! The connections, points at inline[] unless there are many */
+    struct appsrv_connection **ppCONN;
+    struct appsrv_connection *inline_CONN[APPSRV_SNAPSHOT_INLINE];
 };
 
+/*! Decides if a connection gets a broadcast */
+typedef bool appsrv_match_fn(struct appsrv_connection *pCONN, void *pCookie);
+
 /******************************************************************************
  GLOBAL Variables
 *****************************************************************************/
@@ -86,6 +239,8 @@ struct socket_cfg appClient_socket_cfg;
 struct socket_cfg npi_socket_cfg;
 /*! UART configuration for apimac if talking to UART instead of npi */
 struct uart_cfg   uart_cfg;
+/*! Application server settings */
+struct appsrv_cfg appsrv_cfg;
 
 /*! Generic template for all gateway interfaces
   Note: These parameters can be modified via the ini file
@@ -166,900 +321,3996 @@ struct mt_msg_interface npi_mt_interface = {
  * LOCAL VARIABLES
  ********************************************************************/
 
-static intptr_t all_connections_mutex;
-static struct appsrv_connection *all_connections;
-static intptr_t all_connections_mutex;
+/*! Gateway connections, read without locks (see appsrv_read_enter) */
+static struct appsrv_conn_set *pConnSet;
+/*! Serializes changes to the connection set and connection filters,
+  readers never take it */
+static intptr_t conn_update_mutex;
+/*! Readers count themselves in conn_readers[epoch & 1] */
+static unsigned conn_epoch;
+static int conn_readers[2];
+/*! Posted by the last reader to leave an old epoch */
+static intptr_t conn_grace_sem;
+/*! Posted whenever a connection has been taken out of the set */
+static intptr_t conn_gone_sem;
+/*! Posted by the collector and server threads as they return */
+static intptr_t app_exit_sem;
+/*! How long a shutdown waits for the gateway connections to go, longer
+  than the 1 second the connection threads block for at most */
+#define APPSRV_SHUTDOWN_MSECS 3000
+
+/*! Number of connections that asked for batched data indications */
+static int rx_batch_connections;
+
+/*! Posted when a batch starts filling up, see appsrv_rxBatch_thread */
+static intptr_t rx_batch_sem;
+
+/*! Versioned device table, see APPSRV_GET_DEVICE_DELTA_REQ */
+static intptr_t devtab_mutex;
+static bool devtab_loaded;
+static struct appsrv_devtab_entry *pDevTab;
+static int devtab_n;
+static int devtab_size;
+/*! Change counter, bumped for every add/change/remove */
+static uint32_t devtab_version;
+/*! Identifies this run, versions restart with the collector */
+static uint32_t devtab_epoch;
+/*! Oldest and newest entry in version order */
+static int devtab_oldest = -1;
+static int devtab_newest = -1;
+/*! Extended address hash buckets, first index of each chain, -1: empty */
+static int *pDevTabHash;
+static uint32_t devtab_hash_mask;
+/*! Newest tombstone dropped so far, deltas from before it are gone */
+static uint32_t devtab_floor;
+
+/*! Recent data indications per device, hashed on the short address */
+#define APPSRV_HIST_BUCKETS 256
+static intptr_t hist_mutex;
+static struct appsrv_hist *hist_buckets[APPSRV_HIST_BUCKETS];
+/*! Sequence number of the last remembered indication */
+static uint32_t hist_seq;
+
+/*! The shared memory ring, it takes part in broadcasts like a gateway */
+static struct appsrv_connection *pRingCONN;
+static intptr_t ring_mutex;
+
+/*! epoll server mode: event loop and its wakeup eventfd */
+static int epoll_fd = -1;
+static int epoll_wakeup_fd = -1;
+/*! epoll server mode: markers for the non-connection descriptors */
+static int epoll_listen_marker;
+static int epoll_unix_marker;
+static int epoll_wakeup_marker;
 
 /*******************************************************************
  * LOCAL FUNCTIONS
  ********************************************************************/
 
-/*! Lock the list of gateway connections
-  Often used when modifying the list
-*/
-static void lock_connection_list(void)
-{
-    MUTEX_lock(all_connections_mutex, -1);
-}
+static unsigned appsrv_read_enter(void);
+static void appsrv_read_exit(unsigned epoch);
+static int appsrv_snapshot_take(struct appsrv_snapshot *pSnap,
+                                appsrv_match_fn *pMatch, void *pCookie);
+static void appsrv_snapshot_send(struct appsrv_snapshot *pSnap,
+                                 struct appsrv_frame *pFrame);
+static void appsrv_snapshot_release(struct appsrv_snapshot *pSnap);
+static void appsrv_hist_add(uint16_t shortAddr, int cmdId,
+                            struct appsrv_frame *pFrame);
+static void appsrv_hist_forget(bool all, uint16_t shortAddr);
 
-/* See lock() above */
-static void unlock_connection_list(void)
+/*!
+ * @brief stop reading the connection set
+ * @param epoch - from appsrv_read_enter()
+ */
+static void appsrv_read_exit(unsigned epoch)
 {
-    MUTEX_unLock(all_connections_mutex);
+    if((__atomic_sub_fetch(&(conn_readers[epoch & 1]), 1,
+                           __ATOMIC_SEQ_CST) == 0) &&
+       (__atomic_load_n(&conn_epoch, __ATOMIC_SEQ_CST) != epoch))
+    {
+        /* last one out of an old epoch, a writer waits for that */
+        SEMAPHORE_put(conn_grace_sem);
+    }
 }
 
 /*!
- * @brief send a data confirm to the gateway
- * @param status - the status value to send
+ * @brief start reading the connection set (and the connection filters)
+ * @returns the epoch to pass to appsrv_read_exit()
+ *
+ * Never blocks and takes no lock. Whatever is published when this
+ * returns stays allocated until appsrv_read_exit(), so readers must
+ * not wait for anything that a writer may hold.
  */
-static void send_AppsrvTxDataCnf(int status)
+static unsigned appsrv_read_enter(void)
 {
-    int len = TX_DATA_CNF_LEN;
-    uint8_t *pBuff;
-
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_TX_DATA_CNF);
+    unsigned epoch;
 
-    /* Create duplicate pointer to msg buffer for building */
-    pBuff = pMsg->iobuf + HEADER_LEN;
+    for(;;)
+    {
+        epoch = __atomic_load_n(&conn_epoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&(conn_readers[epoch & 1]), 1, __ATOMIC_SEQ_CST);
+        /* if a writer moved on in between it may have missed us,
+           then count ourselves in the new epoch instead */
+        if(__atomic_load_n(&conn_epoch, __ATOMIC_SEQ_CST) == epoch)
+        {
+            return epoch;
+        }
+        appsrv_read_exit(epoch);
+    }
+}
 
-    /* Put status in the msg buffer */
-    *pBuff++ = (uint8_t)(status & 0xFF);
-    *pBuff++ = (uint8_t)((status >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)((status >> 16) & 0xFF);
-    *pBuff++ = (uint8_t)((status >> 24) & 0xFF);
+/*!
+ * @brief wait until no reader can see what was just unpublished
+ *
+ * Called with conn_update_mutex held, after something new was
+ * published. Starts a new epoch and sleeps until the readers of
+ * the old one are gone, they are short so this takes microseconds.
+ */
+static void appsrv_synchronize(void)
+{
+    unsigned epoch;
 
-    /* Send msg  */
-    MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-    MT_MSG_wrBuf(pMsg, NULL, len);
-    appsrv_broadcast(pMsg);
-        MT_MSG_free(pMsg);
-        pMsg = NULL;
+    epoch = __atomic_fetch_add(&conn_epoch, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&(conn_readers[epoch & 1]), __ATOMIC_SEQ_CST))
+    {
+        (void)SEMAPHORE_waitWithTimeout(conn_grace_sem, 1000);
     }
+}
 
 /*!
- * @brief send a join confirm to the gateway
+ * @brief Append the checksum (if the interface wants one)
+ * @param pFrame - frame to finish
+ *
+ * Must be called before the frame is shared, after this
+ * the bytes in the frame are never modified again.
  */
-static void send_AppSrvJoinPermitCnf(int status)
+static void appsrv_frame_seal(struct appsrv_frame *pFrame)
 {
-    int len = JOIN_PERMIT_CNF_LEN;
-    uint8_t *pBuff;
-
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_SET_JOIN_PERMIT_CNF);
+    size_t x;
+    uint8_t chksum;
 
-    /* Create duplicate pointer to msg buffer for building */
-    pBuff = pMsg->iobuf + HEADER_LEN;
+    if(pFrame->is_sealed)
+    {
+        return;
+    }
+    pFrame->is_sealed = true;
 
-    /* Put status in the msg buffer */
-    *pBuff++ = (uint8_t)(status & 0xFF);
-    *pBuff++ = (uint8_t)((status >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)((status >> 16) & 0xFF);
-    *pBuff++ = (uint8_t)((status >> 24) & 0xFF);
+    if(!appClient_mt_interface_template.include_chksum)
+    {
+        return;
+    }
 
-    /* Send msg */
-    MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-    MT_MSG_wrBuf(pMsg, NULL, len);
-    appsrv_broadcast(pMsg);
-        MT_MSG_free(pMsg);
-        pMsg = NULL;
+    /* checksum covers everything after the frame sync byte */
+    x = appClient_mt_interface_template.frame_sync ? 1 : 0;
+    chksum = 0;
+    for(/* above */ ; x < pFrame->wire_len ; x++)
+    {
+        chksum ^= pFrame->wire[x];
     }
+    pFrame->wire[pFrame->wire_len++] = chksum;
+}
 
 /*!
- * @brief handle a data request from the gateway
- * @param pCONN - where the request came from
- * @param pIncomingMsg - the msg from the gateway
+ * @brief shrink the payload of a frame that was allocated for the worst case
+ * @param pFrame - the frame, not sealed yet
+ * @param len - the payload length actually used
  */
-static void appsrv_processTxDataReq(struct appsrv_connection *pCONN,
-                                    struct mt_msg *pIncomingMsg)
+static void appsrv_frame_setLen(struct appsrv_frame *pFrame, int len)
 {
-    int status;
-    int ind = HEADER_LEN;
-    uint8_t msgId;
-    uint16_t shortAddr;
-
-    /* Parse msg */
-    msgId = (uint8_t)pIncomingMsg->iobuf[ind];
-    ind += 1;
+    uint8_t *pWire;
 
-    shortAddr = (uint16_t)(pIncomingMsg->iobuf[ind]) |
-                (pIncomingMsg->iobuf[ind + 1] << 8);
-    ind += 2;
+    if(pFrame->is_sealed || (len > pFrame->len))
+    {
+        BUG_HERE("bad frame length\n");
+    }
+    pWire = pFrame->wire + (appClient_mt_interface_template.frame_sync ? 1 : 0);
+    *pWire++ = (uint8_t)(len & 0xFF);
+    if(appClient_mt_interface_template.len_2bytes)
+    {
+        *pWire++ = (uint8_t)((len >> 8) & 0xFF);
+    }
+    pFrame->wire_len -= (size_t)(pFrame->len - len);
+    pFrame->len = len;
+}
 
-    ApiMac_sAddr_t pDstAddr;
-    pDstAddr.addrMode = ApiMac_addrType_short;
-    pDstAddr.addr.shortAddr = shortAddr;
+/*!
+ * @brief tell whoever drains the tx queue that there is work
+ * @param pCONN - the connection
+ */
+static void appsrv_connection_wake(struct appsrv_connection *pCONN)
+{
+    uint64_t one;
 
-    if (msgId == Smsgs_cmdIds_configReq)
+    if(pCONN->fd < 0)
     {
-        uint16_t framecontrol;
-        uint32_t pollingInterval;
-        uint32_t reportingInterval;
-        uint8_t configStatus;
-
-        pollingInterval = (uint32_t)(pIncomingMsg->iobuf[ind]) |
-                          (pIncomingMsg->iobuf[ind + 1] << 8);
-        ind += 2;
+        SEMAPHORE_put(pCONN->txq_sem);
+        return;
+    }
+    /* epoll mode, the event loop does the writing */
+    one = 1;
+    if(write(epoll_wakeup_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        /* counter is saturated, the loop is awake anyway */
+    }
+}
 
-        reportingInterval = (uint32_t)(pIncomingMsg->iobuf[ind]) |
-                            (pIncomingMsg->iobuf[ind + 1] << 8);
-        ind += 2;
+/*!
+ * @brief write a frame to the socket of one gateway connection
+ * @param pCONN - where to send
+ * @param pFrame - what to send
+ *
+ * Only the writer thread of the connection calls this.
+ */
+static void appsrv_connection_write(struct appsrv_connection *pCONN,
+                                    struct appsrv_frame *pFrame)
+{
+    int r;
 
-        framecontrol = (uint16_t)(pIncomingMsg->iobuf[ind]) |
-                       (pIncomingMsg->iobuf[ind + 1] << 8);
+    r = STREAM_wrBytes(pCONN->socket_interface.hndl,
+                       pFrame->wire,
+                       pFrame->wire_len,
+                       pCONN->socket_interface.intermsg_timeout_mSecs);
 
-        configStatus = Csf_sendConfigRequest(&pDstAddr, framecontrol, reportingInterval, pollingInterval);
-        LOG_printf(LOG_APPSRV_MSG_CONTENT, " Config-req sent\n");
-        LOG_printf(LOG_APPSRV_MSG_CONTENT, "Config status: %x\n", configStatus);
-    }
-    else if (msgId == Smsgs_cmdIds_customCommand)
+    if((r < 0) || ((size_t)r != pFrame->wire_len))
     {
-        uint16_t length = ((pIncomingMsg->iobuf[ind]) |
-                (pIncomingMsg->iobuf[ind + 1] << 8)) + sizeof(uint16_t);
-        uint8_t *state = Csf_malloc(128); // fixme
-        int i = 0;
-        for(i=0; i < length; i++ ) {
-        	*(state+i) = pIncomingMsg->iobuf[ind+i];
-	}
-        Csf_customCommand(&pDstAddr, state, length);
+        LOG_printf(LOG_ERROR, "%s: cannot write msg 0x%02x\n",
+                   pCONN->dbg_name, pFrame->cmd1);
+        pCONN->is_dead = true;
+        return;
     }
-
-    status = ApiMac_status_success;
-    send_AppsrvTxDataCnf(status);
+    pCONN->txq_stats.n_sent++;
+    LOG_printf(LOG_APPSRV_BROADCAST, "%s: sent msg 0x%02x (%d bytes)\n",
+               pCONN->dbg_name, pFrame->cmd1, (int)(pFrame->wire_len));
 }
 
-static void appsrv_processRemoveDeviceReq(struct appsrv_connection *pCONN,
-                                          struct mt_msg *pIncomingMsg)
+/*!
+ * @brief append a frame to the shared memory ring
+ * @param pCONN - the ring connection
+ * @param pFrame - sealed frame
+ *
+ * See struct appsrv_ring_hdr for the reader side.
+ */
+static void appsrv_ring_write(struct appsrv_connection *pCONN,
+                              struct appsrv_frame *pFrame)
+{
+    struct appsrv_ring_hdr *pRing;
+    uint8_t *pData;
+    uint64_t head;
+    uint64_t size;
+    uint64_t pos;
+    uint32_t len;
+    size_t rec;
+
+    pRing = pCONN->pRing;
+    pData = ((uint8_t *)pRing) + pRing->data_offset;
+    size = pRing->data_size;
+    len = (uint32_t)(pFrame->wire_len);
+    rec = (sizeof(len) + pFrame->wire_len + 3) & ~((size_t)3);
+    if(rec > (size / 2))
     {
-    int ind = HEADER_LEN;
-    uint16_t shortAddr;
-    ApiMac_sAddr_t dstAddr;
-    Llc_deviceListItem_t devListItem;
-    ApiMac_status_t status;
-
-    shortAddr = (uint16_t)(pIncomingMsg->iobuf[ind]) |
-                (pIncomingMsg->iobuf[ind + 1] << 8);
-
-    dstAddr.addrMode = ApiMac_addrType_short;
-    dstAddr.addr.shortAddr = shortAddr;
+        pCONN->txq_stats.n_dropped++;
+        return;
+    }
 
-    if (Csf_getDevice(&dstAddr, &devListItem))
+    /* the connection list can broadcast from several threads */
+    MUTEX_lock(ring_mutex, -1);
+    head = pRing->head;
+    pos = head & (size - 1);
+    if(pos + rec > size)
     {
-        /* Send disassociation request to specified sensor */
-        ApiMac_mlmeDisassociateReq_t disassocReq;
-        memset(&disassocReq, 0, sizeof(ApiMac_mlmeDisassociateReq_t));
-        disassocReq.deviceAddress.addrMode = ApiMac_addrType_short;
-        disassocReq.deviceAddress.addr.shortAddr = devListItem.devInfo.shortAddress;
-        disassocReq.devicePanId = devListItem.devInfo.panID;
-        disassocReq.disassociateReason = ApiMac_disassocateReason_coord;
-        disassocReq.txIndirect = true;
-        status = ApiMac_mlmeDisassociateReq(&disassocReq);
-        LOG_printf(LOG_APPSRV_MSG_CONTENT, "Disassociate Sent, status: %x\n", status);
+        /* does not fit at the end, skip to the start */
+        __atomic_store_n(&(pRing->reserve), head + (size - pos) + rec,
+                         __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        *((uint32_t *)(pData + pos)) = APPSRV_RING_WRAP;
+        head += size - pos;
+        pos = 0;
+    }
+    else
+    {
+        __atomic_store_n(&(pRing->reserve), head + rec, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
     }
+    memcpy(pData + pos, &len, sizeof(len));
+    memcpy(pData + pos + sizeof(len), pFrame->wire, pFrame->wire_len);
+    __atomic_store_n(&(pRing->head), head + rec, __ATOMIC_RELEASE);
+    MUTEX_unLock(ring_mutex);
+
+    pCONN->txq_stats.n_sent++;
 }
 
 /*!
- * @brief handle a join permit request from the gateway
- * @param pCONN - where the request came from
- * @param pIncomingMsg - the msg from the gateway
+ * @brief create the shared memory ring and its connection
+ * @returns 0 ok, -1 error
  */
-static void appsrv_processSetJoinPermitReq(struct appsrv_connection *pCONN,
-                                           struct mt_msg *pIncomingMsg)
+static int appsrv_ring_create(void)
 {
-    int status;
-    uint32_t duration;
-    duration = (uint32_t)(pIncomingMsg->iobuf[HEADER_LEN]) |
-               (pIncomingMsg->iobuf[HEADER_LEN + 1] << 8) |
-               (pIncomingMsg->iobuf[HEADER_LEN + 2] << 16) |
-               (pIncomingMsg->iobuf[HEADER_LEN + 3] << 24);
+    struct appsrv_ring_hdr *pRing;
+    struct appsrv_connection *pCONN;
+    size_t total;
+    int fd;
 
-    /* Set the join permit */
-    LOG_printf(LOG_APPSRV_MSG_CONTENT, "\nSending duration: 0x%x\n\n", duration);
-    status = Cllc_setJoinPermit(duration);
+    total = sizeof(*pRing) + appsrv_cfg.shm_ring_size;
+    fd = open(appsrv_cfg.shm_ring_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        LOG_printf(LOG_ERROR, "cannot open shm ring %s: %s\n",
+                   appsrv_cfg.shm_ring_path, strerror(errno));
+        return -1;
+    }
+    if(ftruncate(fd, (off_t)total) != 0)
+    {
+        LOG_printf(LOG_ERROR, "cannot size shm ring %s: %s\n",
+                   appsrv_cfg.shm_ring_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    pRing = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pRing == MAP_FAILED)
+    {
+        LOG_printf(LOG_ERROR, "cannot map shm ring %s: %s\n",
+                   appsrv_cfg.shm_ring_path, strerror(errno));
+        return -1;
+    }
 
-    /* Send cnf msg  */
-    LOG_printf(LOG_APPSRV_MSG_CONTENT, "\nSending permitCnf message\n\n");
-    send_AppSrvJoinPermitCnf(status);
+    /* start empty, readers wait for the magic */
+    memset((void *)pRing, 0, sizeof(*pRing));
+    pRing->data_offset = sizeof(*pRing);
+    pRing->data_size = appsrv_cfg.shm_ring_size;
+    __atomic_store_n(&(pRing->magic), APPSRV_RING_MAGIC, __ATOMIC_RELEASE);
+
+    ring_mutex = MUTEX_create("shm-ring");
+    if(ring_mutex == 0)
+    {
+        BUG_HERE("cannot create shm ring mutex\n");
+    }
+    pCONN = calloc(1, sizeof(*pCONN));
+    if(pCONN == NULL)
+    {
+        BUG_HERE("No memory\n");
     }
+    pCONN->fd = -1;
+    pCONN->connection_id = -1;
+    pCONN->dbg_name = "shm-ring";
+    pCONN->pRing = pRing;
+    pRingCONN = pCONN;
+    LOG_printf(LOG_APPSRV_CONNECTIONS, "shm ring: %s, %d bytes\n",
+               appsrv_cfg.shm_ring_path, appsrv_cfg.shm_ring_size);
+    return 0;
+}
 
 /*!
- * @brief handle a getnetwork info request from the gateway
- * @param pCONN - where the request came from
+ * @brief queue a frame for one gateway connection
+ * @param pCONN - where to send
+ * @param pFrame - what to send, the queue takes its own reference
+ *
+ * All traffic towards a gateway, replies and broadcasts alike,
+ * goes through here. This never blocks on the socket, the frame
+ * is written later by the connection writer thread. When the
+ * queue is full appsrv_cfg.txq_overflow decides what happens.
  */
-static void appsrv_processGetNwkInfoReq(struct appsrv_connection *pCONN)
+static void appsrv_connection_send(struct appsrv_connection *pCONN,
+                                   struct appsrv_frame *pFrame)
 {
-    Llc_netInfo_t networkInfo;
-    uint8_t *pBuff;
-    int len = NWK_INFO_REQ_LEN;
+    struct appsrv_frame *pDropped;
+    int depth;
 
-    uint8_t status = (uint8_t)Csf_getNetworkInformation(&networkInfo);
-    uint8_t securityEnabled = CONFIG_SECURE;
-    uint8_t networkMode;
-    uint8_t state = Csf_getCllcState();
+    if(pCONN->is_dead)
+    {
+        return;
+    }
 
-    LOG_printf(LOG_APPSRV_MSG_CONTENT, "\nSending NwkCnf STATE = %x\n\n", state);
+    appsrv_frame_seal(pFrame);
 
-    if (CONFIG_FH_ENABLE == true)
+    /* the ring has no queue, readers keep up or lose messages */
+    if(pCONN->pRing)
     {
-        networkMode = FREQUENCY_HOPPING;
+        appsrv_ring_write(pCONN, pFrame);
+        return;
     }
 
-    else
+    pDropped = NULL;
+    depth = appsrv_cfg.txq_depth;
+
+    MUTEX_lock(pCONN->txq_mutex, -1);
+    if(pCONN->txq_count == depth)
     {
-        if ((CONFIG_MAC_SUPERFRAME_ORDER == 15) && (CONFIG_MAC_BEACON_ORDER == 15))
-        {
-            networkMode = NON_BEACON;
-        }
-        else
+        pCONN->txq_stats.n_dropped++;
+        switch(appsrv_cfg.txq_overflow)
         {
-            networkMode = BEACON_ENABLED;
+        default:
+        case APPSRV_TXQ_DROP_OLDEST:
+            pDropped = pCONN->ppTxq[pCONN->txq_head];
+            pCONN->txq_head = (pCONN->txq_head + 1) % depth;
+            pCONN->txq_count--;
+            break;
+        case APPSRV_TXQ_DROP_NEWEST:
+            MUTEX_unLock(pCONN->txq_mutex);
+            LOG_printf(LOG_APPSRV_BROADCAST, "%s: queue full, msg 0x%02x dropped\n",
+                       pCONN->dbg_name, pFrame->cmd1);
+            return;
+        case APPSRV_TXQ_DISCONNECT:
+            pCONN->is_dead = true;
+            MUTEX_unLock(pCONN->txq_mutex);
+            LOG_printf(LOG_ERROR, "%s: queue full, disconnecting\n",
+                       pCONN->dbg_name);
+            /* wake the writer so it notices */
+            appsrv_connection_wake(pCONN);
+            return;
         }
     }
 
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_GET_NWK_INFO_CNF);
-
-    /* Create duplicate pointer to msg buffer for building */
-    pBuff = pMsg->iobuf + HEADER_LEN;
+    appsrv_frame_hold(pFrame);
+    pCONN->ppTxq[(pCONN->txq_head + pCONN->txq_count) % depth] = pFrame;
+    pCONN->txq_count++;
+    if(pCONN->txq_count > pCONN->txq_stats.max_depth)
+    {
+        pCONN->txq_stats.max_depth = pCONN->txq_count;
+    }
+    MUTEX_unLock(pCONN->txq_mutex);
 
-    /* Build msg */
-    *pBuff++ = status;
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.panID & 0xFF);
-    *pBuff++ = (uint8_t)((networkInfo.devInfo.panID >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.shortAddress & 0xFF);
-    *pBuff++ = (uint8_t)((networkInfo.devInfo.shortAddress >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[0]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[1]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[2]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[3]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[4]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[5]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[6]);
-    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[7]);
-    *pBuff++ = (uint8_t)(networkInfo.channel);
-    *pBuff++ = (uint8_t)(networkInfo.fh);
-    *pBuff++ = securityEnabled;
-    *pBuff++ = networkMode;
-    *pBuff++ = state;
+    appsrv_connection_wake(pCONN);
 
-    /* Send msg */
-        MT_MSG_setDestIface(pMsg, &(pCONN->socket_interface));
-        MT_MSG_wrBuf(pMsg, NULL, len);
-        MT_MSG_txrx(pMsg);
-        MT_MSG_free(pMsg);
-    pMsg = NULL;
+    if(pDropped)
+    {
+        LOG_printf(LOG_APPSRV_BROADCAST, "%s: queue full, msg 0x%02x dropped\n",
+                   pCONN->dbg_name, pDropped->cmd1);
+        appsrv_frame_release(pDropped);
     }
+}
 
 /*!
- * @brief  Process incoming getDeviceArrayReq message
- *
- * @param pConn - the connection
+ * @brief remove the oldest frame from a connection tx queue
+ * @param pCONN - the connection
+ * @returns the frame (caller owns the reference) or NULL if empty
  */
-static void appsrv_processGetDeviceArrayReq(struct appsrv_connection *pCONN)
+static struct appsrv_frame *appsrv_connection_dequeue(struct appsrv_connection *pCONN)
 {
-    uint16_t n = 0;
-    uint8_t *pBuff;
-    Csf_deviceInformation_t *pDeviceInfo;
+    struct appsrv_frame *pFrame;
 
-    uint8_t status = ApiMac_status_success;
-    n = (uint16_t)Csf_getDeviceInformationList(&pDeviceInfo);
-
-    int len = DEV_ARRAY_HEAD_LEN + (DEV_ARRAY_INFO_LEN * n);
-
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_GET_DEVICE_ARRAY_CNF);
-
-    /* Create duplicate pointer to msg buffer for building */
-    pBuff = pMsg->iobuf + HEADER_LEN;
-
-    /* Build msg */
-    *pBuff++ = status;
-    *pBuff++ = (uint8_t)(n & 0xFF);
-    *pBuff++ = (uint8_t)((n >> 8) & 0xFF);
-
-    uint16_t x;
-    for (x = 0; x < n; x++)
-    {
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.panID & 0xFF);
-        *pBuff++ = (uint8_t)((pDeviceInfo[x].devInfo.panID >> 8) & 0xFF);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.shortAddress & 0xFF);
-        *pBuff++ = (uint8_t)((pDeviceInfo[x].devInfo.shortAddress >> 8) & 0xFF);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[0]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[1]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[2]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[3]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[4]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[5]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[6]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].devInfo.extAddress[7]);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].capInfo.panCoord);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].capInfo.ffd);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].capInfo.mainsPower);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].capInfo.rxOnWhenIdle);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].capInfo.security);
-        *pBuff++ = (uint8_t)(pDeviceInfo[x].capInfo.allocAddr);
+    pFrame = NULL;
+    MUTEX_lock(pCONN->txq_mutex, -1);
+    if(pCONN->txq_count)
+    {
+        pFrame = pCONN->ppTxq[pCONN->txq_head];
+        pCONN->ppTxq[pCONN->txq_head] = NULL;
+        pCONN->txq_head = (pCONN->txq_head + 1) % appsrv_cfg.txq_depth;
+        pCONN->txq_count--;
     }
+    MUTEX_unLock(pCONN->txq_mutex);
+    return pFrame;
+}
 
-    /* Send msg */
-            MT_MSG_setDestIface(pMsg, &(pCONN->socket_interface));
-            MT_MSG_wrBuf(pMsg, NULL, len);
-            MT_MSG_txrx(pMsg);
-    MT_MSG_free(pMsg);
-    pMsg = NULL;
-
-    if (pDeviceInfo)
+/*!
+ * @brief create the tx queue of a connection
+ * @param pCONN - the connection
+ */
+static void appsrv_connection_txq_create(struct appsrv_connection *pCONN)
+{
+    pCONN->ppTxq = calloc(appsrv_cfg.txq_depth, sizeof(*(pCONN->ppTxq)));
+    if(pCONN->ppTxq == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    pCONN->txq_mutex = MUTEX_create(pCONN->dbg_name);
+    if(pCONN->txq_mutex == 0)
+    {
+        BUG_HERE("Cannot create tx queue mutex?\n");
+    }
+    pCONN->txq_sem = SEMAPHORE_create(pCONN->dbg_name, 0);
+    if(pCONN->txq_sem == 0)
     {
-        Csf_freeDeviceInformationList(n, pDeviceInfo);
-        pDeviceInfo = NULL;
+        BUG_HERE("Cannot create tx queue semaphore?\n");
     }
 }
 
-/******************************************************************************
- Function Implementation
-*****************************************************************************/
-
-/*
-  Broadcast a message to all connections.
-  Public function in appsrv.h
-*/
-void appsrv_broadcast(struct mt_msg *pMsg)
+/*!
+ * @brief throw away whatever is queued and destroy the tx queue
+ * @param pCONN - the connection, nobody may be sending to it anymore
+ */
+static void appsrv_connection_txq_destroy(struct appsrv_connection *pCONN)
 {
-    struct appsrv_connection *pCONN;
-    struct mt_msg *pClone;
-
-    /* mark all connections as "ready to broadcast" */
-    lock_connection_list();
+    struct appsrv_frame *pFrame;
+    int x;
 
-    for(pCONN = all_connections ; pCONN ; pCONN = pCONN->pNext)
+    for(x = 0 ; x < pCONN->tx_ncur ; x++)
     {
-        pCONN->is_busy = false;
+        appsrv_frame_release(pCONN->ppTxCur[x]);
+        pCONN->ppTxCur[x] = NULL;
     }
-
-    unlock_connection_list();
-
-next_connection:
-    /* find first connection in "ready-state"
-     * NOTE: this loop is funny we goto the top
-     * and we restart scanning from the head
-     * because ... while broadcasting a new
-     * connection may appear, or one may go away
-     */
-    lock_connection_list();
-    for(pCONN = all_connections ; pCONN ; pCONN = pCONN->pNext)
+    pCONN->tx_ncur = 0;
+    for(;;)
     {
-        /* this one is dead */
-        if(pCONN->is_dead)
-        {
-            continue;
-        }
-        /* is this one ready? */
-
-        if(pCONN->is_busy == false)
+        pFrame = appsrv_connection_dequeue(pCONN);
+        if(pFrame == NULL)
         {
-            /* Yes we have found one */
-            pCONN->is_busy = true;
             break;
         }
+        appsrv_frame_release(pFrame);
     }
-    unlock_connection_list();
+    LOG_printf(LOG_APPSRV_CONNECTIONS,
+               "%s: closed, sent: %u, dropped: %u, max queue depth: %u\n",
+               pCONN->dbg_name,
+               (unsigned)(pCONN->txq_stats.n_sent),
+               (unsigned)(pCONN->txq_stats.n_dropped),
+               (unsigned)(pCONN->txq_stats.max_depth));
+    SEMAPHORE_destroy(pCONN->txq_sem);
+    MUTEX_destroy(pCONN->txq_mutex);
+    free((void *)(pCONN->ppTxq));
+    pCONN->ppTxq = NULL;
+    appsrv_frame_release(pCONN->pBatch);
+    pCONN->pBatch = NULL;
+    free((void *)(pCONN->pFilter));
+    pCONN->pFilter = NULL;
+}
 
-    /* Did we find a connection? */
-    if(pCONN)
+/*!
+ * @brief add and/or remove a gateway connection
+ * @param pAdd - connection to add, or NULL
+ * @param pDel - connection to remove, or NULL
+ *
+ * Publishes a new connection set and returns once no reader can
+ * still see the old one, after that pDel can be torn down.
+ */
+static void appsrv_conn_set_update(struct appsrv_connection *pAdd,
+                                   struct appsrv_connection *pDel)
+{
+    struct appsrv_conn_set *pOld;
+    struct appsrv_conn_set *pNew;
+    int n;
+    int x;
+
+    MUTEX_lock(conn_update_mutex, -1);
+    pOld = pConnSet;
+    n = pOld ? pOld->n : 0;
+    pNew = malloc(sizeof(*pNew) + ((n + 1) * sizeof(pNew->ppCONN[0])));
+    if(pNew == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    pNew->n = 0;
+    for(x = 0 ; x < n ; x++)
     {
-        /* we have a connection we can send */
-        pClone = MT_MSG_clone(pMsg);
-        if(pClone)
+        if(pOld->ppCONN[x] != pDel)
         {
-            MT_MSG_setDestIface(pClone, &(pCONN->socket_interface));
-            MT_MSG_txrx(pClone);
-            MT_MSG_free(pClone);
+            pNew->ppCONN[pNew->n++] = pOld->ppCONN[x];
         }
-        /* leave this connection as 'busy'
-         * busy really means: "done"
-         * so that we do not repeat this connection
-         * we clean up the list later
-         *---
-         * Go back to the *FIRST* connection
-         * And search again.... from the top..
-         * Why? Because connections may have died...
-         */
-        goto next_connection;
     }
+    if(pAdd)
+    {
+        pNew->ppCONN[pNew->n++] = pAdd;
+    }
+    __atomic_store_n(&pConnSet, pNew, __ATOMIC_SEQ_CST);
+    appsrv_synchronize();
+    MUTEX_unLock(conn_update_mutex);
+    free((void *)pOld);
 
-    /* if we get here - we have no more connections to broadcast to */
-    /* mark all items as idle */
-    lock_connection_list();
-    for(pCONN = all_connections ; pCONN ; pCONN = pCONN->pNext)
+    if(pDel)
     {
-        pCONN->is_busy = false;
+        if(pDel->rx_batch)
+        {
+            pDel->rx_batch = false;
+            __atomic_sub_fetch(&rx_batch_connections, 1, __ATOMIC_RELAXED);
+        }
+        SEMAPHORE_put(conn_gone_sem);
     }
-    unlock_connection_list();
 }
 
 /*!
-  Csf module calls this function to inform the user/appClient
-  that the application has either started/restored the network
+ * @brief start describing a broadcast
+ * @param pEvent - the event to fill in
+ * @param cmd1 - the APPSRV_* indication
+ */
+static void appsrv_event_init(struct appsrv_event *pEvent, int cmd1)
+{
+    memset((void *)pEvent, 0, sizeof(*pEvent));
+    pEvent->cmd1 = cmd1;
+    pEvent->cmdId = -1;
+}
 
-  Public function defined in appsrv_Collector.h
-*/
-void appsrv_networkUpdate(bool restored, Llc_netInfo_t *networkInfo)
+/* bsearch helpers for the filter address sets */
+static int cmp_short(const void *pA, const void *pB)
 {
-    int len = NWK_INFO_IND_LEN;
-    uint8_t *pBuff;
+    return (int)(*(const uint16_t *)pA) - (int)(*(const uint16_t *)pB);
+}
 
-    uint8_t securityEnabled = CONFIG_SECURE;
-    uint8_t networkMode;
-    uint8_t state = Csf_getCllcState();
+static int cmp_ext(const void *pA, const void *pB)
+{
+    return memcmp(pA, pB, APIMAC_SADDR_EXT_LEN);
+}
 
-    if (CONFIG_FH_ENABLE == true)
+/*!
+ * @brief does a connection subscribe to this event?
+ * @param pCONN - the connection
+ * @param pCookie - the struct appsrv_event
+ *
+ * Called between appsrv_read_enter() and appsrv_read_exit(),
+ * which keeps the filter from being freed under us.
+ */
+static bool match_event(struct appsrv_connection *pCONN, void *pCookie)
+{
+    struct appsrv_event *pEvent;
+    struct appsrv_filter *pFilter;
+
+    pEvent = (struct appsrv_event *)pCookie;
+    pFilter = __atomic_load_n(&(pCONN->pFilter), __ATOMIC_ACQUIRE);
+    if(pFilter == NULL)
     {
-        networkMode = FREQUENCY_HOPPING;
+        return true;
     }
 
-    else
+    if((pEvent->cmd1 < 32) &&
+       !(pFilter->event_mask & (1UL << pEvent->cmd1)))
     {
-        if ((CONFIG_MAC_SUPERFRAME_ORDER == 15) && (CONFIG_MAC_BEACON_ORDER == 15))
-        {
-            networkMode = NON_BEACON;
-        }
-        else
-        {
-            networkMode = BEACON_ENABLED;
-        }
+        return false;
     }
 
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_NWK_INFO_IND);
-
-    /* Create duplicate pointer to msg buffer for building purposes */
-    pBuff = pMsg->iobuf + HEADER_LEN;
-
-    /* Build msg */
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.panID & 0xFF);
-    *pBuff++ = (uint8_t)((networkInfo->devInfo.panID >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.shortAddress & 0xFF);
-    *pBuff++ = (uint8_t)((networkInfo->devInfo.shortAddress >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[0]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[1]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[2]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[3]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[4]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[5]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[6]);
-    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[7]);
-    *pBuff++ = (uint8_t)(networkInfo->channel);
-    *pBuff++ = (uint8_t)(networkInfo->fh);
-    *pBuff++ = securityEnabled;
-    *pBuff++ = networkMode;
-    *pBuff++ = state;
+    if((pEvent->cmdId >= 0) &&
+       !(pFilter->cmdid_mask & (1UL << ((pEvent->cmdId < 31) ? pEvent->cmdId : 31))))
+    {
+        return false;
+    }
 
-    /* Send msg */
-            MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-            MT_MSG_wrBuf(pMsg, NULL, len);
-            appsrv_broadcast(pMsg);
-            MT_MSG_free(pMsg);
-            pMsg = NULL;
+    /* device filter, only for events about a device */
+    if(((pFilter->n_short == 0) && (pFilter->n_ext == 0)) ||
+       (!(pEvent->has_short) && (pEvent->pExtAddr == NULL)))
+    {
+        return true;
+    }
+    if(pEvent->has_short && pFilter->n_short &&
+       bsearch(&(pEvent->shortAddr), pFilter->pShort, pFilter->n_short,
+               sizeof(uint16_t), cmp_short))
+    {
+        return true;
+    }
+    /* most indications only carry the short address, look up the
+       extended one once for all connections that filter on it */
+    if(pEvent->has_short && (pEvent->pExtAddr == NULL) && pFilter->n_ext &&
+       !(pEvent->ext_looked_up))
+    {
+        pEvent->ext_looked_up = true;
+        if(Csf_getDeviceExtended(pEvent->shortAddr, &(pEvent->ext_addr)))
+        {
+            pEvent->pExtAddr = pEvent->ext_addr;
         }
+    }
+    if(pEvent->pExtAddr && pFilter->n_ext &&
+       bsearch(pEvent->pExtAddr, pFilter->pExt, pFilter->n_ext,
+               APIMAC_SADDR_EXT_LEN, cmp_ext))
+    {
+        return true;
+    }
+    return false;
+}
 
 /*!
+ * @brief pick the connection with this connection_id
+ */
+static bool match_connection_id(struct appsrv_connection *pCONN,
+                                 void *pCookie)
+{
+    return (pCONN->connection_id == *((int *)pCookie));
+}
 
-  Csf module calls this function to inform the user/appClient
-  that a device has joined the network
-
-  Public function defined in appsrv_Collector.h
-*/
-void appsrv_deviceUpdate(Llc_deviceListItem_t *pDevListItem)
+/*!
+ * @brief build a data confirm
+ * @param corrId - correlation id from the request, 0 if it had none
+ * @param status - the status value to send
+ * @param latency_mSecs - from the request to the MAC confirm
+ * @returns the frame, the caller releases it
+ */
+static struct appsrv_frame *build_AppsrvTxDataCnf(uint32_t corrId, int status,
+                                                  uint32_t latency_mSecs)
 {
-    int len = DEVICE_JOINED_IND_LEN;
+    int len = TX_DATA_CNF_LEN;
     uint8_t *pBuff;
 
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_DEVICE_JOINED_IND);
-
-    /* Create duplicate pointer to msg buffer for building purposes */
-    pBuff = pMsg->iobuf + HEADER_LEN;
-
-    /* Build msg */
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.panID & 0xFF);
-    *pBuff++ = (uint8_t)((pDevListItem->devInfo.panID >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.shortAddress & 0xFF);
-    *pBuff++ = (uint8_t)((pDevListItem->devInfo.shortAddress >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[0]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[1]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[2]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[3]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[4]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[5]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[6]);
-    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[7]);
-    *pBuff++ = (uint8_t)(pDevListItem->capInfo.panCoord);
-    *pBuff++ = (uint8_t)(pDevListItem->capInfo.ffd);
-    *pBuff++ = (uint8_t)(pDevListItem->capInfo.mainsPower);
-    *pBuff++ = (uint8_t)(pDevListItem->capInfo.rxOnWhenIdle);
-    *pBuff++ = (uint8_t)(pDevListItem->capInfo.security);
-    *pBuff++ = (uint8_t)(pDevListItem->capInfo.allocAddr);
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_TX_DATA_CNF, len);
 
-    /* Send msg */
-            MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-            MT_MSG_wrBuf(pMsg, NULL, len);
-            appsrv_broadcast(pMsg);
-            MT_MSG_free(pMsg);
-            pMsg = NULL;
-        }
+    /* Create duplicate pointer to msg buffer for building */
+    pBuff = pFrame->pPayload;
 
+    /* Put status in the msg buffer */
+    *pBuff++ = (uint8_t)(status & 0xFF);
+    *pBuff++ = (uint8_t)((status >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((status >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((status >> 24) & 0xFF);
+    *pBuff++ = (uint8_t)(corrId & 0xFF);
+    *pBuff++ = (uint8_t)((corrId >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((corrId >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((corrId >> 24) & 0xFF);
+    *pBuff++ = (uint8_t)(latency_mSecs & 0xFF);
+    *pBuff++ = (uint8_t)((latency_mSecs >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((latency_mSecs >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((latency_mSecs >> 24) & 0xFF);
+    return pFrame;
+}
 
-/*
- * @brief common code to handle sensor data messages
- * @param pSrcAddr - address related to this message
+/*!
+ * @brief send a data confirm to the gateway that sent the request
+ * @param pCONN - that gateway
+ * @param corrId - correlation id from the request, 0 if it had none
+ * @param status - the status value to send
+ * @param latency_mSecs - from the request to the MAC confirm
  *
- * In the end, the message is sent to the gateway
+ * Correlation ids are chosen by each gateway, so confirms never go
+ * to the others.
  */
-void appsrv_deviceRawDataUpdate(ApiMac_mcpsDataInd_t *pDataInd)
+static void send_AppsrvTxDataCnf(struct appsrv_connection *pCONN,
+                                 uint32_t corrId, int status,
+                                 uint32_t latency_mSecs)
 {
-    // Get the length (srcAddr + rssi + msdu.len)
-    uint16_t bufferLength = pDataInd->msdu.len + sizeof(pDataInd->rssi) + sizeof(ApiMac_sAddr_t);
-    uint8_t buffer[bufferLength];
-    memset(buffer, 0, bufferLength);
-    uint16_t idx = 0;
-    buffer[idx++] = pDataInd->srcAddr.addrMode;
-    if (pDataInd->srcAddr.addrMode == ApiMac_addrType_short)
-    {
-        buffer[idx++] = (uint8_t)(pDataInd->srcAddr.addr.shortAddr & 0xFF);
-        buffer[idx++] = (uint8_t)((pDataInd->srcAddr.addr.shortAddr >> 8) & 0xFF);
-    }
-    else if (pDataInd->srcAddr.addrMode == ApiMac_addrType_extended)
-    {
-        memcpy((buffer + idx), pDataInd->srcAddr.addr.extAddr, APIMAC_SADDR_EXT_LEN);
-        idx += APIMAC_SADDR_EXT_LEN;
-    }
-    buffer[idx++] = pDataInd->rssi;
-    memcpy((buffer + idx), pDataInd->msdu.p, pDataInd->msdu.len);
+    struct appsrv_frame *pFrame;
 
-    // initalize the message struct
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        bufferLength,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_DEVICE_DATA_RX_IND);
+    pFrame = build_AppsrvTxDataCnf(corrId, status, latency_mSecs);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief send a join confirm to the gateway
+ */
+static void send_AppSrvJoinPermitCnf(int status)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = JOIN_PERMIT_CNF_LEN;
+    uint8_t *pBuff;
 
-    //add the ApiMac data to the message iobuf
-    uint16_t i;
-    for (i = 0; i < bufferLength; i++)
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_SET_JOIN_PERMIT_CNF);
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
     {
-        pMsg->iobuf[i + HEADER_LEN] = buffer[i];
+        appsrv_snapshot_release(&snap);
+        return;
     }
 
-    // send the message buffer over a socket to the appclient
-    MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-    MT_MSG_wrBuf(pMsg, NULL, bufferLength);
-    appsrv_broadcast(pMsg);
-    MT_MSG_free(pMsg);
-    pMsg = NULL;
-}
-
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_SET_JOIN_PERMIT_CNF, len);
 
-void appsrv_send_removeDeviceRsp(void)
-{
-    int len = REMOVE_DEVICE_RSP_LEN;
+    /* Create duplicate pointer to msg buffer for building */
+    pBuff = pFrame->pPayload;
 
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_RMV_DEVICE_RSP);
+    /* Put status in the msg buffer */
+    *pBuff++ = (uint8_t)(status & 0xFF);
+    *pBuff++ = (uint8_t)((status >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((status >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((status >> 24) & 0xFF);
 
     /* Send msg */
-    MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-    MT_MSG_wrBuf(pMsg, NULL, len);
-    appsrv_broadcast(pMsg);
-    MT_MSG_free(pMsg);
-    pMsg = NULL;
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
 }
 
 /*!
-  Csf module calls this function to inform the user/appClient
-  that a device is no longer active in the network
+ * @brief map a Collector_status_t to the status of a data confirm
+ */
+static int appsrv_txStatus(uint8_t collectorStatus)
+{
+    switch(collectorStatus)
+    {
+    case Collector_status_success:
+        return ApiMac_status_success;
+    case Collector_status_busy:
+        return ApiMac_status_noResources;
+    default:
+        return ApiMac_status_invalidParameter;
+    }
+}
 
-  Public function defined in appsrv_Collector.h
-*/
-void appsrv_deviceNotActiveUpdate(ApiMac_deviceDescriptor_t *pDevInfo,
-                                  bool timeout)
+/*!
+ * @brief handle a data request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * The request may end with a 4 byte correlation id. Accepted requests
+ * are confirmed when the MAC confirms them (APPSRV_TX_DATA_CNF with the
+ * MAC status, the id and the latency), so a gateway can keep several
+ * in flight. Requests that cannot be sent are confirmed right away.
+ * Confirms only go back to pCONN.
+ */
+static void appsrv_processTxDataReq(struct appsrv_connection *pCONN,
+                                    struct mt_msg *pIncomingMsg)
 {
-    int len = DEVICE_NOT_ACTIVE_LEN;
-    uint8_t *pBuff;
+    int status;
+    int ind = HEADER_LEN;
+    int body_len;
+    uint8_t msgId;
+    uint16_t shortAddr;
+    uint16_t length;
+    uint32_t corrId;
+    uint8_t *pCorr;
 
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_DEVICE_NOTACTIVE_UPDATE_IND);
+    if(pIncomingMsg->expected_len < TX_DATA_REQ_HEAD_LEN)
+    {
+        LOG_printf(LOG_ERROR, "%s: tx data request too short\n",
+                   pCONN->dbg_name);
+        send_AppsrvTxDataCnf(pCONN, 0, ApiMac_status_invalidParameter, 0);
+        return;
+    }
 
-    /* Create duplicate pointer to msg buffer for building purposes */
-    pBuff = pMsg->iobuf + HEADER_LEN;
+    /* Parse msg */
+    msgId = (uint8_t)pIncomingMsg->iobuf[ind];
+    ind += 1;
 
-    /* Build msg */
-    *pBuff++ = (uint8_t)(pDevInfo->panID & 0xFF);
-    *pBuff++ = (uint8_t)((pDevInfo->panID >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(pDevInfo->shortAddress & 0xFF);
-    *pBuff++ = (uint8_t)((pDevInfo->shortAddress >> 8) & 0xFF);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[0]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[1]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[2]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[3]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[4]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[5]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[6]);
-    *pBuff++ = (uint8_t)(pDevInfo->extAddress[7]);
-    *pBuff++ = (uint8_t)timeout;
+    shortAddr = (uint16_t)(pIncomingMsg->iobuf[ind]) |
+                (pIncomingMsg->iobuf[ind + 1] << 8);
+    ind += 2;
+
+    ApiMac_sAddr_t pDstAddr;
+    pDstAddr.addrMode = ApiMac_addrType_short;
+    pDstAddr.addr.shortAddr = shortAddr;
+
+    /* the correlation id follows the body, so find where that ends */
+    length = 0;
+    body_len = TX_DATA_REQ_HEAD_LEN;
+    if (msgId == Smsgs_cmdIds_configReq)
+    {
+        body_len += TX_DATA_REQ_CONFIG_LEN;
+    }
+    else if (msgId == Smsgs_cmdIds_customCommand)
+    {
+        /* the length prefix goes over the air with the command, it
+           can only be read if it is there */
+        if((body_len + sizeof(uint16_t)) > pIncomingMsg->expected_len)
+        {
+            body_len += sizeof(uint16_t);
+        }
+        else
+        {
+            length = ((pIncomingMsg->iobuf[ind]) |
+                      (pIncomingMsg->iobuf[ind + 1] << 8)) + sizeof(uint16_t);
+            body_len += length;
+        }
+    }
+    if(body_len > pIncomingMsg->expected_len)
+    {
+        LOG_printf(LOG_ERROR, "%s: tx data request too short\n",
+                   pCONN->dbg_name);
+        send_AppsrvTxDataCnf(pCONN, 0, ApiMac_status_invalidParameter, 0);
+        return;
+    }
+    corrId = 0;
+    if((body_len + sizeof(uint32_t)) <= pIncomingMsg->expected_len)
+    {
+        pCorr = &(pIncomingMsg->iobuf[HEADER_LEN + body_len]);
+        corrId = (uint32_t)(pCorr[0]) | ((uint32_t)(pCorr[1]) << 8) |
+                 ((uint32_t)(pCorr[2]) << 16) | ((uint32_t)(pCorr[3]) << 24);
+    }
+
+    if (msgId == Smsgs_cmdIds_configReq)
+    {
+        uint16_t framecontrol;
+        uint32_t pollingInterval;
+        uint32_t reportingInterval;
+        uint8_t configStatus;
+
+        pollingInterval = (uint32_t)(pIncomingMsg->iobuf[ind]) |
+                          (pIncomingMsg->iobuf[ind + 1] << 8);
+        ind += 2;
+
+        reportingInterval = (uint32_t)(pIncomingMsg->iobuf[ind]) |
+                            (pIncomingMsg->iobuf[ind + 1] << 8);
+        ind += 2;
+
+        framecontrol = (uint16_t)(pIncomingMsg->iobuf[ind]) |
+                       (pIncomingMsg->iobuf[ind + 1] << 8);
+
+        configStatus = Csf_sendConfigRequest(&pDstAddr, framecontrol,
+                                             reportingInterval,
+                                             pollingInterval, &corrId,
+                                             pCONN->connection_id);
+        LOG_printf(LOG_APPSRV_MSG_CONTENT, " Config-req sent\n");
+        LOG_printf(LOG_APPSRV_MSG_CONTENT, "Config status: %x\n", configStatus);
+        if(configStatus != Collector_status_success)
+        {
+            send_AppsrvTxDataCnf(pCONN, corrId,
+                                 appsrv_txStatus(configStatus), 0);
+        }
+        /* else the MAC data confirm answers */
+        return;
+    }
+    else if (msgId == Smsgs_cmdIds_customCommand)
+    {
+        uint8_t cmdStatus;
+
+        /* Long commands are copied into the fragmentation pool,
+           short ones straight into the MSDU */
+        cmdStatus = Csf_customCommand(&pDstAddr,
+                                      &(pIncomingMsg->iobuf[ind]), length,
+                                      &corrId, pCONN->connection_id);
+        LOG_printf(LOG_APPSRV_MSG_CONTENT, "Custom command status: %x\n",
+                   cmdStatus);
+        if(cmdStatus != Collector_status_success)
+        {
+            send_AppsrvTxDataCnf(pCONN, corrId,
+                                 appsrv_txStatus(cmdStatus), 0);
+        }
+        /* else the MAC data confirm, or the end of the fragmented
+           transfer, answers */
+        return;
+    }
+
+    /* nothing goes over the air for anything else */
+    status = ApiMac_status_success;
+    send_AppsrvTxDataCnf(pCONN, corrId, status, 0);
+}
+
+static void appsrv_processRemoveDeviceReq(struct appsrv_connection *pCONN,
+                                          struct mt_msg *pIncomingMsg)
+    {
+    int ind = HEADER_LEN;
+    uint16_t shortAddr;
+    ApiMac_sAddr_t dstAddr;
+    Llc_deviceListItem_t devListItem;
+    ApiMac_status_t status;
+
+    shortAddr = (uint16_t)(pIncomingMsg->iobuf[ind]) |
+                (pIncomingMsg->iobuf[ind + 1] << 8);
+
+    dstAddr.addrMode = ApiMac_addrType_short;
+    dstAddr.addr.shortAddr = shortAddr;
+
+    if (Csf_getDevice(&dstAddr, &devListItem))
+    {
+        /* Send disassociation request to specified sensor */
+        ApiMac_mlmeDisassociateReq_t disassocReq;
+        memset(&disassocReq, 0, sizeof(ApiMac_mlmeDisassociateReq_t));
+        disassocReq.deviceAddress.addrMode = ApiMac_addrType_short;
+        disassocReq.deviceAddress.addr.shortAddr = devListItem.devInfo.shortAddress;
+        disassocReq.devicePanId = devListItem.devInfo.panID;
+        disassocReq.disassociateReason = ApiMac_disassocateReason_coord;
+        disassocReq.txIndirect = true;
+        status = ApiMac_mlmeDisassociateReq(&disassocReq);
+        LOG_printf(LOG_APPSRV_MSG_CONTENT, "Disassociate Sent, status: %x\n", status);
+    }
+}
+
+/*!
+ * @brief handle a join permit request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ */
+static void appsrv_processSetJoinPermitReq(struct appsrv_connection *pCONN,
+                                           struct mt_msg *pIncomingMsg)
+{
+    int status;
+    uint32_t duration;
+    duration = (uint32_t)(pIncomingMsg->iobuf[HEADER_LEN]) |
+               (pIncomingMsg->iobuf[HEADER_LEN + 1] << 8) |
+               (pIncomingMsg->iobuf[HEADER_LEN + 2] << 16) |
+               (pIncomingMsg->iobuf[HEADER_LEN + 3] << 24);
+
+    /* Set the join permit */
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "\nSending duration: 0x%x\n\n", duration);
+    status = Cllc_setJoinPermit(duration);
+
+    /* Send cnf msg  */
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "\nSending permitCnf message\n\n");
+    send_AppSrvJoinPermitCnf(status);
+    }
+
+/*!
+ * @brief handle a getnetwork info request from the gateway
+ * @param pCONN - where the request came from
+ */
+static void appsrv_processGetNwkInfoReq(struct appsrv_connection *pCONN)
+{
+    Llc_netInfo_t networkInfo;
+    uint8_t *pBuff;
+    int len = NWK_INFO_REQ_LEN;
+
+    uint8_t status = (uint8_t)Csf_getNetworkInformation(&networkInfo);
+    uint8_t securityEnabled = CONFIG_SECURE;
+    uint8_t networkMode;
+    uint8_t state = Csf_getCllcState();
+
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "\nSending NwkCnf STATE = %x\n\n", state);
+
+    if (CONFIG_FH_ENABLE == true)
+    {
+        networkMode = FREQUENCY_HOPPING;
+    }
+
+    else
+    {
+        if ((CONFIG_MAC_SUPERFRAME_ORDER == 15) && (CONFIG_MAC_BEACON_ORDER == 15))
+        {
+            networkMode = NON_BEACON;
+        }
+        else
+        {
+            networkMode = BEACON_ENABLED;
+        }
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_GET_NWK_INFO_CNF, len);
+
+    /* Create duplicate pointer to msg buffer for building */
+    pBuff = pFrame->pPayload;
+
+    /* Build msg */
+    *pBuff++ = status;
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.panID & 0xFF);
+    *pBuff++ = (uint8_t)((networkInfo.devInfo.panID >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.shortAddress & 0xFF);
+    *pBuff++ = (uint8_t)((networkInfo.devInfo.shortAddress >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[0]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[1]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[2]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[3]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[4]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[5]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[6]);
+    *pBuff++ = (uint8_t)(networkInfo.devInfo.extAddress[7]);
+    *pBuff++ = (uint8_t)(networkInfo.channel);
+    *pBuff++ = (uint8_t)(networkInfo.fh);
+    *pBuff++ = securityEnabled;
+    *pBuff++ = networkMode;
+    *pBuff++ = state;
+
+    /* Send msg */
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+}
+
+/*!
+ * @brief move a device table entry to the newest end, with a new version
+ * @param idx - the entry, devtab_mutex must be held
+ */
+static void devtab_touch(int idx)
+{
+    struct appsrv_devtab_entry *pE;
+
+    pE = &pDevTab[idx];
+    /* unlink */
+    if(pE->older >= 0)
+    {
+        pDevTab[pE->older].newer = pE->newer;
+    }
+    else if(devtab_oldest == idx)
+    {
+        devtab_oldest = pE->newer;
+    }
+    if(pE->newer >= 0)
+    {
+        pDevTab[pE->newer].older = pE->older;
+    }
+    else if(devtab_newest == idx)
+    {
+        devtab_newest = pE->older;
+    }
+
+    /* and append, so the list stays in version order */
+    pE->version = ++devtab_version;
+    pE->older = devtab_newest;
+    pE->newer = -1;
+    if(devtab_newest >= 0)
+    {
+        pDevTab[devtab_newest].newer = idx;
+    }
+    else
+    {
+        devtab_oldest = idx;
+    }
+    devtab_newest = idx;
+}
+
+/*!
+ * @brief extended address hash bucket
+ * @param pExtAddr - the address
+ */
+static uint32_t devtab_hash(const uint8_t *pExtAddr)
+{
+    uint32_t hash = 2166136261u;
+    int x;
+
+    /* FNV-1a, same as the device list in csf_linux.c */
+    for(x = 0 ; x < APIMAC_SADDR_EXT_LEN ; x++)
+    {
+        hash = (hash ^ pExtAddr[x]) * 16777619u;
+    }
+    return (hash & devtab_hash_mask);
+}
+
+/*!
+ * @brief rebuild the hash chains, about one bucket per table slot
+ *
+ * devtab_mutex must be held. Called when the table grows or is
+ * compacted, both move entries around anyway.
+ */
+static void devtab_rehash(void)
+{
+    uint32_t buckets;
+    uint32_t b;
+    int idx;
+
+    buckets = 1;
+    while(buckets < (uint32_t)devtab_size)
+    {
+        buckets <<= 1;
+    }
+    if((pDevTabHash == NULL) || (buckets != (devtab_hash_mask + 1)))
+    {
+        free((void *)pDevTabHash);
+        pDevTabHash = malloc(buckets * sizeof(*pDevTabHash));
+        if(pDevTabHash == NULL)
+        {
+            BUG_HERE("No memory\n");
+        }
+        devtab_hash_mask = buckets - 1;
+    }
+    for(b = 0 ; b < buckets ; b++)
+    {
+        pDevTabHash[b] = -1;
+    }
+    for(idx = 0 ; idx < devtab_n ; idx++)
+    {
+        b = devtab_hash(pDevTab[idx].info.devInfo.extAddress);
+        pDevTab[idx].next_hash = pDevTabHash[b];
+        pDevTabHash[b] = idx;
+    }
+}
+
+/*!
+ * @brief find a device in the table
+ * @param pExtAddr - its extended address
+ * @returns index or -1, devtab_mutex must be held
+ */
+static int devtab_find(const uint8_t *pExtAddr)
+{
+    int x;
+
+    if(pDevTabHash == NULL)
+    {
+        return -1;
+    }
+    for(x = pDevTabHash[devtab_hash(pExtAddr)] ; x >= 0 ;
+        x = pDevTab[x].next_hash)
+    {
+        if(memcmp(pDevTab[x].info.devInfo.extAddress, pExtAddr,
+                  APIMAC_SADDR_EXT_LEN) == 0)
+        {
+            return x;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief drop the tombstones every delta reader has seen
+ *
+ * devtab_mutex must be held. The horizon is the oldest cursor of
+ * the connected gateways that read deltas; with none of them
+ * connected it is the newest version. Removed devices at or below
+ * it are dropped once they are an eighth of the table, the rest is
+ * copied in version order. A gateway that comes back with a cursor
+ * below devtab_floor is told to start over.
+ */
+static void devtab_compact(void)
+{
+    struct appsrv_devtab_entry *pNew;
+    struct appsrv_snapshot snap;
+    uint32_t horizon;
+    uint32_t floor;
+    int reclaim;
+    int idx;
+    int n;
+    int x;
+
+    horizon = devtab_version;
+    appsrv_snapshot_take(&snap, NULL, NULL);
+    for(x = 0 ; x < snap.n ; x++)
+    {
+        if(snap.ppCONN[x]->has_devtab_cursor &&
+           (snap.ppCONN[x]->devtab_cursor < horizon))
+        {
+            horizon = snap.ppCONN[x]->devtab_cursor;
+        }
+    }
+    appsrv_snapshot_release(&snap);
+
+    reclaim = 0;
+    for(idx = devtab_oldest ;
+        (idx >= 0) && (pDevTab[idx].version <= horizon) ;
+        idx = pDevTab[idx].newer)
+    {
+        if(pDevTab[idx].is_removed)
+        {
+            reclaim++;
+        }
+    }
+    if((reclaim == 0) || ((reclaim * 8) < devtab_n))
+    {
+        return;
+    }
+
+    pNew = malloc(devtab_size * sizeof(*pNew));
+    if(pNew == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    n = 0;
+    floor = devtab_floor;
+    for(idx = devtab_oldest ; idx >= 0 ; idx = pDevTab[idx].newer)
+    {
+        if(pDevTab[idx].is_removed && (pDevTab[idx].version <= horizon))
+        {
+            floor = pDevTab[idx].version;
+            continue;
+        }
+        pNew[n] = pDevTab[idx];
+        pNew[n].older = n - 1;
+        pNew[n].newer = n + 1;
+        n++;
+    }
+    if(n > 0)
+    {
+        pNew[n - 1].newer = -1;
+    }
+    free((void *)pDevTab);
+    pDevTab = pNew;
+    devtab_n = n;
+    devtab_oldest = (n > 0) ? 0 : -1;
+    devtab_newest = n - 1;
+    devtab_floor = floor;
+    devtab_rehash();
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "device table: %d tombstones dropped, "
+               "%d entries left\n", reclaim, n);
+}
+
+/*!
+ * @brief add a device, or update it if it is already known
+ * @param pInfo - the device, devtab_mutex must be held
+ */
+static void devtab_put(const Csf_deviceInformation_t *pInfo)
+{
+    struct appsrv_devtab_entry *pE;
+    uint32_t b;
+    int idx;
+
+    idx = devtab_find(pInfo->devInfo.extAddress);
+    if(idx >= 0)
+    {
+        pE = &pDevTab[idx];
+        /* rejoin with nothing new? keep the version */
+        if(!(pE->is_removed) &&
+           (memcmp(&(pE->info), pInfo, sizeof(*pInfo)) == 0))
+        {
+            return;
+        }
+    }
+    else
+    {
+        if(devtab_n == devtab_size)
+        {
+            void *pNew;
+
+            devtab_size = devtab_size ? (devtab_size * 2) : CONFIG_MAX_DEVICES;
+            pNew = realloc((void *)pDevTab, devtab_size * sizeof(*pDevTab));
+            if(pNew == NULL)
+            {
+                BUG_HERE("No memory\n");
+            }
+            pDevTab = pNew;
+            devtab_rehash();
+        }
+        idx = devtab_n++;
+        pE = &pDevTab[idx];
+        memset((void *)pE, 0, sizeof(*pE));
+        pE->older = -1;
+        pE->newer = -1;
+        pE->is_removed = true;
+        pE->info = *pInfo;
+        b = devtab_hash(pInfo->devInfo.extAddress);
+        pE->next_hash = pDevTabHash[b];
+        pDevTabHash[b] = idx;
+    }
+
+    pE->info = *pInfo;
+    devtab_touch(idx);
+    if(pE->is_removed)
+    {
+        pE->added_version = pE->version;
+        pE->is_removed = false;
+    }
+}
+
+/*!
+ * @brief lock the device table, loading it from NV the first time
+ */
+static void devtab_lock(void)
+{
+    Csf_deviceInformation_t *pDeviceInfo;
+    int n;
+    int x;
+
+    MUTEX_lock(devtab_mutex, -1);
+    if(devtab_loaded)
+    {
+        return;
+    }
+    devtab_loaded = true;
+
+    /* the only full NV walk, after this we track changes */
+    n = Csf_getDeviceInformationList(&pDeviceInfo);
+    for(x = 0 ; x < n ; x++)
+    {
+        devtab_put(&pDeviceInfo[x]);
+    }
+    Csf_freeDeviceInformationList(n, pDeviceInfo);
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "device table: %d devices loaded\n", n);
+}
+
+static void devtab_unlock(void)
+{
+    MUTEX_unLock(devtab_mutex);
+}
+
+/*!
+ * @brief put one device in a message, device array layout
+ * @param pBuff - where to write DEV_ARRAY_INFO_LEN bytes
+ * @param pInfo - the device
+ * @returns pBuff, moved past the device
+ */
+static uint8_t *appsrv_build_devInfo(uint8_t *pBuff,
+                                     const Csf_deviceInformation_t *pInfo)
+{
+    *pBuff++ = (uint8_t)(pInfo->devInfo.panID & 0xFF);
+    *pBuff++ = (uint8_t)((pInfo->devInfo.panID >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.shortAddress & 0xFF);
+    *pBuff++ = (uint8_t)((pInfo->devInfo.shortAddress >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[0]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[1]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[2]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[3]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[4]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[5]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[6]);
+    *pBuff++ = (uint8_t)(pInfo->devInfo.extAddress[7]);
+    *pBuff++ = (uint8_t)(pInfo->capInfo.panCoord);
+    *pBuff++ = (uint8_t)(pInfo->capInfo.ffd);
+    *pBuff++ = (uint8_t)(pInfo->capInfo.mainsPower);
+    *pBuff++ = (uint8_t)(pInfo->capInfo.rxOnWhenIdle);
+    *pBuff++ = (uint8_t)(pInfo->capInfo.security);
+    *pBuff++ = (uint8_t)(pInfo->capInfo.allocAddr);
+    return pBuff;
+}
+
+/*
+  A device was deleted from the device list.
+  Public function in appsrv.h
+*/
+void appsrv_deviceRemoved(ApiMac_sAddrExt_t *pExtAddr)
+{
+    int idx;
+
+    devtab_lock();
+    idx = devtab_find(*pExtAddr);
+    if((idx >= 0) && !(pDevTab[idx].is_removed))
+    {
+        pDevTab[idx].is_removed = true;
+        devtab_touch(idx);
+        /* its short address may be given to a new device */
+        appsrv_hist_forget(false, pDevTab[idx].info.devInfo.shortAddress);
+    }
+    devtab_unlock();
+}
+
+/*
+  The device list was cleared.
+  Public function in appsrv.h
+*/
+void appsrv_deviceListCleared(void)
+{
+    int idx;
+    int last;
+    int newer;
+
+    devtab_lock();
+    /* touched entries move to the end, so stop at the old newest */
+    last = devtab_newest;
+    for(idx = devtab_oldest ; idx >= 0 ; idx = newer)
+    {
+        newer = pDevTab[idx].newer;
+        if(!(pDevTab[idx].is_removed))
+        {
+            pDevTab[idx].is_removed = true;
+            devtab_touch(idx);
+        }
+        if(idx == last)
+        {
+            break;
+        }
+    }
+    devtab_unlock();
+
+    appsrv_hist_forget(true, 0);
+}
+
+/*!
+ * @brief  Process incoming getDeviceArrayReq message
+ *
+ * @param pConn - the connection
+ *
+ * A network too big for one frame gets the oldest
+ * DEV_ARRAY_MAX_DEVICES devices and status frameTooLong, the
+ * gateway then pages through APPSRV_GET_DEVICE_DELTA_REQ instead.
+ */
+static void appsrv_processGetDeviceArrayReq(struct appsrv_connection *pCONN)
+{
+    uint16_t n = 0;
+    uint8_t *pBuff;
+    int idx;
+    int x;
+
+    uint8_t status = ApiMac_status_success;
+
+    /* served from the device table, not from NV */
+    devtab_lock();
+    for(idx = devtab_oldest ; idx >= 0 ; idx = pDevTab[idx].newer)
+    {
+        if(!(pDevTab[idx].is_removed))
+        {
+            n++;
+        }
+    }
+    if(n > DEV_ARRAY_MAX_DEVICES)
+    {
+        LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: %d devices do not fit in "
+                   "a device array\n", pCONN->dbg_name, (int)n);
+        n = DEV_ARRAY_MAX_DEVICES;
+        status = ApiMac_status_frameTooLong;
+    }
+
+    int len = DEV_ARRAY_HEAD_LEN + (DEV_ARRAY_INFO_LEN * n);
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_GET_DEVICE_ARRAY_CNF, len);
+
+    /* Create duplicate pointer to msg buffer for building */
+    pBuff = pFrame->pPayload;
+
+    /* Build msg */
+    *pBuff++ = status;
+    *pBuff++ = (uint8_t)(n & 0xFF);
+    *pBuff++ = (uint8_t)((n >> 8) & 0xFF);
+
+    x = 0;
+    for(idx = devtab_oldest ; (idx >= 0) && (x < n) ;
+        idx = pDevTab[idx].newer)
+    {
+        if(!(pDevTab[idx].is_removed))
+        {
+            pBuff = appsrv_build_devInfo(pBuff, &(pDevTab[idx].info));
+            x++;
+        }
+    }
+    devtab_unlock();
+
+    /* Send msg */
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+}
+
+/*!
+ * @brief  Process incoming getDeviceDeltaReq message
+ *
+ * @param pConn - the connection
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * Returns, oldest first, the devices added, changed or removed
+ * after since_version; at most page_size of them. The gateway
+ * asks again with next_since while more is set. If epoch changed
+ * the collector restarted and the gateway must start over at 0.
+ * The same goes for status transactionExpired: removals after
+ * since were already dropped from the table, see devtab_compact().
+ */
+static void appsrv_processGetDeviceDeltaReq(struct appsrv_connection *pCONN,
+                                            struct mt_msg *pIncomingMsg)
+{
+    struct appsrv_frame *pFrame;
+    uint8_t *pBuf;
+    uint8_t *pBuff;
+    uint32_t since;
+    uint32_t next_since;
+    uint8_t status;
+    uint16_t page_size;
+    uint16_t n;
+    bool more;
+    int first;
+    int idx;
+    int x;
+
+    pBuf = pIncomingMsg->iobuf + HEADER_LEN;
+    since = 0;
+    page_size = 0;
+    status = ApiMac_status_success;
+    if(pIncomingMsg->expected_len < DEV_DELTA_REQ_LEN)
+    {
+        status = ApiMac_status_invalidParameter;
+    }
+    else
+    {
+        since = (uint32_t)(pBuf[0]) | ((uint32_t)(pBuf[1]) << 8) |
+                ((uint32_t)(pBuf[2]) << 16) | ((uint32_t)(pBuf[3]) << 24);
+        page_size = (uint16_t)(pBuf[4]) | (pBuf[5] << 8);
+    }
+    if((page_size == 0) || (page_size > DEV_DELTA_MAX_PAGE))
+    {
+        page_size = DEV_DELTA_MAX_PAGE;
+    }
+
+    devtab_lock();
+    if((status == ApiMac_status_success) && (since != 0) &&
+       (since < devtab_floor))
+    {
+        status = ApiMac_status_transactionExpired;
+    }
+    /* walk back from the newest to the first change after since */
+    first = -1;
+    if(status == ApiMac_status_success)
+    {
+        for(idx = devtab_newest ;
+            (idx >= 0) && (pDevTab[idx].version > since) ;
+            idx = pDevTab[idx].older)
+        {
+            first = idx;
+        }
+    }
+    n = 0;
+    for(idx = first ; (idx >= 0) && (n < page_size) ; idx = pDevTab[idx].newer)
+    {
+        n++;
+    }
+    more = (idx >= 0);
+
+    pFrame = appsrv_frame_alloc(APPSRV_GET_DEVICE_DELTA_CNF,
+                                DEV_DELTA_HEAD_LEN + (DEV_DELTA_REC_LEN * n));
+    pBuff = pFrame->pPayload + DEV_DELTA_HEAD_LEN;
+    next_since = since;
+    for(idx = first, x = 0 ; x < n ; idx = pDevTab[idx].newer, x++)
+    {
+        struct appsrv_devtab_entry *pE;
+
+        pE = &pDevTab[idx];
+        if(pE->is_removed)
+        {
+            *pBuff++ = DEV_DELTA_REMOVED;
+        }
+        else if(pE->added_version > since)
+        {
+            *pBuff++ = DEV_DELTA_ADDED;
+        }
+        else
+        {
+            *pBuff++ = DEV_DELTA_CHANGED;
+        }
+        pBuff = appsrv_build_devInfo(pBuff, &(pE->info));
+        next_since = pE->version;
+    }
+
+    pBuff = pFrame->pPayload;
+    *pBuff++ = status;
+    *pBuff++ = (uint8_t)(devtab_epoch & 0xFF);
+    *pBuff++ = (uint8_t)((devtab_epoch >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((devtab_epoch >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((devtab_epoch >> 24) & 0xFF);
+    *pBuff++ = (uint8_t)(devtab_version & 0xFF);
+    *pBuff++ = (uint8_t)((devtab_version >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((devtab_version >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((devtab_version >> 24) & 0xFF);
+    *pBuff++ = (uint8_t)(next_since & 0xFF);
+    *pBuff++ = (uint8_t)((next_since >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((next_since >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((next_since >> 24) & 0xFF);
+    *pBuff++ = (uint8_t)more;
+    *pBuff++ = (uint8_t)(n & 0xFF);
+    *pBuff++ = (uint8_t)((n >> 8) & 0xFF);
+
+    /* this gateway has seen everything up to next_since */
+    if(status == ApiMac_status_success)
+    {
+        pCONN->has_devtab_cursor = true;
+        pCONN->devtab_cursor = next_since;
+        devtab_compact();
+    }
+    devtab_unlock();
+
+    LOG_printf(LOG_APPSRV_MSG_CONTENT,
+               "%s: device delta since %u: %d records, next %u%s\n",
+               pCONN->dbg_name, (unsigned)since, (int)n,
+               (unsigned)next_since, more ? " (more)" : "");
+
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/******************************************************************************
+ Function Implementation
+*****************************************************************************/
+
+/*
+  Allocate a frame for a gateway message.
+  Public function in appsrv.h
+*/
+struct appsrv_frame *appsrv_frame_alloc(int cmd1, int len)
+{
+    struct appsrv_frame *pFrame;
+    uint8_t *pWire;
+
+    pFrame = calloc(1, sizeof(*pFrame) + APPSRV_FRAME_OVERHEAD + len);
+    if(pFrame == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    pFrame->refcount = 1;
+    pFrame->cmd1 = cmd1;
+    pFrame->len = len;
+
+    /* Encode the header once, same format the MT layer would use */
+    pWire = pFrame->wire;
+    if(appClient_mt_interface_template.frame_sync)
+    {
+        *pWire++ = APPSRV_FRAME_SOF;
+    }
+    *pWire++ = (uint8_t)(len & 0xFF);
+    if(appClient_mt_interface_template.len_2bytes)
+    {
+        *pWire++ = (uint8_t)((len >> 8) & 0xFF);
+    }
+    *pWire++ = (uint8_t)MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC);
+    *pWire++ = (uint8_t)cmd1;
+
+    /* the caller builds the payload directly in the frame */
+    pFrame->pPayload = pWire;
+    pFrame->wire_len = (size_t)(pWire - pFrame->wire) + len;
+    return pFrame;
+}
+
+/*
+  Take another reference on a frame.
+  Public function in appsrv.h
+*/
+void appsrv_frame_hold(struct appsrv_frame *pFrame)
+{
+    __atomic_add_fetch(&(pFrame->refcount), 1, __ATOMIC_RELAXED);
+}
+
+/*
+  Drop a reference on a frame, the last one frees it.
+  Public function in appsrv.h
+*/
+void appsrv_frame_release(struct appsrv_frame *pFrame)
+{
+    if(pFrame == NULL)
+    {
+        return;
+    }
+    if(__atomic_sub_fetch(&(pFrame->refcount), 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free((void *)pFrame);
+    }
+}
+
+/*!
+ * @brief pick the connections for a broadcast
+ * @param pSnap - filled in with the picked connections
+ * @param pMatch - decides if a connection gets the message, NULL for all
+ * @param pCookie - passed to pMatch
+ * @returns number of connections picked
+ *
+ * Takes a snapshot of the live connections in one pass, without
+ * any lock. The read side epoch keeps each of them allocated
+ * until appsrv_snapshot_release(), connections that show up
+ * later miss this message. Callers check the count before they
+ * encode anything.
+ */
+static int appsrv_snapshot_take(struct appsrv_snapshot *pSnap,
+                                appsrv_match_fn *pMatch,
+                                void *pCookie)
+{
+    struct appsrv_conn_set *pSet;
+    struct appsrv_connection *pCONN;
+    int n;
+    int x;
+
+    pSnap->ppCONN = pSnap->inline_CONN;
+    pSnap->n = 0;
+
+    pSnap->epoch = appsrv_read_enter();
+    pSet = __atomic_load_n(&pConnSet, __ATOMIC_ACQUIRE);
+    /* the ring is not in the set but gets broadcasts too */
+    n = (pSet ? pSet->n : 0) + (pRingCONN ? 1 : 0);
+    if(n > APPSRV_SNAPSHOT_INLINE)
+    {
+        pSnap->ppCONN = malloc(n * sizeof(*(pSnap->ppCONN)));
+        if(pSnap->ppCONN == NULL)
+        {
+            BUG_HERE("No memory\n");
+        }
+    }
+    for(x = 0 ; pSet && (x < pSet->n) ; x++)
+    {
+        pCONN = pSet->ppCONN[x];
+        /* this one is dead */
+        if(pCONN->is_dead)
+        {
+            continue;
+        }
+        if(pMatch && !((*pMatch)(pCONN, pCookie)))
+        {
+            continue;
+        }
+        pSnap->ppCONN[pSnap->n++] = pCONN;
+    }
+    pCONN = pRingCONN;
+    if(pCONN && (!pMatch || (*pMatch)(pCONN, pCookie)))
+    {
+        pSnap->ppCONN[pSnap->n++] = pCONN;
+    }
+    return pSnap->n;
+}
+
+/*!
+ * @brief send one frame to every connection in a snapshot
+ * @param pSnap - from appsrv_snapshot_take()
+ * @param pFrame - the frame, encoded once for all of them
+ */
+static void appsrv_snapshot_send(struct appsrv_snapshot *pSnap,
+                                 struct appsrv_frame *pFrame)
+{
+    int x;
+
+    appsrv_frame_seal(pFrame);
+    for(x = 0 ; x < pSnap->n ; x++)
+    {
+        appsrv_connection_send(pSnap->ppCONN[x], pFrame);
+    }
+}
+
+/*!
+ * @brief give back the connections of a snapshot
+ * @param pSnap - from appsrv_snapshot_take()
+ */
+static void appsrv_snapshot_release(struct appsrv_snapshot *pSnap)
+{
+    appsrv_read_exit(pSnap->epoch);
+    if(pSnap->ppCONN != pSnap->inline_CONN)
+    {
+        free((void *)(pSnap->ppCONN));
+    }
+    pSnap->ppCONN = NULL;
+    pSnap->n = 0;
+}
+
+/*
+  Broadcast a message to all connections.
+  Public function in appsrv.h
+*/
+void appsrv_broadcast(struct appsrv_frame *pFrame)
+{
+    struct appsrv_snapshot snap;
+
+    /* the frame is encoded once, every connection gets the same bytes */
+    if(appsrv_snapshot_take(&snap, NULL, NULL))
+    {
+        appsrv_snapshot_send(&snap, pFrame);
+    }
+    appsrv_snapshot_release(&snap);
+}
+
+/*!
+  Csf module calls this function to inform the user/appClient
+  that the application has either started/restored the network
+
+  Public function defined in appsrv_Collector.h
+*/
+void appsrv_networkUpdate(bool restored, Llc_netInfo_t *networkInfo)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = NWK_INFO_IND_LEN;
+    uint8_t *pBuff;
+
+    uint8_t securityEnabled = CONFIG_SECURE;
+    uint8_t networkMode;
+    uint8_t state = Csf_getCllcState();
+
+    if (CONFIG_FH_ENABLE == true)
+    {
+        networkMode = FREQUENCY_HOPPING;
+    }
+
+    else
+    {
+        if ((CONFIG_MAC_SUPERFRAME_ORDER == 15) && (CONFIG_MAC_BEACON_ORDER == 15))
+        {
+            networkMode = NON_BEACON;
+        }
+        else
+        {
+            networkMode = BEACON_ENABLED;
+        }
+    }
+
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_NWK_INFO_IND);
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
+    {
+        appsrv_snapshot_release(&snap);
+        return;
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_NWK_INFO_IND, len);
+
+    /* Create duplicate pointer to msg buffer for building purposes */
+    pBuff = pFrame->pPayload;
+
+    /* Build msg */
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.panID & 0xFF);
+    *pBuff++ = (uint8_t)((networkInfo->devInfo.panID >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.shortAddress & 0xFF);
+    *pBuff++ = (uint8_t)((networkInfo->devInfo.shortAddress >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[0]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[1]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[2]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[3]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[4]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[5]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[6]);
+    *pBuff++ = (uint8_t)(networkInfo->devInfo.extAddress[7]);
+    *pBuff++ = (uint8_t)(networkInfo->channel);
+    *pBuff++ = (uint8_t)(networkInfo->fh);
+    *pBuff++ = securityEnabled;
+    *pBuff++ = networkMode;
+    *pBuff++ = state;
+
+    /* Send msg */
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
+}
+
+/*!
+
+  Csf module calls this function to inform the user/appClient
+  that a device has joined the network
+
+  Public function defined in appsrv_Collector.h
+*/
+void appsrv_deviceUpdate(Llc_deviceListItem_t *pDevListItem)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = DEVICE_JOINED_IND_LEN;
+    uint8_t *pBuff;
+    Csf_deviceInformation_t info;
+
+    /* the device table tracks it even if nobody listens now */
+    info.devInfo = pDevListItem->devInfo;
+    info.capInfo = pDevListItem->capInfo;
+    devtab_lock();
+    devtab_put(&info);
+    devtab_unlock();
+
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_DEVICE_JOINED_IND);
+    ev.has_short = true;
+    ev.shortAddr = pDevListItem->devInfo.shortAddress;
+    ev.pExtAddr = pDevListItem->devInfo.extAddress;
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
+    {
+        appsrv_snapshot_release(&snap);
+        return;
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_DEVICE_JOINED_IND, len);
+
+    /* Create duplicate pointer to msg buffer for building purposes */
+    pBuff = pFrame->pPayload;
+
+    /* Build msg */
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.panID & 0xFF);
+    *pBuff++ = (uint8_t)((pDevListItem->devInfo.panID >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.shortAddress & 0xFF);
+    *pBuff++ = (uint8_t)((pDevListItem->devInfo.shortAddress >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[0]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[1]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[2]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[3]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[4]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[5]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[6]);
+    *pBuff++ = (uint8_t)(pDevListItem->devInfo.extAddress[7]);
+    *pBuff++ = (uint8_t)(pDevListItem->capInfo.panCoord);
+    *pBuff++ = (uint8_t)(pDevListItem->capInfo.ffd);
+    *pBuff++ = (uint8_t)(pDevListItem->capInfo.mainsPower);
+    *pBuff++ = (uint8_t)(pDevListItem->capInfo.rxOnWhenIdle);
+    *pBuff++ = (uint8_t)(pDevListItem->capInfo.security);
+    *pBuff++ = (uint8_t)(pDevListItem->capInfo.allocAddr);
+
+    /* Send msg */
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
+}
+
+
+/*
+ * @brief match subscribed connections that want one message per data indication
+ */
+static bool match_rx_single(struct appsrv_connection *pCONN, void *pCookie)
+{
+    return !(pCONN->rx_batch) && match_event(pCONN, pCookie);
+}
+
+/*
+ * @brief match subscribed connections that want batched data indications
+ *        (pCookie NULL: all of them)
+ */
+static bool match_rx_batch(struct appsrv_connection *pCONN, void *pCookie)
+{
+    return pCONN->rx_batch && ((pCookie == NULL) || match_event(pCONN, pCookie));
+}
+
+/*
+ * @brief write the srcAddr/rssi head of a data indication record
+ * @param pBuff - where to write, at least RX_IND_HEAD_MAX bytes
+ * @param pDataInd - the indication
+ * @returns number of bytes written, the msdu goes right after
+ */
+static int appsrv_build_rxHead(uint8_t *pBuff, ApiMac_mcpsDataInd_t *pDataInd)
+{
+    int idx = 0;
+
+    pBuff[idx++] = pDataInd->srcAddr.addrMode;
+    if (pDataInd->srcAddr.addrMode == ApiMac_addrType_short)
+    {
+        pBuff[idx++] = (uint8_t)(pDataInd->srcAddr.addr.shortAddr & 0xFF);
+        pBuff[idx++] = (uint8_t)((pDataInd->srcAddr.addr.shortAddr >> 8) & 0xFF);
+    }
+    else if (pDataInd->srcAddr.addrMode == ApiMac_addrType_extended)
+    {
+        memcpy((pBuff + idx), pDataInd->srcAddr.addr.extAddr, APIMAC_SADDR_EXT_LEN);
+        idx += APIMAC_SADDR_EXT_LEN;
+    }
+    pBuff[idx++] = pDataInd->rssi;
+    return idx;
+}
+
+/*
+ * @brief turn the pending batch of a connection into a frame
+ * @param pCONN - the connection, txq_mutex must be held
+ * @returns the frame or NULL if there was nothing pending
+ */
+static struct appsrv_frame *appsrv_rxBatchDetach(struct appsrv_connection *pCONN)
+{
+    struct appsrv_frame *pFrame;
+
+    pFrame = pCONN->pBatch;
+    if(pFrame == NULL)
+    {
+        return NULL;
+    }
+    pFrame->pPayload[0] = (uint8_t)(pCONN->batch_count & 0xFF);
+    pFrame->pPayload[1] = (uint8_t)((pCONN->batch_count >> 8) & 0xFF);
+    appsrv_frame_setLen(pFrame, RX_BATCH_HEAD_LEN + pCONN->batch_len);
+    pCONN->pBatch = NULL;
+    pCONN->batch_len = 0;
+    pCONN->batch_count = 0;
+    return pFrame;
+}
+
+/*
+ * @brief send the pending batch of data indications of a connection
+ * @param pCONN - the connection
+ */
+static void appsrv_rxBatchFlush(struct appsrv_connection *pCONN)
+{
+    struct appsrv_frame *pFrame;
+
+    MUTEX_lock(pCONN->txq_mutex, -1);
+    pFrame = appsrv_rxBatchDetach(pCONN);
+    MUTEX_unLock(pCONN->txq_mutex);
+
+    if(pFrame)
+    {
+        appsrv_connection_send(pCONN, pFrame);
+        appsrv_frame_release(pFrame);
+    }
+}
+
+/*
+ * @brief add one data indication record to the pending batch of a connection
+ * @param pCONN - the connection
+ * @param pDataInd - the indication
+ *
+ * Batches are per connection because each gateway has its own
+ * subscription. The record is written straight into the batch
+ * frame, and the batch is sent right away once rx_batch_max_bytes
+ * of records are waiting, or when the next record does not fit.
+ */
+static void appsrv_rxBatchAdd(struct appsrv_connection *pCONN,
+                              ApiMac_mcpsDataInd_t *pDataInd)
+{
+    struct appsrv_frame *pFull;
+    struct appsrv_frame *pReady;
+    uint8_t *pRec;
+    bool kick;
+    int need;
+    int len;
+
+    pFull = NULL;
+    MUTEX_lock(pCONN->txq_mutex, -1);
+
+    /* no room for this one? send what we have first */
+    need = RX_BATCH_REC_HEAD_LEN + RX_IND_HEAD_MAX + pDataInd->msdu.len;
+    if(pCONN->pBatch &&
+       (pCONN->batch_len + need > pCONN->pBatch->len - RX_BATCH_HEAD_LEN))
+    {
+        pFull = appsrv_rxBatchDetach(pCONN);
+    }
+    if(pCONN->pBatch == NULL)
+    {
+        /* a single record may be bigger than the batch limit */
+        pCONN->pBatch =
+            appsrv_frame_alloc(APPSRV_DEVICE_DATA_RX_BATCH_IND,
+                               RX_BATCH_HEAD_LEN +
+                               ((need > appsrv_cfg.rx_batch_max_bytes) ?
+                                need : appsrv_cfg.rx_batch_max_bytes));
+    }
+
+    pRec = pCONN->pBatch->pPayload + RX_BATCH_HEAD_LEN + pCONN->batch_len;
+    len = appsrv_build_rxHead(pRec + RX_BATCH_REC_HEAD_LEN, pDataInd);
+    memcpy(pRec + RX_BATCH_REC_HEAD_LEN + len, pDataInd->msdu.p, pDataInd->msdu.len);
+    len += pDataInd->msdu.len;
+    pRec[0] = (uint8_t)(len & 0xFF);
+    pRec[1] = (uint8_t)((len >> 8) & 0xFF);
+    pCONN->batch_len += RX_BATCH_REC_HEAD_LEN + len;
+    pCONN->batch_count++;
+
+    /* reached the limit? don't wait for the window */
+    pReady = NULL;
+    kick = false;
+    if(pCONN->batch_len >= appsrv_cfg.rx_batch_max_bytes)
+    {
+        pReady = appsrv_rxBatchDetach(pCONN);
+    }
+    else
+    {
+        /* first one in the batch starts the flush window */
+        kick = (pCONN->batch_count == 1);
+    }
+    MUTEX_unLock(pCONN->txq_mutex);
+
+    if(pFull)
+    {
+        appsrv_connection_send(pCONN, pFull);
+        appsrv_frame_release(pFull);
+    }
+    if(pReady)
+    {
+        appsrv_connection_send(pCONN, pReady);
+        appsrv_frame_release(pReady);
+    }
+    if(kick)
+    {
+        SEMAPHORE_put(rx_batch_sem);
+    }
+}
+
+/*
+ * @brief sends the batches when the flush window expires
+ */
+static intptr_t appsrv_rxBatch_thread(intptr_t dummy)
+{
+    struct appsrv_snapshot snap;
+    int x;
+
+    (void)(dummy);
+    for(;;)
+    {
+        if(SEMAPHORE_waitWithTimeout(rx_batch_sem, 1000) <= 0)
+        {
+            continue;
+        }
+        /* let the window fill up, then send it */
+        TIMER_sleep(appsrv_cfg.rx_batch_window_mSecs);
+        if(appsrv_snapshot_take(&snap, match_rx_batch, NULL))
+        {
+            for(x = 0 ; x < snap.n ; x++)
+            {
+                appsrv_rxBatchFlush(snap.ppCONN[x]);
+            }
+        }
+        appsrv_snapshot_release(&snap);
+    }
+#if defined(__linux__)
+    return 0;
+#endif
+}
+
+/*
+ * @brief common code to handle sensor data messages
+ * @param pSrcAddr - address related to this message
+ *
+ * In the end, the message is sent to the gateway
+ */
+void appsrv_deviceRawDataUpdate(ApiMac_mcpsDataInd_t *pDataInd)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int n;
+    int x;
+
+    // what subscribers filter on
+    appsrv_event_init(&ev, APPSRV_DEVICE_DATA_RX_IND);
+    if (pDataInd->msdu.len)
+    {
+        ev.cmdId = pDataInd->msdu.p[0];
+    }
+    if (pDataInd->srcAddr.addrMode == ApiMac_addrType_short)
+    {
+        ev.has_short = true;
+        ev.shortAddr = pDataInd->srcAddr.addr.shortAddr;
+    }
+    else if (pDataInd->srcAddr.addrMode == ApiMac_addrType_extended)
+    {
+        ev.pExtAddr = pDataInd->srcAddr.addr.extAddr;
+    }
+
+    // batched gateways get a tight record, without the padding
+    if(__atomic_load_n(&rx_batch_connections, __ATOMIC_RELAXED))
+    {
+        if(appsrv_snapshot_take(&snap, match_rx_batch, &ev))
+        {
+            for(x = 0 ; x < snap.n ; x++)
+            {
+                appsrv_rxBatchAdd(snap.ppCONN[x], pDataInd);
+            }
+        }
+        appsrv_snapshot_release(&snap);
+    }
+
+    // the frame is also kept for replays, even when nobody wants it now
+    n = appsrv_snapshot_take(&snap, match_rx_single, &ev);
+    if(n || (appsrv_cfg.replay_depth && ev.has_short))
+    {
+        // Get the length (srcAddr + rssi + msdu.len)
+        uint16_t bufferLength = pDataInd->msdu.len + sizeof(pDataInd->rssi) + sizeof(ApiMac_sAddr_t);
+        struct appsrv_frame *pFrame;
+        int idx;
+
+        // the head goes straight into the frame, the msdu is copied once,
+        // the frame is zeroed so the padding is already there
+        pFrame = appsrv_frame_alloc(APPSRV_DEVICE_DATA_RX_IND, bufferLength);
+        idx = appsrv_build_rxHead(pFrame->pPayload, pDataInd);
+        memcpy(pFrame->pPayload + idx, pDataInd->msdu.p, pDataInd->msdu.len);
+
+        // send the message buffer over a socket to the appclient
+        if(n)
+        {
+            appsrv_snapshot_send(&snap, pFrame);
+        }
+        if(appsrv_cfg.replay_depth && ev.has_short)
+        {
+            appsrv_hist_add(ev.shortAddr, ev.cmdId, pFrame);
+        }
+        appsrv_frame_release(pFrame);
+        pFrame = NULL;
+    }
+    appsrv_snapshot_release(&snap);
+}
+
+
+void appsrv_send_removeDeviceRsp(void)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = REMOVE_DEVICE_RSP_LEN;
+
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_RMV_DEVICE_RSP);
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
+    {
+        appsrv_snapshot_release(&snap);
+        return;
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_RMV_DEVICE_RSP, len);
+
+    /* Send msg */
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
+}
+
+/*!
+  Csf module calls this function to inform the user/appClient
+  that a device is no longer active in the network
+
+  Public function defined in appsrv_Collector.h
+*/
+void appsrv_deviceNotActiveUpdate(ApiMac_deviceDescriptor_t *pDevInfo,
+                                  bool timeout)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = DEVICE_NOT_ACTIVE_LEN;
+    uint8_t *pBuff;
+
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_DEVICE_NOTACTIVE_UPDATE_IND);
+    ev.has_short = true;
+    ev.shortAddr = pDevInfo->shortAddress;
+    ev.pExtAddr = pDevInfo->extAddress;
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
+    {
+        appsrv_snapshot_release(&snap);
+        return;
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_DEVICE_NOTACTIVE_UPDATE_IND, len);
+
+    /* Create duplicate pointer to msg buffer for building purposes */
+    pBuff = pFrame->pPayload;
+
+    /* Build msg */
+    *pBuff++ = (uint8_t)(pDevInfo->panID & 0xFF);
+    *pBuff++ = (uint8_t)((pDevInfo->panID >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pDevInfo->shortAddress & 0xFF);
+    *pBuff++ = (uint8_t)((pDevInfo->shortAddress >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[0]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[1]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[2]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[3]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[4]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[5]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[6]);
+    *pBuff++ = (uint8_t)(pDevInfo->extAddress[7]);
+    *pBuff++ = (uint8_t)timeout;
+
+    /* Send msg */
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
+}
+
+/*
+  A tracked data request was confirmed.
+  Public function in appsrv.h
+*/
+void appsrv_txDataCnf(int connId, uint32_t corrId, int status,
+                      uint32_t latency_mSecs)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_frame *pFrame;
+
+    LOG_printf(LOG_APPSRV_MSG_CONTENT,
+               "tx data cnf: connection %d id %u status %x after %u mSecs\n",
+               connId, (unsigned)corrId, status, (unsigned)latency_mSecs);
+
+    /* only the gateway that asked, if it is still there */
+    if(appsrv_snapshot_take(&snap, match_connection_id, &connId))
+    {
+        pFrame = build_AppsrvTxDataCnf(corrId, status, latency_mSecs);
+        appsrv_snapshot_send(&snap, pFrame);
+        appsrv_frame_release(pFrame);
+    }
+    appsrv_snapshot_release(&snap);
+}
+
+/*
+  A fragmented custom command ended.
+  Public function in appsrv.h
+*/
+void appsrv_fragTxDone(const Frag_txResult_t *pResult)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = FRAG_TX_DONE_IND_LEN;
+    uint8_t *pBuff;
+
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_FRAG_TX_DONE_IND);
+    ev.has_short = true;
+    ev.shortAddr = pResult->dstShortAddr;
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
+    {
+        appsrv_snapshot_release(&snap);
+        return;
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_FRAG_TX_DONE_IND, len);
+
+    /* Create duplicate pointer to msg buffer for building purposes */
+    pBuff = pFrame->pPayload;
+
+    /* Build msg */
+    *pBuff++ = (uint8_t)(pResult->dstShortAddr & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->dstShortAddr >> 8) & 0xFF);
+    *pBuff++ = pResult->msgId;
+    *pBuff++ = (uint8_t)(pResult->status);
+    *pBuff++ = (uint8_t)(pResult->len & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->len >> 8) & 0xFF);
+    *pBuff++ = pResult->numFrags;
+    *pBuff++ = (uint8_t)(pResult->fragsSent & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->fragsSent >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pResult->retransmits & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->retransmits >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)(pResult->durationMs & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->durationMs >> 8) & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->durationMs >> 16) & 0xFF);
+    *pBuff++ = (uint8_t)((pResult->durationMs >> 24) & 0xFF);
+
+    /* Send msg */
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
+}
+
+
+
+/*!
+ * @brief monotonic clock in mSecs, for the replay age limit
+ */
+static uint64_t appsrv_now_mSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)(ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*!
+ * @brief remember a data indication for later replays
+ * @param shortAddr - the device
+ * @param cmdId - Smsgs cmdId of the msdu
+ * @param pFrame - the APPSRV_DEVICE_DATA_RX_IND frame, a reference is taken
+ */
+static void appsrv_hist_add(uint16_t shortAddr, int cmdId,
+                            struct appsrv_frame *pFrame)
+{
+    struct appsrv_hist *pHist;
+    struct appsrv_hist_rec *pRec;
+    struct appsrv_frame *pOld;
+    int depth;
+    int b;
+
+    depth = appsrv_cfg.replay_depth;
+    b = shortAddr % APPSRV_HIST_BUCKETS;
+    pOld = NULL;
+
+    MUTEX_lock(hist_mutex, -1);
+    for(pHist = hist_buckets[b] ; pHist ; pHist = pHist->pNext)
+    {
+        if(pHist->shortAddr == shortAddr)
+        {
+            break;
+        }
+    }
+    if(pHist == NULL)
+    {
+        /* first indication from this device, allocated once */
+        pHist = calloc(1, sizeof(*pHist) + (depth * sizeof(pHist->recs[0])));
+        if(pHist == NULL)
+        {
+            MUTEX_unLock(hist_mutex);
+            LOG_printf(LOG_ERROR, "No memory for replay history\n");
+            return;
+        }
+        pHist->shortAddr = shortAddr;
+        pHist->pNext = hist_buckets[b];
+        hist_buckets[b] = pHist;
+    }
+
+    if(pHist->count == depth)
+    {
+        /* full, the oldest one goes */
+        pOld = pHist->recs[pHist->head].pFrame;
+        pHist->head = (pHist->head + 1) % depth;
+        pHist->count--;
+    }
+    pRec = &(pHist->recs[(pHist->head + pHist->count) % depth]);
+    appsrv_frame_hold(pFrame);
+    pRec->pFrame = pFrame;
+    pRec->cmdId = cmdId;
+    pRec->when_mSecs = appsrv_now_mSecs();
+    pRec->seq = ++hist_seq;
+    if(pRec->seq == 0)
+    {
+        /* 0 is the cursor for "from the start" */
+        pRec->seq = ++hist_seq;
+    }
+    pHist->count++;
+    MUTEX_unLock(hist_mutex);
+
+    if(pOld)
+    {
+        appsrv_frame_release(pOld);
+    }
+}
+
+/*!
+ * @brief forget the history of one device, or of all
+ * @param all - true: every device
+ * @param shortAddr - else this device
+ */
+static void appsrv_hist_forget(bool all, uint16_t shortAddr)
+{
+    struct appsrv_hist **ppHist;
+    struct appsrv_hist *pHist;
+    int b;
+    int x;
+
+    MUTEX_lock(hist_mutex, -1);
+    for(b = 0 ; b < APPSRV_HIST_BUCKETS ; b++)
+    {
+        if(!all && (b != (shortAddr % APPSRV_HIST_BUCKETS)))
+        {
+            continue;
+        }
+        ppHist = &hist_buckets[b];
+        while((pHist = *ppHist) != NULL)
+        {
+            if(!all && (pHist->shortAddr != shortAddr))
+            {
+                ppHist = &(pHist->pNext);
+                continue;
+            }
+            *ppHist = pHist->pNext;
+            for(x = 0 ; x < pHist->count ; x++)
+            {
+                appsrv_frame_release(
+                    pHist->recs[(pHist->head + x) % appsrv_cfg.replay_depth].pFrame);
+            }
+            free((void *)pHist);
+        }
+    }
+    MUTEX_unLock(hist_mutex);
+}
+
+/* qsort helper, replays go out in arrival order */
+static int cmp_replay_pick(const void *pA, const void *pB)
+{
+    uint32_t a = ((const struct appsrv_replay_pick *)pA)->seq;
+    uint32_t b = ((const struct appsrv_replay_pick *)pB)->seq;
+
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+/*!
+ * @brief handle a replay request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * The remembered indications go to this connection only, as normal
+ * APPSRV_DEVICE_DATA_RX_IND frames (oldest first), followed by the
+ * confirm. Its subscription filter applies as for live traffic.
+ *
+ * One request sends no more than fits in the free part of the tx
+ * queue, so nothing is dropped and the overflow policy never kicks
+ * in. When more is left the confirm says so and carries the cursor
+ * the gateway sends back for the next batch.
+ */
+static void appsrv_processReplayReq(struct appsrv_connection *pCONN,
+                                    struct mt_msg *pIncomingMsg)
+{
+    struct appsrv_replay_pick *pPicks;
+    struct appsrv_replay_pick *pGrow;
+    struct appsrv_frame *pFrame;
+    struct appsrv_hist *pHist;
+    struct appsrv_hist_rec *pRec;
+    struct appsrv_event ev;
+    uint8_t *pBuf;
+    uint8_t status;
+    uint32_t max_age;
+    uint32_t cursor;
+    uint16_t shortAddr;
+    uint64_t now;
+    unsigned epoch;
+    bool more;
+    int cmdId;
+    int room;
+    int n;
+    int size;
+    int b;
+    int x;
+
+    pBuf = pIncomingMsg->iobuf + HEADER_LEN;
+    pPicks = NULL;
+    n = 0;
+    size = 0;
+    cursor = 0;
+    status = ApiMac_status_success;
+    if(pIncomingMsg->expected_len < REPLAY_REQ_LEN)
+    {
+        status = ApiMac_status_invalidParameter;
+    }
+    else if(appsrv_cfg.replay_depth == 0)
+    {
+        status = ApiMac_status_unsupported;
+    }
+    else
+    {
+        max_age = (uint32_t)(pBuf[0]) | ((uint32_t)(pBuf[1]) << 8) |
+                  ((uint32_t)(pBuf[2]) << 16) | ((uint32_t)(pBuf[3]) << 24);
+        shortAddr = (uint16_t)(pBuf[4]) | (pBuf[5] << 8);
+        cmdId = (pBuf[6] == 0xFF) ? -1 : pBuf[6];
+        if(pIncomingMsg->expected_len >= REPLAY_REQ_CURSOR_LEN)
+        {
+            cursor = (uint32_t)(pBuf[7]) | ((uint32_t)(pBuf[8]) << 8) |
+                     ((uint32_t)(pBuf[9]) << 16) |
+                     ((uint32_t)(pBuf[10]) << 24);
+        }
+        now = appsrv_now_mSecs();
+
+        /* the read side keeps our filter alive for match_event() */
+        MUTEX_lock(hist_mutex, -1);
+        epoch = appsrv_read_enter();
+        for(b = 0 ; b < APPSRV_HIST_BUCKETS ; b++)
+        {
+            for(pHist = hist_buckets[b] ; pHist ; pHist = pHist->pNext)
+            {
+                if((shortAddr != 0xFFFF) && (pHist->shortAddr != shortAddr))
+                {
+                    continue;
+                }
+                for(x = 0 ; x < pHist->count ; x++)
+                {
+                    pRec = &(pHist->recs[(pHist->head + x) %
+                                         appsrv_cfg.replay_depth]);
+                    if((cursor && ((int32_t)(pRec->seq - cursor) <= 0)) ||
+                       (max_age && ((now - pRec->when_mSecs) > max_age)) ||
+                       ((cmdId >= 0) && (pRec->cmdId != cmdId)))
+                    {
+                        continue;
+                    }
+                    appsrv_event_init(&ev, APPSRV_DEVICE_DATA_RX_IND);
+                    ev.cmdId = pRec->cmdId;
+                    ev.has_short = true;
+                    ev.shortAddr = pHist->shortAddr;
+                    if(!match_event(pCONN, &ev))
+                    {
+                        continue;
+                    }
+                    if(n == size)
+                    {
+                        size = size ? (size * 2) : 64;
+                        pGrow = realloc(pPicks, size * sizeof(*pPicks));
+                        if(pGrow == NULL)
+                        {
+                            status = ApiMac_status_noResources;
+                            break;
+                        }
+                        pPicks = pGrow;
+                    }
+                    appsrv_frame_hold(pRec->pFrame);
+                    pPicks[n].seq = pRec->seq;
+                    pPicks[n].pFrame = pRec->pFrame;
+                    n++;
+                }
+            }
+        }
+        appsrv_read_exit(epoch);
+        MUTEX_unLock(hist_mutex);
+    }
+
+    /* what fits next to the confirm without pushing anything out */
+    room = n;
+    if(pCONN->ppTxq)
+    {
+        MUTEX_lock(pCONN->txq_mutex, -1);
+        room = appsrv_cfg.txq_depth - pCONN->txq_count - 1;
+        MUTEX_unLock(pCONN->txq_mutex);
+        if(room < 0)
+        {
+            room = 0;
+        }
+    }
+    more = (n > room);
+
+    if(n > 1)
+    {
+        qsort(pPicks, n, sizeof(*pPicks), cmp_replay_pick);
+    }
+
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: replay of %d indications%s\n",
+               pCONN->dbg_name, more ? room : n, more ? ", more left" : "");
+
+    /* send outside the locks, these are queued like any other frame */
+    for(x = 0 ; x < n ; x++)
+    {
+        if(x < room)
+        {
+            appsrv_connection_send(pCONN, pPicks[x].pFrame);
+            cursor = pPicks[x].seq;
+        }
+        appsrv_frame_release(pPicks[x].pFrame);
+    }
+    free((void *)pPicks);
+    if(more)
+    {
+        n = room;
+    }
+
+    pFrame = appsrv_frame_alloc(APPSRV_REPLAY_CNF, REPLAY_CNF_LEN);
+    pBuf = pFrame->pPayload;
+    *pBuf++ = status;
+    *pBuf++ = (uint8_t)(n & 0xFF);
+    *pBuf++ = (uint8_t)((n >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((n >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((n >> 24) & 0xFF);
+    *pBuf++ = more ? 1 : 0;
+    *pBuf++ = (uint8_t)(cursor & 0xFF);
+    *pBuf++ = (uint8_t)((cursor >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((cursor >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((cursor >> 24) & 0xFF);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief handle a config rollout request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * Starts sending the config to the devices, see
+ * Collector_startConfigRollout(). The confirm only says whether it
+ * started, APPSRV_GET_ROLLOUT_PROGRESS_REQ tells how far it got.
+ */
+static void appsrv_processConfigRolloutReq(struct appsrv_connection *pCONN,
+                                           struct mt_msg *pIncomingMsg)
+{
+    Collector_rolloutCfg_t cfg;
+    struct appsrv_frame *pFrame;
+    uint16_t *pShortAddrs;
+    uint8_t *pBuf;
+    int n;
+    int x;
+    int status;
+
+    pShortAddrs = NULL;
+    n = 0;
+    status = ApiMac_status_invalidParameter;
+    pBuf = pIncomingMsg->iobuf + HEADER_LEN;
+    if(pIncomingMsg->expected_len >= CONFIG_ROLLOUT_REQ_HEAD_LEN)
+    {
+        cfg.pollingInterval = (uint32_t)(pBuf[0]) |
+                              ((uint32_t)(pBuf[1]) << 8) |
+                              ((uint32_t)(pBuf[2]) << 16) |
+                              ((uint32_t)(pBuf[3]) << 24);
+        cfg.reportingInterval = (uint32_t)(pBuf[4]) |
+                                ((uint32_t)(pBuf[5]) << 8) |
+                                ((uint32_t)(pBuf[6]) << 16) |
+                                ((uint32_t)(pBuf[7]) << 24);
+        cfg.frameControl = (uint16_t)(pBuf[8]) | (pBuf[9] << 8);
+        cfg.window = pBuf[10];
+        cfg.pacing_mSecs = (uint16_t)(pBuf[11]) | (pBuf[12] << 8);
+        n = (int)(pBuf[13]) | (pBuf[14] << 8);
+        pBuf += CONFIG_ROLLOUT_REQ_HEAD_LEN;
+
+        if(pIncomingMsg->expected_len >=
+           (CONFIG_ROLLOUT_REQ_HEAD_LEN + (n * 2)))
+        {
+            if(n != 0)
+            {
+                pShortAddrs = malloc(n * sizeof(uint16_t));
+                if(pShortAddrs == NULL)
+                {
+                    BUG_HERE("No memory\n");
+                }
+            }
+            for(x = 0 ; x < n ; x++)
+            {
+                pShortAddrs[x] = (uint16_t)(pBuf[0]) | (pBuf[1] << 8);
+                pBuf += 2;
+            }
+            status = appsrv_txStatus(Csf_startConfigRollout(&cfg,
+                                                            pShortAddrs,
+                                                            n));
+            free(pShortAddrs);
+        }
+    }
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: config rollout to %d devices, "
+               "status %d\n", pCONN->dbg_name, n, status);
+
+    pFrame = appsrv_frame_alloc(APPSRV_CONFIG_ROLLOUT_CNF,
+                                CONFIG_ROLLOUT_CNF_LEN);
+    pBuf = pFrame->pPayload;
+    *pBuf++ = (uint8_t)(status & 0xFF);
+    *pBuf++ = (uint8_t)((status >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((status >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((status >> 24) & 0xFF);
+    *pBuf++ = (uint8_t)(n & 0xFF);
+    *pBuf++ = (uint8_t)((n >> 8) & 0xFF);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief handle a rollout progress request from the gateway
+ * @param pCONN - where the request came from
+ */
+static void appsrv_processGetRolloutProgressReq(struct appsrv_connection *pCONN)
+{
+    Collector_rolloutProgress_t progress;
+    struct appsrv_frame *pFrame;
+    uint8_t *pBuf;
+
+    Csf_getConfigRolloutProgress(&progress);
+
+    pFrame = appsrv_frame_alloc(APPSRV_GET_ROLLOUT_PROGRESS_CNF,
+                                ROLLOUT_PROGRESS_CNF_LEN);
+    pBuf = pFrame->pPayload;
+    *pBuf++ = (uint8_t)(progress.state);
+    *pBuf++ = (uint8_t)(progress.total & 0xFF);
+    *pBuf++ = (uint8_t)((progress.total >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.pending & 0xFF);
+    *pBuf++ = (uint8_t)((progress.pending >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.inFlight & 0xFF);
+    *pBuf++ = (uint8_t)((progress.inFlight >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.configured & 0xFF);
+    *pBuf++ = (uint8_t)((progress.configured >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.failed & 0xFF);
+    *pBuf++ = (uint8_t)((progress.failed >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.requestsSent & 0xFF);
+    *pBuf++ = (uint8_t)((progress.requestsSent >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((progress.requestsSent >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((progress.requestsSent >> 24) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.elapsed_mSecs & 0xFF);
+    *pBuf++ = (uint8_t)((progress.elapsed_mSecs >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((progress.elapsed_mSecs >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((progress.elapsed_mSecs >> 24) & 0xFF);
+    *pBuf++ = (uint8_t)(progress.devicesPerHour & 0xFF);
+    *pBuf++ = (uint8_t)((progress.devicesPerHour >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((progress.devicesPerHour >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((progress.devicesPerHour >> 24) & 0xFF);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief put a 32 bit value into a frame, little endian
+ * @param pBuf - where
+ * @param value - what
+ *
+ * @return the byte after it
+ */
+static uint8_t *appsrv_put32(uint8_t *pBuf, uint32_t value)
+{
+    *pBuf++ = (uint8_t)(value & 0xFF);
+    *pBuf++ = (uint8_t)((value >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)((value >> 16) & 0xFF);
+    *pBuf++ = (uint8_t)((value >> 24) & 0xFF);
+    return (pBuf);
+}
+
+/*!
+ * @brief handle a downlink queue stats request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * Answers with the Collector_dlqStats_t of the device, all zero and
+ * a failed status if the device has no downlink queue.
+ */
+static void appsrv_processGetDlqStatsReq(struct appsrv_connection *pCONN,
+                                         struct mt_msg *pIncomingMsg)
+{
+    Collector_dlqStats_t stats;
+    struct appsrv_frame *pFrame;
+    uint16_t shortAddr;
+    uint8_t *pBuf;
+    int status;
+
+    memset(&stats, 0, sizeof(stats));
+    shortAddr = CSF_INVALID_SHORT_ADDR;
+    status = ApiMac_status_invalidParameter;
+    pBuf = pIncomingMsg->iobuf + HEADER_LEN;
+    if(pIncomingMsg->expected_len >= DLQ_STATS_REQ_LEN)
+    {
+        shortAddr = (uint16_t)(pBuf[0]) | (pBuf[1] << 8);
+        status = appsrv_txStatus(Csf_getDownlinkQueueStats(shortAddr,
+                                                           &stats));
+    }
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: downlink queue stats of 0x%04x, "
+               "status %d\n", pCONN->dbg_name, shortAddr, status);
+
+    pFrame = appsrv_frame_alloc(APPSRV_GET_DLQ_STATS_CNF, DLQ_STATS_CNF_LEN);
+    pBuf = pFrame->pPayload;
+    pBuf = appsrv_put32(pBuf, (uint32_t)status);
+    *pBuf++ = (uint8_t)(shortAddr & 0xFF);
+    *pBuf++ = (uint8_t)((shortAddr >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(stats.depth & 0xFF);
+    *pBuf++ = (uint8_t)((stats.depth >> 8) & 0xFF);
+    *pBuf++ = (uint8_t)(stats.maxDepth & 0xFF);
+    *pBuf++ = (uint8_t)((stats.maxDepth >> 8) & 0xFF);
+    *pBuf++ = stats.atMac;
+    pBuf = appsrv_put32(pBuf, stats.queued);
+    pBuf = appsrv_put32(pBuf, stats.released);
+    pBuf = appsrv_put32(pBuf, stats.coalesced);
+    pBuf = appsrv_put32(pBuf, stats.dropped);
+    pBuf = appsrv_put32(pBuf, stats.expired);
+    pBuf = appsrv_put32(pBuf, stats.waitTotal_mSecs);
+    (void)appsrv_put32(pBuf, stats.waitMax_mSecs);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief handle a tx queue stats request from the gateway
+ * @param pCONN - where the request came from, whose queue is reported
+ *
+ * Depth and queue size are 0 when the connection has no tx queue.
+ */
+static void appsrv_processGetTxqStatsReq(struct appsrv_connection *pCONN)
+{
+    struct appsrv_txq_stats stats;
+    struct appsrv_frame *pFrame;
+    uint32_t depth;
+    uint32_t size;
+    uint8_t *pBuf;
+
+    depth = 0;
+    size = 0;
+    if(pCONN->ppTxq)
+    {
+        MUTEX_lock(pCONN->txq_mutex, -1);
+        stats = pCONN->txq_stats;
+        depth = (uint32_t)(pCONN->txq_count);
+        MUTEX_unLock(pCONN->txq_mutex);
+        size = (uint32_t)(appsrv_cfg.txq_depth);
+    }
+    else
+    {
+        stats = pCONN->txq_stats;
+    }
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: tx queue sent %u, dropped %u, "
+               "max depth %u, depth %u/%u\n", pCONN->dbg_name,
+               (unsigned)(stats.n_sent), (unsigned)(stats.n_dropped),
+               (unsigned)(stats.max_depth), (unsigned)depth, (unsigned)size);
+
+    pFrame = appsrv_frame_alloc(APPSRV_GET_TXQ_STATS_CNF, TXQ_STATS_CNF_LEN);
+    pBuf = pFrame->pPayload;
+    pBuf = appsrv_put32(pBuf, stats.n_sent);
+    pBuf = appsrv_put32(pBuf, stats.n_dropped);
+    pBuf = appsrv_put32(pBuf, stats.max_depth);
+    pBuf = appsrv_put32(pBuf, depth);
+    (void)appsrv_put32(pBuf, size);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief handle a fragmentation stats request from the gateway
+ * @param pCONN - where the request came from
+ */
+static void appsrv_processGetFragStatsReq(struct appsrv_connection *pCONN)
+{
+    Frag_statistics_t stats;
+    struct appsrv_frame *pFrame;
+    uint8_t *pBuf;
+
+    Csf_getFragStatistics(&stats);
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: frag tx %u done %u failed %u, "
+               "rx %u done %u expired %u\n", pCONN->dbg_name,
+               (unsigned)(stats.txMessages), (unsigned)(stats.txCompleted),
+               (unsigned)(stats.txFailed), (unsigned)(stats.rxFragments),
+               (unsigned)(stats.rxCompleted), (unsigned)(stats.rxExpired));
+
+    pFrame = appsrv_frame_alloc(APPSRV_GET_FRAG_STATS_CNF, FRAG_STATS_CNF_LEN);
+    pBuf = pFrame->pPayload;
+    pBuf = appsrv_put32(pBuf, stats.txMessages);
+    pBuf = appsrv_put32(pBuf, stats.txCompleted);
+    pBuf = appsrv_put32(pBuf, stats.txFailed);
+    pBuf = appsrv_put32(pBuf, stats.txBusy);
+    pBuf = appsrv_put32(pBuf, stats.txFragments);
+    pBuf = appsrv_put32(pBuf, stats.txRetransmits);
+    pBuf = appsrv_put32(pBuf, stats.txBytesAcked);
+    pBuf = appsrv_put32(pBuf, stats.txMsAcked);
+    pBuf = appsrv_put32(pBuf, stats.rxFragments);
+    pBuf = appsrv_put32(pBuf, stats.rxOutOfOrder);
+    pBuf = appsrv_put32(pBuf, stats.rxDuplicates);
+    pBuf = appsrv_put32(pBuf, stats.rxDropped);
+    pBuf = appsrv_put32(pBuf, stats.rxCompleted);
+    (void)appsrv_put32(pBuf, stats.rxExpired);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+  TBD
+
+  Public function defined in appsrv_Collector.h
+*/
+void appsrv_stateChangeUpdate(Cllc_states_t state)
+{
+    struct appsrv_snapshot snap;
+    struct appsrv_event ev;
+    int len = STATE_CHG_IND_LEN;
+
+    /* nobody subscribed? then don't even build it */
+    appsrv_event_init(&ev, APPSRV_COLLECTOR_STATE_CNG_IND);
+    if(appsrv_snapshot_take(&snap, match_event, &ev) == 0)
+    {
+        appsrv_snapshot_release(&snap);
+        return;
+    }
+
+    struct appsrv_frame *pFrame;
+    pFrame = appsrv_frame_alloc(APPSRV_COLLECTOR_STATE_CNG_IND, len);
+
+    /* Build msg, no need for duplicate pointer*/
+    pFrame->pPayload[0] = (uint8_t)(state & 0xFF);
+
+    appsrv_snapshot_send(&snap, pFrame);
+    appsrv_frame_release(pFrame);
+    pFrame = NULL;
+    appsrv_snapshot_release(&snap);
+}
+
+/*!
+ * @brief handle a set rx batch request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * Enables (1) or disables (0) batched data indications
+ * for this connection only.
+ */
+static void appsrv_processSetRxBatchReq(struct appsrv_connection *pCONN,
+                                        struct mt_msg *pIncomingMsg)
+{
+    struct appsrv_frame *pFrame;
+    bool enable;
+    int status;
+
+    enable = (pIncomingMsg->iobuf[HEADER_LEN] != 0);
+
+    /* only this connection's request handler and its teardown
+       change the flag, broadcasts just read it */
+    if(enable != pCONN->rx_batch)
+    {
+        __atomic_store_n(&(pCONN->rx_batch), enable, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&rx_batch_connections, enable ? 1 : -1,
+                           __ATOMIC_RELAXED);
+    }
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "%s: rx batch %s\n",
+               pCONN->dbg_name, enable ? "on" : "off");
+    /* anything still pending goes out now */
+    if(!enable)
+    {
+        appsrv_rxBatchFlush(pCONN);
+    }
+
+    status = ApiMac_status_success;
+    pFrame = appsrv_frame_alloc(APPSRV_SET_RX_BATCH_CNF, SET_RX_BATCH_CNF_LEN);
+    pFrame->pPayload[0] = (uint8_t)(status & 0xFF);
+    pFrame->pPayload[1] = (uint8_t)((status >> 8) & 0xFF);
+    pFrame->pPayload[2] = (uint8_t)((status >> 16) & 0xFF);
+    pFrame->pPayload[3] = (uint8_t)((status >> 24) & 0xFF);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*!
+ * @brief handle a subscribe request from the gateway
+ * @param pCONN - where the request came from
+ * @param pIncomingMsg - the msg from the gateway
+ *
+ * Payload: event mask (4), cmdId mask (4), short address
+ * count (2) and the short addresses, ext address count (2)
+ * and the ext addresses. All ones and no addresses is the
+ * same as no subscription: everything.
+ */
+static void appsrv_processSubscribeReq(struct appsrv_connection *pCONN,
+                                       struct mt_msg *pIncomingMsg)
+{
+    struct appsrv_filter *pFilter;
+    struct appsrv_filter *pOld;
+    struct appsrv_frame *pFrame;
+    uint32_t event_mask;
+    uint32_t cmdid_mask;
+    uint8_t *pBuf;
+    int n_short;
+    int n_ext;
+    int len;
+    int x;
+    int status;
+
+    pFilter = NULL;
+    status = ApiMac_status_invalidParameter;
+    pBuf = pIncomingMsg->iobuf + HEADER_LEN;
+    len = pIncomingMsg->expected_len;
+
+    if(len < SUBSCRIBE_REQ_HEAD_LEN + 2)
+    {
+        goto reply;
+    }
+    event_mask = (uint32_t)(pBuf[0]) | ((uint32_t)(pBuf[1]) << 8) |
+                 ((uint32_t)(pBuf[2]) << 16) | ((uint32_t)(pBuf[3]) << 24);
+    cmdid_mask = (uint32_t)(pBuf[4]) | ((uint32_t)(pBuf[5]) << 8) |
+                 ((uint32_t)(pBuf[6]) << 16) | ((uint32_t)(pBuf[7]) << 24);
+    n_short = (int)(pBuf[8]) | (pBuf[9] << 8);
+    x = SUBSCRIBE_REQ_HEAD_LEN + (n_short * 2);
+    if((n_short > SUBSCRIBE_MAX_ADDRS) || (len < x + 2))
+    {
+        goto reply;
+    }
+    n_ext = (int)(pBuf[x]) | (pBuf[x + 1] << 8);
+    if((n_ext > SUBSCRIBE_MAX_ADDRS) ||
+       (len != x + 2 + (n_ext * APIMAC_SADDR_EXT_LEN)))
+    {
+        goto reply;
+    }
+    status = ApiMac_status_success;
+
+    if((event_mask == 0xFFFFFFFF) && (cmdid_mask == 0xFFFFFFFF) &&
+       (n_short == 0) && (n_ext == 0))
+    {
+        goto reply;
+    }
+
+    /* one block: the filter, then the address sets */
+    pFilter = calloc(1, sizeof(*pFilter) +
+                     (n_short * sizeof(uint16_t)) +
+                     (n_ext * APIMAC_SADDR_EXT_LEN));
+    if(pFilter == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    pFilter->event_mask = event_mask;
+    pFilter->cmdid_mask = cmdid_mask;
+    pFilter->n_short = n_short;
+    pFilter->pShort = (uint16_t *)(pFilter + 1);
+    for(x = 0 ; x < n_short ; x++)
+    {
+        pFilter->pShort[x] =
+            (uint16_t)(pBuf[SUBSCRIBE_REQ_HEAD_LEN + (x * 2)]) |
+            (pBuf[SUBSCRIBE_REQ_HEAD_LEN + (x * 2) + 1] << 8);
+    }
+    pFilter->n_ext = n_ext;
+    pFilter->pExt = (uint8_t *)(pFilter->pShort + n_short);
+    memcpy(pFilter->pExt,
+           pBuf + SUBSCRIBE_REQ_HEAD_LEN + (n_short * 2) + 2,
+           n_ext * APIMAC_SADDR_EXT_LEN);
+    /* sorted, so broadcasts can bsearch */
+    qsort(pFilter->pShort, n_short, sizeof(uint16_t), cmp_short);
+    qsort(pFilter->pExt, n_ext, APIMAC_SADDR_EXT_LEN, cmp_ext);
+
+reply:
+    if(status == ApiMac_status_success)
+    {
+        /* broadcasts match without a lock, the old filter
+           goes once none of them can still be looking at it */
+        MUTEX_lock(conn_update_mutex, -1);
+        pOld = pCONN->pFilter;
+        __atomic_store_n(&(pCONN->pFilter), pFilter, __ATOMIC_RELEASE);
+        appsrv_synchronize();
+        MUTEX_unLock(conn_update_mutex);
+        free((void *)pOld);
+        LOG_printf(LOG_APPSRV_MSG_CONTENT,
+                   "%s: subscribed events=0x%08x cmdIds=0x%08x short=%d ext=%d\n",
+                   pCONN->dbg_name,
+                   (unsigned)(pFilter ? pFilter->event_mask : 0xFFFFFFFF),
+                   (unsigned)(pFilter ? pFilter->cmdid_mask : 0xFFFFFFFF),
+                   pFilter ? pFilter->n_short : 0,
+                   pFilter ? pFilter->n_ext : 0);
+    }
+    else
+    {
+        LOG_printf(LOG_ERROR, "%s: bad subscribe request (len=%d)\n",
+                   pCONN->dbg_name, len);
+    }
+
+    pFrame = appsrv_frame_alloc(APPSRV_SUBSCRIBE_CNF, SUBSCRIBE_CNF_LEN);
+    pFrame->pPayload[0] = (uint8_t)(status & 0xFF);
+    pFrame->pPayload[1] = (uint8_t)((status >> 8) & 0xFF);
+    pFrame->pPayload[2] = (uint8_t)((status >> 16) & 0xFF);
+    pFrame->pPayload[3] = (uint8_t)((status >> 24) & 0xFF);
+    appsrv_connection_send(pCONN, pFrame);
+    appsrv_frame_release(pFrame);
+}
+
+/*********************************************************************
+ * Local Functions
+ *********************************************************************/
+
+/*!
+ * @brief handle a request from a client.
+ * @param pCONN - the client connection details
+ * @param pMsg  - the message we received.
+ */
+static void appsrv_handle_appClient_request( struct appsrv_connection *pCONN,
+                                             struct mt_msg *pMsg )
+{
+    int subsys = _bitsXYof(pMsg->cmd0 , 4, 0);
+    int handled = true;
+    if (subsys != APPSRV_SYS_ID_RPC)
+    {
+        handled = false;
+    }
+    else
+    {
+        switch(pMsg->cmd1)
+        {
+        default:
+            handled = false;
+            break;
+            /*
+             * NOTE: ADD MORE ITEMS HERE TO EXTEND THE EXAMPLE
+             */
+        case APPSRV_GET_DEVICE_ARRAY_REQ:
+            /* Rcvd data from Client */
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd get device array msg\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetDeviceArrayReq(pCONN);
+            break;
+
+        case APPSRV_GET_NWK_INFO_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "getnwkinfo req message\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetNwkInfoReq(pCONN);
+            break;
+
+        case APPSRV_SET_JOIN_PERMIT_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd join premit message\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processSetJoinPermitReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_TX_DATA_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to send message to a device\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processTxDataReq(pCONN, pMsg);
+            break;
+        case APPSRV_RMV_DEVICE_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to remove a device\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processRemoveDeviceReq(pCONN, pMsg);
+            break;
+        case APPSRV_SET_RX_BATCH_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to set rx batching\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processSetRxBatchReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_GET_DEVICE_DELTA_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to get device delta\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetDeviceDeltaReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_SUBSCRIBE_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to subscribe\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processSubscribeReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_REPLAY_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to replay indications\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processReplayReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_CONFIG_ROLLOUT_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to roll out a config\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processConfigRolloutReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_GET_ROLLOUT_PROGRESS_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req for rollout progress\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetRolloutProgressReq(pCONN);
+            break;
+
+        case APPSRV_GET_DLQ_STATS_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req for downlink queue stats\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetDlqStatsReq(pCONN, pMsg);
+            break;
+
+        case APPSRV_GET_TXQ_STATS_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req for tx queue stats\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetTxqStatsReq(pCONN);
+            break;
+
+        case APPSRV_GET_FRAG_STATS_REQ:
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req for fragmentation stats\n ");
+            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
+            appsrv_processGetFragStatsReq(pCONN);
+            break;
+        }
+    }
+    if(!handled)
+    {
+        MT_MSG_log(LOG_ERROR, pMsg, "unknown msg\n");
+    }
+}
+
+/*
+ * @brief connection writer thread
+ * @param cookie - opaque parameter that is the connection details.
+ *
+ * Drains the connection tx queue onto the socket, so a slow
+ * gateway only ever blocks this thread. Exits when the
+ * connection is dead.
+ */
+static intptr_t appsrv_writer_thread(intptr_t cookie)
+{
+    struct appsrv_connection *pCONN;
+    struct appsrv_frame *pFrame;
+
+    pCONN = (struct appsrv_connection *)(cookie);
+
+    for(;;)
+    {
+        if(pCONN->is_dead)
+        {
+            break;
+        }
+
+        pFrame = appsrv_connection_dequeue(pCONN);
+        if(pFrame == NULL)
+        {
+            /* nothing to do, wait for more (or time out and recheck) */
+            (void)SEMAPHORE_waitWithTimeout(pCONN->txq_sem, 1000);
+            continue;
+        }
+
+        appsrv_connection_write(pCONN, pFrame);
+        appsrv_frame_release(pFrame);
+    }
+    return 0;
+}
+
+/*
+ * @brief specific connection thread
+ * @param cookie - opaque parameter that is the connection details.
+ *
+ * The server thread creates these as needed
+ *
+ * This thread lives until the connection dies.
+ */
+static intptr_t s2appsrv_thread(intptr_t cookie)
+{
+    struct appsrv_connection *pCONN;
+    struct mt_msg *pMsg;
+    int r;
+    char iface_name[30];
+    char thread_name[30];
+    char star_line[30];
+    int star_line_char;
 
-    /* Send msg */
-            MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-            MT_MSG_wrBuf(pMsg, NULL, len);
-            appsrv_broadcast(pMsg);
+    pCONN = (struct appsrv_connection *)(cookie);
+    if( pCONN == NULL )
+    {
+        BUG_HERE("pCONN is null?\n");
+    }
+
+    /* create our upstream interface */
+    (void)snprintf(iface_name,
+                   sizeof(iface_name),
+                   "s2u-%d-iface",
+                   pCONN->connection_id);
+    pCONN->socket_interface.dbg_name = iface_name;
+
+    /* Create our interface */
+    r = MT_MSG_interfaceCreate(&(pCONN->socket_interface));
+    if(r != 0)
+    {
+        BUG_HERE("Cannot create socket interface?\n");
+    }
+
+    /* Create the tx queue and the thread that drains it */
+    appsrv_connection_txq_create(pCONN);
+    (void)snprintf(thread_name,
+                   sizeof(thread_name),
+                   "thread-tx-%d",
+                   pCONN->connection_id);
+    pCONN->thread_id_writer = THREAD_create(thread_name,
+                                            appsrv_writer_thread,
+                                            (intptr_t)(pCONN),
+                                            THREAD_FLAGS_DEFAULT);
+
+    /* Add this connection to the set. */
+    appsrv_conn_set_update(pCONN, NULL);
+
+    star_line_char = 0;
+    /* Wait for messages to come in from the socket.. */
+    for(;;)
+    {
+        /* Did the other guy die? */
+        if(pCONN->is_dead)
+        {
+            break;
+        }
+
+        /* did the socket die? */
+        if(pCONN->socket_interface.is_dead)
+        {
+            pCONN->is_dead = true;
+            continue;
+        }
+
+        /* get our message */
+        pMsg = MT_MSG_LIST_remove(&(pCONN->socket_interface),
+                                  &(pCONN->socket_interface.rx_list), 1000);
+        if(pMsg == NULL)
+        {
+            /* must have timed out. */
+            continue;
+        }
+
+        pMsg->pLogPrefix = "web-request";
+
+        /* Print a *MARKER* line in the log to help trace this message */
+        star_line_char++;
+        /* Cycle through the letters AAAA, BBBB, CCCC .... */
+        star_line_char = star_line_char % 26;
+        memset((void *)(star_line),
+               star_line_char + 'A',
+               sizeof(star_line) - 1);
+        star_line[sizeof(star_line) - 1] = 0;
+        LOG_printf(LOG_DBG_MT_MSG_traffic, "START MSG: %s\n", star_line);
+
+        /* Actually process the request */
+        appsrv_handle_appClient_request(pCONN, pMsg);
+
+        /* Same *MARKER* line at the end of the message */
+        LOG_printf(LOG_DBG_MT_MSG_traffic, "END MSG: %s\n", star_line);
+        MT_MSG_free(pMsg);
+        pMsg = NULL;
+    }
+
+    /* There is an interock here.
+     * FIRST: We set "is_dead"
+     *   The broadcast code will skip this item.
+     *   if and only if it is dead.
+     * HOWEVER
+     *   Q: What happens if we die in the middle of broadcasting?
+     *   A: We must wait until the broad cast is complete
+     *      Removing us from the set returns only once no
+     *      broadcast can still see us.
+     */
+    appsrv_conn_set_update(NULL, pCONN);
+
+    /* Nobody can queue anything now, stop the writer */
+    SEMAPHORE_put(pCONN->txq_sem);
+    while(THREAD_isAlive(pCONN->thread_id_writer))
+    {
+        TIMER_sleep(10);
+    }
+    THREAD_destroy(pCONN->thread_id_writer);
+
+    /* and throw away what it did not get to */
+    appsrv_connection_txq_destroy(pCONN);
+
+    /* socket is dead */
+    /* we need to destroy the interface */
+    MT_MSG_interfaceDestroy(&(pCONN->socket_interface));
+
+    /* destroy the socket. */
+    SOCKET_ACCEPT_destroy(pCONN->socket_interface.hndl);
+
+    /* we can free this now */
+    free((void *)pCONN);
+
+    /* we do not destroy free the connection */
+    /* this is done in the uart thread */
+    return 0;
+}
+
+/*
+ * @brief epoll mode: create the non-blocking listening socket
+ * @returns socket or -1 on error
+ *
+ * Uses the host/service/inet settings from appClient_socket_cfg
+ */
+static int appsrv_epoll_listen(void)
+{
+    struct addrinfo hints;
+    struct addrinfo *pResults;
+    struct addrinfo *pAI;
+    int fd;
+    int one;
+    int r;
+
+    memset((void *)(&hints), 0, sizeof(hints));
+    hints.ai_family = (appClient_socket_cfg.inet_4or6 == 6) ? AF_INET6 : AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    r = getaddrinfo(appClient_socket_cfg.host,
+                    appClient_socket_cfg.service,
+                    &hints, &pResults);
+    if(r != 0)
+    {
+        LOG_printf(LOG_ERROR, "getaddrinfo(%s): %s\n",
+                   appClient_socket_cfg.service, gai_strerror(r));
+        return -1;
+    }
+
+    fd = -1;
+    for(pAI = pResults ; pAI ; pAI = pAI->ai_next)
+    {
+        fd = socket(pAI->ai_family,
+                    pAI->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    pAI->ai_protocol);
+        if(fd < 0)
+        {
+            continue;
+        }
+        one = 1;
+        (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if((bind(fd, pAI->ai_addr, pAI->ai_addrlen) == 0) &&
+           (listen(fd, appClient_socket_cfg.server_backlog) == 0))
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(pResults);
+    return fd;
+}
+
+/*!
+ * @brief create the non-blocking AF_UNIX listen socket (unix-path)
+ * @returns socket or -1
+ */
+static int appsrv_epoll_listen_unix(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if(strlen(appsrv_cfg.unix_path) >= sizeof(addr.sun_path))
+    {
+        LOG_printf(LOG_ERROR, "unix-path too long: %s\n", appsrv_cfg.unix_path);
+        return -1;
+    }
+    memset((void *)(&addr), 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, appsrv_cfg.unix_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    /* left over from a previous run? */
+    (void)unlink(appsrv_cfg.unix_path);
+    if((bind(fd, (struct sockaddr *)(&addr), sizeof(addr)) != 0) ||
+       (listen(fd, appClient_socket_cfg.server_backlog) != 0))
+    {
+        LOG_printf(LOG_ERROR, "cannot listen on %s: %s\n",
+                   appsrv_cfg.unix_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * @brief epoll mode: write as much of the tx queue as the socket takes
+ * @param pCONN - the connection
+ *
+ * Stops at EAGAIN, the next EPOLLOUT edge brings us back here.
+ */
+static void appsrv_epoll_flush(struct appsrv_connection *pCONN)
+{
+    struct iovec iov[APPSRV_TX_IOV_MAX];
+    struct msghdr msg;
+    struct appsrv_frame *pFrame;
+    ssize_t r;
+    size_t n;
+    int x;
+
+    while(!(pCONN->is_dead))
+    {
+        /* gather what is queued, one sendmsg for all of it */
+        while(pCONN->tx_ncur < APPSRV_TX_IOV_MAX)
+        {
+            pFrame = appsrv_connection_dequeue(pCONN);
+            if(pFrame == NULL)
+            {
+                break;
+            }
+            if(pCONN->tx_ncur == 0)
+            {
+                pCONN->tx_offset = 0;
+            }
+            pCONN->ppTxCur[pCONN->tx_ncur++] = pFrame;
+        }
+        if(pCONN->tx_ncur == 0)
+        {
+            /* all done */
+            return;
+        }
+        for(x = 0 ; x < pCONN->tx_ncur ; x++)
+        {
+            iov[x].iov_base = (void *)(pCONN->ppTxCur[x]->wire);
+            iov[x].iov_len = pCONN->ppTxCur[x]->wire_len;
+        }
+        iov[0].iov_base = (void *)(pCONN->ppTxCur[0]->wire + pCONN->tx_offset);
+        iov[0].iov_len -= pCONN->tx_offset;
+
+        memset((void *)&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = pCONN->tx_ncur;
+        r = sendmsg(pCONN->fd, &msg, MSG_NOSIGNAL);
+        if(r < 0)
+        {
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            LOG_printf(LOG_ERROR, "%s: cannot write msg 0x%02x\n",
+                       pCONN->dbg_name, pCONN->ppTxCur[0]->cmd1);
+            pCONN->is_dead = true;
+            return;
+        }
+
+        /* drop the frames that went out completely */
+        n = (size_t)r;
+        x = 0;
+        while((x < pCONN->tx_ncur) && (n >= iov[x].iov_len))
+        {
+            n -= iov[x].iov_len;
+            pCONN->txq_stats.n_sent++;
+            LOG_printf(LOG_APPSRV_BROADCAST, "%s: sent msg 0x%02x (%d bytes)\n",
+                       pCONN->dbg_name, pCONN->ppTxCur[x]->cmd1,
+                       (int)(pCONN->ppTxCur[x]->wire_len));
+            appsrv_frame_release(pCONN->ppTxCur[x]);
+            x++;
+        }
+        pCONN->tx_offset = (x == 0) ? (pCONN->tx_offset + n) : n;
+        pCONN->tx_ncur -= x;
+        memmove(&(pCONN->ppTxCur[0]), &(pCONN->ppTxCur[x]),
+                pCONN->tx_ncur * sizeof(pCONN->ppTxCur[0]));
+    }
+}
+
+/*
+ * @brief epoll mode: turn complete frames in the rx buffer into requests
+ * @param pCONN - the connection
+ *
+ * Frames use the same format the MT layer uses for the
+ * appClient interface (see appClient_mt_interface_template).
+ */
+static void appsrv_epoll_parse(struct appsrv_connection *pCONN)
+{
+    struct mt_msg_interface *pIface;
+    struct mt_msg *pMsg;
+    uint8_t *pBytes;
+    size_t hdr_len;
+    size_t frame_len;
+    size_t x;
+    int len;
+    int cmd0;
+    int cmd1;
+    uint8_t chksum;
+
+    pIface = &appClient_mt_interface_template;
+    hdr_len = (pIface->frame_sync ? 1 : 0) + (pIface->len_2bytes ? 2 : 1) + 2;
+
+    while(!(pCONN->is_dead))
+    {
+        pBytes = pCONN->pRxBuf;
+
+        /* resync on the frame sync byte */
+        if(pIface->frame_sync)
+        {
+            for(x = 0 ; x < pCONN->rx_len ; x++)
+            {
+                if(pBytes[x] == APPSRV_FRAME_SOF)
+                {
+                    break;
+                }
+            }
+            if(x)
+            {
+                memmove(pBytes, pBytes + x, pCONN->rx_len - x);
+                pCONN->rx_len -= x;
+            }
+        }
+
+        if(pCONN->rx_len < hdr_len)
+        {
+            /* need more */
+            return;
+        }
+
+        x = pIface->frame_sync ? 1 : 0;
+        len = pBytes[x++];
+        if(pIface->len_2bytes)
+        {
+            len |= (pBytes[x++] << 8);
+        }
+        cmd0 = pBytes[x++];
+        cmd1 = pBytes[x++];
+
+        frame_len = hdr_len + len + (pIface->include_chksum ? 1 : 0);
+        if(pCONN->rx_len < frame_len)
+        {
+            /* need more */
+            return;
+        }
+
+        chksum = 0;
+        if(pIface->include_chksum)
+        {
+            for(x = (pIface->frame_sync ? 1 : 0) ; x < frame_len - 1 ; x++)
+            {
+                chksum ^= pBytes[x];
+            }
+            chksum ^= pBytes[frame_len - 1];
+        }
+
+        if(chksum != 0)
+        {
+            LOG_printf(LOG_ERROR, "%s: bad checksum, frame dropped\n",
+                       pCONN->dbg_name);
+        }
+        else
+        {
+            pMsg = MT_MSG_alloc(len, cmd0, cmd1);
+            if(pMsg == NULL)
+            {
+                BUG_HERE("No memory\n");
+            }
+            memcpy(pMsg->iobuf + HEADER_LEN, pBytes + hdr_len, len);
+            pMsg->pLogPrefix = "web-request";
+
+            /* Actually process the request */
+            appsrv_handle_appClient_request(pCONN, pMsg);
             MT_MSG_free(pMsg);
             pMsg = NULL;
         }
 
+        /* consume the frame */
+        pCONN->rx_len -= frame_len;
+        memmove(pBytes, pBytes + frame_len, pCONN->rx_len);
+    }
+}
+
+/*
+ * @brief epoll mode: read everything the socket has
+ * @param pCONN - the connection
+ */
+static void appsrv_epoll_read(struct appsrv_connection *pCONN)
+{
+    ssize_t r;
+    uint8_t *pNew;
+
+    while(!(pCONN->is_dead))
+    {
+        if(pCONN->rx_len == pCONN->rx_size)
+        {
+            /* grow, the biggest possible frame is 64K + overhead */
+            if(pCONN->rx_size >= (65536 + APPSRV_FRAME_OVERHEAD))
+            {
+                LOG_printf(LOG_ERROR, "%s: rx frame too big\n",
+                           pCONN->dbg_name);
+                pCONN->is_dead = true;
+                return;
+            }
+            pNew = realloc(pCONN->pRxBuf, pCONN->rx_size * 2);
+            if(pNew == NULL)
+            {
+                BUG_HERE("No memory\n");
+            }
+            pCONN->pRxBuf = pNew;
+            pCONN->rx_size *= 2;
+        }
+
+        r = recv(pCONN->fd,
+                 pCONN->pRxBuf + pCONN->rx_len,
+                 pCONN->rx_size - pCONN->rx_len,
+                 0);
+        if(r == 0)
+        {
+            LOG_printf(LOG_APPSRV_CONNECTIONS, "%s: peer closed\n",
+                       pCONN->dbg_name);
+            pCONN->is_dead = true;
+            return;
+        }
+        if(r < 0)
+        {
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            pCONN->is_dead = true;
+            return;
+        }
+        pCONN->rx_len += (size_t)r;
+        appsrv_epoll_parse(pCONN);
+    }
+}
+
+/*
+ * @brief epoll mode: accept all pending connections
+ * @param listen_fd - the listening socket
+ * @param ppLoop - the event loop connection list
+ * @param pConnection_id - connection id counter
+ */
+static void appsrv_epoll_accept(int listen_fd,
+                                struct appsrv_connection **ppLoop,
+                                int *pConnection_id)
+{
+    struct appsrv_connection *pCONN;
+    struct epoll_event ev;
+    char buf[30];
+    int fd;
+
+    for(;;)
+    {
+        fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                LOG_printf(LOG_ERROR, "accept failed: %s\n", strerror(errno));
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        pCONN = calloc(1, sizeof(*pCONN));
+        if(pCONN == NULL)
+        {
+            BUG_HERE("No memory\n");
+        }
+        pCONN->connection_id = (*pConnection_id)++;
+        pCONN->fd = fd;
+        (void)snprintf(buf, sizeof(buf),
+                       "connection-%d",
+                       pCONN->connection_id);
+        pCONN->dbg_name = strdup(buf);
+        if(pCONN->dbg_name == NULL)
+        {
+            BUG_HERE("no memory\n");
+        }
+        pCONN->rx_size = 256;
+        pCONN->pRxBuf = malloc(pCONN->rx_size);
+        if(pCONN->pRxBuf == NULL)
+        {
+            BUG_HERE("No memory\n");
+        }
+        appsrv_connection_txq_create(pCONN);
 
+        memset((void *)(&ev), 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = pCONN;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            BUG_HERE("cannot add connection to epoll\n");
+        }
 
-/*!
-  TBD
-
-  Public function defined in appsrv_Collector.h
-*/
-void appsrv_stateChangeUpdate(Cllc_states_t state)
-{
-    int len = STATE_CHG_IND_LEN;
-    struct mt_msg *pMsg;
-    pMsg = MT_MSG_alloc(
-        len,
-        MT_MSG_cmd0_areq(APPSRV_SYS_ID_RPC),
-        APPSRV_COLLECTOR_STATE_CNG_IND);
+        /* Add this connection to the set. */
+        appsrv_conn_set_update(pCONN, NULL);
 
-    /* Build msg, no need for duplicate pointer*/
-    pMsg->iobuf[HEADER_LEN] = (uint8_t)(state & 0xFF);
+        pCONN->pNextLoop = *ppLoop;
+        *ppLoop = pCONN;
 
-        MT_MSG_setDestIface(pMsg, &appClient_mt_interface_template);
-        MT_MSG_wrBuf(pMsg, NULL, len);
-        appsrv_broadcast(pMsg);
-        MT_MSG_free(pMsg);
-        pMsg = NULL;
+        LOG_printf(LOG_APPSRV_CONNECTIONS, "%s: connected\n", pCONN->dbg_name);
     }
+}
 
-/*********************************************************************
- * Local Functions
- *********************************************************************/
-
-/*!
- * @brief handle a request from a client.
- * @param pCONN - the client connection details
- * @param pMsg  - the message we received.
+/*
+ * @brief epoll mode: free dead connections
+ * @param ppLoop - the event loop connection list
  */
-static void appsrv_handle_appClient_request( struct appsrv_connection *pCONN,
-                                             struct mt_msg *pMsg )
+static void appsrv_epoll_reap(struct appsrv_connection **ppLoop)
 {
-    int subsys = _bitsXYof(pMsg->cmd0 , 4, 0);
-    int handled = true;
-    if (subsys != APPSRV_SYS_ID_RPC)
-    {
-        handled = false;
-    }
-    else
+    struct appsrv_connection **ppTHIS;
+    struct appsrv_connection *pCONN;
+
+    ppTHIS = ppLoop;
+    while(*ppTHIS)
     {
-        switch(pMsg->cmd1)
+        pCONN = *ppTHIS;
+        if(!(pCONN->is_dead))
         {
-        default:
-            handled = false;
-            break;
-            /*
-             * NOTE: ADD MORE ITEMS HERE TO EXTEND THE EXAMPLE
-             */
-        case APPSRV_GET_DEVICE_ARRAY_REQ:
-            /* Rcvd data from Client */
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd get device array msg\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            appsrv_processGetDeviceArrayReq(pCONN);
-            break;
-
-        case APPSRV_GET_NWK_INFO_REQ:
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "getnwkinfo req message\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            appsrv_processGetNwkInfoReq(pCONN);
-            break;
+            ppTHIS = &(pCONN->pNextLoop);
+            continue;
+        }
 
-        case APPSRV_SET_JOIN_PERMIT_REQ:
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd join premit message\n ");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            appsrv_processSetJoinPermitReq(pCONN, pMsg);
-            break;
+        /* once out of the set no broadcast is using it */
+        appsrv_conn_set_update(NULL, pCONN);
 
-        case APPSRV_TX_DATA_REQ:
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to send message to a device\n ");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            appsrv_processTxDataReq(pCONN, pMsg);
-            break;
-        case APPSRV_RMV_DEVICE_REQ:
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "rcvd req to remove a device\n ");
-            LOG_printf(LOG_APPSRV_MSG_CONTENT, "______________________________\n");
-            appsrv_processRemoveDeviceReq(pCONN, pMsg);
-            break;
-        }
-    }
-    if(!handled)
-    {
-        MT_MSG_log(LOG_ERROR, pMsg, "unknown msg\n");
+        *ppTHIS = pCONN->pNextLoop;
+        (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pCONN->fd, NULL);
+        close(pCONN->fd);
+        appsrv_connection_txq_destroy(pCONN);
+        free((void *)(pCONN->pRxBuf));
+        free((void *)(pCONN->dbg_name));
+        free((void *)pCONN);
     }
 }
 
 /*
- * @brief specific connection thread
- * @param cookie - opaque parameter that is the connection details.
- *
- * The server thread creates these as needed
+ * @brief epoll mode: one event loop for all gateway connections
  *
- * This thread lives until the connection dies.
+ * Replaces the thread per connection model, the listening socket,
+ * all connections and the tx queue wakeup are multiplexed with
+ * edge triggered epoll. Requests are handled on this thread.
  */
-static intptr_t s2appsrv_thread(intptr_t cookie)
+static intptr_t appsrv_epoll_server(void)
 {
+    struct epoll_event events[32];
+    struct epoll_event ev;
+    struct appsrv_connection *pLoop;
     struct appsrv_connection *pCONN;
-    struct mt_msg *pMsg;
-    int r;
-    char iface_name[30];
-    char star_line[30];
-    int star_line_char;
+    uint64_t count;
+    int listen_fd;
+    int unix_fd;
+    int connection_id;
+    int n;
+    int x;
 
-    pCONN = (struct appsrv_connection *)(cookie);
-    if( pCONN == NULL )
+    pLoop = NULL;
+    connection_id = 0;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0)
     {
-        BUG_HERE("pCONN is null?\n");
+        BUG_HERE("cannot create epoll\n");
+    }
+    epoll_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(epoll_wakeup_fd < 0)
+    {
+        BUG_HERE("cannot create eventfd\n");
+    }
+    listen_fd = appsrv_epoll_listen();
+    if(listen_fd < 0)
+    {
+        BUG_HERE("cannot create socket to listen\n");
     }
 
-    /* create our upstream interface */
-    (void)snprintf(iface_name,
-                   sizeof(iface_name),
-                   "s2u-%d-iface",
-                   pCONN->connection_id);
-    pCONN->socket_interface.dbg_name = iface_name;
-
-    /* Create our interface */
-    r = MT_MSG_interfaceCreate(&(pCONN->socket_interface));
-    if(r != 0)
+    memset((void *)(&ev), 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &epoll_listen_marker;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0)
     {
-        BUG_HERE("Cannot create socket interface?\n");
+        BUG_HERE("cannot add listen socket to epoll\n");
+    }
+    ev.data.ptr = &epoll_wakeup_marker;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, epoll_wakeup_fd, &ev) != 0)
+    {
+        BUG_HERE("cannot add eventfd to epoll\n");
     }
 
-    /* Add this connection to the list. */
-    lock_connection_list();
-    pCONN->pNext = all_connections;
-    pCONN->is_busy = false;
-    all_connections = pCONN;
-    unlock_connection_list();
+    /* co-located gateways, same framing without TCP */
+    unix_fd = -1;
+    if(appsrv_cfg.unix_path)
+    {
+        unix_fd = appsrv_epoll_listen_unix();
+        if(unix_fd < 0)
+        {
+            BUG_HERE("cannot create unix socket to listen\n");
+        }
+        ev.data.ptr = &epoll_unix_marker;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_fd, &ev) != 0)
+        {
+            BUG_HERE("cannot add unix socket to epoll\n");
+        }
+    }
 
-    star_line_char = 0;
-    /* Wait for messages to come in from the socket.. */
     for(;;)
     {
-        /* Did the other guy die? */
-        if(pCONN->is_dead)
+        n = epoll_wait(epoll_fd, events, 32, 1000);
+        if(n < 0)
         {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            LOG_printf(LOG_ERROR, "epoll_wait: %s\n", strerror(errno));
             break;
         }
 
-        /* did the socket die? */
-        if(pCONN->socket_interface.is_dead)
+        for(x = 0 ; x < n ; x++)
         {
-            pCONN->is_dead = true;
-            continue;
+            if(events[x].data.ptr == &epoll_listen_marker)
+            {
+                appsrv_epoll_accept(listen_fd, &pLoop, &connection_id);
+                continue;
+            }
+            if(events[x].data.ptr == &epoll_unix_marker)
+            {
+                appsrv_epoll_accept(unix_fd, &pLoop, &connection_id);
+                continue;
+            }
+            if(events[x].data.ptr == &epoll_wakeup_marker)
+            {
+                /* tx queues have data, flushed below */
+                while(read(epoll_wakeup_fd, &count, sizeof(count)) > 0)
+                {
+                    /* drain */
+                }
+                continue;
+            }
+
+            pCONN = (struct appsrv_connection *)(events[x].data.ptr);
+            if(events[x].events & EPOLLIN)
+            {
+                appsrv_epoll_read(pCONN);
+            }
+            if(events[x].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            {
+                pCONN->is_dead = true;
+            }
         }
 
-        /* get our message */
-        pMsg = MT_MSG_LIST_remove(&(pCONN->socket_interface),
-                                  &(pCONN->socket_interface.rx_list), 1000);
-        if(pMsg == NULL)
+        /* Writing is cheap when there is nothing queued, so
+         * just try all of them rather than track who is ready */
+        for(pCONN = pLoop ; pCONN ; pCONN = pCONN->pNextLoop)
         {
-            /* must have timed out. */
-            continue;
+            appsrv_epoll_flush(pCONN);
         }
 
-        pMsg->pLogPrefix = "web-request";
-
-        /* Print a *MARKER* line in the log to help trace this message */
-        star_line_char++;
-        /* Cycle through the letters AAAA, BBBB, CCCC .... */
-        star_line_char = star_line_char % 26;
-        memset((void *)(star_line),
-               star_line_char + 'A',
-               sizeof(star_line) - 1);
-        star_line[sizeof(star_line) - 1] = 0;
-        LOG_printf(LOG_DBG_MT_MSG_traffic, "START MSG: %s\n", star_line);
-
-        /* Actually process the request */
-        appsrv_handle_appClient_request(pCONN, pMsg);
-
-        /* Same *MARKER* line at the end of the message */
-        LOG_printf(LOG_DBG_MT_MSG_traffic, "END MSG: %s\n", star_line);
-        MT_MSG_free(pMsg);
-        pMsg = NULL;
+        appsrv_epoll_reap(&pLoop);
     }
 
-    /* There is an interock here.
-     * FIRST: We set "is_dead"
-     *   The broadcast code will skip this item.
-     *   if and only if it is dead.
-     * HOWEVER
-     *   Q: What happens if we die in the middle of broadcasting?
-     *   A: We must wait until the broad cast is complete
-     *      We know this by checking the bcast_state.
-     */
-    while(pCONN->is_busy)
+    /* nobody else would close them */
+    for(pCONN = pLoop ; pCONN ; pCONN = pCONN->pNextLoop)
     {
-        /* we must wait ... a broadcast is active. */
-        /* so sleep alittle and try again */
-        TIMER_sleep(10);
+        pCONN->is_dead = true;
     }
+    appsrv_epoll_reap(&pLoop);
 
-    /* we can now remove this DEAD connection from the list. */
-    lock_connection_list();
+    close(listen_fd);
+    if(unix_fd >= 0)
     {
-        struct appsrv_connection **ppTHIS;
-
-        /* find our self in the list of connections. */
-        for(ppTHIS = &all_connections ;
-            (*ppTHIS) != NULL ;
-            ppTHIS = &((*ppTHIS)->pNext))
-        {
-            /* found? */
-            if((*ppTHIS) == pCONN)
-            {
-                /* yes we are done */
-                break;
-            }
-        }
-
-        /* did we find this one? */
-        if(*ppTHIS)
-        {
-            /* remove this one from the list */
-            (*ppTHIS) = pCONN->pNext;
-            pCONN->pNext = NULL;
-        }
+        close(unix_fd);
+        (void)unlink(appsrv_cfg.unix_path);
     }
-    unlock_connection_list();
-    /* socket is dead */
-    /* we need to destroy the interface */
-    MT_MSG_interfaceDestroy(&(pCONN->socket_interface));
-
-    /* destroy the socket. */
-    SOCKET_ACCEPT_destroy(pCONN->socket_interface.hndl);
-
-    /* we can free this now */
-    free((void *)pCONN);
-
-    /* we do not destroy free the connection */
-    /* this is done in the uart thread */
     return 0;
 }
 
@@ -1067,7 +4318,8 @@ static intptr_t s2appsrv_thread(intptr_t cookie)
  * @brief This thread handles all connections from the nodeJS/gateway client.
  *
  * This server thread spawns off threads that handle
- * each connection from each gateway app.
+ * each connection from each gateway app, or runs the
+ * epoll event loop if the ini file asks for that.
  */
 
 static intptr_t appsrv_server_thread(intptr_t _notused)
@@ -1080,6 +4332,18 @@ static intptr_t appsrv_server_thread(intptr_t _notused)
     int connection_id;
     char buf[30];
 
+    if(appsrv_cfg.server_mode == APPSRV_SERVER_EPOLL)
+    {
+        r = (int)appsrv_epoll_server();
+        SEMAPHORE_put(app_exit_sem);
+        return r;
+    }
+    if(appsrv_cfg.unix_path)
+    {
+        /* the stream layer only does inet sockets */
+        LOG_printf(LOG_ERROR, "unix-path needs server-mode = epoll, ignored\n");
+    }
+
     pCONN = NULL;
     connection_id = 0;
 
@@ -1111,6 +4375,7 @@ static intptr_t appsrv_server_thread(intptr_t _notused)
                 BUG_HERE("No memory\n");
             }
             pCONN->connection_id = connection_id++;
+            pCONN->fd = -1;
 
             /* clone the connection details */
             pCONN->socket_interface = appClient_mt_interface_template;
@@ -1164,6 +4429,7 @@ static intptr_t appsrv_server_thread(intptr_t _notused)
         pCONN = NULL;
 
     }
+    SEMAPHORE_put(app_exit_sem);
     return 0;
 }
 
@@ -1187,6 +4453,7 @@ static intptr_t collector_thread(intptr_t dummy)
 #if defined(__linux__)
     /* gcc complains, unreachable.. */
     /* other analisys tools do not .. Grrr. */
+    SEMAPHORE_put(app_exit_sem);
     return 0;
 #endif
 }
@@ -1197,15 +4464,55 @@ static intptr_t collector_thread(intptr_t dummy)
 void APP_main(void)
 {
     int r;
-    intptr_t server_thread_id;
-    intptr_t collector_thread_id;
+    struct appsrv_conn_set *pSet;
     struct appsrv_connection *pCONN;
+    uint64_t deadline;
+    uint64_t now;
+    unsigned epoch;
+    int n;
+    int x;
+
+    conn_update_mutex = MUTEX_create("all-connections");
+
+    if(conn_update_mutex == 0)
+    {
+        BUG_HERE("cannot create connection set mutex\n");
+    }
+    conn_grace_sem = SEMAPHORE_create("conn-grace", 0);
+    conn_gone_sem = SEMAPHORE_create("conn-gone", 0);
+    if((conn_grace_sem == 0) || (conn_gone_sem == 0))
+    {
+        BUG_HERE("cannot create connection set semaphores\n");
+    }
+    app_exit_sem = SEMAPHORE_create("app-exit", 0);
+    if(app_exit_sem == 0)
+    {
+        BUG_HERE("cannot create exit semaphore\n");
+    }
+
+    rx_batch_sem = SEMAPHORE_create("rx-batch", 0);
+    if(rx_batch_sem == 0)
+    {
+        BUG_HERE("cannot create rx batch semaphore\n");
+    }
 
-    all_connections_mutex = MUTEX_create("all-connections");
+    devtab_mutex = MUTEX_create("device-table");
+    if(devtab_mutex == 0)
+    {
+        BUG_HERE("cannot create device table mutex\n");
+    }
+    /* versions restart with us, gateways resync when this changes */
+    devtab_epoch = (uint32_t)time(NULL);
+
+    hist_mutex = MUTEX_create("replay-history");
+    if(hist_mutex == 0)
+    {
+        BUG_HERE("cannot create replay history mutex\n");
+    }
 
-    if(all_connections_mutex == 0)
+    if(appsrv_cfg.shm_ring_path && (appsrv_ring_create() != 0))
     {
-        BUG_HERE("cannot create connection list mutex\n");
+        FATAL_printf("cannot create shm ring %s\n", appsrv_cfg.shm_ring_path);
     }
 
     Collector_init();
@@ -1238,69 +4545,62 @@ void APP_main(void)
     fprintf( stdout, "Start the gateway application\n");
 #endif //IS_HEADLESS
 
-    server_thread_id = THREAD_create("server-thread",
-                                     appsrv_server_thread, 0,
-                                     THREAD_FLAGS_DEFAULT);
+    (void)THREAD_create("server-thread",
+                        appsrv_server_thread, 0, THREAD_FLAGS_DEFAULT);
+
+    (void)THREAD_create("collector-thread",
+                        collector_thread, 0, THREAD_FLAGS_DEFAULT);
 
-    collector_thread_id = THREAD_create("collector-thread",
-                                        collector_thread, 0, THREAD_FLAGS_DEFAULT);
+    (void)THREAD_create("rx-batch-thread",
+                        appsrv_rxBatch_thread, 0, THREAD_FLAGS_DEFAULT);
 
+    /* we stay here while both threads are alive */
+    (void)SEMAPHORE_waitWithTimeout(app_exit_sem, -1);
 
+    /* mark the connections as dead and wake their writers, each one
+     * posts conn_gone_sem as it leaves the set */
+    deadline = appsrv_now_mSecs() + APPSRV_SHUTDOWN_MSECS;
     for(;;)
     {
-        /* every 10 seconds.. */
-        /* 10 seconds is an arbitrary value */
-        TIMER_sleep(10 * 1000);
-        r = 0;
-
-        if(THREAD_isAlive(collector_thread_id))
+        epoch = appsrv_read_enter();
+        pSet = __atomic_load_n(&pConnSet, __ATOMIC_ACQUIRE);
+        n = pSet ? pSet->n : 0;
+        for(x = 0 ; x < n ; x++)
         {
-            r += 1;
+            pCONN = pSet->ppCONN[x];
+            pCONN->is_dead = true;
+            appsrv_connection_wake(pCONN);
         }
+        appsrv_read_exit(epoch);
 
-        if(THREAD_isAlive(server_thread_id))
-        {
-            r += 1;
-        }
-        /* we stay here while both *2* threads are alive */
-        if(r != 2)
+        /* still have connections? */
+        now = appsrv_now_mSecs();
+        if((n == 0) || (now >= deadline))
         {
             break;
         }
+        (void)SEMAPHORE_waitWithTimeout(conn_gone_sem, (int)(deadline - now));
     }
 
-    /* wait at most (N) seconds then we just 'die' */
-    r = 0;
-    while(r < 10)
+    /* Force close what is left: dead connections get no more
+     * broadcasts, the sockets of those still stuck in a write to
+     * their gateway are closed by the exit */
+    epoch = appsrv_read_enter();
+    pSet = __atomic_load_n(&pConnSet, __ATOMIC_ACQUIRE);
+    n = pSet ? pSet->n : 0;
+    for(x = 0 ; x < n ; x++)
     {
-
-        lock_connection_list();
-        pCONN = all_connections;
-        /* mark them all as dead */
-        while(pCONN)
-        {
-            pCONN->is_dead = true;
-            LOG_printf(LOG_APPSRV_CONNECTIONS,
-                       "Connection: %s is still alive\n",
-                       pCONN->dbg_name);
-            pCONN = pCONN->pNext;
-        }
-        unlock_connection_list();
-
-        /* still have connections? */
-        if(all_connections)
-        {
-            /* wait a second.. */
-            TIMER_sleep(10000);
-            /* and try again */
-            r++;
-            continue;
-        }
-        else
+        pCONN = pSet->ppCONN[x];
+        if(pCONN->fd >= 0)
         {
-            break;
+            /* the event loop is gone or going, do not wait for it */
+            (void)shutdown(pCONN->fd, SHUT_RDWR);
         }
+        LOG_printf(LOG_APPSRV_CONNECTIONS,
+                   "Connection: %s force closed\n",
+                   pCONN->dbg_name);
     }
+    appsrv_read_exit(epoch);
     /* thread exit */
 }
 
@@ -1325,6 +4625,22 @@ void APP_defaults(void)
     appClient_socket_cfg.device_binding = NULL;
     /*! print a 'non-connect' every minute */
     appClient_socket_cfg.connect_timeout_mSecs = 60 * 1000;
+
+    /*! queue up to 256 messages per gateway */
+    appsrv_cfg.txq_depth = 256;
+    /*! a slow gateway loses its oldest messages first */
+    appsrv_cfg.txq_overflow = APPSRV_TXQ_DROP_OLDEST;
+    /*! one thread per gateway connection */
+    appsrv_cfg.server_mode = APPSRV_SERVER_THREADS;
+    /*! batches go out after 5 mSecs or when 2K of records piled up */
+    appsrv_cfg.rx_batch_window_mSecs = 5;
+    appsrv_cfg.rx_batch_max_bytes = 2048;
+    /*! no unix socket, no shared memory ring, 1M ring if enabled */
+    appsrv_cfg.unix_path = NULL;
+    appsrv_cfg.shm_ring_path = NULL;
+    appsrv_cfg.shm_ring_size = 1024 * 1024;
+    /*! remember the last 8 data indications of every device */
+    appsrv_cfg.replay_depth = 8;
 }
 
 /*
@@ -23,6 +23,8 @@ extern "C"
  Includes
  *****************************************************************************/
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "csf.h"
 #include "csf_linux.h"
@@ -37,6 +39,118 @@ extern "C"
  Typedefs
  *****************************************************************************/
 
+/*!
+ * A fully framed gateway message.
+ *
+ * The frame is encoded once and is immutable after it is handed
+ * to appsrv_broadcast(), so the same bytes can be written to every
+ * connection. The frame is reference counted, the last
+ * appsrv_frame_release() frees it.
+ */
+struct appsrv_frame {
+    /*! Number of owners */
+    int refcount;
+    /*! Checksum appended, no more changes allowed */
+    bool is_sealed;
+    /*! The APPSRV_* message id */
+    int cmd1;
+    /*! Payload length in bytes */
+    int len;
+    /*! Where the payload is built (points into wire) */
+    uint8_t *pPayload;
+    /*! Number of valid bytes in wire */
+    size_t wire_len;
+    /*! The message as it goes out on the socket */
+    uint8_t wire[];
+};
+
+/*! What to do when a gateway tx queue is full */
+#define APPSRV_TXQ_DROP_OLDEST 0
+#define APPSRV_TXQ_DROP_NEWEST 1
+#define APPSRV_TXQ_DISCONNECT  2
+
+/*! How gateway connections are served */
+#define APPSRV_SERVER_THREADS  0
+#define APPSRV_SERVER_EPOLL    1
+
+/*! Application server settings
+  Note: These parameters can be modified via the ini file
+*/
+struct appsrv_cfg {
+    /*! Max number of messages queued per gateway connection */
+    int txq_depth;
+    /*! One of APPSRV_TXQ_xxx */
+    int txq_overflow;
+    /*! One of APPSRV_SERVER_xxx */
+    int server_mode;
+    /*! Batched data indications go out this long after the first one */
+    int rx_batch_window_mSecs;
+    /*! ... or as soon as this many bytes of records are waiting */
+    int rx_batch_max_bytes;
+    /*! Also listen on this AF_UNIX path (epoll mode), NULL: don't */
+    char *unix_path;
+    /*! Publish indications in a shared memory ring here, NULL: don't */
+    char *shm_ring_path;
+    /*! Data bytes in the ring, a power of 2 */
+    int shm_ring_size;
+    /*! Data indications remembered per device for replays, 0: none */
+    int replay_depth;
+};
+
+/*
+ * Shared memory ring (shm-ring in the ini file)
+ *
+ * The collector is the only writer process. Every indication that goes
+ * to the gateways is also appended here, as a record: a 32 bit
+ * length and then the MT frame exactly as it goes out on the
+ * socket, padded to 4 bytes. A length of APPSRV_RING_WRAP means
+ * the rest of the data area is unused, continue at offset 0.
+ *
+ * Inside the collector every thread that broadcasts can append,
+ * they take turns on one mutex around reserve, copy and publish.
+ * Readers rely on everything before head being complete, so records
+ * must be published in the order they were reserved. With an
+ * atomic reserve, a writer that got a slot would still have to wait
+ * for all earlier ones to publish, spinning behind any that was
+ * preempted mid copy; the mutex costs no more than that wait and
+ * lets the waiter sleep. It is held for one frame copy, a data
+ * indication is well under 200 bytes, and nearly all appends come
+ * from the collector thread, so it is rarely contended.
+ *
+ * Readers never write to the ring and the writer never waits
+ * for them. A reader keeps its own position (a byte count like
+ * head), reads head, copies the records between its position
+ * and head, then reads reserve: if reserve - data_size is past
+ * the position the copy started at, the writer lapped the reader
+ * and the copy must be thrown away.
+ */
+#define APPSRV_RING_MAGIC 0x34353152
+#define APPSRV_RING_WRAP 0xFFFFFFFF
+
+struct appsrv_ring_hdr {
+    /*! APPSRV_RING_MAGIC once the ring is set up */
+    uint32_t magic;
+    /*! Offset of the data area from the start of the segment */
+    uint32_t data_offset;
+    /*! Size of the data area, a power of 2 */
+    uint64_t data_size;
+    /*! Bytes published so far (data area offset is head % data_size) */
+    uint64_t head __attribute__((aligned(64)));
+    /*! Bytes the writer may be overwriting, at least head */
+    uint64_t reserve __attribute__((aligned(64)));
+};
+
+/*! Per gateway connection tx queue counters */
+struct appsrv_txq_stats {
+    /*! Messages written to the socket */
+    uint32_t n_sent;
+    /*! Messages lost because the queue was full */
+    uint32_t n_dropped;
+    /*! Highest queue depth seen */
+    uint32_t max_depth;
+};
+
+extern struct appsrv_cfg       appsrv_cfg;
 extern struct mt_msg_interface appClient_mt_interface_template;
 extern struct socket_cfg       appClient_socket_cfg;
 
@@ -72,18 +186,109 @@ extern struct uart_cfg         uart_cfg;
 #define APPSRV_TX_DATA_CNF 14
 #define APPSRV_RMV_DEVICE_REQ 15
 #define APPSRV_RMV_DEVICE_RSP 16
+#define APPSRV_DEVICE_DATA_RX_BATCH_IND 17
+#define APPSRV_SET_RX_BATCH_REQ 18
+#define APPSRV_SET_RX_BATCH_CNF 19
+#define APPSRV_SUBSCRIBE_REQ 20
+#define APPSRV_SUBSCRIBE_CNF 21
+#define APPSRV_GET_DEVICE_DELTA_REQ 22
+#define APPSRV_GET_DEVICE_DELTA_CNF 23
+#define APPSRV_FRAG_TX_DONE_IND 24
+#define APPSRV_REPLAY_REQ 25
+#define APPSRV_REPLAY_CNF 26
+#define APPSRV_CONFIG_ROLLOUT_REQ 27
+#define APPSRV_CONFIG_ROLLOUT_CNF 28
+#define APPSRV_GET_ROLLOUT_PROGRESS_REQ 29
+#define APPSRV_GET_ROLLOUT_PROGRESS_CNF 30
+#define APPSRV_GET_DLQ_STATS_REQ 31
+#define APPSRV_GET_DLQ_STATS_CNF 32
+#define APPSRV_GET_TXQ_STATS_REQ 33
+#define APPSRV_GET_TXQ_STATS_CNF 34
+#define APPSRV_GET_FRAG_STATS_REQ 35
+#define APPSRV_GET_FRAG_STATS_CNF 36
 
 #define HEADER_LEN 4
-#define TX_DATA_CNF_LEN 4
+/*! frame sync, 2 byte length, cmd0, cmd1 and checksum */
+#define APPSRV_FRAME_OVERHEAD 6
+#define APPSRV_FRAME_SOF 0xFE
+/*! most frames gathered into one sendmsg (epoll server mode) */
+#define APPSRV_TX_IOV_MAX 16
+/*! tx data request: msgId, short address, then the body,
+    then optionally a 4 byte correlation id */
+#define TX_DATA_REQ_HEAD_LEN 3
+/*! tx data request config body: polling, reporting, frame control */
+#define TX_DATA_REQ_CONFIG_LEN 6
+/*! tx data confirm: status, correlation id, latency in mSecs */
+#define TX_DATA_CNF_LEN 12
 #define JOIN_PERMIT_CNF_LEN 4
 #define NWK_INFO_REQ_LEN 18
 #define NWK_INFO_IND_LEN 17
 #define DEV_ARRAY_HEAD_LEN 3
 #define DEV_ARRAY_INFO_LEN 18
+/*! most devices in one device array, the frame length is 16 bits.
+    More than that: status frameTooLong, use the delta request */
+#define DEV_ARRAY_MAX_DEVICES ((0xFFFF - DEV_ARRAY_HEAD_LEN) / DEV_ARRAY_INFO_LEN)
 #define DEVICE_JOINED_IND_LEN 18
 #define DEVICE_NOT_ACTIVE_LEN 13
 #define STATE_CHG_IND_LEN 1
 #define REMOVE_DEVICE_RSP_LEN 0
+#define SET_RX_BATCH_CNF_LEN 4
+/*! batch: record count, then per record a length and the record */
+#define RX_BATCH_HEAD_LEN 2
+#define RX_BATCH_REC_HEAD_LEN 2
+/*! data indication record head: addr mode, ext address, rssi */
+#define RX_IND_HEAD_MAX 10
+/*! subscribe: event mask, cmdId mask, short address count */
+#define SUBSCRIBE_REQ_HEAD_LEN 10
+#define SUBSCRIBE_CNF_LEN 4
+/*! most addresses of either kind in one subscription */
+#define SUBSCRIBE_MAX_ADDRS 1024
+/*! delta: since version (4), page size (2) */
+#define DEV_DELTA_REQ_LEN 6
+/*! delta: status, epoch, table version, next since, more, count */
+#define DEV_DELTA_HEAD_LEN 16
+/*! delta: change type, then the same 18 bytes as the device array */
+#define DEV_DELTA_REC_LEN (1 + DEV_ARRAY_INFO_LEN)
+/*! most records in one delta page */
+#define DEV_DELTA_MAX_PAGE 256
+/*! delta change types */
+#define DEV_DELTA_ADDED 0
+#define DEV_DELTA_CHANGED 1
+#define DEV_DELTA_REMOVED 2
+/*! fragmented command done: short addr, msg id, status, length,
+    fragment count, fragments sent, retransmits, duration (ms) */
+#define FRAG_TX_DONE_IND_LEN 15
+/*! replay: max age in mSecs (0: any), short addr (0xFFFF: all),
+    cmdId (0xFF: any), optionally the cursor (4) of the last confirm */
+#define REPLAY_REQ_LEN 7
+#define REPLAY_REQ_CURSOR_LEN 11
+/*! replay: status, number of indications sent before the confirm,
+    more to come (1), cursor to ask for them with (4) */
+#define REPLAY_CNF_LEN 10
+/*! config rollout: polling (4), reporting (4), frame control (2),
+    window (1), pacing in mSecs (2), short address count (2) and the
+    short addresses (count 0: all devices) */
+#define CONFIG_ROLLOUT_REQ_HEAD_LEN 15
+/*! config rollout: status, number of devices (0: all, counted later) */
+#define CONFIG_ROLLOUT_CNF_LEN 6
+/*! rollout progress: state (1), total, pending, in flight, configured,
+    failed (2 each), requests sent, elapsed mSecs, devices per hour
+    (4 each) */
+#define ROLLOUT_PROGRESS_CNF_LEN 23
+/*! downlink queue stats: short address */
+#define DLQ_STATS_REQ_LEN 2
+/*! downlink queue stats: status (4), short address, depth, max depth
+    (2 each), frames at the MAC (1), queued, released, coalesced,
+    dropped, expired, total and worst wait in mSecs (4 each) */
+#define DLQ_STATS_CNF_LEN 39
+/*! tx queue stats of the asking connection: sent, dropped, max depth,
+    depth, queue size (4 each) */
+#define TXQ_STATS_CNF_LEN 20
+/*! fragmentation stats, Frag_statistics_t in order: tx messages,
+    completed, failed, busy, fragments, retransmits, bytes acked,
+    mSecs acked, rx fragments, out of order, duplicates, dropped,
+    completed, expired (4 each) */
+#define FRAG_STATS_CNF_LEN 56
 
 #define BEACON_ENABLED 1
 #define NON_BEACON 2
@@ -183,17 +388,64 @@ void APP_main(void);
  */
  void appsrv_stateChangeUpdate(Cllc_states_t state);
 
+/*!
+ * @brief Allocate a frame for a message to the gateway
+ * @param cmd1 - the APPSRV_* message id
+ * @param len - payload length in bytes
+ * @returns frame holding one reference, build the payload in pPayload
+ */
+extern struct appsrv_frame *appsrv_frame_alloc(int cmd1, int len);
+
+/*!
+ * @brief Take an additional reference on a frame
+ * @param pFrame - the frame
+ */
+extern void appsrv_frame_hold(struct appsrv_frame *pFrame);
+
+/*!
+ * @brief Drop a reference on a frame, the last one frees it
+ * @param pFrame - the frame
+ */
+extern void appsrv_frame_release(struct appsrv_frame *pFrame);
+
 /*!
  * @brief Broadcast a message to all connections
- * @param pMsg - msg to broadcast
+ * @param pFrame - frame to broadcast, the caller keeps its reference
  */
-extern void appsrv_broadcast(struct mt_msg *pMsg);
+extern void appsrv_broadcast(struct appsrv_frame *pFrame);
 
 /*!
  * @brief Send remove device response to gateway
  */
 extern void appsrv_send_removeDeviceRsp(void);
 
+/*!
+ * @brief A device was deleted from the device list
+ * @param pExtAddr - extended address of the device
+ */
+extern void appsrv_deviceRemoved(ApiMac_sAddrExt_t *pExtAddr);
+
+/*!
+ * @brief The whole device list was cleared
+ */
+extern void appsrv_deviceListCleared(void);
+
+/*!
+ * @brief A data request sent with a correlation id was confirmed
+ * @param connId - connection_id of the gateway that sent it
+ * @param corrId - correlation id from the gateway
+ * @param status - ApiMac_status_t from the MAC
+ * @param latency_mSecs - time from the request to the confirm
+ */
+extern void appsrv_txDataCnf(int connId, uint32_t corrId, int status,
+                             uint32_t latency_mSecs);
+
+/*!
+ * @brief A fragmented custom command was acked completely or given up on
+ * @param pResult - outcome and statistics of the transfer
+ */
+extern void appsrv_fragTxDone(const Frag_txResult_t *pResult);
+
 #ifdef __cplusplus
 }
 #endif
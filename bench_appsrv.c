@@ -0,0 +1,469 @@
+/******************************************************************************
+
+ @file bench_appsrv.c
+
+ @brief Time the gateway fan out of appsrv.c without a network
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/*
+ * Builds appsrv.c into a program of its own, with the collector side
+ * stubbed out, and feeds it data indications:
+ *
+ *   make bench_appsrv
+ *   ./bench_appsrv fanout [MSDU-LEN]
+ *   ./bench_appsrv copy [MSDU-LEN]
+ *
+ * fanout: cost of one data indication for 1 to 64 gateways. The
+ *     gateways are connections in thread mode whose writer threads are
+ *     not started, the queues are emptied between rounds, outside the
+ *     timed part. The replay history is off, it costs the same for any
+ *     number of gateways.
+ *
+ * copy: bytes copied and time per data indication, the way
+ *     appsrv_deviceRawDataUpdate() used to do it against what it does
+ *     now. The old path is rebuilt here with plain allocations in place
+ *     of the MT_MSG calls, so it runs without a socket: the record was
+ *     built on the stack, copied byte by byte into the message, and
+ *     each gateway got a clone which the MT layer then encoded into
+ *     its own transmit buffer. Zeroing is not counted as a copy.
+ */
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* the statics are what we time */
+#include "appsrv.c"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Indications per connection count, in rounds of one queue full */
+#define BENCH_INDICATIONS 200000
+/*! Most gateways */
+#define BENCH_MAX_CONNECTIONS 64
+/*! Default MSDU length, a sensor data message with all fields */
+#define BENCH_MSDU_LEN 60
+
+/******************************************************************************
+ Collector side, not part of what is timed
+ *****************************************************************************/
+
+int linux_CONFIG_MAX_DEVICES = CONFIG_MAX_DEVICES_DEFAULT;
+bool linux_CONFIG_FH_ENABLE = CONFIG_FH_ENABLE_DEFAULT;
+bool linux_CONFIG_SECURE = CONFIG_SECURE_DEFAULT;
+int linux_CONFIG_MAC_BEACON_ORDER = CONFIG_MAC_BEACON_ORDER_DEFAULT;
+int linux_CONFIG_MAC_SUPERFRAME_ORDER = CONFIG_MAC_SUPERFRAME_ORDER_DEFAULT;
+
+ApiMac_status_t ApiMac_mlmeDisassociateReq(ApiMac_mlmeDisassociateReq_t *pData)
+{
+    (void)pData;
+    return ApiMac_status_success;
+}
+
+ApiMac_status_t Cllc_setJoinPermit(uint32_t duration)
+{
+    (void)duration;
+    return ApiMac_status_success;
+}
+
+void Collector_init(void)
+{
+}
+
+void Collector_process(void)
+{
+}
+
+uint8_t Csf_sendConfigRequest(ApiMac_sAddr_t *pDstAddr, uint16_t frameControl,
+                              uint32_t reportingInterval,
+                              uint32_t pollingInterval,
+                              const uint32_t *pCorrId, int connId)
+{
+    return Collector_status_invalid_state;
+}
+
+uint8_t Csf_customCommand(ApiMac_sAddr_t *pDstAddr, uint8_t *state,
+                          uint16_t length, const uint32_t *pCorrId,
+                          int connId)
+{
+    return Collector_status_invalid_state;
+}
+
+uint8_t Csf_startConfigRollout(const Collector_rolloutCfg_t *pCfg,
+                               const uint16_t *pShortAddrs, uint16_t n)
+{
+    return Collector_status_invalid_state;
+}
+
+void Csf_getConfigRolloutProgress(Collector_rolloutProgress_t *pProgress)
+{
+    memset(pProgress, 0, sizeof(*pProgress));
+}
+
+uint8_t Csf_getDownlinkQueueStats(uint16_t shortAddr,
+                                  Collector_dlqStats_t *pStats)
+{
+    memset(pStats, 0, sizeof(*pStats));
+    return Collector_status_deviceNotFound;
+}
+
+void Csf_getFragStatistics(Frag_statistics_t *pStats)
+{
+    memset(pStats, 0, sizeof(*pStats));
+}
+
+int Csf_getDeviceInformationList(Csf_deviceInformation_t **ppDeviceInfo)
+{
+    *ppDeviceInfo = NULL;
+    return 0;
+}
+
+void Csf_freeDeviceInformationList(size_t n, Csf_deviceInformation_t *p)
+{
+    (void)n;
+    free(p);
+}
+
+Cllc_states_t Csf_getCllcState(void)
+{
+    return Cllc_states_started;
+}
+
+bool Csf_getDevice(ApiMac_sAddr_t *pDevAddr, Llc_deviceListItem_t *pItem)
+{
+    return false;
+}
+
+bool Csf_getDeviceExtended(uint16_t shortAddr, ApiMac_sAddrExt_t *pExtAddr)
+{
+    return false;
+}
+
+bool Csf_getNetworkInformation(Llc_netInfo_t *pInfo)
+{
+    return false;
+}
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief monotonic time in nanoseconds
+ */
+static uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/*!
+ * @brief a gateway connection with a tx queue and nothing behind it
+ */
+static struct appsrv_connection *benchConnection(int id)
+{
+    struct appsrv_connection *pCONN;
+    char name[32];
+
+    pCONN = calloc(1, sizeof(*pCONN));
+    if(pCONN == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    snprintf(name, sizeof(name), "bench-%d", id);
+    pCONN->dbg_name = strdup(name);
+    pCONN->connection_id = id;
+    /* thread mode, the writer would be woken by txq_sem */
+    pCONN->fd = -1;
+    appsrv_connection_txq_create(pCONN);
+    return pCONN;
+}
+
+/*!
+ * @brief drop whatever the writer threads would have sent
+ */
+static void benchDrain(struct appsrv_conn_set *pSet)
+{
+    struct appsrv_frame *pFrame;
+    int x;
+
+    for(x = 0; x < pSet->n; x++)
+    {
+        while((pFrame = appsrv_connection_dequeue(pSet->ppCONN[x])) != NULL)
+        {
+            appsrv_frame_release(pFrame);
+        }
+    }
+}
+
+/*!
+ * @brief one data indication from a sensor with a short address
+ */
+static void benchDataInd(ApiMac_mcpsDataInd_t *pDataInd, uint8_t *pMsdu,
+                         uint16_t len)
+{
+    memset(pDataInd, 0, sizeof(*pDataInd));
+    memset(pMsdu, 0x5A, len);
+    pMsdu[0] = Smsgs_cmdIds_sensorData;
+    pDataInd->srcAddr.addrMode = ApiMac_addrType_short;
+    pDataInd->srcAddr.addr.shortAddr = 0x0001;
+    pDataInd->rssi = -40;
+    pDataInd->msdu.p = pMsdu;
+    pDataInd->msdu.len = len;
+}
+
+/*!
+ * @brief per indication cost for 1 to BENCH_MAX_CONNECTIONS gateways
+ */
+static void benchFanout(uint16_t msduLen)
+{
+    ApiMac_mcpsDataInd_t dataInd;
+    struct appsrv_conn_set *pSet;
+    uint8_t *pMsdu;
+    uint64_t total;
+    uint64_t start;
+    int perRound;
+    int sent;
+    int n;
+    int x;
+
+    pMsdu = malloc(msduLen);
+    pSet = calloc(1, sizeof(*pSet) +
+                  (BENCH_MAX_CONNECTIONS * sizeof(pSet->ppCONN[0])));
+    if((pMsdu == NULL) || (pSet == NULL))
+    {
+        BUG_HERE("No memory\n");
+    }
+    benchDataInd(&dataInd, pMsdu, msduLen);
+    for(x = 0; x < BENCH_MAX_CONNECTIONS; x++)
+    {
+        pSet->ppCONN[x] = benchConnection(x);
+    }
+    __atomic_store_n(&pConnSet, pSet, __ATOMIC_RELEASE);
+
+    /* fill each queue up to just below the drop point per round */
+    perRound = appsrv_cfg.txq_depth - 1;
+
+    printf("msdu %d bytes, %d indications per row\n", (int)msduLen,
+           BENCH_INDICATIONS);
+    printf("gateways  ns/indication  ns/indication/gateway\n");
+    for(n = 1; n <= BENCH_MAX_CONNECTIONS; n *= 2)
+    {
+        pSet->n = n;
+        total = 0;
+        for(sent = 0; sent < BENCH_INDICATIONS; sent += perRound)
+        {
+            start = benchNowNs();
+            for(x = 0; x < perRound; x++)
+            {
+                appsrv_deviceRawDataUpdate(&dataInd);
+            }
+            total += benchNowNs() - start;
+            benchDrain(pSet);
+        }
+        sent = (sent / perRound) * perRound;
+        printf("%8d  %13.1f  %21.1f\n", n, (double)total / sent,
+               (double)total / sent / n);
+    }
+}
+
+/*!
+ * @brief the old appsrv_deviceRawDataUpdate(), without the sockets
+ * @param pDataInd - the indication
+ * @param nConn - number of gateways
+ * @returns number of bytes copied
+ */
+static uint32_t benchOldPath(ApiMac_mcpsDataInd_t *pDataInd, int nConn)
+{
+    uint16_t bufferLength = pDataInd->msdu.len + sizeof(pDataInd->rssi) + sizeof(ApiMac_sAddr_t);
+    uint8_t buffer[bufferLength];
+    uint32_t copied;
+    uint8_t *pIobuf;
+    uint8_t *pClone;
+    uint8_t *pTx;
+    uint16_t idx;
+    uint16_t i;
+    int x;
+
+    memset(buffer, 0, bufferLength);
+    idx = appsrv_build_rxHead(buffer, pDataInd);
+    memcpy((buffer + idx), pDataInd->msdu.p, pDataInd->msdu.len);
+    copied = idx + pDataInd->msdu.len;
+
+    /* MT_MSG_alloc(), then the byte loop */
+    pIobuf = calloc(1, HEADER_LEN + bufferLength);
+    if(pIobuf == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    for (i = 0; i < bufferLength; i++)
+    {
+        pIobuf[i + HEADER_LEN] = buffer[i];
+    }
+    copied += bufferLength;
+
+    /* appsrv_broadcast(): MT_MSG_clone() and MT_MSG_txrx() per gateway */
+    for(x = 0; x < nConn; x++)
+    {
+        pClone = malloc(HEADER_LEN + bufferLength);
+        pTx = malloc(APPSRV_FRAME_OVERHEAD + bufferLength);
+        if((pClone == NULL) || (pTx == NULL))
+        {
+            BUG_HERE("No memory\n");
+        }
+        memcpy(pClone, pIobuf, HEADER_LEN + bufferLength);
+        memcpy(pTx + APPSRV_FRAME_OVERHEAD - 1, pClone + HEADER_LEN,
+               bufferLength);
+        copied += HEADER_LEN + (2 * bufferLength);
+        /* keep the copies from being optimized out */
+        __asm__ volatile("" : : "r"(pTx) : "memory");
+        free(pTx);
+        free(pClone);
+    }
+    free(pIobuf);
+    return copied;
+}
+
+/*!
+ * @brief bytes copied and time per indication, old path against new
+ */
+static void benchCopy(uint16_t msduLen)
+{
+    uint8_t head[RX_IND_HEAD_MAX];
+    ApiMac_mcpsDataInd_t dataInd;
+    struct appsrv_conn_set *pSet;
+    uint8_t *pMsdu;
+    uint64_t oldNs;
+    uint64_t newNs;
+    uint64_t start;
+    uint32_t oldBytes;
+    uint32_t newBytes;
+    int perRound;
+    int sent;
+    int n;
+    int x;
+
+    pMsdu = malloc(msduLen);
+    pSet = calloc(1, sizeof(*pSet) +
+                  (BENCH_MAX_CONNECTIONS * sizeof(pSet->ppCONN[0])));
+    if((pMsdu == NULL) || (pSet == NULL))
+    {
+        BUG_HERE("No memory\n");
+    }
+    benchDataInd(&dataInd, pMsdu, msduLen);
+    for(x = 0; x < BENCH_MAX_CONNECTIONS; x++)
+    {
+        pSet->ppCONN[x] = benchConnection(x);
+    }
+    __atomic_store_n(&pConnSet, pSet, __ATOMIC_RELEASE);
+    perRound = appsrv_cfg.txq_depth - 1;
+
+    /* the new path writes the head in place and copies the msdu once,
+       the queues take a reference */
+    newBytes = appsrv_build_rxHead(head, &dataInd) + msduLen;
+
+    printf("msdu %d bytes, %d indications per row\n", (int)msduLen,
+           BENCH_INDICATIONS);
+    printf("gateways  old bytes  new bytes  old ns/ind  new ns/ind\n");
+    for(n = 1; n <= BENCH_MAX_CONNECTIONS; n *= 2)
+    {
+        pSet->n = n;
+        oldBytes = 0;
+        oldNs = 0;
+        newNs = 0;
+        for(sent = 0; sent < BENCH_INDICATIONS; sent += perRound)
+        {
+            start = benchNowNs();
+            for(x = 0; x < perRound; x++)
+            {
+                oldBytes = benchOldPath(&dataInd, n);
+            }
+            oldNs += benchNowNs() - start;
+
+            start = benchNowNs();
+            for(x = 0; x < perRound; x++)
+            {
+                appsrv_deviceRawDataUpdate(&dataInd);
+            }
+            newNs += benchNowNs() - start;
+            benchDrain(pSet);
+        }
+        sent = (sent / perRound) * perRound;
+        printf("%8d  %9u  %9u  %10.1f  %10.1f\n", n, oldBytes, newBytes,
+               (double)oldNs / sent, (double)newNs / sent);
+    }
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int msduLen;
+
+    if((argc < 2) || (argc > 3))
+    {
+        fprintf(stderr, "usage: %s fanout|copy [MSDU-LEN]\n", argv[0]);
+        return (1);
+    }
+    msduLen = BENCH_MSDU_LEN;
+    if(argc == 3)
+    {
+        msduLen = atoi(argv[2]);
+    }
+    if((msduLen < 1) || (msduLen > 2047))
+    {
+        fprintf(stderr, "bench_appsrv: MSDU-LEN must be 1..2047\n");
+        return (1);
+    }
+
+    LOG_init("/dev/null");
+    APP_defaults();
+    appsrv_cfg.replay_depth = 0;
+
+    if(strcmp(argv[1], "fanout") == 0)
+    {
+        benchFanout((uint16_t)msduLen);
+        return (0);
+    }
+    if(strcmp(argv[1], "copy") == 0)
+    {
+        benchCopy((uint16_t)msduLen);
+        return (0);
+    }
+    fprintf(stderr, "bench_appsrv: unknown benchmark %s\n", argv[1]);
+    return (1);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -0,0 +1,226 @@
+/******************************************************************************
+
+ @file bench_cllc.c
+
+ @brief Time the association table lookup of cllc.c without a MAC
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/*
+ * Builds cllc.c into a program of its own, the MAC and Csf calls it
+ * makes are stubbed out in bench_cllc_stubs.c, and times
+ * Cllc_findDevice() on tables of 50 to 10000 devices:
+ *
+ *   make bench_cllc
+ *   ./bench_cllc
+ *
+ * The tables are filled the way devices join, through
+ * maintainAssocTable() with the short addresses handed out in sequence.
+ * Each row looks up every device in a scrambled order, then as many
+ * addresses that are not in the table. The last column is the linear
+ * scan Cllc_findDevice() did before the index, for scale.
+ */
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* the statics are what we time */
+#include "cllc.c"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Lookups per row */
+#define BENCH_LOOKUPS 2000000
+
+/******************************************************************************
+ Configuration cllc.c reads, as linux_main.c has it
+ *****************************************************************************/
+
+int linux_FH_NUM_NON_SLEEPY_HOPPING_NEIGHBORS = FH_NUM_NON_SLEEPY_HOPPING_NEIGHBORS_DEFAULT;
+int linux_FH_NUM_NON_SLEEPY_FIXED_CHANNEL_NEIGHBORS = FH_NUM_NON_SLEEPY_FIXED_CHANNEL_NEIGHBORS_DEFAULT;
+int linux_CONFIG_PHY_ID = CONFIG_PHY_ID_DEFAULT;
+int linux_CONFIG_CHANNEL_PAGE = CONFIG_CHANNEL_PAGE_DEFAULT;
+uint8_t linux_CONFIG_FH_CHANNEL_MASK[APIMAC_154G_CHANNEL_BITMAP_SIZ]= CONFIG_FH_CHANNEL_MASK_DEFAULT;
+uint8_t linux_FH_ASYNC_CHANNEL_MASK[APIMAC_154G_CHANNEL_BITMAP_SIZ] = FH_ASYNC_CHANNEL_MASK_DEFAULT;
+uint8_t linux_CONFIG_SCAN_DURATION = CONFIG_SCAN_DURATION_DEFAULT;
+char linux_CONFIG_FH_NETNAME[32] = CONFIG_FH_NETNAME_DEFAULT;
+int linux_CONFIG_DWELL_TIME = CONFIG_DWELL_TIME_DEFAULT;
+int linux_FH_BROADCAST_INTERVAL = FH_BROADCAST_INTERVAL_DEFAULT;
+int linux_FH_BROADCAST_DWELL_TIME = FH_BROADCAST_DWELL_TIME_DEFAULT;
+int linux_CONFIG_TRICKLE_MIN_CLK_DURATION = CONFIG_TRICKLE_MIN_CLK_DURATION_DEFAULT;
+int linux_CONFIG_TRICKLE_MAX_CLK_DURATION = CONFIG_TRICKLE_MAX_CLK_DURATION_DEFAULT;
+bool linux_CONFIG_DOUBLE_TRICKLE_TIMER = CONFIG_DOUBLE_TRICKLE_TIMER_DEFAULT;
+bool linux_CONFIG_SECURE = CONFIG_SECURE_DEFAULT;
+int  linux_CONFIG_PAN_ID = CONFIG_PAN_ID_DEFAULT;
+bool linux_CONFIG_FH_ENABLE = CONFIG_FH_ENABLE_DEFAULT;
+int  linux_CONFIG_MAC_BEACON_ORDER = CONFIG_MAC_BEACON_ORDER_DEFAULT;
+int  linux_CONFIG_MAC_SUPERFRAME_ORDER = CONFIG_MAC_SUPERFRAME_ORDER_DEFAULT;
+int linux_CONFIG_MAX_DEVICES = CONFIG_MAX_DEVICES_DEFAULT;
+
+/******************************************************************************
+ Local Variables
+ *****************************************************************************/
+
+/*! Table sizes, one row each */
+static const int benchSizes[] = { 50, 100, 500, 1000, 5000, 10000 };
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief monotonic time in nanoseconds
+ */
+static uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/*!
+ * @brief the lookup before the index: walk the whole table
+ */
+static Cllc_associated_devices_t *benchScan(uint16_t shortAddr)
+{
+    int x;
+
+    for(x = 0; (x < CONFIG_MAX_DEVICES); x++)
+    {
+        if(shortAddr == Cllc_associatedDevList[x].shortAddr)
+        {
+            return (&Cllc_associatedDevList[x]);
+        }
+    }
+    return (NULL);
+}
+
+/*!
+ * @brief a fresh table of nDevices joined devices
+ */
+static void benchFill(int nDevices)
+{
+    ApiMac_deviceDescriptor_t devInfo;
+    ApiMac_capabilityInfo_t capInfo;
+    int x;
+
+    free(Cllc_associatedDevList);
+    Cllc_associatedDevList = NULL;
+    Cllc_numOfDevices = 0;
+
+    CONFIG_MAX_DEVICES = nDevices;
+    allocAssocTable();
+    memset(Cllc_associatedDevList, 0xFF,
+           (sizeof(Cllc_associated_devices_t) * CONFIG_MAX_DEVICES));
+    memset(assocIndex, 0, (assocIndexMask + 1) * sizeof(uint16_t));
+
+    memset(&devInfo, 0, sizeof(devInfo));
+    memset(&capInfo, 0, sizeof(capInfo));
+    for(x = 0; x < nDevices; x++)
+    {
+        devInfo.shortAddress = Cllc_numOfDevices +
+                               CLLC_ASSOC_DEVICE_STARTING_NUMBER;
+        maintainAssocTable(&devInfo, &capInfo, 1, 0, false);
+    }
+}
+
+/*!
+ * @brief lookups in a scrambled order, hits or misses
+ * @param nDevices - devices in the table
+ * @param miss - look up addresses above the last one handed out
+ * @param scan - use benchScan() instead of Cllc_findDevice()
+ * @param nLookups - how many
+ * @returns nanoseconds per lookup
+ */
+static double benchLookups(int nDevices, bool miss, bool scan, int nLookups)
+{
+    Cllc_associated_devices_t *pItem;
+    uint64_t start;
+    uint32_t seed;
+    uint16_t shortAddr;
+    int found;
+    int x;
+
+    seed = 1;
+    found = 0;
+    start = benchNowNs();
+    for(x = 0; x < nLookups; x++)
+    {
+        seed = (seed * 1103515245) + 12345;
+        shortAddr = (uint16_t)(CLLC_ASSOC_DEVICE_STARTING_NUMBER +
+                               ((seed >> 8) % nDevices));
+        if(miss)
+        {
+            shortAddr += nDevices;
+        }
+        pItem = scan ? benchScan(shortAddr) : Cllc_findDevice(shortAddr);
+        found += (pItem != NULL);
+    }
+    start = benchNowNs() - start;
+
+    if(found != (miss ? 0 : nLookups))
+    {
+        fprintf(stderr, "bench_cllc: %d of %d found\n", found, nLookups);
+        exit(1);
+    }
+    return ((double)start / nLookups);
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int nScan;
+    int n;
+    int x;
+
+    (void)argc;
+    (void)argv;
+
+    printf("devices  ns/hit  ns/miss  ns/scan-hit\n");
+    for(x = 0; x < (int)(sizeof(benchSizes) / sizeof(benchSizes[0])); x++)
+    {
+        n = benchSizes[x];
+        benchFill(n);
+        /* the scan is slow, fewer of those */
+        nScan = BENCH_LOOKUPS / n;
+        printf("%7d  %6.1f  %7.1f  %11.1f\n", n,
+               benchLookups(n, false, false, BENCH_LOOKUPS),
+               benchLookups(n, true, false, BENCH_LOOKUPS),
+               benchLookups(n, false, true, nScan));
+    }
+    return (0);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
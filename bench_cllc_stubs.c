@@ -0,0 +1,280 @@
+/******************************************************************************
+
+ @file bench_cllc_stubs.c
+
+ @brief The MAC and Csf calls of cllc.c, for bench_cllc
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/*
+ * bench_cllc only fills the association table and looks devices up,
+ * none of these are reached. They are here so cllc.c links without the
+ * MAC library and the rest of the collector. This file includes none of
+ * the headers that declare them, the real prototypes do not matter to
+ * the linker; reaching one anyway is a bug in the benchmark.
+ */
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief a stub was called after all
+ */
+static void bench_cllc_stub(const char *pName)
+{
+    fprintf(stderr, "bench_cllc: %s() is only a stub\n", pName);
+    abort();
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+void ApiMac_freeIEList(void)
+{
+    bench_cllc_stub("ApiMac_freeIEList");
+}
+
+void ApiMac_init(void)
+{
+    bench_cllc_stub("ApiMac_init");
+}
+
+void ApiMac_mlmeAssociateRsp(void)
+{
+    bench_cllc_stub("ApiMac_mlmeAssociateRsp");
+}
+
+void ApiMac_mlmeDisassociateReq(void)
+{
+    bench_cllc_stub("ApiMac_mlmeDisassociateReq");
+}
+
+void ApiMac_mlmeGetReqArray(void)
+{
+    bench_cllc_stub("ApiMac_mlmeGetReqArray");
+}
+
+void ApiMac_mlmeGetReqUint16(void)
+{
+    bench_cllc_stub("ApiMac_mlmeGetReqUint16");
+}
+
+void ApiMac_mlmeGetReqUint8(void)
+{
+    bench_cllc_stub("ApiMac_mlmeGetReqUint8");
+}
+
+void ApiMac_mlmeOrphanRsp(void)
+{
+    bench_cllc_stub("ApiMac_mlmeOrphanRsp");
+}
+
+void ApiMac_mlmeScanReq(void)
+{
+    bench_cllc_stub("ApiMac_mlmeScanReq");
+}
+
+void ApiMac_mlmeSetFhReqArray(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetFhReqArray");
+}
+
+void ApiMac_mlmeSetFhReqUint16(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetFhReqUint16");
+}
+
+void ApiMac_mlmeSetFhReqUint32(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetFhReqUint32");
+}
+
+void ApiMac_mlmeSetFhReqUint8(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetFhReqUint8");
+}
+
+void ApiMac_mlmeSetReqArray(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetReqArray");
+}
+
+void ApiMac_mlmeSetReqBool(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetReqBool");
+}
+
+void ApiMac_mlmeSetReqUint16(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetReqUint16");
+}
+
+void ApiMac_mlmeSetSecurityReqArray(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetSecurityReqArray");
+}
+
+void ApiMac_mlmeSetSecurityReqStruct(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetSecurityReqStruct");
+}
+
+void ApiMac_mlmeSetSecurityReqUint16(void)
+{
+    bench_cllc_stub("ApiMac_mlmeSetSecurityReqUint16");
+}
+
+void ApiMac_mlmeStartReq(void)
+{
+    bench_cllc_stub("ApiMac_mlmeStartReq");
+}
+
+void ApiMac_mlmeWSAsyncReq(void)
+{
+    bench_cllc_stub("ApiMac_mlmeWSAsyncReq");
+}
+
+void ApiMac_parsePayloadGroupIEs(void)
+{
+    bench_cllc_stub("ApiMac_parsePayloadGroupIEs");
+}
+
+void ApiMac_parsePayloadSubIEs(void)
+{
+    bench_cllc_stub("ApiMac_parsePayloadSubIEs");
+}
+
+void ApiMac_secAddDevice(void)
+{
+    bench_cllc_stub("ApiMac_secAddDevice");
+}
+
+void ApiMac_secAddKeyInitFrameCounter(void)
+{
+    bench_cllc_stub("ApiMac_secAddKeyInitFrameCounter");
+}
+
+void ApiMac_secDeleteDevice(void)
+{
+    bench_cllc_stub("ApiMac_secDeleteDevice");
+}
+
+void ApiMac_srcMatchEnable(void)
+{
+    bench_cllc_stub("ApiMac_srcMatchEnable");
+}
+
+void ApiMac_startFH(void)
+{
+    bench_cllc_stub("ApiMac_startFH");
+}
+
+void CLLC_LINUX_init(void)
+{
+    bench_cllc_stub("CLLC_LINUX_init");
+}
+
+void Csf_deviceDisassocUpdate(void)
+{
+    bench_cllc_stub("Csf_deviceDisassocUpdate");
+}
+
+void Csf_free(void)
+{
+    bench_cllc_stub("Csf_free");
+}
+
+void Csf_getDevice(void)
+{
+    bench_cllc_stub("Csf_getDevice");
+}
+
+void Csf_getDeviceExtAdd(void)
+{
+    bench_cllc_stub("Csf_getDeviceExtAdd");
+}
+
+void Csf_getDeviceShort(void)
+{
+    bench_cllc_stub("Csf_getDeviceShort");
+}
+
+void Csf_getNetworkInformation(void)
+{
+    bench_cllc_stub("Csf_getNetworkInformation");
+}
+
+void Csf_getNextDeviceItem(void)
+{
+    bench_cllc_stub("Csf_getNextDeviceItem");
+}
+
+void Csf_initializeTrickleClock(void)
+{
+    bench_cllc_stub("Csf_initializeTrickleClock");
+}
+
+void Csf_malloc(void)
+{
+    bench_cllc_stub("Csf_malloc");
+}
+
+void Csf_processCoPReset(void)
+{
+    bench_cllc_stub("Csf_processCoPReset");
+}
+
+void Csf_removeDeviceListItem(void)
+{
+    bench_cllc_stub("Csf_removeDeviceListItem");
+}
+
+void Csf_restoreMacAttributes(void)
+{
+    bench_cllc_stub("Csf_restoreMacAttributes");
+}
+
+void Csf_setJoinPermitClock(void)
+{
+    bench_cllc_stub("Csf_setJoinPermitClock");
+}
+
+void Csf_setTrickleClock(void)
+{
+    bench_cllc_stub("Csf_setTrickleClock");
+}
+
+void Csf_updateFrameCounter(void)
+{
+    bench_cllc_stub("Csf_updateFrameCounter");
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -0,0 +1,322 @@
+/******************************************************************************
+
+ @file bench_nv_mmap.c
+
+ @brief Time the nv_mmap driver on the items of a large network
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/*
+ * Writes, reads and rewrites the device list items of networks of 100
+ * to 10000 devices through the NVINTF table of nv_mmap.c, then times a
+ * restore: opening the log (the scan that builds the index) and reading
+ * every device back, as the collector does at start:
+ *
+ *   make bench_nv_mmap
+ *   ./bench_nv_mmap /tmp/bench-nv.log [LOG-SIZE]
+ *
+ * The driver is opened once per process, so each network is written in
+ * one child process and restored in another. The log file is replaced
+ * for every network and removed at the end. LOG-SIZE defaults to 16 MB,
+ * enough that no compaction runs in the middle of a row.
+ */
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "nvintf.h"
+#include "nv_mmap.h"
+#include "log.h"
+#include "api_mac.h"
+#include "llc.h"
+#include "csf.h"
+#include "csf_linux.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Default log size */
+#define BENCH_LOG_SIZE (16 * 1024 * 1024)
+/*! PAN of the synthetic network */
+#define BENCH_PAN_ID 0xACDC
+
+/*! What a child reports, nanoseconds */
+typedef struct
+{
+    uint64_t writeNs;
+    uint64_t readNs;
+    uint64_t updateNs;
+    uint64_t openNs;
+    uint64_t restoreNs;
+    int failed;
+} benchResult_t;
+
+/******************************************************************************
+ Local Variables
+ *****************************************************************************/
+
+/*! Network sizes, one row each */
+static const int benchSizes[] = { 100, 1000, 5000, 10000 };
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief monotonic time in nanoseconds
+ */
+static uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/*!
+ * @brief the id of a device list item
+ */
+static NVINTF_itemID_t benchId(uint16_t itemID, uint16_t subID)
+{
+    NVINTF_itemID_t id;
+
+    id.systemID = NVINTF_SYSID_APP;
+    id.itemID = itemID;
+    id.subID = subID;
+    return (id);
+}
+
+/*!
+ * @brief the device list item of device x
+ */
+static void benchItem(Llc_deviceListItem_t *pItem, int x)
+{
+    memset(pItem, 0, sizeof(*pItem));
+    pItem->devInfo.panID = BENCH_PAN_ID;
+    pItem->devInfo.shortAddress = (uint16_t)(1 + x);
+    pItem->devInfo.extAddress[0] = (uint8_t)(x & 0xFF);
+    pItem->devInfo.extAddress[1] = (uint8_t)((x >> 8) & 0xFF);
+    pItem->devInfo.extAddress[6] = 0x4B;
+    pItem->devInfo.extAddress[7] = 0x12;
+    pItem->capInfo.rxOnWhenIdle = false;
+}
+
+/*!
+ * @brief child: a fresh log with n devices, written, read and updated
+ */
+static void benchWrite(const char *pPath, int n, benchResult_t *pRes)
+{
+    NVINTF_nvFuncts_t nv;
+    Llc_deviceListItem_t item;
+    uint16_t numDevices;
+    uint64_t start;
+    int x;
+
+    unlink(pPath);
+    NVMMAP_loadApiPtrs(&nv);
+    if(nv.initNV((void *)pPath) != NVINTF_SUCCESS)
+    {
+        pRes->failed++;
+        return;
+    }
+
+    start = benchNowNs();
+    for(x = 0; x < n; x++)
+    {
+        benchItem(&item, x);
+        if(nv.writeItem(benchId(CSF_NV_DEVICELIST_ID, (uint16_t)x),
+                        sizeof(item), &item) != NVINTF_SUCCESS)
+        {
+            pRes->failed++;
+        }
+    }
+    pRes->writeNs = benchNowNs() - start;
+    numDevices = (uint16_t)n;
+    if(nv.writeItem(benchId(CSF_NV_DEVICELIST_ENTRIES_ID, 0),
+                    sizeof(numDevices), &numDevices) != NVINTF_SUCCESS)
+    {
+        pRes->failed++;
+    }
+
+    start = benchNowNs();
+    for(x = 0; x < n; x++)
+    {
+        if(nv.readItem(benchId(CSF_NV_DEVICELIST_ID, (uint16_t)x), 0,
+                       sizeof(item), &item) != NVINTF_SUCCESS)
+        {
+            pRes->failed++;
+        }
+    }
+    pRes->readNs = benchNowNs() - start;
+
+    /* what a frame counter update does to every device */
+    start = benchNowNs();
+    for(x = 0; x < n; x++)
+    {
+        benchItem(&item, x);
+        item.rxFrameCounter = 1;
+        if(nv.writeItem(benchId(CSF_NV_DEVICELIST_ID, (uint16_t)x),
+                        sizeof(item), &item) != NVINTF_SUCCESS)
+        {
+            pRes->failed++;
+        }
+    }
+    pRes->updateNs = benchNowNs() - start;
+}
+
+/*!
+ * @brief child: open the log left by benchWrite() and read it all back
+ */
+static void benchRestore(const char *pPath, int n, benchResult_t *pRes)
+{
+    NVINTF_nvFuncts_t nv;
+    Llc_deviceListItem_t item;
+    uint16_t numDevices;
+    uint64_t start;
+    int x;
+
+    NVMMAP_loadApiPtrs(&nv);
+    start = benchNowNs();
+    if(nv.initNV((void *)pPath) != NVINTF_SUCCESS)
+    {
+        pRes->failed++;
+        return;
+    }
+    pRes->openNs = benchNowNs() - start;
+
+    numDevices = 0;
+    if((nv.readItem(benchId(CSF_NV_DEVICELIST_ENTRIES_ID, 0), 0,
+                    sizeof(numDevices), &numDevices) != NVINTF_SUCCESS) ||
+       (numDevices != n))
+    {
+        pRes->failed++;
+    }
+    for(x = 0; x < numDevices; x++)
+    {
+        if((nv.readItem(benchId(CSF_NV_DEVICELIST_ID, (uint16_t)x), 0,
+                        sizeof(item), &item) != NVINTF_SUCCESS) ||
+           (item.rxFrameCounter != 1))
+        {
+            pRes->failed++;
+        }
+    }
+    pRes->restoreNs = benchNowNs() - start;
+}
+
+/*!
+ * @brief run one of the above in a child process
+ */
+static void benchChild(void (*pFxn)(const char *, int, benchResult_t *),
+                       const char *pPath, int n, benchResult_t *pRes)
+{
+    int fds[2];
+    pid_t pid;
+
+    if(pipe(fds) != 0)
+    {
+        perror("bench_nv_mmap: pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid = fork();
+    if(pid < 0)
+    {
+        perror("bench_nv_mmap: fork");
+        exit(1);
+    }
+    if(pid == 0)
+    {
+        close(fds[0]);
+        (*pFxn)(pPath, n, pRes);
+        if(write(fds[1], pRes, sizeof(*pRes)) != sizeof(*pRes))
+        {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    if(read(fds[0], pRes, sizeof(*pRes)) != sizeof(*pRes))
+    {
+        pRes->failed++;
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    benchResult_t res;
+    int n;
+    int x;
+
+    if((argc < 2) || (argc > 3))
+    {
+        fprintf(stderr, "usage: %s NV-LOG-FILE [LOG-SIZE]\n", argv[0]);
+        return (1);
+    }
+    NVMMAP_fileSize = BENCH_LOG_SIZE;
+    if(argc == 3)
+    {
+        NVMMAP_fileSize = (uint32_t)strtoul(argv[2], NULL, 0);
+    }
+
+    LOG_init("/dev/stderr");
+
+    printf("devices  write ns/item  read ns/item  update ns/item"
+           "  open ms  restore ms\n");
+    for(x = 0; x < (int)(sizeof(benchSizes) / sizeof(benchSizes[0])); x++)
+    {
+        n = benchSizes[x];
+        memset(&res, 0, sizeof(res));
+        benchChild(benchWrite, argv[1], n, &res);
+        benchChild(benchRestore, argv[1], n, &res);
+        if(res.failed)
+        {
+            fprintf(stderr, "bench_nv_mmap: %d failures with %d devices\n",
+                    res.failed, n);
+            unlink(argv[1]);
+            return (1);
+        }
+        printf("%7d  %13.1f  %12.1f  %14.1f  %7.2f  %10.2f\n", n,
+               (double)res.writeNs / n, (double)res.readNs / n,
+               (double)res.updateNs / n, res.openNs / 1e6,
+               res.restoreNs / 1e6);
+    }
+    unlink(argv[1]);
+    return (0);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -0,0 +1,195 @@
+/******************************************************************************
+
+ @file bench_sensor_decode.c
+
+ @brief Time SensorDecode_decode() on synthetic sensor data messages
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/*
+ * sensor_decode.c needs nothing from the stack, this links it alone:
+ *
+ *   make bench_sensor_decode
+ *   ./bench_sensor_decode
+ *
+ * Three message mixes: the default sensor (temperature, light and
+ * humidity), every fixed field, and all frame control combinations of
+ * the fixed fields in turn. Each message is exactly as long as its
+ * frame control says, the length is what the decoder reports.
+ */
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_decode.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Decodes per mix */
+#define BENCH_DECODES 20000000
+/*! Room for the header and every fixed field */
+#define BENCH_MSG_MAX 128
+/*! Frame control combinations of the fixed fields */
+#define BENCH_MASKS (1 << SENSOR_DECODE_FIELDS)
+
+/*! One message on the air */
+typedef struct
+{
+    uint16_t len;
+    uint8_t buf[BENCH_MSG_MAX];
+} benchMsg_t;
+
+/******************************************************************************
+ Local Variables
+ *****************************************************************************/
+
+/*! One message per fixed field combination */
+static benchMsg_t benchMsgs[BENCH_MASKS];
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief monotonic time in nanoseconds
+ */
+static uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+/*!
+ * @brief a message with the given fixed fields, trimmed to its length
+ */
+static void benchBuild(benchMsg_t *pMsg, uint16_t frameControl)
+{
+    Smsgs_sensorMsg_t sensor;
+    uint16_t varOffset;
+    int x;
+
+    for(x = 0; x < BENCH_MSG_MAX; x++)
+    {
+        pMsg->buf[x] = (uint8_t)(x * 7);
+    }
+    pMsg->buf[0] = Smsgs_cmdIds_sensorData;
+    pMsg->buf[1 + SMGS_SENSOR_EXTADDR_LEN] = (uint8_t)(frameControl & 0xFF);
+    pMsg->buf[2 + SMGS_SENSOR_EXTADDR_LEN] = (uint8_t)(frameControl >> 8);
+
+    if(SensorDecode_decode(pMsg->buf, BENCH_MSG_MAX, &sensor, &varOffset) !=
+       SensorDecode_status_success)
+    {
+        fprintf(stderr, "bench_sensor_decode: BENCH_MSG_MAX too small\n");
+        exit(1);
+    }
+    pMsg->len = varOffset;
+}
+
+/*!
+ * @brief decode messages first..first+count-1 in turn
+ * @returns nanoseconds per message
+ */
+static double benchDecode(int first, int count)
+{
+    Smsgs_sensorMsg_t sensor;
+    benchMsg_t *pMsg;
+    uint64_t start;
+    uint32_t sum;
+    int failed;
+    int x;
+
+    sum = 0;
+    failed = 0;
+    start = benchNowNs();
+    for(x = 0; x < BENCH_DECODES; x++)
+    {
+        pMsg = &benchMsgs[first + (x % count)];
+        if(SensorDecode_decode(pMsg->buf, pMsg->len, &sensor, NULL) !=
+           SensorDecode_status_success)
+        {
+            failed++;
+        }
+        sum += sensor.tempSensor.temp + sensor.humiditySensor.humidity;
+    }
+    start = benchNowNs() - start;
+
+    if(failed)
+    {
+        fprintf(stderr, "bench_sensor_decode: %d failed\n", failed);
+        exit(1);
+    }
+    /* keep the decode from being optimized out */
+    __asm__ volatile("" : : "r"(sum));
+    return ((double)start / BENCH_DECODES);
+}
+
+/*!
+ * @brief one line of the report
+ */
+static void benchReport(const char *pName, int first, int count)
+{
+    double ns;
+
+    ns = benchDecode(first, count);
+    printf("%-22s %3d bytes  %6.1f ns  %12.0f msgs/s\n", pName,
+           benchMsgs[first + count - 1].len, ns, 1e9 / ns);
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int x;
+
+    (void)argc;
+    (void)argv;
+
+    SensorDecode_init();
+    for(x = 0; x < BENCH_MASKS; x++)
+    {
+        benchBuild(&benchMsgs[x], (uint16_t)x);
+    }
+
+    printf("%d decodes per mix, length of the longest message\n",
+           BENCH_DECODES);
+    benchReport("temp+light+humidity", Smsgs_dataFields_tempSensor |
+                Smsgs_dataFields_lightSensor |
+                Smsgs_dataFields_humiditySensor, 1);
+    benchReport("all fixed fields", SENSOR_DECODE_FIXED_MASK, 1);
+    benchReport("every combination", 0, BENCH_MASKS);
+    return (0);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -24,8 +24,10 @@
 #include "csf.h"
 #include "mac_util.h"
 #ifdef __unix__
+#include <stdlib.h>
 #include "csf_linux.h"
 #include "cllc_linux.h"
+#include "fatal.h"
 #endif
 #ifdef FEATURE_SECURE_COMMISSIONING
 #ifdef USE_DMM
@@ -101,6 +103,9 @@
 /*! percent filter */
 #define CONFIG_PERCENTFILTER              0xFF
 
+/*! Alignment of the association table and its index */
+#define CLLC_CACHE_LINE                   64
+
 /******************************************************************************
  Security constants and definitions
  *****************************************************************************/
@@ -141,7 +146,7 @@ typedef struct
 /* Task pending events */
 uint16_t Cllc_events = 0;
 /* Association table */
-Cllc_associated_devices_t Cllc_associatedDevList[CONFIG_MAX_DEVICES];
+Cllc_associated_devices_t *Cllc_associatedDevList = NULL;
 Cllc_statistics_t Cllc_statistics;
 
 /**
@@ -183,6 +188,14 @@ STATIC uint8_t chanMask[APIMAC_154G_CHANNEL_BITMAP_SIZ];
 STATIC panDescList_t *pPANDesclist = NULL;
 /* number of devices associated with the coordinator */
 STATIC uint16_t Cllc_numOfDevices = 0;
+/*
+ * Open addressing (linear probing) index from short address to
+ * Cllc_associatedDevList, holds the table slot + 1, 0 is empty.
+ * A power of two at least twice CONFIG_MAX_DEVICES buckets, so
+ * probe runs stay short.
+ */
+STATIC uint16_t *assocIndex = NULL;
+STATIC int assocIndexMask;
 /* copy of MAC API callbacks */
 STATIC ApiMac_callbacks_t macCallbacksCopy = { 0 };
 /* copy of CLLC callbacks */
@@ -320,6 +333,12 @@ static void maintainAssocTable(ApiMac_deviceDescriptor_t *pDevInfo,
                                bool mode);
 static void configureStartParam(uint8_t channel);
 
+/* Association table index */
+static void allocAssocTable(void);
+static int assocIndexFind(uint16_t shortAddr);
+static void assocIndexInsert(int slot);
+static void assocIndexRemove(int slot);
+
 /* PAN decriptor list management functions */
 static void addToPANList(ApiMac_panDesc_t *pData);
 static void clearPANList(void);
@@ -391,8 +410,10 @@ void Cllc_init(ApiMac_callbacks_t *pMacCbs, Cllc_callbacks_t *pCllcCbs)
     }
 
     /* initialize association table */
+    allocAssocTable();
     memset(Cllc_associatedDevList, 0xFF,
            (sizeof(Cllc_associated_devices_t) * CONFIG_MAX_DEVICES));
+    memset(assocIndex, 0, (assocIndexMask + 1) * sizeof(uint16_t));
 
     ApiMac_mlmeSetReqBool(ApiMac_attribute_RxOnWhenIdle,true);
 
@@ -801,10 +822,15 @@ void Cllc_restoreNetwork(Llc_netInfo_t *pNetworkInfo, uint16_t numDevices,
     else
     {
         Llc_deviceListItem_t item;
-        /* repopulate association table */
+        int cursor = CSF_DEVICE_ITER_START;
+        /* repopulate association table, one pass over the device list */
         for(i = 0; i < numDevices; i++)
         {
-            Csf_getDeviceItem(i, &item);
+            cursor = Csf_getNextDeviceItem(cursor, &item);
+            if(cursor < 0)
+            {
+                break;
+            }
 #ifdef FEATURE_MAC_SECURITY
             /* Add device to security device table */
             Cllc_addSecDevice(item.devInfo.panID,
@@ -868,50 +894,49 @@ ApiMac_status_t Cllc_setJoinPermit(uint32_t duration)
  */
 void Cllc_removeDevice(ApiMac_sAddrExt_t *pExtAddr)
 {
-    int8_t i = 0;
+    int i;
     uint16_t shortAddr = Csf_getDeviceShort(pExtAddr);
 
     if(shortAddr != CSF_INVALID_SHORT_ADDR)
     {
-        for(i = 0; i < CONFIG_MAX_DEVICES; i++)
+        i = assocIndexFind(shortAddr);
+        if(i >= 0)
         {
-            if(Cllc_associatedDevList[i].shortAddr == shortAddr)
-            {
 #ifdef FEATURE_MAC_SECURITY
-                /* Delete the device from the key table */
-                ApiMac_secDeleteDevice(pExtAddr);
+            /* Delete the device from the key table */
+            ApiMac_secDeleteDevice(pExtAddr);
 #endif
 
 #ifdef FEATURE_SECURE_COMMISSIONING
-                if (SM_Current_State == SM_CM_InProgress)
-                {
-                   SM_stopCMProcess();
-                   return;
-                }
-                else
-                {
-                  SM_removeEntryFromSeedKeyTable(pExtAddr);
-                }
-#endif /* FEATURE_SECURE_COMMISSIONING */
-                /* Clear the entry - delete */
-                memset(&Cllc_associatedDevList[i], 0xFF,
-                       sizeof(Cllc_associated_devices_t));
-                /* remove from NV */
-                Csf_removeDeviceListItem(pExtAddr);
-
-                /* update CUI */
-                #ifndef __unix__
-                Csf_deviceDisassocUpdate(shortAddr);
-                #else
-                ApiMac_sAddr_t sAddr;
-                sAddr.addr.shortAddr = shortAddr;
-                sAddr.addrMode = ApiMac_addrType_short;
-
-                Csf_deviceDisassocUpdate(&sAddr);
-                #endif
-                /* The corresponding device is removed, return from the function call */
-                return;
+            if (SM_Current_State == SM_CM_InProgress)
+            {
+               SM_stopCMProcess();
+               return;
+            }
+            else
+            {
+              SM_removeEntryFromSeedKeyTable(pExtAddr);
             }
+#endif /* FEATURE_SECURE_COMMISSIONING */
+            /* Clear the entry - delete */
+            assocIndexRemove(i);
+            memset(&Cllc_associatedDevList[i], 0xFF,
+                   sizeof(Cllc_associated_devices_t));
+            /* remove from NV */
+            Csf_removeDeviceListItem(pExtAddr);
+
+            /* update CUI */
+            #ifndef __unix__
+            Csf_deviceDisassocUpdate(shortAddr);
+            #else
+            ApiMac_sAddr_t sAddr;
+            sAddr.addr.shortAddr = shortAddr;
+            sAddr.addrMode = ApiMac_addrType_short;
+
+            Csf_deviceDisassocUpdate(&sAddr);
+            #endif
+            /* The corresponding device is removed, return from the function call */
+            return;
         }
     }
 }
@@ -1090,15 +1115,25 @@ Cllc_associated_devices_t *Cllc_findDevice(uint16_t shortAddr)
 {
     int x;
 
-    for(x = 0; (x < CONFIG_MAX_DEVICES); x++)
+    /* Empty slots are not indexed, look for one the slow way */
+    if(shortAddr == CSF_INVALID_SHORT_ADDR)
     {
-        /* Make sure the entry is valid. */
-        if(shortAddr == Cllc_associatedDevList[x].shortAddr)
+        for(x = 0; (x < CONFIG_MAX_DEVICES); x++)
         {
-            return (&Cllc_associatedDevList[x]);
+            if(shortAddr == Cllc_associatedDevList[x].shortAddr)
+            {
+                return (&Cllc_associatedDevList[x]);
+            }
         }
+        return (NULL);
+    }
+
+    x = assocIndexFind(shortAddr);
+    if(x < 0)
+    {
+        return (NULL);
     }
-    return (NULL);
+    return (&Cllc_associatedDevList[x]);
 }
 
 /******************************************************************************
@@ -1622,6 +1657,8 @@ static void maintainAssocTable(ApiMac_deviceDescriptor_t *pDevInfo,
             memcpy(&pItem->capInfo, pCapInfo, sizeof(ApiMac_capabilityInfo_t));
             pItem->rssi = rssi;
             pItem->status = status;
+            pItem->pollingInterval = 0;
+            assocIndexInsert(pItem - Cllc_associatedDevList);
         }
     }
     else if(mode == true)
@@ -1641,6 +1678,145 @@ static void maintainAssocTable(ApiMac_deviceDescriptor_t *pDevInfo,
     }
 }
 
+
+/*!
+ * @brief       Allocate the association table and its index, once
+ *
+ * Sized from CONFIG_MAX_DEVICES (config-max-devices in the ini file).
+ * Both live in one cache line aligned block, the index starts on its
+ * own cache line right behind the table.
+ */
+static void allocAssocTable(void)
+{
+    size_t tableSize;
+    int indexSize;
+    void *pBlock;
+
+    if(Cllc_associatedDevList != NULL)
+    {
+        return;
+    }
+
+    indexSize = 1;
+    while(indexSize < (2 * CONFIG_MAX_DEVICES))
+    {
+        indexSize <<= 1;
+    }
+    tableSize = sizeof(Cllc_associated_devices_t) * CONFIG_MAX_DEVICES;
+    tableSize = (tableSize + CLLC_CACHE_LINE - 1) &
+                ~((size_t)CLLC_CACHE_LINE - 1);
+
+    if(posix_memalign(&pBlock, CLLC_CACHE_LINE,
+                      tableSize + (indexSize * sizeof(uint16_t))) != 0)
+    {
+        BUG_HERE("No memory for the association table\n");
+    }
+    Cllc_associatedDevList = (Cllc_associated_devices_t *)pBlock;
+    assocIndex = (uint16_t *)((uint8_t *)pBlock + tableSize);
+    assocIndexMask = indexSize - 1;
+}
+
+/*!
+ * @brief       Home bucket of a short address in the association index
+ *
+ * @param       shortAddr - device's short address
+ *
+ * @return      bucket
+ */
+static int assocIndexHome(uint16_t shortAddr)
+{
+    /* Addresses are handed out in sequence, the low bits spread them */
+    return (shortAddr & assocIndexMask);
+}
+
+/*!
+ * @brief       Look up a short address in the association index
+ *
+ * @param       shortAddr - device's short address
+ *
+ * @return      Cllc_associatedDevList slot, -1 if not found
+ */
+static int assocIndexFind(uint16_t shortAddr)
+{
+    int h;
+    uint16_t slot;
+
+    /* the index is never more than half full, so this ends */
+    for(h = assocIndexHome(shortAddr); (slot = assocIndex[h]) != 0;
+        h = (h + 1) & assocIndexMask)
+    {
+        if(Cllc_associatedDevList[slot - 1].shortAddr == shortAddr)
+        {
+            return (slot - 1);
+        }
+    }
+    return (-1);
+}
+
+/*!
+ * @brief       Add a table slot to the association index
+ *
+ * @param       slot - Cllc_associatedDevList slot, its shortAddr is set
+ */
+static void assocIndexInsert(int slot)
+{
+    uint16_t shortAddr = Cllc_associatedDevList[slot].shortAddr;
+    int h;
+    uint16_t cur;
+
+    for(h = assocIndexHome(shortAddr); (cur = assocIndex[h]) != 0;
+        h = (h + 1) & assocIndexMask)
+    {
+        /* same address in another slot, the newest entry wins */
+        if(Cllc_associatedDevList[cur - 1].shortAddr == shortAddr)
+        {
+            break;
+        }
+    }
+    assocIndex[h] = (uint16_t)(slot + 1);
+}
+
+/*!
+ * @brief       Remove a table slot from the association index
+ *
+ * @param       slot - Cllc_associatedDevList slot, still holding its
+ *                     shortAddr
+ */
+static void assocIndexRemove(int slot)
+{
+    int hole;
+    int h;
+    int home;
+    uint16_t cur;
+
+    for(hole = assocIndexHome(Cllc_associatedDevList[slot].shortAddr);
+        (cur = assocIndex[hole]) != (uint16_t)(slot + 1);
+        hole = (hole + 1) & assocIndexMask)
+    {
+        if(cur == 0)
+        {
+            /* not indexed */
+            return;
+        }
+    }
+    assocIndex[hole] = 0;
+
+    /* Shift the rest of the probe run back, no tombstones needed */
+    for(h = (hole + 1) & assocIndexMask; (cur = assocIndex[h]) != 0;
+        h = (h + 1) & assocIndexMask)
+    {
+        home = assocIndexHome(Cllc_associatedDevList[cur - 1].shortAddr);
+        /* can move if the hole lies between its home and here */
+        if(((h - home) & assocIndexMask) >=
+           ((h - hole) & assocIndexMask))
+        {
+            assocIndex[hole] = cur;
+            assocIndex[h] = 0;
+            hole = h;
+        }
+    }
+}
+
 /*!
  * @brief       callback for Async indication
  *
@@ -98,6 +98,8 @@ typedef struct
     int8_t rssi;
     /*! Device alive status */
     uint16_t status;
+    /*! Polling interval from the last config response, 0 if not known */
+    uint32_t pollingInterval;
 #ifdef FEATURE_SECURE_COMMISSIONING
     uint8_t reCM_status;
     uint8_t keyRef_statue;
@@ -122,8 +124,8 @@ typedef struct
     uint32_t otherStats;
 } Cllc_statistics_t;
 
-/*! Association table */
-extern Cllc_associated_devices_t Cllc_associatedDevList[CONFIG_MAX_DEVICES];
+/*! Association table, CONFIG_MAX_DEVICES entries allocated by Cllc_init() */
+extern Cllc_associated_devices_t *Cllc_associatedDevList;
 /*! Cllc statistics */
 extern Cllc_statistics_t Cllc_statistics;
 
@@ -18,10 +18,12 @@
  Includes
  *****************************************************************************/
 #include <string.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <libgen.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "mac_util.h"
 #include "api_mac.h"
@@ -29,8 +31,13 @@
 #include "csf.h"
 #include "smsgs.h"
 #include "collector.h"
+#include "frag.h"
+#include "sensor_decode.h"
+#include "timer_wheel.h"
 
 #include "log.h"
+#include "mutex.h"
+#include "fatal.h"
 
 #include "oad_protocol.h"
 #include "oad_storage.h"
@@ -61,6 +68,100 @@
 #define RAMP_DATA_MSDU_HANDLE 0x20
 /* App Broadcast Cmd Msg marker for the MSDU Handle */
 #define APP_BROADCAST_MSDU_HANDLE 0x20
+
+/*! A data request waiting for its confirm, see sendMsgTracked() */
+typedef struct
+{
+    bool inUse;
+    /*! Full MSDU handle of the request */
+    uint8_t msduHandle;
+    /*! What was sent to whom */
+    Smsgs_cmdIds_t type;
+    uint16_t dstShortAddr;
+    /*! Sent indirect, counts against the device's downlink queue */
+    bool indirect;
+    /*! Waiting in the downlink queue, not handed to the MAC yet */
+    bool held;
+    /*! Gateway correlation id and connection, if a gateway waits on it */
+    bool hasCorrId;
+    uint32_t corrId;
+    int connId;
+    /*! When the request went to the MAC (or into its downlink queue) */
+    uint32_t startMs;
+} txTrack_t;
+
+/*! One of the Collector_trackingWindow tracking requests in flight */
+typedef struct
+{
+    /*! Deadline of what the slot waits for */
+    TimerWheel_timer_t timer;
+    /*! Association table slot of the device, -1 if none */
+    int devIdx;
+    uint16_t shortAddr;
+    /*! Waiting for the data confirm of this MSDU handle */
+    bool cnfPending;
+    uint8_t msduHandle;
+} trackingSlot_t;
+
+/*! Where a device is in a config rollout */
+typedef enum
+{
+    rollout_pending = 0,    /* config request still to send */
+    rollout_sent,           /* waiting for the data confirm */
+    rollout_acked,          /* waiting for the config response */
+    rollout_configured,
+    rollout_failed
+} rolloutDevState_t;
+
+/*! One device of a config rollout */
+typedef struct
+{
+    uint16_t shortAddr;
+    /*! One of rolloutDevState_t */
+    uint8_t state;
+    /*! Config requests sent so far */
+    uint8_t tries;
+    /*! MSDU handle of the last config request */
+    uint8_t msduHandle;
+    /*! Stop waiting for the response at this time */
+    uint32_t deadlineMs;
+    /*! Goes off at deadlineMs */
+    TimerWheel_timer_t timer;
+} rolloutEntry_t;
+
+/*! A message waiting for its sleepy device to poll */
+typedef struct dlqMsg_s
+{
+    struct dlqMsg_s *pNext;
+    Smsgs_cmdIds_t type;
+    /*! When it was queued */
+    uint32_t queuedMs;
+    /*! The data request, msdu.p points to data */
+    ApiMac_mcpsDataReq_t dataReq;
+    uint8_t data[];
+} dlqMsg_t;
+
+/*! Downlink queue of a sleepy device, same index as
+    Cllc_associatedDevList */
+typedef struct
+{
+    /*! Whose queue it is, the table slot may get a new device */
+    uint16_t shortAddr;
+    dlqMsg_t *pHead;
+    dlqMsg_t *pTail;
+    Collector_dlqStats_t stats;
+    /*! Goes off when the first waiting message expires */
+    TimerWheel_timer_t expiry;
+} dlq_t;
+
+/*! What dlqSubmit() did with a message */
+typedef enum
+{
+    dlq_send,       /* hand it to the MAC now */
+    dlq_held,       /* it waits for the device to poll */
+    dlq_coalesced,  /* it replaced a waiting one of the same type */
+    dlq_full        /* no room */
+} dlqResult_t;
 /* Default configuration frame control */
 #define CONFIG_FRAME_CONTROL (Smsgs_dataFields_tempSensor | \
                               Smsgs_dataFields_lightSensor | \
@@ -101,6 +202,15 @@
 #else
 #define TRACKING_TIMEOUT_TIME (CONFIG_POLLING_INTERVAL * 3) /*in milliseconds*/
 #endif
+
+/*
+ * Decode sensor data only when something uses the fields, that is the
+ * display. The raw frame goes to the gateway either way.
+ */
+#if !defined(IS_HEADLESS)
+#define COLLECTOR_DECODE_SENSOR_DATA
+#endif
+
 /* Initial delay before broadcast transmissions are started in FH mode */
 #define BROADCAST_CMD_START_TIME 60000
 
@@ -156,6 +266,9 @@ uint16_t Collector_events = 0;
 /*! Collector statistics */
 Collector_statistics_t Collector_statistics;
 
+/*! Tracking requests kept in flight */
+int Collector_trackingWindow = COLLECTOR_TRACKING_WINDOW;
+
 /******************************************************************************
  Local variables
  *****************************************************************************/
@@ -179,6 +292,39 @@ static bool fhEnabled = false;
 static oadFile_t oad_file_list[MAX_OAD_FILES] = {{0}};
 static uint16_t oadBNumBlocks;
 
+/*! Tracked data requests, indexed by the MSDU handle counter */
+static txTrack_t txTrack[MSDU_HANDLE_MAX + 1];
+static intptr_t txTrackMutex;
+
+/*! Tracking scheduler, only used by the collector thread */
+static trackingSlot_t *trackingSlots;
+/*! Where the round robin over the association table goes on */
+static int trackingCursor;
+static bool trackingStarted = false;
+
+/*! Config rollout, see Collector_startConfigRollout(). The gateway
+    starts it and reads the progress, the collector thread runs it */
+static intptr_t rolloutMutex;
+static Collector_rolloutState_t rolloutState = Collector_rollout_idle;
+static Collector_rolloutCfg_t rolloutCfg;
+static rolloutEntry_t *rolloutEntries;
+static int rolloutN;
+/*! Take the devices from the association table on the first run */
+static bool rolloutAllDevices;
+static int rolloutCursor;
+static int rolloutInFlight;
+static uint32_t rolloutSent;
+static uint32_t rolloutStartMs;
+static uint32_t rolloutEndMs;
+/*! No config request before this time (pacing) */
+static uint32_t rolloutNextSendMs;
+
+/*! Downlink queues of the sleepy devices, see dlqSubmit() */
+static dlq_t *dlqs;
+static intptr_t dlqMutex;
+/*! Messages waiting in all queues */
+static int dlqHeld;
+
 /******************************************************************************
  Local function prototypes
  *****************************************************************************/
@@ -195,22 +341,60 @@ static void disassocCnfCB(ApiMac_mlmeDisassociateCnf_t *pDisassocCnf);
 static void processStartEvent(void);
 #ifndef PROCESS_JS
 static void processConfigResponse(ApiMac_mcpsDataInd_t *pDataInd);
-static void processSensorData(ApiMac_mcpsDataInd_t *pDataInd);
 #endif
+static bool parseConfigResponse(ApiMac_mcpsDataInd_t *pDataInd,
+                                Smsgs_configRspMsg_t *pRsp);
+static void processSensorData(ApiMac_mcpsDataInd_t *pDataInd);
 static void processTrackingResponse(ApiMac_mcpsDataInd_t *pDataInd);
 static void processToggleLedResponse(ApiMac_mcpsDataInd_t *pDataInd);
 static void processDeviceTypeResponse(ApiMac_mcpsDataInd_t *pDataInd);
 static void processOadData(ApiMac_mcpsDataInd_t *pDataInd);
 static Cllc_associated_devices_t *findDevice(ApiMac_sAddr_t *pAddr);
 static Cllc_associated_devices_t *findDeviceStatusBit(uint16_t mask, uint16_t statusBit);
-static uint8_t getMsduHandle(Smsgs_cmdIds_t msgType);
+static bool getMsduHandle(Smsgs_cmdIds_t msgType, uint8_t *pMsduHandle);
 static bool sendMsg(Smsgs_cmdIds_t type, uint16_t dstShortAddr, bool rxOnIdle,
                     uint16_t len,
                     uint8_t *pData);
+static bool sendMsgTracked(Smsgs_cmdIds_t type, uint16_t dstShortAddr,
+                           bool rxOnIdle, uint16_t len, uint8_t *pData,
+                           const uint32_t *pCorrId, int connId,
+                           uint8_t *pMsduHandle);
+static bool processTxTrack(ApiMac_mcpsDataCnf_t *pDataCnf,
+                           txTrack_t *pDone);
+static uint32_t txTrackNowMs(void);
+static void txTrackHold(uint8_t msduHandle, bool held);
+static void fragTxDone(const Frag_txResult_t *pResult);
 static void generateConfigRequests(void);
 static void generateTrackingRequests(void);
+static void trackingSchedule(trackingSlot_t *pSlot, uint32_t ms);
+static void trackingSlotTimeout(intptr_t cookie);
+static void trackingSlotExpired(trackingSlot_t *pSlot);
+static void trackingSlotNext(trackingSlot_t *pSlot);
+static void trackingSend(trackingSlot_t *pSlot, int devIdx);
+static trackingSlot_t *trackingFindSlot(uint16_t shortAddr);
+static void buildConfigRequest(uint8_t *pBuf, uint16_t frameControl,
+                               uint32_t reportingInterval,
+                               uint32_t pollingInterval);
+static void processRollout(void);
+static void rolloutSend(rolloutEntry_t *pEntry, uint32_t now);
+static void rolloutGiveUp(rolloutEntry_t *pEntry);
+static void rolloutTimeout(intptr_t cookie);
+static rolloutEntry_t *rolloutFind(uint16_t shortAddr);
+static void rolloutDataCnf(uint16_t shortAddr, uint8_t msduHandle,
+                           uint8_t status);
+static void rolloutConfigRsp(uint16_t shortAddr,
+                             Smsgs_configRspMsg_t *pRsp);
+static dlq_t *dlqFind(uint16_t shortAddr);
+static dlqResult_t dlqSubmit(ApiMac_mcpsDataReq_t *pDataReq,
+                             Smsgs_cmdIds_t type, uint8_t *pOldHandle);
+static void dlqSupersede(uint8_t msduHandle);
+static void dlqMacDone(uint16_t shortAddr);
+static void dlqRelease(uint16_t shortAddr);
+static void dlqArmExpiry(dlq_t *pQ);
+static void dlqExpire(intptr_t cookie);
 static void generateBroadcastCmd(void);
-static void sendTrackingRequest(Cllc_associated_devices_t *pDev);
+static bool sendTrackingRequest(Cllc_associated_devices_t *pDev,
+                                uint8_t *pMsduHandle);
 static void commStatusIndCB(ApiMac_mlmeCommStatusInd_t *pCommStatusInd);
 static void pollIndCB(ApiMac_mlmePollInd_t *pPollInd);
 
@@ -228,6 +412,9 @@ static void oadResetRspCb(void* pSrcAddr);
 static void* oadRadioAccessAllocMsg(uint32_t size);
 static OADProtocol_Status_t oadRadioAccessPacketSend(void* pDstAddr, uint8_t *pMsg, uint32_t msgLen);
 
+static bool fragPacketSend(uint16_t dstShortAddr, bool rxOnIdle,
+                           uint8_t *pMsg, uint16_t len);
+
 static long findDeltaSeg(FILE* pFile);
 
 /******************************************************************************
@@ -293,6 +480,18 @@ static OADProtocol_RadioAccessFxns_t  oadRadioAccessFxns =
       oadRadioAccessPacketSend
     };
 
+static const Frag_fxns_t fragFxns =
+    {
+      /*! Send one fragment */
+      fragPacketSend,
+      /*! Transfer ended */
+      fragTxDone,
+      /*! Fragmentation clock */
+      Csf_setFragClock,
+      /*! Reassembled uplink message */
+      Csf_deviceRawDataUpdate
+    };
+
 static OADProtocol_MsgCBs_t oadMsgCallbacks =
     {
       /*! Incoming FW Req */
@@ -325,10 +524,53 @@ static OADProtocol_MsgCBs_t oadMsgCallbacks =
 void Collector_init(void)
 {
     OADProtocol_Params_t OADProtocol_params;
+    int x;
 
     /* Initialize the collector's statistics */
     memset(&Collector_statistics, 0, sizeof(Collector_statistics_t));
 
+    /* Gateways send from their own threads */
+    txTrackMutex = MUTEX_create("tx-track");
+    if(txTrackMutex == 0)
+    {
+        BUG_HERE("cannot create tx track mutex\n");
+    }
+
+    /* Tracking requests in flight */
+    trackingSlots = calloc(Collector_trackingWindow, sizeof(trackingSlot_t));
+    if(trackingSlots == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    for(x = 0; x < Collector_trackingWindow; x++)
+    {
+        trackingSlots[x].devIdx = -1;
+        TimerWheel_setup(&trackingSlots[x].timer, trackingSlotTimeout, x);
+    }
+
+    rolloutMutex = MUTEX_create("config-rollout");
+    if(rolloutMutex == 0)
+    {
+        BUG_HERE("cannot create config rollout mutex\n");
+    }
+
+    /* Downlink queues of the sleepy devices */
+    dlqs = calloc(CONFIG_MAX_DEVICES, sizeof(dlq_t));
+    if(dlqs == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    for(x = 0; x < CONFIG_MAX_DEVICES; x++)
+    {
+        dlqs[x].shortAddr = CSF_INVALID_SHORT_ADDR;
+        TimerWheel_setup(&dlqs[x].expiry, dlqExpire, x);
+    }
+    dlqMutex = MUTEX_create("downlink-queues");
+    if(dlqMutex == 0)
+    {
+        BUG_HERE("cannot create downlink queue mutex\n");
+    }
+
     /* Initialize the MAC */
     sem = ApiMac_init(CONFIG_FH_ENABLE);
 
@@ -404,6 +646,10 @@ void Collector_init(void)
 
     OADProtocol_open(&OADProtocol_params);
 
+    Frag_init(&fragFxns);
+#ifdef COLLECTOR_DECODE_SENSOR_DATA
+    SensorDecode_init();
+#endif
 }
 
 /*!
@@ -413,6 +659,14 @@ void Collector_init(void)
  */
 void Collector_process(void)
 {
+    /* Run the timers that are due, they set the events below */
+    if(Collector_events & COLLECTOR_WHEEL_EVT)
+    {
+        /* Clear the event */
+        Util_clearEvent(&Collector_events, COLLECTOR_WHEEL_EVT);
+        TimerWheel_process();
+    }
+
     /* Start the collector device in the network */
     if(Collector_events & COLLECTOR_START_EVT)
     {
@@ -461,6 +715,22 @@ void Collector_process(void)
         }
     }
 
+    /* Custom command fragments: ack timeouts and retransmits */
+    if(Collector_events & COLLECTOR_FRAG_EVT)
+    {
+        /* Clear the event */
+        Util_clearEvent(&Collector_events, COLLECTOR_FRAG_EVT);
+        Frag_process();
+    }
+
+    /* Config rollout: timeouts and the next config requests */
+    if(Collector_events & COLLECTOR_ROLLOUT_EVT)
+    {
+        /* Clear the event */
+        Util_clearEvent(&Collector_events, COLLECTOR_ROLLOUT_EVT);
+        processRollout();
+    }
+
     /* Process LLC Events */
     Cllc_process();
 
@@ -486,7 +756,9 @@ void Collector_process(void)
 Collector_status_t Collector_sendConfigRequest(ApiMac_sAddr_t *pDstAddr,
                                                uint16_t frameControl,
                                                uint32_t reportingInterval,
-                                               uint32_t pollingInterval)
+                                               uint32_t pollingInterval,
+                                               const uint32_t *pCorrId,
+                                               int connId)
 {
     Collector_status_t status = Collector_status_invalid_state;
 
@@ -499,25 +771,16 @@ Collector_status_t Collector_sendConfigRequest(ApiMac_sAddr_t *pDstAddr,
         if(Csf_getDevice(pDstAddr, &item))
         {
             uint8_t buffer[SMSGS_CONFIG_REQUEST_MSG_LENGTH];
-            uint8_t *pBuf = buffer;
 
             /* Build the message */
-            *pBuf++ = (uint8_t)Smsgs_cmdIds_configReq;
-            *pBuf++ = Util_loUint16(frameControl);
-            *pBuf++ = Util_hiUint16(frameControl);
-            *pBuf++ = Util_breakUint32(reportingInterval, 0);
-            *pBuf++ = Util_breakUint32(reportingInterval, 1);
-            *pBuf++ = Util_breakUint32(reportingInterval, 2);
-            *pBuf++ = Util_breakUint32(reportingInterval, 3);
-            *pBuf++ = Util_breakUint32(pollingInterval, 0);
-            *pBuf++ = Util_breakUint32(pollingInterval, 1);
-            *pBuf++ = Util_breakUint32(pollingInterval, 2);
-            *pBuf = Util_breakUint32(pollingInterval, 3);
-
-            if((sendMsg(Smsgs_cmdIds_configReq, item.devInfo.shortAddress,
-                        item.capInfo.rxOnWhenIdle,
-                        (SMSGS_CONFIG_REQUEST_MSG_LENGTH),
-                         buffer)) == true)
+            buildConfigRequest(buffer, frameControl, reportingInterval,
+                               pollingInterval);
+
+            if((sendMsgTracked(Smsgs_cmdIds_configReq,
+                               item.devInfo.shortAddress,
+                               item.capInfo.rxOnWhenIdle,
+                               (SMSGS_CONFIG_REQUEST_MSG_LENGTH),
+                               buffer, pCorrId, connId, NULL)) == true)
             {
                 status = Collector_status_success;
                 Collector_statistics.configRequestAttempts++;
@@ -534,6 +797,154 @@ Collector_status_t Collector_sendConfigRequest(ApiMac_sAddr_t *pDstAddr,
     return (status);
 }
 
+/*!
+ Start sending a config to a set of devices.
+
+ Public function defined in collector.h
+ */
+Collector_status_t Collector_startConfigRollout(
+                const Collector_rolloutCfg_t *pCfg,
+                const uint16_t *pShortAddrs, uint16_t n)
+{
+    rolloutEntry_t *pEntries;
+    int x;
+
+    /* Are we in the right state? */
+    if(cllcState < Cllc_states_started)
+    {
+        return (Collector_status_invalid_state);
+    }
+    if(n > CONFIG_MAX_DEVICES)
+    {
+        return (Collector_status_too_long);
+    }
+
+    /* All devices: the collector thread fills them in */
+    pEntries = calloc((n == 0) ? CONFIG_MAX_DEVICES : n,
+                      sizeof(rolloutEntry_t));
+    if(pEntries == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    for(x = 0; x < n; x++)
+    {
+        pEntries[x].shortAddr = pShortAddrs[x];
+    }
+    for(x = 0; x < ((n == 0) ? CONFIG_MAX_DEVICES : n); x++)
+    {
+        TimerWheel_setup(&pEntries[x].timer, rolloutTimeout, x);
+    }
+
+    MUTEX_lock(rolloutMutex, -1);
+    for(x = 0; x < rolloutN; x++)
+    {
+        TimerWheel_cancel(&rolloutEntries[x].timer);
+    }
+    free(rolloutEntries);
+    rolloutEntries = pEntries;
+    rolloutN = n;
+    rolloutAllDevices = (n == 0);
+    rolloutCfg = *pCfg;
+    if(rolloutCfg.window == 0)
+    {
+        rolloutCfg.window = COLLECTOR_ROLLOUT_WINDOW;
+    }
+    if(rolloutCfg.pacing_mSecs == 0)
+    {
+        rolloutCfg.pacing_mSecs = COLLECTOR_ROLLOUT_PACING;
+    }
+    rolloutCursor = 0;
+    rolloutInFlight = 0;
+    rolloutSent = 0;
+    rolloutStartMs = txTrackNowMs();
+    rolloutNextSendMs = rolloutStartMs;
+    rolloutState = Collector_rollout_running;
+
+    /* Let the collector thread take it from here */
+    Csf_setRolloutClock(1);
+    MUTEX_unLock(rolloutMutex);
+
+    return (Collector_status_success);
+}
+
+/*!
+ Get the progress of the last config rollout.
+
+ Public function defined in collector.h
+ */
+void Collector_getConfigRolloutProgress(Collector_rolloutProgress_t *pProgress)
+{
+    int x;
+
+    memset(pProgress, 0, sizeof(Collector_rolloutProgress_t));
+
+    MUTEX_lock(rolloutMutex, -1);
+    pProgress->state = rolloutState;
+    if(rolloutState != Collector_rollout_idle)
+    {
+        pProgress->total = rolloutN;
+        for(x = 0; x < rolloutN; x++)
+        {
+            switch(rolloutEntries[x].state)
+            {
+                case rollout_pending:
+                    pProgress->pending++;
+                    break;
+                case rollout_sent:
+                case rollout_acked:
+                    pProgress->inFlight++;
+                    break;
+                case rollout_configured:
+                    pProgress->configured++;
+                    break;
+                default:
+                    pProgress->failed++;
+                    break;
+            }
+        }
+        pProgress->requestsSent = rolloutSent;
+        if(rolloutState == Collector_rollout_done)
+        {
+            pProgress->elapsed_mSecs = rolloutEndMs - rolloutStartMs;
+        }
+        else
+        {
+            pProgress->elapsed_mSecs = txTrackNowMs() - rolloutStartMs;
+        }
+    }
+    MUTEX_unLock(rolloutMutex);
+
+    if(pProgress->elapsed_mSecs != 0)
+    {
+        pProgress->devicesPerHour =
+            (uint32_t)(((uint64_t)pProgress->configured * 3600000) /
+                       pProgress->elapsed_mSecs);
+    }
+}
+
+/*!
+ Get the downlink queue statistics of a sleepy device.
+
+ Public function defined in collector.h
+ */
+Collector_status_t Collector_getDownlinkQueueStats(uint16_t shortAddr,
+                                                   Collector_dlqStats_t *pStats)
+{
+    Collector_status_t status = Collector_status_deviceNotFound;
+    dlq_t *pQ;
+
+    MUTEX_lock(dlqMutex, -1);
+    pQ = dlqFind(shortAddr);
+    if(pQ != NULL)
+    {
+        *pStats = pQ->stats;
+        status = Collector_status_success;
+    }
+    MUTEX_unLock(dlqMutex);
+
+    return (status);
+}
+
 /*!
  Update the collector statistics
 
@@ -587,34 +998,104 @@ Collector_status_t Collector_sendToggleLedRequest(ApiMac_sAddr_t *pDstAddr)
     return(status);
 }
 
-Collector_status_t Collector_sendCustomCommand(ApiMac_sAddr_t *pDstAddr, uint8_t *state, uint16_t length) {
-       	Collector_status_t status = Collector_status_invalid_state;
-    	if(cllcState >= Cllc_states_started)
-    	{
-        	Llc_deviceListItem_t item;
-
-        	if(Csf_getDevice(pDstAddr, &item))
-        	{
-            		uint8_t buffer[length+sizeof(uint8_t)];
-            		uint8_t *pBuf = buffer;
-            		*pBuf = (uint8_t)Smsgs_cmdIds_customCommand;
-           		int i = 0;
-           		for(i = 0; i < length; i++ ) {
-               			pBuf[i+1] = *(state+i);
-           		}
-
-            		sendMsg(Smsgs_cmdIds_customCommand, item.devInfo.shortAddress,
-                    		item.capInfo.rxOnWhenIdle,
-                    		length+1,
-                    		buffer);
-            		status = Collector_status_success;
-        	}
-        	else
-        	{
-            		status = Collector_status_deviceNotFound;
-        	}
-    	}
-    	return(status);
+/*!
+ Build and send a custom command to a device, in fragments when it does
+ not fit in one MSDU.
+
+ Public function defined in collector.h
+ */
+Collector_status_t Collector_sendCustomCommand(ApiMac_sAddr_t *pDstAddr,
+                                               uint8_t *state,
+                                               uint16_t length,
+                                               const uint32_t *pCorrId,
+                                               int connId)
+{
+    Collector_status_t status = Collector_status_invalid_state;
+
+    /* Are we in the right state? */
+    if(cllcState >= Cllc_states_started)
+    {
+        Llc_deviceListItem_t item;
+
+        /* Is the device a known device? */
+        if(Csf_getDevice(pDstAddr, &item))
+        {
+            /*
+             * Only devices whose firmware reassembles take fragments,
+             * without config-custom-frag it all goes in one MSDU
+             */
+            if(((length + 1) <= (SMSGS_CUSTOM_FRAG_HDR_LEN + FRAG_PAYLOAD_LEN))
+               || (CONFIG_CUSTOM_FRAG == false))
+            {
+                /* One MSDU, no fragment header */
+                uint8_t buffer[SMSGS_CUSTOM_FRAG_HDR_LEN + FRAG_PAYLOAD_LEN];
+                uint8_t *pBuf = buffer;
+
+                if((length + 1) > sizeof(buffer))
+                {
+                    pBuf = malloc(length + 1);
+                    if(pBuf == NULL)
+                    {
+                        BUG_HERE("No memory\n");
+                    }
+                }
+                pBuf[0] = (uint8_t)Smsgs_cmdIds_customCommand;
+                memcpy(&pBuf[1], state, length);
+
+                if(sendMsgTracked(Smsgs_cmdIds_customCommand,
+                                  item.devInfo.shortAddress,
+                                  item.capInfo.rxOnWhenIdle,
+                                  (length + 1),
+                                  pBuf, pCorrId, connId, NULL) == true)
+                {
+                    status = Collector_status_success;
+                }
+                else
+                {
+                    /* MAC queue full */
+                    status = Collector_status_busy;
+                }
+                if(pBuf != buffer)
+                {
+                    free(pBuf);
+                }
+            }
+            else
+            {
+                Cllc_associated_devices_t *pDev;
+                uint32_t pollingInterval = CONFIG_POLLING_INTERVAL;
+
+                /* Retries wait for the device's own polls */
+                pDev = Cllc_findDevice(item.devInfo.shortAddress);
+                if((pDev != NULL) && (pDev->pollingInterval != 0))
+                {
+                    pollingInterval = pDev->pollingInterval;
+                }
+
+                switch(Frag_send(item.devInfo.shortAddress,
+                                 item.capInfo.rxOnWhenIdle,
+                                 pollingInterval, state, length,
+                                 pCorrId, connId))
+                {
+                    case Frag_status_success:
+                        status = Collector_status_success;
+                        break;
+                    case Frag_status_busy:
+                        status = Collector_status_busy;
+                        break;
+                    default:
+                        status = Collector_status_too_long;
+                        break;
+                }
+            }
+        }
+        else
+        {
+            status = Collector_status_deviceNotFound;
+        }
+    }
+
+    return(status);
 }
 
 /*!
@@ -1091,13 +1572,30 @@ static void dataCnfCB(ApiMac_mcpsDataCnf_t *pDataCnf)
     /* Make sure the message came from the app */
     if(pDataCnf->msduHandle & APP_MARKER_MSDU_HANDLE)
     {
+        txTrack_t done;
+        Cllc_associated_devices_t *pDev = NULL;
+        bool found;
+
+        /* Which request was it, and does a gateway wait for it? */
+        found = processTxTrack(pDataCnf, &done);
+        if(found)
+        {
+            pDev = Cllc_findDevice(done.dstShortAddr);
+        }
+
         /* What message type was the original request? */
         if(pDataCnf->msduHandle & APP_CONFIG_MSDU_HANDLE)
         {
-            /* Config Request */
-            Cllc_associated_devices_t *pDev;
-            pDev = findDeviceStatusBit(ASSOC_CONFIG_MASK, ASSOC_CONFIG_SENT);
-            if(pDev != NULL)
+            /* Config rollout, if the request was one of its own */
+            if((pDev != NULL) && (done.type == Smsgs_cmdIds_configReq))
+            {
+                rolloutDataCnf(done.dstShortAddr, pDataCnf->msduHandle,
+                               pDataCnf->status);
+            }
+
+            /* Config Request, if the device waits on it */
+            if((pDev != NULL) && (done.type == Smsgs_cmdIds_configReq)
+               && ((pDev->status & ASSOC_CONFIG_MASK) == ASSOC_CONFIG_SENT))
             {
                 if(pDataCnf->status != ApiMac_status_success)
                 {
@@ -1129,12 +1627,22 @@ static void dataCnfCB(ApiMac_mcpsDataCnf_t *pDataCnf)
         }
         else
         {
-            /* Tracking Request */
-            Cllc_associated_devices_t *pDev;
-            pDev = findDeviceStatusBit(ASSOC_TRACKING_SENT,
-                                       ASSOC_TRACKING_SENT);
-            if(pDev != NULL)
+            /* Tracking Request, if its tracking slot waits on it */
+            trackingSlot_t *pSlot = NULL;
+
+            if((pDev != NULL) && (done.type == Smsgs_cmdIds_trackingReq))
+            {
+                pSlot = trackingFindSlot(done.dstShortAddr);
+                if((pSlot != NULL) && ((pSlot->cnfPending == false) ||
+                   (pSlot->msduHandle != pDataCnf->msduHandle)))
+                {
+                    pSlot = NULL;
+                }
+            }
+            if(pSlot != NULL)
             {
+                pSlot->cnfPending = false;
+
                 if(pDataCnf->status == ApiMac_status_success)
                 {
                     /* Make sure the retry is clear */
@@ -1157,16 +1665,23 @@ static void dataCnfCB(ApiMac_mcpsDataCnf_t *pDataCnf)
                     pDev->status &= ~ASSOC_TRACKING_SENT;
 
                     /* Try to send again or another */
-                    Csf_setTrackingClock(TRACKING_CNF_DELAY_TIME);
+                    trackingSchedule(pSlot, TRACKING_CNF_DELAY_TIME);
                 }
             }
 
             /* Update stats */
-            if(pDataCnf->status == ApiMac_status_success)
+            if((pSlot != NULL) && (pDataCnf->status == ApiMac_status_success))
             {
                 Collector_statistics.trackingReqRequestSent++;
             }
         }
+
+        /* A sleepy device took (or missed) a frame, the next may go */
+        if(found && done.indirect)
+        {
+            dlqMacDone(done.dstShortAddr);
+            dlqRelease(done.dstShortAddr);
+        }
     }
 }
 
@@ -1245,9 +1760,18 @@ static void dataIndCB(ApiMac_mcpsDataInd_t *pDataInd)
                 Cllc_associated_devices_t *pDev = findDevice(&pDataInd->srcAddr);
                 if (pDev != NULL)
                 {
+                    Smsgs_configRspMsg_t configRsp;
+                    bool parsed = parseConfigResponse(pDataInd, &configRsp);
+
                     /* Clear the sent flag and set the response flag */
                     pDev->status &= ~ASSOC_CONFIG_SENT;
                     pDev->status |= ASSOC_CONFIG_RSP;
+                    if(parsed)
+                    {
+                        pDev->pollingInterval = configRsp.pollingInterval;
+                    }
+                    rolloutConfigRsp(pDev->shortAddr,
+                                     (parsed ? &configRsp : NULL));
                 }
                 Csf_deviceConfigDisplay(&pDataInd->srcAddr);
                 Util_setEvent(&Collector_events, COLLECTOR_CONFIG_EVT);
@@ -1267,10 +1791,7 @@ static void dataIndCB(ApiMac_mcpsDataInd_t *pDataInd)
                 break;
 
             case Smsgs_cmdIds_sensorData:
-                Collector_statistics.sensorMessagesReceived++;
-				Csf_deviceSensorDisplay(pDataInd);
-                processDataRetry(&(pDataInd->srcAddr));
-                Csf_deviceRawDataUpdate(pDataInd);
+                processSensorData(pDataInd);
                 break;
 
             case Smsgs_cmdIds_rampdata:
@@ -1285,6 +1806,24 @@ static void dataIndCB(ApiMac_mcpsDataInd_t *pDataInd)
                 processOadData(pDataInd);
                 break;
 
+            case Smsgs_cmdIds_customFragAck:
+                Frag_processAck(pDataInd);
+                break;
+
+            case Smsgs_cmdIds_customFrag:
+            {
+                Cllc_associated_devices_t *pFragDev;
+
+                /* acks to sleepy devices go indirect */
+                pFragDev = findDevice(&pDataInd->srcAddr);
+                if(pFragDev != NULL)
+                {
+                    Frag_processFragment(pDataInd,
+                                         pFragDev->capInfo.rxOnWhenIdle);
+                }
+                break;
+            }
+
             default:
                 /* Should not receive other messages */
                 Csf_deviceRawDataUpdate(pDataInd);
@@ -1300,6 +1839,8 @@ static void processStartEvent(void)
 {
     Llc_netInfo_t netInfo;
     uint32_t frameCounter = 0;
+    struct timespec start;
+    struct timespec end;
 
     Csf_getFrameCounter(NULL, &frameCounter);
     /* See if there is existing network information */
@@ -1315,7 +1856,13 @@ static void processStartEvent(void)
         numDevices = Csf_getNumDeviceListEntries();
 
         /* Restore with the network and device information */
+        clock_gettime(CLOCK_MONOTONIC, &start);
         Cllc_restoreNetwork(&netInfo, (uint16_t)numDevices, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        LOG_printf(LOG_ALWAYS, "Network restored, %d devices in %ld us\n",
+                   (int)numDevices,
+                   (long)(((end.tv_sec - start.tv_sec) * 1000000)
+                          + ((end.tv_nsec - start.tv_nsec) / 1000)));
 
         restarted = true;
     }
@@ -1333,45 +1880,65 @@ static void processStartEvent(void)
     }
 }
 
-#ifndef PROCESS_JS
 /*!
- * @brief      Process the Config Response message.
+ * @brief      Parse a Config Response message.
  *
  * @param      pDataInd - pointer to the data indication information
+ * @param      pRsp - where to put the parsed message
+ *
+ * @return     true if the message has the right size, false if not
  */
-static void processConfigResponse(ApiMac_mcpsDataInd_t *pDataInd)
+static bool parseConfigResponse(ApiMac_mcpsDataInd_t *pDataInd,
+                                Smsgs_configRspMsg_t *pRsp)
 {
+    uint8_t *pBuf = pDataInd->msdu.p;
+
     /* Make sure the message is the correct size */
-    if(pDataInd->msdu.len == SMSGS_CONFIG_RESPONSE_MSG_LENGTH)
+    if(pDataInd->msdu.len != SMSGS_CONFIG_RESPONSE_MSG_LENGTH)
     {
-        Cllc_associated_devices_t *pDev;
-        Smsgs_configRspMsg_t configRsp;
-        uint8_t *pBuf = pDataInd->msdu.p;
+        return (false);
+    }
+
+    /* Parse the message */
+    pRsp->cmdId = (Smsgs_cmdIds_t)*pBuf++;
+
+    pRsp->status = (Smsgs_statusValues_t)Util_buildUint16(pBuf[0], pBuf[1]);
+    pBuf += 2;
 
-        /* Parse the message */
-        configRsp.cmdId = (Smsgs_cmdIds_t)*pBuf++;
+    pRsp->frameControl = Util_buildUint16(pBuf[0], pBuf[1]);
+    pBuf += 2;
 
-        configRsp.status = (Smsgs_statusValues_t)Util_buildUint16(pBuf[0],
-                                                                  pBuf[1]);
-        pBuf += 2;
+    pRsp->reportingInterval = Util_buildUint32(pBuf[0], pBuf[1], pBuf[2],
+                                               pBuf[3]);
+    pBuf += 4;
 
-        configRsp.frameControl = Util_buildUint16(pBuf[0], pBuf[1]);
-        pBuf += 2;
+    pRsp->pollingInterval = Util_buildUint32(pBuf[0], pBuf[1], pBuf[2],
+                                             pBuf[3]);
 
-        configRsp.reportingInterval = Util_buildUint32(pBuf[0], pBuf[1],
-                                                       pBuf[2],
-                                                       pBuf[3]);
-        pBuf += 4;
+    return (true);
+}
 
-        configRsp.pollingInterval = Util_buildUint32(pBuf[0], pBuf[1], pBuf[2],
-                                                     pBuf[3]);
+#ifndef PROCESS_JS
+/*!
+ * @brief      Process the Config Response message.
+ *
+ * @param      pDataInd - pointer to the data indication information
+ */
+static void processConfigResponse(ApiMac_mcpsDataInd_t *pDataInd)
+{
+    Cllc_associated_devices_t *pDev;
+    Smsgs_configRspMsg_t configRsp;
 
+    if(parseConfigResponse(pDataInd, &configRsp) == true)
+    {
         pDev = findDevice(&pDataInd->srcAddr);
         if(pDev != NULL)
         {
             /* Clear the sent flag and set the response flag */
             pDev->status &= ~ASSOC_CONFIG_SENT;
             pDev->status |= ASSOC_CONFIG_RSP;
+            pDev->pollingInterval = configRsp.pollingInterval;
+            rolloutConfigRsp(pDev->shortAddr, &configRsp);
         }
 
         /* Report the config response */
@@ -1403,11 +1970,17 @@ static void processTrackingResponse(ApiMac_mcpsDataInd_t *pDataInd)
         {
             if(pDev->status & ASSOC_TRACKING_SENT)
             {
+                trackingSlot_t *pSlot;
+
                 pDev->status &= ~ASSOC_TRACKING_SENT;
                 pDev->status |= ASSOC_TRACKING_RSP;
 
                 /* Setup for next tracking */
-                Csf_setTrackingClock( TRACKING_DELAY_TIME);
+                pSlot = trackingFindSlot(pDev->shortAddr);
+                if(pSlot != NULL)
+                {
+                    trackingSchedule(pSlot, TRACKING_DELAY_TIME);
+                }
 
                 /* Retry config request */
                 processConfigRetry();
@@ -1498,7 +2071,6 @@ static void processDeviceTypeResponse(ApiMac_mcpsDataInd_t *pDataInd)
     }
 }
 
-#ifndef PROCESS_JS
 /*!
  * @brief      Process the Sensor Data message.
  *
@@ -1506,149 +2078,38 @@ static void processDeviceTypeResponse(ApiMac_mcpsDataInd_t *pDataInd)
  */
 static void processSensorData(ApiMac_mcpsDataInd_t *pDataInd)
 {
+#ifdef COLLECTOR_DECODE_SENSOR_DATA
     Smsgs_sensorMsg_t sensorData;
-    uint8_t *pBuf = pDataInd->msdu.p;
-
-    memset(&sensorData, 0, sizeof(Smsgs_sensorMsg_t));
-
-    /* Parse the message */
-    sensorData.cmdId = (Smsgs_cmdIds_t)*pBuf++;
-
-    memcpy(sensorData.extAddress, pBuf, SMGS_SENSOR_EXTADDR_LEN);
-    pBuf += SMGS_SENSOR_EXTADDR_LEN;
-
-    sensorData.frameControl = Util_buildUint16(pBuf[0], pBuf[1]);
-    pBuf += 2;
-
-    /* Parse data in order of frameControl mask, starting with LSB */
-    if(sensorData.frameControl & Smsgs_dataFields_tempSensor)
-    {
-	sensorData.tempSensor.temp = Util_buildUint16(pBuf[0], pBuf[1]);
-	pBuf += 2;
-    }
-
-    if(sensorData.frameControl & Smsgs_dataFields_msgStats)
-    {
-        sensorData.msgStats.joinAttempts = Util_buildUint16(pBuf[0], pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.joinFails = Util_buildUint16(pBuf[0], pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.msgsAttempted = Util_buildUint16(pBuf[0], pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.msgsSent = Util_buildUint16(pBuf[0], pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.trackingRequests = Util_buildUint16(pBuf[0],
-                                                                pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.trackingResponseAttempts = Util_buildUint16(
-                        pBuf[0],
-                        pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.trackingResponseSent = Util_buildUint16(pBuf[0],
-                                                                    pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.configRequests = Util_buildUint16(pBuf[0],
-                                                              pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.configResponseAttempts = Util_buildUint16(
-                        pBuf[0],
-                        pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.configResponseSent = Util_buildUint16(pBuf[0],
-                                                                  pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.channelAccessFailures = Util_buildUint16(pBuf[0],
-                                                                     pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.macAckFailures = Util_buildUint16(pBuf[0], pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.otherDataRequestFailures = Util_buildUint16(
-                        pBuf[0],
-                        pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.syncLossIndications = Util_buildUint16(pBuf[0],
-                                                                   pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.rxDecryptFailures = Util_buildUint16(pBuf[0],
-                                                                 pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.txEncryptFailures = Util_buildUint16(pBuf[0],
-                                                                 pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.resetCount = Util_buildUint16(pBuf[0],
-                                                          pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.lastResetReason = Util_buildUint16(pBuf[0],
-                                                               pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.joinTime = Util_buildUint16(pBuf[0],
-                                                        pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.interimDelay = Util_buildUint16(pBuf[0],
-                                                            pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.numBroadcastMsgRcvd = Util_buildUint16(pBuf[0],
-                                                                   pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.numBroadcastMsglost = Util_buildUint16(pBuf[0],
-                                                                   pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.avgE2EDelay = Util_buildUint16(pBuf[0],pBuf[1]);
-        pBuf += 2;
-        sensorData.msgStats.worstCaseE2EDelay = Util_buildUint16(pBuf[0],pBuf[1]);
-        pBuf += 2;
-    }
-
-    if(sensorData.frameControl & Smsgs_dataFields_configSettings)
-    {
-        sensorData.configSettings.reportingInterval = Util_buildUint32(pBuf[0],
-                                                                       pBuf[1],
-                                                                       pBuf[2],
-                                                                       pBuf[3]);
-        pBuf += 4;
-        sensorData.configSettings.pollingInterval = Util_buildUint32(pBuf[0],
-                                                                     pBuf[1],
-                                                                     pBuf[2],
-                                                                     pBuf[3]);
-#ifdef LPSTK
-        pBuf += 4;
-    }
-
-    if(sensorData.frameControl & Smsgs_dataFields_hallEffectSensor)
-    {
-        sensorData.hallEffectSensor.flux = (float) Util_buildUint32(pBuf[0],
-                                                                    pBuf[1],
-                                                                    pBuf[2],
-                                                                    pBuf[3]);
-        pBuf += 4;
-    }
-
-    if(sensorData.frameControl & Smsgs_dataFields_accelSensor)
-    {
-        sensorData.accelerometerSensor.xAxis = (int16_t)Util_buildUint16(pBuf[0],
-                                                                pBuf[1]);
-        pBuf += 2;
-        sensorData.accelerometerSensor.yAxis = (int16_t)Util_buildUint16(pBuf[0],
-                                                                pBuf[1]);
-        pBuf += 2;
-        sensorData.accelerometerSensor.zAxis = (int16_t)Util_buildUint16(pBuf[0],
-                                                                pBuf[1]);
-        pBuf += 2;
-        sensorData.accelerometerSensor.xTiltDet = *pBuf++;
-        sensorData.accelerometerSensor.yTiltDet = *pBuf++;
-
-#endif /* LPSTK */
-    }
+    SensorDecode_status_t status;
+#endif
 
     Collector_statistics.sensorMessagesReceived++;
 
-    /* Report the sensor data */
-    Csf_deviceSensorDataUpdate(&pDataInd->srcAddr, pDataInd->rssi,
-                               &sensorData);
+#ifdef COLLECTOR_DECODE_SENSOR_DATA
+    status = SensorDecode_decode(pDataInd->msdu.p, pDataInd->msdu.len,
+                                 &sensorData, NULL);
+    if(status == SensorDecode_status_success)
+    {
+        Csf_deviceSensorDisplay(&pDataInd->srcAddr, pDataInd->rssi,
+                                &sensorData);
+    }
+    else
+    {
+        LOG_printf(LOG_DBG_COLLECTOR,
+                   "Sensor 0x%04x: bad sensor data, status %d, len %d\n",
+                   pDataInd->srcAddr.addr.shortAddr, (int)status,
+                   (int)pDataInd->msdu.len);
+    }
+#else
+    LOG_printf(LOG_APPSRV_MSG_CONTENT, "Sensor 0x%04x\n",
+               pDataInd->srcAddr.addr.shortAddr);
+#endif
 
     processDataRetry(&(pDataInd->srcAddr));
+
+    /* The gateway decodes the frame itself, even one we could not */
+    Csf_deviceRawDataUpdate(pDataInd);
 }
-#endif
 
 
 /*!
@@ -1674,32 +2135,20 @@ static void processOadData(ApiMac_mcpsDataInd_t *pDataInd)
  */
 static Cllc_associated_devices_t *findDevice(ApiMac_sAddr_t *pAddr)
 {
-    int x;
-    Cllc_associated_devices_t *pItem = NULL;
-
     /* Check for invalid parameters */
-    if((pAddr == NULL) || (pAddr->addrMode == ApiMac_addrType_none))
+    if((pAddr == NULL) || (pAddr->addrMode != ApiMac_addrType_short))
     {
         return (NULL);
     }
 
-    for(x = 0; x < CONFIG_MAX_DEVICES; x++)
+    /* Cllc_findDevice() would hand back an empty slot */
+    if(pAddr->addr.shortAddr == CSF_INVALID_SHORT_ADDR)
     {
-        /* Make sure the entry is valid. */
-        if(Cllc_associatedDevList[x].shortAddr != CSF_INVALID_SHORT_ADDR)
-        {
-            if(pAddr->addrMode == ApiMac_addrType_short)
-            {
-                if(pAddr->addr.shortAddr == Cllc_associatedDevList[x].shortAddr)
-                {
-                    pItem = &Cllc_associatedDevList[x];
-                    break;
-                }
-            }
-        }
+        return (NULL);
     }
 
-    return (pItem);
+    /* hashed on the short address, see cllc.c */
+    return (Cllc_findDevice(pAddr->addr.shortAddr));
 }
 
 /*!
@@ -1731,6 +2180,17 @@ static Cllc_associated_devices_t *findDeviceStatusBit(uint16_t mask, uint16_t st
     return (pItem);
 }
 
+/*!
+ * @brief      Monotonic clock in milliseconds, for the confirm latency
+ */
+static uint32_t txTrackNowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
 /*!
  * @brief      Get the next MSDU Handle
  *             <BR>
@@ -1740,28 +2200,51 @@ static Cllc_associated_devices_t *findDeviceStatusBit(uint16_t mask, uint16_t st
  *             - Bits 0-5, used as a message counter that rolls over.
  *
  * @param      msgType - message command id needed
+ * @param      pMsduHandle - where to put the msdu Handle
  *
- * @return     msdu Handle
+ * @return     true, false if every handle still waits for its confirm
  */
-static uint8_t getMsduHandle(Smsgs_cmdIds_t msgType)
+static bool getMsduHandle(Smsgs_cmdIds_t msgType, uint8_t *pMsduHandle)
 {
-    uint8_t msduHandle = deviceTxMsduHandle;
+    uint8_t msduHandle = 0;
+    bool found = false;
+    int x;
 
-    /* Increment for the next msdu handle, or roll over */
-    if(deviceTxMsduHandle >= MSDU_HANDLE_MAX)
+    /* A handle is given out again only after its confirm, so a late
+       confirm is never credited to a newer request */
+    MUTEX_lock(txTrackMutex, -1);
+    for(x = 0; x <= MSDU_HANDLE_MAX; x++)
     {
-        deviceTxMsduHandle = 0;
+        msduHandle = deviceTxMsduHandle;
+
+        /* Increment for the next msdu handle, or roll over */
+        if(deviceTxMsduHandle >= MSDU_HANDLE_MAX)
+        {
+            deviceTxMsduHandle = 0;
+        }
+        else
+        {
+            deviceTxMsduHandle++;
+        }
+
+        if(txTrack[msduHandle].inUse == false)
+        {
+            found = true;
+            break;
+        }
     }
-    else
+    if(found == false)
     {
-        deviceTxMsduHandle++;
+        MUTEX_unLock(txTrackMutex);
+        return (false);
     }
 
     /* Add the message type bit for ramp data */
     if(msgType == Smsgs_cmdIds_rampdata)
     {
-        msduHandle |= RAMP_DATA_MSDU_HANDLE;
-        return (msduHandle);
+        MUTEX_unLock(txTrackMutex);
+        *pMsduHandle = msduHandle | RAMP_DATA_MSDU_HANDLE;
+        return (true);
     }
 
     /* Add the App specific bit */
@@ -1777,7 +2260,15 @@ static uint8_t getMsduHandle(Smsgs_cmdIds_t msgType)
         msduHandle |= APP_BROADCAST_MSDU_HANDLE;
     }
 
-    return (msduHandle);
+    /* Taken until its confirm comes back, see processTxTrack() */
+    memset(&txTrack[msduHandle & MSDU_HANDLE_MAX], 0, sizeof(txTrack_t));
+    txTrack[msduHandle & MSDU_HANDLE_MAX].inUse = true;
+    txTrack[msduHandle & MSDU_HANDLE_MAX].msduHandle = msduHandle;
+    txTrack[msduHandle & MSDU_HANDLE_MAX].type = msgType;
+    MUTEX_unLock(txTrackMutex);
+
+    *pMsduHandle = msduHandle;
+    return (true);
 }
 
 /*!
@@ -1794,8 +2285,35 @@ static uint8_t getMsduHandle(Smsgs_cmdIds_t msgType)
 static bool sendMsg(Smsgs_cmdIds_t type, uint16_t dstShortAddr, bool rxOnIdle,
                     uint16_t len,
                     uint8_t *pData)
+{
+    return sendMsgTracked(type, dstShortAddr, rxOnIdle, len, pData, NULL, 0,
+                          NULL);
+}
+
+/*!
+ * @brief      Send MAC data request, and remember it in txTrack[] until
+ *             its confirm comes back.
+ *
+ * @param      type - message type
+ * @param      dstShortAddr - destination short address
+ * @param      rxOnIdle - true if not a sleepy device
+ * @param      len - length of payload
+ * @param      pData - pointer to the buffer
+ * @param      pCorrId - gateway correlation id, NULL if nobody waits
+ * @param      connId - gateway connection, goes with pCorrId
+ * @param      pMsduHandle - where to put the MSDU handle used, or NULL
+ *
+ * @return  true if sent, false if not
+ */
+static bool sendMsgTracked(Smsgs_cmdIds_t type, uint16_t dstShortAddr,
+                           bool rxOnIdle, uint16_t len, uint8_t *pData,
+                           const uint32_t *pCorrId, int connId,
+                           uint8_t *pMsduHandle)
 {
     ApiMac_mcpsDataReq_t dataReq;
+    txTrack_t *pTrack;
+    dlqResult_t queued;
+    uint8_t oldHandle;
 
     /* Fill the data request field */
     memset(&dataReq, 0, sizeof(ApiMac_mcpsDataReq_t));
@@ -1825,7 +2343,17 @@ static bool sendMsg(Smsgs_cmdIds_t type, uint16_t dstShortAddr, bool rxOnIdle,
 
     dataReq.dstPanId = devicePanId;
 
-    dataReq.msduHandle = getMsduHandle(type);
+    if(getMsduHandle(type, &dataReq.msduHandle) == false)
+    {
+        /* every handle waits for a confirm, the caller reports it */
+        LOG_printf(LOG_ERROR, "no free msdu handle for 0x%04x\n",
+                   dstShortAddr);
+        return (false);
+    }
+    if(pMsduHandle != NULL)
+    {
+        *pMsduHandle = dataReq.msduHandle;
+    }
 
     dataReq.txOptions.ack = true;
     if(rxOnIdle == false)
@@ -1841,10 +2369,53 @@ static bool sendMsg(Smsgs_cmdIds_t type, uint16_t dstShortAddr, bool rxOnIdle,
     Cllc_securityFill(&dataReq.sec);
 #endif /* FEATURE_MAC_SECURITY */
 
+    /* Remember it before the confirm can come back */
+    MUTEX_lock(txTrackMutex, -1);
+    pTrack = &txTrack[dataReq.msduHandle & MSDU_HANDLE_MAX];
+    pTrack->dstShortAddr = dstShortAddr;
+    pTrack->indirect = dataReq.txOptions.indirect;
+    pTrack->held = false;
+    pTrack->hasCorrId = (pCorrId != NULL);
+    pTrack->corrId = (pCorrId != NULL) ? *pCorrId : 0;
+    pTrack->connId = connId;
+    pTrack->startMs = txTrackNowMs();
+    MUTEX_unLock(txTrackMutex);
+
+    /* Sleepy devices get it when they poll, see dlqSubmit() */
+    queued = dlq_send;
+    if(dataReq.txOptions.indirect)
+    {
+        queued = dlqSubmit(&dataReq, type, &oldHandle);
+    }
+    if((queued == dlq_coalesced) || (queued == dlq_held))
+    {
+        txTrackHold(dataReq.msduHandle, true);
+    }
+    if(queued == dlq_coalesced)
+    {
+        dlqSupersede(oldHandle);
+        return (true);
+    }
+    if(queued == dlq_held)
+    {
+        return (true);
+    }
+
     /* Send the message */
-    if(ApiMac_mcpsDataReq(&dataReq) != ApiMac_status_success)
+    if((queued == dlq_full) ||
+       (ApiMac_mcpsDataReq(&dataReq) != ApiMac_status_success))
     {
-        /*  Transaction overflow occurred */
+        /*  Transaction overflow occurred, the caller reports it */
+        if((queued == dlq_send) && dataReq.txOptions.indirect)
+        {
+            dlqMacDone(dstShortAddr);
+        }
+        MUTEX_lock(txTrackMutex, -1);
+        if(pTrack->msduHandle == dataReq.msduHandle)
+        {
+            pTrack->inUse = false;
+        }
+        MUTEX_unLock(txTrackMutex);
         return (false);
     }
     else
@@ -1853,6 +2424,87 @@ static bool sendMsg(Smsgs_cmdIds_t type, uint16_t dstShortAddr, bool rxOnIdle,
     }
 }
 
+/*!
+ * @brief      Mark a tracked request as waiting in a downlink queue, or
+ *             as handed to the MAC
+ *
+ * @param      msduHandle - its MSDU handle
+ * @param      held - true while it waits
+ */
+static void txTrackHold(uint8_t msduHandle, bool held)
+{
+    txTrack_t *pTrack;
+
+    MUTEX_lock(txTrackMutex, -1);
+    pTrack = &txTrack[msduHandle & MSDU_HANDLE_MAX];
+    if(pTrack->inUse && (pTrack->msduHandle == msduHandle))
+    {
+        pTrack->held = held;
+    }
+    MUTEX_unLock(txTrackMutex);
+}
+
+/*!
+ * @brief      Find the data request a confirm belongs to, and report the
+ *             confirm to the gateway if one waits for it.
+ *
+ * @param      pDataCnf - the MAC data confirm
+ * @param      pDone - filled in with the request
+ *
+ * @return     true if the request was found
+ */
+static bool processTxTrack(ApiMac_mcpsDataCnf_t *pDataCnf, txTrack_t *pDone)
+{
+    txTrack_t *pTrack;
+
+    pDone->inUse = false;
+    MUTEX_lock(txTrackMutex, -1);
+    pTrack = &txTrack[pDataCnf->msduHandle & MSDU_HANDLE_MAX];
+    if(pTrack->inUse && (pTrack->msduHandle == pDataCnf->msduHandle))
+    {
+        *pDone = *pTrack;
+        pTrack->inUse = false;
+    }
+    MUTEX_unLock(txTrackMutex);
+
+    if(pDone->inUse && pDone->hasCorrId)
+    {
+        Csf_txDataCnf(pDone->connId, pDone->corrId, pDataCnf->status,
+                      txTrackNowMs() - pDone->startMs);
+    }
+    return (pDone->inUse);
+}
+
+/*!
+ * @brief      A fragmented custom command ended, report it like a data
+ *             confirm when a gateway waits for it.
+ *
+ * @param      pResult - outcome of the transfer
+ */
+static void fragTxDone(const Frag_txResult_t *pResult)
+{
+    int status;
+
+    if(pResult->hasCorrId)
+    {
+        switch(pResult->status)
+        {
+            case Frag_status_success:
+                status = ApiMac_status_success;
+                break;
+            case Frag_status_sendFailed:
+                status = ApiMac_status_transactionOverflow;
+                break;
+            default:
+                status = ApiMac_status_noAck;
+                break;
+        }
+        Csf_txDataCnf(pResult->connId, pResult->corrId, status,
+                      pResult->durationMs);
+    }
+    Csf_customFragTxDone(pResult);
+}
+
 /*!
  * @brief      Send MAC broadcast data request.
  *             This function can be used to send broadcast messages
@@ -1880,7 +2532,10 @@ static void sendBroadcastMsg(Smsgs_cmdIds_t type, uint16_t len,
 
     dataReq.dstPanId = devicePanId;
 
-    dataReq.msduHandle = getMsduHandle(type);
+    if(getMsduHandle(type, &dataReq.msduHandle) == false)
+    {
+        return;
+    }
 
     dataReq.txOptions.ack = false;
     dataReq.txOptions.indirect = false;
@@ -1894,8 +2549,13 @@ static void sendBroadcastMsg(Smsgs_cmdIds_t type, uint16_t len,
     Cllc_securityFill(&dataReq.sec);
 #endif /* FEATURE_MAC_SECURITY */
 
-    /* Send the message */
-    ApiMac_mcpsDataReq(&dataReq);
+    /* Send the message, no confirm frees the handle if it fails */
+    if(ApiMac_mcpsDataReq(&dataReq) != ApiMac_status_success)
+    {
+        MUTEX_lock(txTrackMutex, -1);
+        txTrack[dataReq.msduHandle & MSDU_HANDLE_MAX].inUse = false;
+        MUTEX_unLock(txTrackMutex);
+    }
 }
 
 /*!
@@ -1958,7 +2618,7 @@ static void generateConfigRequests(void)
                     stat = Collector_sendConfigRequest(
                                     &dstAddr, (CONFIG_FRAME_CONTROL),
                                     (CONFIG_REPORTING_INTERVAL),
-                                    (CONFIG_POLLING_INTERVAL));
+                                    (CONFIG_POLLING_INTERVAL), NULL, 0);
                     if(stat == Collector_status_success)
                     {
                         /*
@@ -1978,142 +2638,226 @@ static void generateConfigRequests(void)
 
 
 /*!
- * @brief      Generate Tracking Requests for all associate devices
- *             that need one.
+ * @brief      Start the tracking scheduler: every tracking slot picks a
+ *             device. From then on each slot runs on its own timer.
  */
 static void generateTrackingRequests(void)
 {
     int x;
 
-    /* Run through all of the devices, looking for previous activity */
-    for(x = 0; x < CONFIG_MAX_DEVICES; x++)
+    if(CERTIFICATION_TEST_MODE)
+    {
+        /* In Certification mode only back to back uplink
+         * data traffic shall be supported*/
+        return;
+    }
+
+    if(trackingStarted == false)
+    {
+        trackingStarted = true;
+        for(x = 0; x < Collector_trackingWindow; x++)
+        {
+            trackingSlotNext(&trackingSlots[x]);
+        }
+    }
+}
+
+/*!
+ * @brief      Set (or move) the deadline of a tracking slot
+ *
+ * @param      pSlot - the slot
+ * @param      ms - from now, in milliseconds
+ */
+static void trackingSchedule(trackingSlot_t *pSlot, uint32_t ms)
+{
+    TimerWheel_arm(&pSlot->timer, ms);
+}
+
+/*!
+ * @brief      Timer wheel function of the tracking slots
+ *
+ * @param      cookie - index of the slot
+ */
+static void trackingSlotTimeout(intptr_t cookie)
+{
+    trackingSlot_t *pSlot = &trackingSlots[cookie];
+
+    if(CERTIFICATION_TEST_MODE)
+    {
+        /* Check again later */
+        trackingSchedule(pSlot, TRACKING_DELAY_TIME);
+        return;
+    }
+    trackingSlotExpired(pSlot);
+}
+
+/*!
+ * @brief      Deadline of a tracking slot passed
+ *
+ * @param      pSlot - the slot
+ */
+static void trackingSlotExpired(trackingSlot_t *pSlot)
+{
+    Cllc_associated_devices_t *pDev = NULL;
+    uint16_t status;
+
+    if((pSlot->devIdx >= 0) &&
+       (Cllc_associatedDevList[pSlot->devIdx].shortAddr == pSlot->shortAddr))
+    {
+        pDev = &Cllc_associatedDevList[pSlot->devIdx];
+    }
+    pSlot->cnfPending = false;
+
+    if(pDev != NULL)
     {
-        if(CERTIFICATION_TEST_MODE)
+        status = pDev->status;
+
+        /*
+         Has the device been sent a tracking request or received a
+         tracking response?
+         */
+        if(status & ASSOC_TRACKING_RETRY)
         {
-            /* In Certification mode only back to back uplink
-             * data traffic shall be supported*/
+            trackingSend(pSlot, pSlot->devIdx);
             return;
         }
-        /* Make sure the entry is valid. */
-        if((Cllc_associatedDevList[x].shortAddr != CSF_INVALID_SHORT_ADDR)
-             && (Cllc_associatedDevList[x].status & CLLC_ASSOC_STATUS_ALIVE))
+
+        if(status & (ASSOC_TRACKING_SENT | ASSOC_TRACKING_ERROR))
         {
-            uint16_t status = Cllc_associatedDevList[x].status;
+            ApiMac_deviceDescriptor_t devInfo;
+            Llc_deviceListItem_t item;
+            ApiMac_sAddr_t devAddr;
 
             /*
-             Has the device been sent a tracking request or received a
-             tracking response?
+             Timeout occured, notify the user that the tracking
+             failed.
              */
-            if(status & ASSOC_TRACKING_RETRY)
-            {
-                sendTrackingRequest(&Cllc_associatedDevList[x]);
-                return;
-            }
-            else if((status & (ASSOC_TRACKING_SENT | ASSOC_TRACKING_RSP
-                               | ASSOC_TRACKING_ERROR)))
-            {
-                Cllc_associated_devices_t *pDev = NULL;
-                int y;
+            memset(&devInfo, 0, sizeof(ApiMac_deviceDescriptor_t));
 
-                if(status & (ASSOC_TRACKING_SENT | ASSOC_TRACKING_ERROR))
-                {
-                    ApiMac_deviceDescriptor_t devInfo;
-                    Llc_deviceListItem_t item;
-                    ApiMac_sAddr_t devAddr;
-
-                    /*
-                     Timeout occured, notify the user that the tracking
-                     failed.
-                     */
-                    memset(&devInfo, 0, sizeof(ApiMac_deviceDescriptor_t));
-
-                    devAddr.addrMode = ApiMac_addrType_short;
-                    devAddr.addr.shortAddr =
-                        Cllc_associatedDevList[x].shortAddr;
+            devAddr.addrMode = ApiMac_addrType_short;
+            devAddr.addr.shortAddr = pDev->shortAddr;
 
-                    if(Csf_getDevice(&devAddr, &item))
-                    {
-                        memcpy(&devInfo.extAddress,
-                               &item.devInfo.extAddress,
-                               sizeof(ApiMac_sAddrExt_t));
-                    }
-                    devInfo.shortAddress = Cllc_associatedDevList[x].shortAddr;
-                    devInfo.panID = devicePanId;
-                    Csf_deviceNotActiveUpdate(&devInfo,
-                        ((status & ASSOC_TRACKING_SENT) ? true : false));
-
-                    /* Not responding, so remove the alive marker */
-                    Cllc_associatedDevList[x].status
-                            &= ~(CLLC_ASSOC_STATUS_ALIVE
-                                | ASSOC_CONFIG_SENT | ASSOC_CONFIG_RSP);
-                }
+            if(Csf_getDevice(&devAddr, &item))
+            {
+                memcpy(&devInfo.extAddress,
+                       &item.devInfo.extAddress,
+                       sizeof(ApiMac_sAddrExt_t));
+            }
+            devInfo.shortAddress = pDev->shortAddr;
+            devInfo.panID = devicePanId;
+            Csf_deviceNotActiveUpdate(&devInfo,
+                ((status & ASSOC_TRACKING_SENT) ? true : false));
+
+            /* Not responding, so remove the alive marker */
+            pDev->status &= ~(CLLC_ASSOC_STATUS_ALIVE
+                              | ASSOC_CONFIG_SENT | ASSOC_CONFIG_RSP);
+        }
 
-                /* Clear the tracking bits */
-                Cllc_associatedDevList[x].status  &= ~(ASSOC_TRACKING_ERROR
-                                | ASSOC_TRACKING_SENT | ASSOC_TRACKING_RSP);
+        /* Clear the tracking bits */
+        pDev->status &= ~(ASSOC_TRACKING_ERROR
+                          | ASSOC_TRACKING_SENT | ASSOC_TRACKING_RSP);
+    }
 
-                /* Find the next valid device */
-                y = x;
-                while(pDev == NULL)
-                {
-                    /* Get the very first active and alive device */
-                    if((Cllc_associatedDevList[y].shortAddr != CSF_INVALID_SHORT_ADDR)
-                            && (Cllc_associatedDevList[y].status
-                                    & CLLC_ASSOC_STATUS_ALIVE))
-                    {
-                        pDev = &Cllc_associatedDevList[y];
-                    }
+    trackingSlotNext(pSlot);
+}
 
-                    /* Check for rollover */
-                    if(y == (CONFIG_MAX_DEVICES-1))
-                    {
-                        /* Move to the beginning */
-                        y = 0;
-                    }
-                    else
-                    {
-                        /* Move the the next device */
-                        y++;
-                    }
+/*!
+ * @brief      Move a tracking slot on to the next device that needs
+ *             tracking, round robin over the association table
+ *
+ * @param      pSlot - the slot
+ */
+static void trackingSlotNext(trackingSlot_t *pSlot)
+{
+    int n;
+    int x;
+    int y;
 
-                    if(y == x)
-                    {
-                        /* We've come back around */
-                        break;
-                    }
-                }
+    pSlot->devIdx = -1;
+    for(n = 0; n < CONFIG_MAX_DEVICES; n++)
+    {
+        x = trackingCursor;
+        trackingCursor = (trackingCursor + 1) % CONFIG_MAX_DEVICES;
 
-                /* Make sure a sensor actually exists before sending */
-                if(pDev != NULL)
-                {
-                    /* Only send the tracking request if you are in the commissioned state for SM only
-                    * this is handled inside of the sendTrackingRequest function */
-                    sendTrackingRequest(pDev);
-                }
+        /* Make sure the entry is valid. */
+        if((Cllc_associatedDevList[x].shortAddr == CSF_INVALID_SHORT_ADDR)
+           || !(Cllc_associatedDevList[x].status & CLLC_ASSOC_STATUS_ALIVE))
+        {
+            continue;
+        }
 
-                /* Only do one at a time */
-                return;
+        /* and that no other slot tracks it already */
+        for(y = 0; y < Collector_trackingWindow; y++)
+        {
+            if(trackingSlots[y].devIdx == x)
+            {
+                break;
             }
         }
+        if(y == Collector_trackingWindow)
+        {
+            /* Only send the tracking request if you are in the commissioned state for SM only
+            * this is handled inside of the sendTrackingRequest function */
+            trackingSend(pSlot, x);
+            return;
+        }
     }
 
-    /* If no activity found, find the first active device */
-    for(x = 0; x < CONFIG_MAX_DEVICES; x++)
+    /* No device found, Setup delay for next tracking message */
+    trackingSchedule(pSlot, TRACKING_DELAY_TIME);
+}
+
+/*!
+ * @brief      Send a tracking request from a tracking slot
+ *
+ * @param      pSlot - the slot
+ * @param      devIdx - association table slot of the device
+ */
+static void trackingSend(trackingSlot_t *pSlot, int devIdx)
+{
+    Cllc_associated_devices_t *pDev = &Cllc_associatedDevList[devIdx];
+
+    pSlot->devIdx = devIdx;
+    pSlot->shortAddr = pDev->shortAddr;
+    if(sendTrackingRequest(pDev, &pSlot->msduHandle) == true)
     {
-        /* Make sure the entry is valid. */
-        if((Cllc_associatedDevList[x].shortAddr != CSF_INVALID_SHORT_ADDR)
-              && (Cllc_associatedDevList[x].status & CLLC_ASSOC_STATUS_ALIVE))
+        pSlot->cnfPending = true;
+
+        /* Setup Timeout for response */
+        trackingSchedule(pSlot, TRACKING_TIMEOUT_TIME);
+    }
+    else
+    {
+        /* The MAC did not take it, a retry that fails counts as error */
+        if(pDev->status & ASSOC_TRACKING_RETRY)
         {
-            sendTrackingRequest(&Cllc_associatedDevList[x]);
-            break;
+            pDev->status &= ~ASSOC_TRACKING_RETRY;
+            pDev->status |= ASSOC_TRACKING_ERROR;
         }
+        trackingSchedule(pSlot, TRACKING_CNF_DELAY_TIME);
     }
+}
 
-    if(x == CONFIG_MAX_DEVICES)
+/*!
+ * @brief      Find the tracking slot tracking a device
+ *
+ * @param      shortAddr - device's short address
+ *
+ * @return     the slot, NULL if none
+ */
+static trackingSlot_t *trackingFindSlot(uint16_t shortAddr)
+{
+    int x;
+
+    for(x = 0; x < Collector_trackingWindow; x++)
     {
-        /* No device found, Setup delay for next tracking message */
-        Csf_setTrackingClock(TRACKING_DELAY_TIME);
+        if((trackingSlots[x].devIdx >= 0) &&
+           (trackingSlots[x].shortAddr == shortAddr))
+        {
+            return (&trackingSlots[x]);
+        }
     }
+    return (NULL);
 }
 
 /*!
@@ -2134,28 +2878,657 @@ static void generateBroadcastCmd(void)
 }
 
 /*!
- * @brief      Generate Tracking Requests for a device
+ * @brief      Build a config request message
  *
- * @param      pDev - pointer to the device's associate device table entry
+ * @param      pBuf - SMSGS_CONFIG_REQUEST_MSG_LENGTH bytes
+ * @param      frameControl - what the device is to report
+ * @param      reportingInterval - in milliseconds
+ * @param      pollingInterval - in milliseconds
  */
-static void sendTrackingRequest(Cllc_associated_devices_t *pDev)
+static void buildConfigRequest(uint8_t *pBuf, uint16_t frameControl,
+                               uint32_t reportingInterval,
+                               uint32_t pollingInterval)
 {
-    uint8_t cmdId = Smsgs_cmdIds_trackingReq;
+    *pBuf++ = (uint8_t)Smsgs_cmdIds_configReq;
+    *pBuf++ = Util_loUint16(frameControl);
+    *pBuf++ = Util_hiUint16(frameControl);
+    *pBuf++ = Util_breakUint32(reportingInterval, 0);
+    *pBuf++ = Util_breakUint32(reportingInterval, 1);
+    *pBuf++ = Util_breakUint32(reportingInterval, 2);
+    *pBuf++ = Util_breakUint32(reportingInterval, 3);
+    *pBuf++ = Util_breakUint32(pollingInterval, 0);
+    *pBuf++ = Util_breakUint32(pollingInterval, 1);
+    *pBuf++ = Util_breakUint32(pollingInterval, 2);
+    *pBuf = Util_breakUint32(pollingInterval, 3);
+}
 
-    /* Send the Tracking Request */
-   if((sendMsg(Smsgs_cmdIds_trackingReq, pDev->shortAddr,
-            pDev->capInfo.rxOnWhenIdle,
-            (SMSGS_TRACKING_REQUEST_MSG_LENGTH),
-            &cmdId)) == true)
-    {
-        /* Mark as Tracking Request sent */
-        pDev->status |= ASSOC_TRACKING_SENT;
+/*!
+ * @brief      Run the config rollout: give up waiting on devices whose
+ *             deadline passed, send the next config requests as far as
+ *             the window and the pacing allow, and set the clock for
+ *             the next thing to do.
+ */
+static void processRollout(void)
+{
+    uint32_t now;
+    uint32_t wait;
+    int pending;
+    int x;
+    int y;
 
-        /* Setup Timeout for response */
-        Csf_setTrackingClock(TRACKING_TIMEOUT_TIME);
+    MUTEX_lock(rolloutMutex, -1);
+    if(rolloutState != Collector_rollout_running)
+    {
+        MUTEX_unLock(rolloutMutex);
+        return;
+    }
+
+    if(rolloutAllDevices)
+    {
+        rolloutAllDevices = false;
+        for(x = 0; x < CONFIG_MAX_DEVICES; x++)
+        {
+            if((Cllc_associatedDevList[x].shortAddr != CSF_INVALID_SHORT_ADDR)
+               && (Cllc_associatedDevList[x].status & CLLC_ASSOC_STATUS_ALIVE))
+            {
+                rolloutEntries[rolloutN++].shortAddr =
+                    Cllc_associatedDevList[x].shortAddr;
+            }
+        }
+    }
+
+    now = txTrackNowMs();
+
+    /* Keep the window full, one config request per pacing interval */
+    if((rolloutInFlight < rolloutCfg.window)
+       && ((int32_t)(now - rolloutNextSendMs) >= 0))
+    {
+        for(y = 0; y < rolloutN; y++)
+        {
+            x = rolloutCursor;
+            rolloutCursor = (rolloutCursor + 1) % rolloutN;
+            if(rolloutEntries[x].state == rollout_pending)
+            {
+                rolloutSend(&rolloutEntries[x], now);
+                rolloutNextSendMs = now + rolloutCfg.pacing_mSecs;
+                break;
+            }
+        }
+    }
+
+    /* What to wait for next, the devices in flight have their own timers */
+    pending = 0;
+    wait = 0;
+    for(x = 0; x < rolloutN; x++)
+    {
+        if(rolloutEntries[x].state == rollout_pending)
+        {
+            pending++;
+        }
+    }
+    if((pending != 0) && (rolloutInFlight < rolloutCfg.window))
+    {
+        if((int32_t)(rolloutNextSendMs - now) <= 0)
+        {
+            wait = 1;
+        }
+        else
+        {
+            wait = rolloutNextSendMs - now;
+        }
+    }
+
+    if((pending == 0) && (rolloutInFlight == 0))
+    {
+        rolloutState = Collector_rollout_done;
+        rolloutEndMs = now;
+        Csf_setRolloutClock(0);
+        LOG_printf(LOG_DBG_COLLECTOR, "config rollout done, %d devices\n",
+                   rolloutN);
+    }
+    else
+    {
+        /* 0: only a confirm, a response or a timeout wakes it up */
+        Csf_setRolloutClock(wait);
+    }
+    MUTEX_unLock(rolloutMutex);
+}
+
+/*!
+ * @brief      Send the rollout config request to a device
+ *
+ * @param      pEntry - the device
+ * @param      now - txTrackNowMs()
+ */
+static void rolloutSend(rolloutEntry_t *pEntry, uint32_t now)
+{
+    Cllc_associated_devices_t *pDev;
+    uint8_t buffer[SMSGS_CONFIG_REQUEST_MSG_LENGTH];
+    uint32_t timeout;
+
+    pEntry->tries++;
+    pDev = Cllc_findDevice(pEntry->shortAddr);
+    if(pDev == NULL)
+    {
+        /* Not (any more) in the network */
+        pEntry->state = rollout_failed;
+        return;
+    }
+
+    buildConfigRequest(buffer, rolloutCfg.frameControl,
+                       rolloutCfg.reportingInterval,
+                       rolloutCfg.pollingInterval);
+    if(sendMsgTracked(Smsgs_cmdIds_configReq, pEntry->shortAddr,
+                      pDev->capInfo.rxOnWhenIdle,
+                      (SMSGS_CONFIG_REQUEST_MSG_LENGTH), buffer, NULL, 0,
+                      &pEntry->msduHandle) == true)
+    {
+        pEntry->state = rollout_sent;
+        rolloutInFlight++;
+        rolloutSent++;
+        Collector_statistics.configRequestAttempts++;
+
+        /*
+         * Sleepy devices pick the request up on their next poll, at the
+         * interval they run now, not the one being rolled out
+         */
+        timeout = CONFIG_RESPONSE_DELAY;
+        if(pDev->capInfo.rxOnWhenIdle == false)
+        {
+            if(pDev->pollingInterval != 0)
+            {
+                timeout += 2 * pDev->pollingInterval;
+            }
+            else
+            {
+                timeout += 2 * CONFIG_POLLING_INTERVAL;
+            }
+        }
+        pEntry->deadlineMs = now + timeout;
+        TimerWheel_arm(&pEntry->timer, timeout);
+    }
+    else if(pEntry->tries >= COLLECTOR_ROLLOUT_MAX_TRIES)
+    {
+        pEntry->state = rollout_failed;
+    }
+}
+
+/*!
+ * @brief      A rollout config request failed or was not answered:
+ *             send it again later, or give up on the device
+ *
+ * @param      pEntry - the device, rollout_sent or rollout_acked
+ */
+static void rolloutGiveUp(rolloutEntry_t *pEntry)
+{
+    TimerWheel_cancel(&pEntry->timer);
+    rolloutInFlight--;
+    if(pEntry->tries >= COLLECTOR_ROLLOUT_MAX_TRIES)
+    {
+        pEntry->state = rollout_failed;
+    }
+    else
+    {
+        pEntry->state = rollout_pending;
+    }
+}
+
+/*!
+ * @brief      Timer wheel function of the rollout devices: no response
+ *             in time
+ *
+ * @param      cookie - index of the device in the rollout
+ */
+static void rolloutTimeout(intptr_t cookie)
+{
+    rolloutEntry_t *pEntry;
+
+    MUTEX_lock(rolloutMutex, -1);
+    if((rolloutState == Collector_rollout_running) && (cookie < rolloutN))
+    {
+        pEntry = &rolloutEntries[cookie];
+
+        /* it may have gone off just as a new rollout replaced this one */
+        if(((pEntry->state == rollout_sent) || (pEntry->state == rollout_acked))
+           && ((int32_t)(txTrackNowMs() - pEntry->deadlineMs) >= 0))
+        {
+            /* send again or give up */
+            rolloutGiveUp(pEntry);
+            Util_setEvent(&Collector_events, COLLECTOR_ROLLOUT_EVT);
+        }
+    }
+    MUTEX_unLock(rolloutMutex);
+}
+
+/*!
+ * @brief      Find a device in the running rollout
+ *
+ * @param      shortAddr - the device
+ *
+ * @return     the rollout entry, NULL if none
+ */
+static rolloutEntry_t *rolloutFind(uint16_t shortAddr)
+{
+    int x;
+
+    if(rolloutState != Collector_rollout_running)
+    {
+        return (NULL);
+    }
+    for(x = 0; x < rolloutN; x++)
+    {
+        if(rolloutEntries[x].shortAddr == shortAddr)
+        {
+            return (&rolloutEntries[x]);
+        }
+    }
+    return (NULL);
+}
+
+/*!
+ * @brief      Data confirm of a config request, for the rollout
+ *
+ * @param      shortAddr - where the request went
+ * @param      msduHandle - the request's MSDU handle
+ * @param      status - ApiMac_status_t of the confirm
+ */
+static void rolloutDataCnf(uint16_t shortAddr, uint8_t msduHandle,
+                           uint8_t status)
+{
+    rolloutEntry_t *pEntry;
+
+    MUTEX_lock(rolloutMutex, -1);
+    pEntry = rolloutFind(shortAddr);
+    if((pEntry != NULL) && (pEntry->state == rollout_sent)
+       && (pEntry->msduHandle == msduHandle))
+    {
+        if(status == ApiMac_status_success)
+        {
+            pEntry->state = rollout_acked;
+        }
+        else
+        {
+            rolloutGiveUp(pEntry);
+            Util_setEvent(&Collector_events, COLLECTOR_ROLLOUT_EVT);
+        }
+    }
+    MUTEX_unLock(rolloutMutex);
+}
+
+/*!
+ * @brief      Config response from a device, for the rollout. Only a
+ *             success with the settings of the rollout counts, anything
+ *             else is a failed try.
+ *
+ * @param      shortAddr - the device
+ * @param      pRsp - the parsed response, NULL if it could not be parsed
+ */
+static void rolloutConfigRsp(uint16_t shortAddr, Smsgs_configRspMsg_t *pRsp)
+{
+    rolloutEntry_t *pEntry;
+
+    MUTEX_lock(rolloutMutex, -1);
+    pEntry = rolloutFind(shortAddr);
+    if((pEntry != NULL) && ((pEntry->state == rollout_sent)
+                            || (pEntry->state == rollout_acked)))
+    {
+        if((pRsp != NULL)
+           && (pRsp->status == Smsgs_statusValues_success)
+           && (pRsp->frameControl == rolloutCfg.frameControl)
+           && (pRsp->reportingInterval == rolloutCfg.reportingInterval)
+           && (pRsp->pollingInterval == rolloutCfg.pollingInterval))
+        {
+            pEntry->state = rollout_configured;
+            TimerWheel_cancel(&pEntry->timer);
+            rolloutInFlight--;
+        }
+        else
+        {
+            LOG_printf(LOG_DBG_COLLECTOR,
+                       "config rollout: 0x%04x rejected, status %d, try %d\n",
+                       shortAddr, (pRsp != NULL) ? (int)pRsp->status : -1,
+                       pEntry->tries);
+
+            /* send again or give up */
+            rolloutGiveUp(pEntry);
+        }
+
+        /* Room in the window */
+        Util_setEvent(&Collector_events, COLLECTOR_ROLLOUT_EVT);
+    }
+    MUTEX_unLock(rolloutMutex);
+}
+
+/*!
+ * @brief      Find the downlink queue of a device, call with dlqMutex
+ *             held. A queue left over from a device that is gone is
+ *             emptied first.
+ *
+ * @param      shortAddr - the device
+ *
+ * @return     the queue, NULL if the device is not associated
+ */
+static dlq_t *dlqFind(uint16_t shortAddr)
+{
+    Cllc_associated_devices_t *pDev;
+    dlqMsg_t *pMsg;
+    dlq_t *pQ;
+
+    pDev = Cllc_findDevice(shortAddr);
+    if(pDev == NULL)
+    {
+        return (NULL);
+    }
+
+    pQ = &dlqs[pDev - Cllc_associatedDevList];
+    if(pQ->shortAddr != shortAddr)
+    {
+        while(pQ->pHead != NULL)
+        {
+            pMsg = pQ->pHead;
+            pQ->pHead = pMsg->pNext;
+            dlqHeld--;
+            dlqSupersede(pMsg->dataReq.msduHandle);
+            free(pMsg);
+        }
+        TimerWheel_cancel(&pQ->expiry);
+        memset(pQ, 0, sizeof(dlq_t));
+        pQ->shortAddr = shortAddr;
+        TimerWheel_setup(&pQ->expiry, dlqExpire, pQ - dlqs);
+    }
+    return (pQ);
+}
+
+/*!
+ * @brief      Decide what happens to an indirect message: it goes to
+ *             the MAC when the device has less than COLLECTOR_DLQ_RELEASE
+ *             frames there and nothing waiting, else it waits (a copy)
+ *             until the device polls. A waiting config or tracking
+ *             request is replaced by a newer one.
+ *
+ * @param      pDataReq - the data request, MSDU handle filled in
+ * @param      type - message type
+ * @param      pOldHandle - for dlq_coalesced, the MSDU handle of the
+ *                          message that was replaced
+ *
+ * @return     what to do with it
+ */
+static dlqResult_t dlqSubmit(ApiMac_mcpsDataReq_t *pDataReq,
+                             Smsgs_cmdIds_t type, uint8_t *pOldHandle)
+{
+    dlqResult_t result;
+    dlqMsg_t **ppThis;
+    dlqMsg_t *pMsg;
+    dlq_t *pQ;
+
+    if(pDataReq->dstAddr.addrMode != ApiMac_addrType_short)
+    {
+        return (dlq_send);
+    }
+
+    MUTEX_lock(dlqMutex, -1);
+    pQ = dlqFind(pDataReq->dstAddr.addr.shortAddr);
+    if(pQ == NULL)
+    {
+        /* Not ours to keep track of */
+        MUTEX_unLock(dlqMutex);
+        return (dlq_send);
+    }
+
+    if((pQ->pHead == NULL) && (pQ->stats.atMac < COLLECTOR_DLQ_RELEASE))
+    {
+        pQ->stats.atMac++;
+        MUTEX_unLock(dlqMutex);
+        return (dlq_send);
+    }
+
+    pMsg = malloc(sizeof(dlqMsg_t) + pDataReq->msdu.len);
+    if(pMsg == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    pMsg->pNext = NULL;
+    pMsg->type = type;
+    pMsg->queuedMs = txTrackNowMs();
+    pMsg->dataReq = *pDataReq;
+    memcpy(pMsg->data, pDataReq->msdu.p, pDataReq->msdu.len);
+    pMsg->dataReq.msdu.p = pMsg->data;
+
+    /* A newer config or tracking request makes the waiting one moot */
+    ppThis = &pQ->pHead;
+    if((type == Smsgs_cmdIds_configReq) || (type == Smsgs_cmdIds_trackingReq))
+    {
+        while((*ppThis != NULL) && ((*ppThis)->type != type))
+        {
+            ppThis = &((*ppThis)->pNext);
+        }
+    }
+    else
+    {
+        ppThis = NULL;
+    }
+
+    if((ppThis != NULL) && (*ppThis != NULL))
+    {
+        /* Takes the old one's place in the queue */
+        *pOldHandle = (*ppThis)->dataReq.msduHandle;
+        pMsg->pNext = (*ppThis)->pNext;
+        pMsg->queuedMs = (*ppThis)->queuedMs;
+        if(pQ->pTail == *ppThis)
+        {
+            pQ->pTail = pMsg;
+        }
+        free(*ppThis);
+        *ppThis = pMsg;
+        pQ->stats.coalesced++;
+        result = dlq_coalesced;
+    }
+    else if((pQ->stats.depth >= COLLECTOR_DLQ_DEPTH)
+            || (dlqHeld >= COLLECTOR_DLQ_HELD_MAX))
+    {
+        free(pMsg);
+        pQ->stats.dropped++;
+        result = dlq_full;
+    }
+    else
+    {
+        if(pQ->pTail != NULL)
+        {
+            pQ->pTail->pNext = pMsg;
+        }
+        else
+        {
+            pQ->pHead = pMsg;
+            dlqArmExpiry(pQ);
+        }
+        pQ->pTail = pMsg;
+        pQ->stats.depth++;
+        pQ->stats.queued++;
+        if(pQ->stats.depth > pQ->stats.maxDepth)
+        {
+            pQ->stats.maxDepth = pQ->stats.depth;
+        }
+        dlqHeld++;
+        result = dlq_held;
+    }
+    MUTEX_unLock(dlqMutex);
+
+    return (result);
+}
+
+/*!
+ * @brief      A waiting message will never be sent, confirm it to the
+ *             gateway if one waits for it
+ *
+ * @param      msduHandle - its MSDU handle
+ */
+static void dlqSupersede(uint8_t msduHandle)
+{
+    ApiMac_mcpsDataCnf_t dataCnf;
+    txTrack_t done;
+
+    memset(&dataCnf, 0, sizeof(ApiMac_mcpsDataCnf_t));
+    dataCnf.msduHandle = msduHandle;
+    dataCnf.status = ApiMac_status_transactionExpired;
+    processTxTrack(&dataCnf, &done);
+}
+
+/*!
+ * @brief      The MAC is done with an indirect frame for a device
+ *
+ * @param      shortAddr - the device
+ */
+static void dlqMacDone(uint16_t shortAddr)
+{
+    dlq_t *pQ;
+
+    MUTEX_lock(dlqMutex, -1);
+    pQ = dlqFind(shortAddr);
+    if((pQ != NULL) && (pQ->stats.atMac > 0))
+    {
+        pQ->stats.atMac--;
+    }
+    MUTEX_unLock(dlqMutex);
+}
+
+/*!
+ * @brief      Hand waiting messages of a device to the MAC, as far as
+ *             COLLECTOR_DLQ_RELEASE allows
+ *
+ * @param      shortAddr - the device
+ */
+static void dlqRelease(uint16_t shortAddr)
+{
+    ApiMac_mcpsDataCnf_t dataCnf;
+    dlqMsg_t *pMsg;
+    dlq_t *pQ;
+    uint32_t wait;
+
+    for(;;)
+    {
+        pMsg = NULL;
+        MUTEX_lock(dlqMutex, -1);
+        pQ = dlqFind(shortAddr);
+        if((pQ != NULL) && (pQ->pHead != NULL)
+           && (pQ->stats.atMac < COLLECTOR_DLQ_RELEASE))
+        {
+            pMsg = pQ->pHead;
+            pQ->pHead = pMsg->pNext;
+            if(pQ->pHead == NULL)
+            {
+                pQ->pTail = NULL;
+            }
+            dlqArmExpiry(pQ);
+            pQ->stats.depth--;
+            dlqHeld--;
+            pQ->stats.atMac++;
+            pQ->stats.released++;
+            wait = txTrackNowMs() - pMsg->queuedMs;
+            pQ->stats.waitTotal_mSecs += wait;
+            if(wait > pQ->stats.waitMax_mSecs)
+            {
+                pQ->stats.waitMax_mSecs = wait;
+            }
+        }
+        MUTEX_unLock(dlqMutex);
+
+        if(pMsg == NULL)
+        {
+            break;
+        }
+
+        txTrackHold(pMsg->dataReq.msduHandle, false);
+        if(ApiMac_mcpsDataReq(&pMsg->dataReq) != ApiMac_status_success)
+        {
+            /* Confirm it like the MAC would, that also frees its place */
+            memset(&dataCnf, 0, sizeof(ApiMac_mcpsDataCnf_t));
+            dataCnf.msduHandle = pMsg->dataReq.msduHandle;
+            dataCnf.status = ApiMac_status_transactionOverflow;
+            dataCnfCB(&dataCnf);
+        }
+        free(pMsg);
+    }
+}
+
+/*!
+ * @brief      Set the expiry timer of a queue for its first waiting
+ *             message, call with dlqMutex held
+ *
+ * @param      pQ - the queue
+ */
+static void dlqArmExpiry(dlq_t *pQ)
+{
+    uint32_t age;
+
+    if(pQ->pHead == NULL)
+    {
+        TimerWheel_cancel(&pQ->expiry);
+        return;
+    }
+
+    age = txTrackNowMs() - pQ->pHead->queuedMs;
+    TimerWheel_arm(&pQ->expiry, (age < COLLECTOR_DLQ_EXPIRY) ?
+                   (COLLECTOR_DLQ_EXPIRY - age) : 1);
+}
+
+/*!
+ * @brief      Timer wheel function of the downlink queues: give up the
+ *             messages that waited COLLECTOR_DLQ_EXPIRY
+ *
+ * @param      cookie - index of the queue
+ */
+static void dlqExpire(intptr_t cookie)
+{
+    dlq_t *pQ = &dlqs[cookie];
+    dlqMsg_t *pMsg;
+    uint32_t now;
+
+    MUTEX_lock(dlqMutex, -1);
+    now = txTrackNowMs();
+    while((pQ->pHead != NULL)
+          && ((now - pQ->pHead->queuedMs) >= COLLECTOR_DLQ_EXPIRY))
+    {
+        pMsg = pQ->pHead;
+        pQ->pHead = pMsg->pNext;
+        if(pQ->pHead == NULL)
+        {
+            pQ->pTail = NULL;
+        }
+        pQ->stats.depth--;
+        pQ->stats.expired++;
+        dlqHeld--;
+        dlqSupersede(pMsg->dataReq.msduHandle);
+        free(pMsg);
+    }
+    dlqArmExpiry(pQ);
+    MUTEX_unLock(dlqMutex);
+}
+
+/*!
+ * @brief      Generate Tracking Requests for a device
+ *
+ * @param      pDev - pointer to the device's associate device table entry
+ * @param      pMsduHandle - where to put the MSDU handle of the request
+ *
+ * @return     true if the MAC took it
+ */
+static bool sendTrackingRequest(Cllc_associated_devices_t *pDev,
+                                uint8_t *pMsduHandle)
+{
+    uint8_t cmdId = Smsgs_cmdIds_trackingReq;
+
+    /* Send the Tracking Request */
+   if((sendMsgTracked(Smsgs_cmdIds_trackingReq, pDev->shortAddr,
+            pDev->capInfo.rxOnWhenIdle,
+            (SMSGS_TRACKING_REQUEST_MSG_LENGTH),
+            &cmdId, NULL, 0, pMsduHandle)) == true)
+    {
+        /* Mark as Tracking Request sent */
+        pDev->status |= ASSOC_TRACKING_SENT;
 
         /* Update stats */
         Collector_statistics.trackingRequestAttempts++;
+        return (true);
     }
     else
     {
@@ -2163,6 +3536,7 @@ static void sendTrackingRequest(Cllc_associated_devices_t *pDev)
         devAddr.addrMode = ApiMac_addrType_short;
         devAddr.addr.shortAddr = pDev->shortAddr;
         processDataRetry(&devAddr);
+        return (false);
     }
 }
 
@@ -2209,6 +3583,9 @@ static void pollIndCB(ApiMac_mlmePollInd_t *pPollInd)
                         &pPollInd->srcAddr.addr.extAddr);
     }
 
+    /* Whatever waits for the device can go to the MAC now */
+    dlqRelease(addr.addr.shortAddr);
+
     processDataRetry(&addr);
 }
 
@@ -2261,11 +3638,11 @@ static void processDataRetry(ApiMac_sAddr_t *pAddr)
             /* Check to see if we need to send it a tracking message */
             if((pItem->status & (ASSOC_TRACKING_SENT| ASSOC_TRACKING_RETRY)) == 0)
             {
-                /* Make sure we aren't already doing a tracking message */
+                /* Make sure the tracking scheduler isn't running yet,
+                   once it is it always has a deadline pending */
                 if(((Collector_events & COLLECTOR_TRACKING_TIMEOUT_EVT) == 0)
                     && (Csf_isTrackingTimerActive() == false)
-                    && (findDeviceStatusBit(ASSOC_TRACKING_MASK,
-                                            ASSOC_TRACKING_SENT) == NULL))
+                    && (trackingStarted == false))
                 {
                     /* Setup for next tracking */
                     Csf_setTrackingClock(TRACKING_DELAY_TIME);
@@ -2377,6 +3754,25 @@ void* oadRadioAccessAllocMsg(uint32_t msgLen)
     return msgBuffer + 1;
 }
 
+/*!
+ * @brief      Radio access function for the fragmentation module, sends
+ *             one complete fragment or ack MSDU.
+ *
+ * @param      dstShortAddr - destination
+ * @param      rxOnIdle - false for sleepy devices
+ * @param      pMsg - the message, starting with its Smsgs_cmdId
+ * @param      len - fragment length
+ *
+ * @return     true if the MAC took the fragment
+ */
+static bool fragPacketSend(uint16_t dstShortAddr, bool rxOnIdle,
+                           uint8_t *pMsg, uint16_t len)
+{
+    /* fragments and acks */
+    return sendMsg((Smsgs_cmdIds_t)pMsg[0], dstShortAddr, rxOnIdle,
+                   len, pMsg);
+}
+
 /*!
  * @brief      Radio access function for OAD module to send messages
  */
@@ -46,6 +46,41 @@ extern "C"
 #define COLLECTOR_CONFIG_EVT 0x0004
 /*! Event ID - Broadcast Timeout Event */
 #define COLLECTOR_BROADCAST_TIMEOUT_EVT 0x0008
+/*! Event ID - Custom command fragmentation timer */
+#define COLLECTOR_FRAG_EVT 0x0010
+/*! Event ID - Config rollout clock */
+#define COLLECTOR_ROLLOUT_EVT 0x0020
+/*! Event ID - Timer wheel clock, run the timers that are due */
+#define COLLECTOR_WHEEL_EVT 0x0040
+
+/*! Tracking requests in flight at the same time, default for
+    Collector_trackingWindow */
+#define COLLECTOR_TRACKING_WINDOW 4
+/*! Upper bound for Collector_trackingWindow. Every request in flight
+    holds one of the 64 MSDU handles until its confirm, and so do up to
+    COLLECTOR_DLQ_HELD_MAX queued sleepy messages */
+#define COLLECTOR_TRACKING_WINDOW_MAX 16
+
+/*! Config rollout: devices waiting for a response at the same time,
+    used when the request asks for 0 */
+#define COLLECTOR_ROLLOUT_WINDOW 4
+/*! Config rollout: least time between two config requests in
+    milliseconds, used when the request asks for 0 */
+#define COLLECTOR_ROLLOUT_PACING 250
+/*! Config rollout: config requests sent to a device before giving up */
+#define COLLECTOR_ROLLOUT_MAX_TRIES 3
+
+/*! Sleepy devices: frames in the MAC's indirect queue per device, the
+    rest waits in the collector until the device polls */
+#define COLLECTOR_DLQ_RELEASE 1
+/*! Sleepy devices: messages waiting in the collector per device */
+#define COLLECTOR_DLQ_DEPTH 8
+/*! Messages waiting for all sleepy devices together, each of them
+    holds on to its MSDU handle */
+#define COLLECTOR_DLQ_HELD_MAX 24
+/*! Sleepy devices: a message that waited this long in the collector,
+    in milliseconds, is given up and confirmed as expired */
+#define COLLECTOR_DLQ_EXPIRY (5 * 60 * 1000)
 
 /*! Collector Status Values */
 typedef enum
@@ -60,6 +95,10 @@ typedef enum
     Collector_status_invalid_file = 3,
     /*! Collector cannot locate the file_id provided */
     Collector_status_invalid_file_id = 4,
+    /*! All fragmentation slots are in use, try again later */
+    Collector_status_busy = 5,
+    /*! Message too long */
+    Collector_status_too_long = 6,
 } Collector_status_t;
 
 /* Beacon order for non beacon network */
@@ -159,6 +198,77 @@ typedef struct
     uint16_t broadcastMsgSentCnt;
 } Collector_statistics_t;
 
+/*! Config rollout states */
+typedef enum
+{
+    /*! No rollout was started */
+    Collector_rollout_idle = 0,
+    /*! Config requests are going out */
+    Collector_rollout_running = 1,
+    /*! Every device is either configured or failed */
+    Collector_rollout_done = 2
+} Collector_rolloutState_t;
+
+/*! What a config rollout sends, and how fast */
+typedef struct
+{
+    /*! The config request, see Collector_sendConfigRequest() */
+    uint16_t frameControl;
+    uint32_t reportingInterval;
+    uint32_t pollingInterval;
+    /*! Devices waiting for a response at the same time,
+        0: COLLECTOR_ROLLOUT_WINDOW */
+    uint8_t window;
+    /*! Least time between two config requests in milliseconds,
+        this is the airtime budget, 0: COLLECTOR_ROLLOUT_PACING */
+    uint16_t pacing_mSecs;
+} Collector_rolloutCfg_t;
+
+/*! Config rollout progress */
+typedef struct
+{
+    Collector_rolloutState_t state;
+    /*! Devices in the rollout */
+    uint16_t total;
+    /*! Devices that still need a config request */
+    uint16_t pending;
+    /*! Devices waiting for the confirm or the config response */
+    uint16_t inFlight;
+    /*! Devices that answered with a config response */
+    uint16_t configured;
+    /*! Devices given up on after COLLECTOR_ROLLOUT_MAX_TRIES */
+    uint16_t failed;
+    /*! Config requests the MAC took, retries included */
+    uint32_t requestsSent;
+    /*! Time since the start, or the run time when done */
+    uint32_t elapsed_mSecs;
+    /*! Configured devices per hour so far */
+    uint32_t devicesPerHour;
+} Collector_rolloutProgress_t;
+
+/*! Downlink queue of a sleepy device */
+typedef struct
+{
+    /*! Messages waiting now, and the most that waited at once */
+    uint16_t depth;
+    uint16_t maxDepth;
+    /*! Frames in the MAC's indirect queue now */
+    uint8_t atMac;
+    /*! Messages that had to wait */
+    uint32_t queued;
+    /*! Waiting messages handed to the MAC */
+    uint32_t released;
+    /*! Waiting messages replaced by a newer one of the same type */
+    uint32_t coalesced;
+    /*! Messages refused because the queue was full */
+    uint32_t dropped;
+    /*! Waiting messages given up after COLLECTOR_DLQ_EXPIRY */
+    uint32_t expired;
+    /*! Time from queueing to release, sum and worst, in milliseconds */
+    uint32_t waitTotal_mSecs;
+    uint32_t waitMax_mSecs;
+} Collector_dlqStats_t;
+
 /******************************************************************************
  Global Variables
  *****************************************************************************/
@@ -171,6 +281,9 @@ extern Collector_statistics_t Collector_statistics;
 
 extern ApiMac_callbacks_t Collector_macCallbacks;
 
+/*! Tracking requests kept in flight (ini setting) */
+extern int Collector_trackingWindow;
+
 /******************************************************************************
  Function Prototypes
  *****************************************************************************/
@@ -198,6 +311,9 @@ extern void Collector_process(void);
  * @param pollingInterval - in milliseconds- how often to the device is to
  *                          poll its parent for data (for sleeping devices
  *                          only.
+ * @param pCorrId - if not NULL, Csf_txDataCnf() reports the MAC data
+ *                  confirm with this correlation id
+ * @param connId - passed back to Csf_txDataCnf() with pCorrId
  *
  * @return Collector_status_success, Collector_status_invalid_state
  *         or Collector_status_deviceNotFound
@@ -205,7 +321,49 @@ extern void Collector_process(void);
 extern Collector_status_t Collector_sendConfigRequest(ApiMac_sAddr_t *pDstAddr,
                 uint16_t frameControl,
                 uint32_t reportingInterval,
-                uint32_t pollingInterval);
+                uint32_t pollingInterval,
+                const uint32_t *pCorrId,
+                int connId);
+
+/*!
+ * @brief Start sending a config to a set of devices.
+ *
+ * The config requests go out from the collector thread, at most
+ * pCfg->window devices wait for their response at the same time and
+ * two requests are at least pCfg->pacing_mSecs apart. Devices that
+ * do not answer get the request again, up to
+ * COLLECTOR_ROLLOUT_MAX_TRIES times. A new rollout replaces the one
+ * that is running.
+ *
+ * @param pCfg - the config and the pacing
+ * @param pShortAddrs - the devices
+ * @param n - number of devices, 0: all devices that are alive
+ *
+ * @return Collector_status_success, Collector_status_invalid_state
+ *         or Collector_status_too_long
+ */
+extern Collector_status_t Collector_startConfigRollout(
+                const Collector_rolloutCfg_t *pCfg,
+                const uint16_t *pShortAddrs, uint16_t n);
+
+/*!
+ * @brief Get the progress of the last config rollout.
+ *
+ * @param pProgress - filled in
+ */
+extern void Collector_getConfigRolloutProgress(
+                Collector_rolloutProgress_t *pProgress);
+
+/*!
+ * @brief Get the downlink queue statistics of a sleepy device.
+ *
+ * @param shortAddr - the device
+ * @param pStats - filled in
+ *
+ * @return Collector_status_success or Collector_status_deviceNotFound
+ */
+extern Collector_status_t Collector_getDownlinkQueueStats(uint16_t shortAddr,
+                Collector_dlqStats_t *pStats);
 
 /*!
  * @brief Update the collector statistics
@@ -223,11 +381,30 @@ extern void Collector_updateStats( void );
 extern Collector_status_t Collector_sendToggleLedRequest(
                 ApiMac_sAddr_t *pDstAddr);
 
-
+/*!
+ * @brief Send a custom command to a device. With CONFIG_CUSTOM_FRAG,
+ *        commands that do not fit in one MSDU are sent in fragments,
+ *        the outcome of those is reported later through
+ *        Csf_customFragTxDone().
+ *
+ * @param pDstAddr - destination address of the device
+ * @param payload - the command
+ * @param length - command length, up to FRAG_MAX_LEN
+ * @param pCorrId - if not NULL, Csf_txDataCnf() reports the MAC data
+ *                  confirm (or the end of the fragmented transfer) with
+ *                  this correlation id
+ * @param connId - passed back to Csf_txDataCnf() with pCorrId
+ *
+ * @return Collector_status_success, Collector_status_invalid_state,
+ *         Collector_status_deviceNotFound, Collector_status_busy
+ *         or Collector_status_too_long
+ */
 extern Collector_status_t Collector_sendCustomCommand(
                 ApiMac_sAddr_t *pDstAddr,
                 uint8_t *payload,
-               uint16_t length);
+                uint16_t length,
+                const uint32_t *pCorrId,
+                int connId);
 
 /*!
  * @brief Build and send the device type request message to a device.
@@ -26,6 +26,8 @@
 #include "llc.h"
 #include "cllc.h"
 #include "smsgs.h"
+#include "frag.h"
+#include "collector.h"
 
 #ifndef __unix__
 #include "cui.h"
@@ -50,9 +52,15 @@ extern "C"
 #define CSF_KEY_EVENT 0x0001
 #define COLLECTOR_UI_INPUT_EVT            0x0002
 #define COLLECTOR_SENSOR_ACTION_EVT       0x0004
+/*! CSF Events - write the NV journal */
+#define CSF_JOURNAL_EVENT                 0x0008
+/*! CSF Events - write the NV journal and mark NV clean, we stop */
+#define CSF_SHUTDOWN_EVENT                0x0010
 
 #define CSF_INVALID_SHORT_ADDR            0xFFFF
 #define CSF_INVALID_SUBID                 0xFFFF
+/*! Csf_getNextDeviceItem() cursor for the first device */
+#define CSF_DEVICE_ITER_START             0
 
 #define SENSOR_ACTION_TOGGLE              0
 #define SENSOR_ACTION_SET_RPT_INT         1
@@ -259,6 +267,28 @@ extern void Csf_initializeBroadcastClock(void);
  */
 extern void Csf_setBroadcastClock(uint32_t trackingTime);
 
+/*!
+ * @brief       set the OS clock that drives the timer wheel, the wheel
+ *              calls this itself (see TimerWheel_init())
+ *
+ * @param       wheelTime - set timer this value (in msec), 0 stops it
+ */
+extern void Csf_setWheelClock(uint32_t wheelTime);
+
+/*!
+ * @brief       set the custom command fragmentation clock.
+ *
+ * @param       fragTime - set timer this value (in msec), 0 stops it
+ */
+extern void Csf_setFragClock(uint32_t fragTime);
+
+/*!
+ * @brief       set the config rollout clock.
+ *
+ * @param       rolloutTime - set timer this value (in msec), 0 stops it
+ */
+extern void Csf_setRolloutClock(uint32_t rolloutTime);
+
 /*!
  * @brief       Initialize the trickle timer clock
  */
@@ -332,6 +362,21 @@ extern bool Csf_getDevice(ApiMac_sAddr_t *pDevAddr, Llc_deviceListItem_t *pItem)
  */
 extern bool Csf_getDeviceItem(uint16_t devIndex, Llc_deviceListItem_t *pItem);
 
+/*!
+ * @brief       Walk the device list
+ *
+ * Start with CSF_DEVICE_ITER_START and pass the returned cursor back in
+ * until it is negative. Walking the whole list this way is one pass,
+ * calling Csf_getDeviceItem() for every index starts over each time.
+ *
+ * @param       cursor - where to continue
+ * @param       pItem - place to put the device information
+ *
+ * @return      cursor for the next call, negative if there are no more
+ *              devices (pItem is not written)
+ */
+extern int Csf_getNextDeviceItem(int cursor, Llc_deviceListItem_t *pItem);
+
 /*!
  * @brief       Find entry in device list
  *
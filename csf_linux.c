@@ -26,10 +26,14 @@
 #include <unistd.h>
 #include "nvintf.h"
 #include "nv_linux.h"
+#include "nv_mmap.h"
 #include "log.h"
 #include "mutex.h"
+#include "threads.h"
+#include "fatal.h"
 #include "ti_semaphore.h"
 #include "timer.h"
+#include "timer_wheel.h"
 #include "appsrv.h"
 #include "time.h"
 #include "mac_util.h"
@@ -54,17 +58,6 @@
 /* Initial timeout value for the tracking clock */
 #define TRACKING_INIT_TIMEOUT_VALUE 100
 
-/* NV Item ID - the device's network information */
-#define CSF_NV_NETWORK_INFO_ID 0x0001
-/* NV Item ID - the number of device list entries */
-#define CSF_NV_DEVICELIST_ENTRIES_ID 0x0004
-/* NV Item ID - the device list, use sub ID for each record in the list */
-#define CSF_NV_DEVICELIST_ID 0x0005
-/* NV Item ID - this devices frame counter */
-#define CSF_NV_FRAMECOUNTER_ID 0x0006
-/* NV Item ID - reset reason */
-#define CSF_NV_RESET_REASON_ID 0x0007
-
 /* Maximum number of device list entries */
 #define CSF_MAX_DEVICELIST_ENTRIES CONFIG_MAX_DEVICES
 
@@ -93,17 +86,41 @@
 #define OAD_RESET_REQ_MAX_RETRIES 3
 
 /*
- The increment value needed to save a frame counter. Example, setting this
- constant to 100, means that the frame counter will be saved when the new
- frame counter is 100 more than the last saved frame counter.  Also, when
- the get frame counter function reads the value from NV it will add this value
- to the read value.
+ The largest distance between this device's frame counter and the one in
+ NV. The journal writes the frame counter at the latest when the new frame
+ counter is this much more than the last saved one, and when the get frame
+ counter function reads the value from NV it adds this value to the read
+ value.
+ */
+#define FRAME_COUNTER_SAVE_WINDOW     1000
+
+/*
+ The same for the frame counters received from each device. After a crash
+ (no clean shutdown marker) the restored counters are rounded up by this
+ much, so frames that were accepted but not yet saved cannot be replayed.
  */
-#define FRAME_COUNTER_SAVE_WINDOW     25
+#define RX_FRAME_COUNTER_SAVE_WINDOW  25
 
 /* Value returned from findDeviceListIndex() when not found */
 #define DEVICE_INDEX_NOT_FOUND  -1
 
+/*! RAM copy of one device list record, indexed by its NV sub ID */
+typedef struct
+{
+    /*! The NV record exists */
+    bool inUse;
+    Llc_deviceListItem_t item;
+    /*! Next sub ID in the same short / extended address bucket, -1: none */
+    int32_t nextShort;
+    int32_t nextExt;
+    /*! Changed in RAM, not yet written to NV */
+    bool dirty;
+    /*! Next sub ID in the journal, -1: none */
+    int32_t nextDirty;
+    /*! The received frame counter in NV */
+    uint32_t savedRxFrameCounter;
+} devCacheEntry_t;
+
 /*! NV driver item ID for reset reason */
 #define NVID_RESET {NVINTF_SYSID_APP, CSF_NV_RESET_REASON_ID, 0}
 
@@ -162,22 +179,37 @@ fprintf(stderr,"\033[2J");
  External variables
  *****************************************************************************/
 
-/* handle for tracking timeout */
-static intptr_t trackingClkHandle;
-/* handle for PA trickle timeout */
-static intptr_t tricklePAClkHandle;
-/* handle for PC timeout */
-static intptr_t tricklePCClkHandle;
-/* handle for join permit timeout */
-static intptr_t joinClkHandle;
-/* handle for config request delay */
-static intptr_t configClkHandle;
-/* handle for broadcast interval */
-static intptr_t broadcastClkHandle;
+/*
+ * The timer wheel clock: one thread that sleeps until wheelClkDue (in
+ * CLOCK_MONOTONIC mSecs), woken up by wheelClkSem when it moves
+ */
+static intptr_t wheelClkSem;
+static intptr_t wheelClkMutex;
+static bool wheelClkArmed;
+static uint64_t wheelClkDue;
+
+/* tracking timeout */
+static TimerWheel_timer_t trackingTimer;
+/* PA trickle timeout */
+static TimerWheel_timer_t tricklePATimer;
+/* PC timeout */
+static TimerWheel_timer_t tricklePCTimer;
+/* join permit timeout */
+static TimerWheel_timer_t joinTimer;
+/* config request delay */
+static TimerWheel_timer_t configTimer;
+/* broadcast interval */
+static TimerWheel_timer_t broadcastTimer;
+/* custom command fragmentation */
+static TimerWheel_timer_t fragTimer;
+/* the config rollout */
+static TimerWheel_timer_t rolloutTimer;
+/* the NV journal flush */
+static TimerWheel_timer_t journalTimer;
 
 #ifndef IS_HEADLESS
-/* Handle for OAD reset request retries timeout */
-static intptr_t oadResetReqRetryClkHandle;
+/* OAD reset request retries timeout */
+static TimerWheel_timer_t oadResetReqRetryTimer;
 #endif
 
 extern intptr_t semaphore0;
@@ -191,6 +223,9 @@ NVINTF_nvFuncts_t nvFps;
 static intptr_t collectorSem;
 #define Semaphore_post(S)  SEMAPHORE_put(S)
 
+/* Posted by the collector thread when the journal is closed */
+static intptr_t shutdownSem;
+
 /* NV Function Pointers */
 static NVINTF_nvFuncts_t *pNV = NULL;
 
@@ -202,6 +237,37 @@ static bool started = false;
 /* The last saved coordinator frame counter */
 static uint32_t lastSavedCoordinatorFrameCounter = 0;
 
+/*
+ The device list lives in RAM as well as in NV, every change is written
+ to NV first and then to the RAM copy, lookups only read the RAM copy.
+ */
+static intptr_t devCacheMutex;
+/* CSF_MAX_DEVICELIST_IDS entries, one per NV sub ID */
+static devCacheEntry_t *devCache = NULL;
+/* Hash buckets, first sub ID of each chain, -1: empty */
+static int32_t *devShortHash;
+static int32_t *devExtHash;
+static uint32_t devHashMask;
+/* Copy of the CSF_NV_DEVICELIST_ENTRIES_ID item */
+static uint16_t devCacheNumEntries;
+
+/*
+ Write-behind journal: frame counter updates change the RAM copy only and
+ are written to NV in batches by Csf_flushJournal(). Both lists are
+ guarded by devCacheMutex.
+ */
+/* Dirty device records, first sub ID, -1: none */
+static int32_t journalHead = DEVICE_INDEX_NOT_FOUND;
+/* Latest coordinator frame counter, not yet in NV */
+static uint32_t journalFrameCounter = 0;
+static bool journalFrameCounterDirty = false;
+/* Updates waiting in the journal */
+static uint32_t journalPending = 0;
+/* NV is marked clean, updates are no longer held back */
+static bool journalClosed = false;
+/* The flush clock is running */
+static bool journalClockArmed = false;
+
 #if defined(MT_CSF)
 /*! NV driver item ID for reset reason */
 static const NVINTF_itemID_t nvResetId = NVID_RESET;
@@ -242,6 +308,10 @@ uint8_t Csf_keys;
 /* pending Csf_events */
 uint16_t Csf_events = 0;
 
+/* Journal flush interval and batch size (ini settings) */
+uint32_t Csf_journalFlush_mSecs = CSF_JOURNAL_FLUSH_INTERVAL;
+uint32_t Csf_journalFlushCount = CSF_JOURNAL_FLUSH_COUNT;
+
 /* Saved CLLC state */
 Cllc_states_t savedCllcState = Cllc_states_initWaiting;
 
@@ -251,15 +321,19 @@ double oadDurationTimer = 0;
  Local function prototypes
  *****************************************************************************/
 
-static void processTrackingTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
-static void processPATrickleTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
-static void processPCTrickleTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
-static void processJoinTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
-static void processConfigTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
-static void processBroadcastTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
+static intptr_t wheelClockThread(intptr_t dummy);
+static void processTrackingTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processPATrickleTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processPCTrickleTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processJoinTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processConfigTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processBroadcastTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processFragTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processRolloutTimeoutCallback_WRAPPER(intptr_t cookie);
+static void processJournalTimeoutCallback_WRAPPER(intptr_t cookie);
 
 #ifndef IS_HEADLESS
-static void processOadResetReqRetryTimeoutCallback_WRAPPER(intptr_t thandle, intptr_t cookie);
+static void processOadResetReqRetryTimeoutCallback_WRAPPER(intptr_t cookie);
 #endif
 
 #ifndef IS_HEADLESS
@@ -267,8 +341,12 @@ char* getConsoleCmd(void);
 void initConsoleCmd(void);
 #endif //!IS_HEADLESS
 
+static void processWheelTimeoutCallback(UArg a0);
 static void processTrackingTimeoutCallback(UArg a0);
 static void processBroadcastTimeoutCallback(UArg a0);
+static void processFragTimeoutCallback(UArg a0);
+static void processRolloutTimeoutCallback(UArg a0);
+static void processJournalTimeoutCallback(UArg a0);
 static void processKeyChangeCallback(uint8_t keysPressed);
 static void processPATrickleTimeoutCallback(UArg a0);
 static void processPCTrickleTimeoutCallback(UArg a0);
@@ -280,10 +358,19 @@ static void processOadResetReqRetryTimeoutCallback(UArg a0);
 #endif
 
 static bool addDeviceListItem(Llc_deviceListItem_t *pItem, bool *pNewDevice);
-static void updateDeviceListItem(Llc_deviceListItem_t *pItem);
 static int findDeviceListIndex(ApiMac_sAddrExt_t *pAddr);
 static int findUnusedDeviceListIndex(void);
 static void saveNumDeviceListEntries(uint16_t numEntries);
+static void devCacheInit(void);
+static void devCacheClear(void);
+static void devCacheStore(int subId, Llc_deviceListItem_t *pItem);
+static void devCacheRemove(int subId);
+static int devCacheFindShort(uint16_t shortAddr);
+static int devCacheFindExt(ApiMac_sAddrExt_t *pAddr);
+static void journalMark(int subId);
+static void journalShutdown(void);
+static void setJournalClock(uint32_t journalTime);
+static void setWheelTimer(TimerWheel_timer_t *pTimer, uint32_t ms);
 
 #ifndef IS_HEADLESS
 static bool removeDevice(ApiMac_sAddr_t addr);
@@ -312,6 +399,8 @@ static void stopOADResetReqRetryTimer(void);
 void Csf_init(void *sem)
 {
     char default_oad_file[256] = DEFAULT_OAD_FILE;
+    struct timespec start;
+    struct timespec end;
 
     /* Set default FW image */
     selected_oad_file_id = Collector_updateFwList(default_oad_file);
@@ -340,17 +429,66 @@ void Csf_init(void *sem)
     /* Save off the semaphore */
     collectorSem = (intptr_t)sem;
 
+    /* All the clocks below are timers in one wheel, on one clock */
+    wheelClkSem = SEMAPHORE_create("wheel-clock", 0);
+    wheelClkMutex = MUTEX_create("wheel-clock");
+    if((wheelClkSem == 0) || (wheelClkMutex == 0))
+    {
+        BUG_HERE("cannot create the wheel clock\n");
+    }
+    (void)THREAD_create("wheel-clock", wheelClockThread, 0,
+                        THREAD_FLAGS_DEFAULT);
+    TimerWheel_init(Csf_setWheelClock);
+    TimerWheel_setup(&trackingTimer,
+                     processTrackingTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&tricklePATimer,
+                     processPATrickleTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&tricklePCTimer,
+                     processPCTrickleTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&joinTimer, processJoinTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&configTimer, processConfigTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&broadcastTimer,
+                     processBroadcastTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&fragTimer, processFragTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&rolloutTimer, processRolloutTimeoutCallback_WRAPPER, 0);
+    TimerWheel_setup(&journalTimer, processJournalTimeoutCallback_WRAPPER, 0);
+#ifndef IS_HEADLESS
+    TimerWheel_setup(&oadResetReqRetryTimer,
+                     processOadResetReqRetryTimeoutCallback_WRAPPER, 0);
+#endif
+
     /* save the application semaphore here */
     /* load the NV function pointers */
     // printf("   >> Initialize the NV Function pointers \n");
-    NVOCMP_loadApiPtrs(&nvFps);
+    if(NVMMAP_fileName != NULL)
+    {
+        NVMMAP_loadApiPtrs(&nvFps);
+    }
+    else
+    {
+        NVOCMP_loadApiPtrs(&nvFps);
+    }
 
     /* Suyash - the code is using pNV var. Using that for now. */
     /* config nv pointer will be read from the mac_config_t... */
     pNV = &nvFps;
 
-    /* Init NV */
+    /* Init NV and read the device list into RAM, timed: cold start */
+    clock_gettime(CLOCK_MONOTONIC, &start);
     nvFps.initNV(NULL);
+    devCacheInit();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    LOG_printf(LOG_ALWAYS, "Device list: %d devices read in %ld us\n",
+               (int)devCacheNumEntries,
+               (long)(((end.tv_sec - start.tv_sec) * 1000000)
+                      + ((end.tv_nsec - start.tv_nsec) / 1000)));
+
+    /* Csf_shutdown() waits on it */
+    shutdownSem = SEMAPHORE_create("csf-shutdown", 0);
+    if(shutdownSem == 0)
+    {
+        BUG_HERE("cannot create shutdown semaphore\n");
+    }
 }
 
 /*!
@@ -361,6 +499,20 @@ void Csf_init(void *sem)
  */
 void Csf_processEvents(void)
 {
+    /* Time to write the journal to NV */
+    if(Csf_events & CSF_JOURNAL_EVENT)
+    {
+        Util_clearEvent(&Csf_events, CSF_JOURNAL_EVENT);
+        Csf_flushJournal();
+    }
+
+    /* We are stopping, see Csf_shutdown() */
+    if(Csf_events & CSF_SHUTDOWN_EVENT)
+    {
+        Util_clearEvent(&Csf_events, CSF_SHUTDOWN_EVENT);
+        journalShutdown();
+        SEMAPHORE_put(shutdownSem);
+    }
 
 #if !defined(IS_HEADLESS)
 
@@ -1128,25 +1280,20 @@ void Csf_deviceSensorDeviceTypeResponseUpdate(ApiMac_sAddr_t *pSrcAddr, uint8_t
 /*!
  * @brief       Display Sensor device and data
  *
- * @param       pDataInd - pointer to the data indication information
+ * @param       pSrcAddr - short address of the device that sent the message
+ * @param       rssi - the received packet's signal strength
+ * @param       pMsg - decoded sensor data message
  */
-void Csf_deviceSensorDisplay(ApiMac_mcpsDataInd_t *pDataInd)
+void Csf_deviceSensorDisplay(ApiMac_sAddr_t *pSrcAddr, int8_t rssi,
+                             const Smsgs_sensorMsg_t *pMsg)
 {
-
-    ApiMac_sAddr_t *pSrcAddr = &pDataInd->srcAddr;
-
 #ifndef IS_HEADLESS
-    int8_t rssi = pDataInd->rssi;
-    uint8_t *pBuf = pDataInd->msdu.p;
-    uint16_t SensorData;
-
-    // go to the first sensor data from msdu.p
-    pBuf ++;   // cmdId
-    pBuf += SMGS_SENSOR_EXTADDR_LEN;
-    pBuf += 2;  // frameControl
-    SensorData = Util_buildUint16(pBuf[0], pBuf[1]);  // first sensor data
-
+    int SensorData = 0;
 
+    if(pMsg->frameControl & Smsgs_dataFields_tempSensor)
+    {
+        SensorData = pMsg->tempSensor.temp;
+    }
 
     if((DisplayLine_sensorStart + (pSrcAddr->addr.shortAddr - 1)) < DisplayLine_sensorEnd)
     {
@@ -1488,62 +1635,121 @@ void Csf_restoreMacAttributes(void)
 }
 
 /* Wrappers for Callbacks*/
-static void processConfigTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                         intptr_t cookie)
+/*!
+ * @brief       monotonic time in milliseconds, for the wheel clock
+ */
+static uint64_t wheelClockNowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+/*!
+ * @brief       thread of the timer wheel clock, tells the collector
+ *              thread when wheelClkDue has come
+ *
+ * @param       dummy - ignored
+ */
+static intptr_t wheelClockThread(intptr_t dummy)
+{
+    uint64_t now;
+    int wait;
+
+    (void)dummy;
+    for(;;)
+    {
+        MUTEX_lock(wheelClkMutex, -1);
+        now = wheelClockNowMs();
+        if(wheelClkArmed && (wheelClkDue <= now))
+        {
+            wheelClkArmed = false;
+            MUTEX_unLock(wheelClkMutex);
+            processWheelTimeoutCallback(0);
+            continue;
+        }
+
+        /* not armed: sleep until Csf_setWheelClock() wakes us up */
+        wait = 60000;
+        if(wheelClkArmed && ((wheelClkDue - now) < (uint64_t)wait))
+        {
+            wait = (int)(wheelClkDue - now);
+        }
+        MUTEX_unLock(wheelClkMutex);
+
+        (void)SEMAPHORE_waitWithTimeout(wheelClkSem, wait);
+    }
+#if defined(__linux__)
+    return 0;
+#endif
+}
+
+static void processConfigTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
     processConfigTimeoutCallback(0);
 }
 
-static void processJoinTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                                               intptr_t cookie)
+static void processJoinTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
     processJoinTimeoutCallback(0);
 }
 
-static void processPATrickleTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                                                    intptr_t cookie)
+static void processPATrickleTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
     processPATrickleTimeoutCallback(0);
 }
 
-static void processPCTrickleTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                                                    intptr_t cookie)
+static void processPCTrickleTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
     processPCTrickleTimeoutCallback(0);
 }
 
 /* Wrap HLOS to embedded callback */
-static void processTrackingTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                                                  intptr_t cookie)
+static void processTrackingTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
     processTrackingTimeoutCallback(0);
 }
 
 /* Wrap HLOS to embedded callback */
-static void processBroadcastTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                                                  intptr_t cookie)
+static void processBroadcastTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
     processBroadcastTimeoutCallback(0);
 }
 
+/* Wrap HLOS to embedded callback */
+static void processFragTimeoutCallback_WRAPPER(intptr_t cookie)
+{
+    (void)cookie;
+    processFragTimeoutCallback(0);
+}
+
+/* Wrap HLOS to embedded callback */
+static void processRolloutTimeoutCallback_WRAPPER(intptr_t cookie)
+{
+    (void)cookie;
+    processRolloutTimeoutCallback(0);
+}
+
+/* Wrap HLOS to embedded callback */
+static void processJournalTimeoutCallback_WRAPPER(intptr_t cookie)
+{
+    (void)cookie;
+    processJournalTimeoutCallback(0);
+}
+
 #ifndef IS_HEADLESS
-static void processOadResetReqRetryTimeoutCallback_WRAPPER(intptr_t timer_handle,
-                                                  intptr_t cookie)
+static void processOadResetReqRetryTimeoutCallback_WRAPPER(intptr_t cookie)
 {
-    (void)timer_handle;
     (void)cookie;
+    /* periodic until stopOADResetReqRetryTimer() */
+    TimerWheel_arm(&oadResetReqRetryTimer, OAD_RESET_REQ_RETRY_TIMEOUT_VALUE);
     processOadResetReqRetryTimeoutCallback(0);
 }
 #endif
@@ -1555,11 +1761,7 @@ static void processOadResetReqRetryTimeoutCallback_WRAPPER(intptr_t timer_handle
  */
 void Csf_initializeTrackingClock(void)
 {
-    trackingClkHandle = TIMER_CB_create("trackingTimer",
-        processTrackingTimeoutCallback_WRAPPER,
-        0,
-        TRACKING_INIT_TIMEOUT_VALUE,
-        false);
+    TimerWheel_arm(&trackingTimer, TRACKING_INIT_TIMEOUT_VALUE);
 }
 
 /*!
@@ -1569,11 +1771,7 @@ void Csf_initializeTrackingClock(void)
  */
 void Csf_initializeBroadcastClock(void)
 {
-    broadcastClkHandle = TIMER_CB_create("broadcastTimer",
-        processBroadcastTimeoutCallback_WRAPPER,
-        0,
-        TRACKING_INIT_TIMEOUT_VALUE,
-        false);
+    TimerWheel_arm(&broadcastTimer, TRACKING_INIT_TIMEOUT_VALUE);
 }
 
 /*!
@@ -1583,21 +1781,8 @@ void Csf_initializeBroadcastClock(void)
  */
 void Csf_initializeTrickleClock(void)
 {
-    tricklePAClkHandle =
-        TIMER_CB_create(
-            "paTrickleTimer",
-            processPATrickleTimeoutCallback_WRAPPER,
-             0,
-                TRICKLE_TIMEOUT_VALUE,
-                false);
-
-    tricklePCClkHandle =
-        TIMER_CB_create(
-            "pcTrickleTimer",
-            processPCTrickleTimeoutCallback_WRAPPER,
-             0,
-            TRICKLE_TIMEOUT_VALUE,
-        false);
+    TimerWheel_arm(&tricklePATimer, TRICKLE_TIMEOUT_VALUE);
+    TimerWheel_arm(&tricklePCTimer, TRICKLE_TIMEOUT_VALUE);
 }
 
 /*!
@@ -1608,13 +1793,7 @@ void Csf_initializeTrickleClock(void)
 void Csf_initializeJoinPermitClock(void)
 {
     /* Initialize join permit timer */
-    joinClkHandle =
-        TIMER_CB_create(
-        "joinTimer",
-        processJoinTimeoutCallback_WRAPPER,
-        0,
-        JOIN_TIMEOUT_VALUE,
-        false);
+    TimerWheel_arm(&joinTimer, JOIN_TIMEOUT_VALUE);
 }
 
 /*!
@@ -1624,13 +1803,7 @@ void Csf_initializeJoinPermitClock(void)
  */
 void Csf_initializeConfigClock(void)
 {
-    configClkHandle =
-        TIMER_CB_create(
-            "configTimer",
-            processConfigTimeoutCallback_WRAPPER,
-            0,
-            CONFIG_TIMEOUT_VALUE,
-            false );
+    TimerWheel_arm(&configTimer, CONFIG_TIMEOUT_VALUE);
 }
 
 /*!
@@ -1644,28 +1817,29 @@ void Csf_initializeIdentifyClock(void)
 }
 
 /*!
- Set the tracking clock.
+ Set the timer wheel clock.
 
  Public function defined in csf.h
  */
-void Csf_setTrackingClock(uint32_t trackingTime)
+void Csf_setWheelClock(uint32_t wheelTime)
 {
-    /* Stop the Tracking timer */
+    /* Only move the deadline, the clock thread picks it up */
+    MUTEX_lock(wheelClkMutex, -1);
+    wheelClkArmed = (wheelTime != 0);
+    wheelClkDue = wheelClockNowMs() + wheelTime;
+    MUTEX_unLock(wheelClkMutex);
 
-    TIMER_CB_destroy(trackingClkHandle);
-    trackingClkHandle = 0;
+    SEMAPHORE_put(wheelClkSem);
+}
 
-    /* Setup timer */
-    if(trackingTime != 0)
-    {
-        trackingClkHandle =
-            TIMER_CB_create(
-                "trackingTimer",
-                processTrackingTimeoutCallback_WRAPPER,
-                0,
-                trackingTime,
-                false);
-    }
+/*!
+ Set the tracking clock.
+
+ Public function defined in csf.h
+ */
+void Csf_setTrackingClock(uint32_t trackingTime)
+{
+    setWheelTimer(&trackingTimer, trackingTime);
 }
 
 
@@ -1676,21 +1850,27 @@ void Csf_setTrackingClock(uint32_t trackingTime)
  */
 void Csf_setBroadcastClock(uint32_t broadcastTime)
 {
-    /* Stop the Broadcast timer */
-    TIMER_CB_destroy(broadcastClkHandle);
-    broadcastClkHandle = 0;
+    setWheelTimer(&broadcastTimer, broadcastTime);
+}
 
-    /* Setup timer */
-    if(broadcastTime != 0)
-    {
-        broadcastClkHandle =
-            TIMER_CB_create(
-                "broadcastTimer",
-                processBroadcastTimeoutCallback_WRAPPER,
-                0,
-                broadcastTime,
-                false);
-    }
+/*!
+ Set the custom command fragmentation clock.
+
+ Public function defined in csf.h
+ */
+void Csf_setFragClock(uint32_t fragTime)
+{
+    setWheelTimer(&fragTimer, fragTime);
+}
+
+/*!
+ Set the config rollout clock.
+
+ Public function defined in csf.h
+ */
+void Csf_setRolloutClock(uint32_t rolloutTime)
+{
+    setWheelTimer(&rolloutTimer, rolloutTime);
 }
 
 
@@ -1713,38 +1893,12 @@ void Csf_setTrickleClock(uint32_t trickleTime, uint8_t frameType)
 
     if(frameType == ApiMac_wisunAsyncFrame_advertisement)
     {
-        /* ALWAYS stop (avoid race conditions) */
-        TIMER_CB_destroy(tricklePAClkHandle);
-        tricklePAClkHandle = 0;
-
-    /* then create new, only if needed */
-        if(trickleTime > 0)
-        {
-            /* Setup timer */
-            tricklePAClkHandle = TIMER_CB_create(
-                "paTrickleTimer",
-                    processPATrickleTimeoutCallback_WRAPPER,
-                    0,
-                    randomTime,
-                    false);
-        }
+        /* 0 stops it */
+        setWheelTimer(&tricklePATimer, randomTime);
     }
     else if(frameType == ApiMac_wisunAsyncFrame_config)
     {
-        /* Always stop */
-        TIMER_CB_destroy(tricklePCClkHandle);
-        tricklePCClkHandle = 0;
-    /* and recreate only if needed */
-        if(trickleTime > 0)
-        {
-            /* Setup timer */
-            tricklePCClkHandle =
-                TIMER_CB_create(
-                "pcTrickleTimer",
-                processPCTrickleTimeoutCallback_WRAPPER,
-                0,
-                trickleTime, false);
-        }
+        setWheelTimer(&tricklePCTimer, trickleTime);
     }
 }
 
@@ -1755,19 +1909,7 @@ void Csf_setTrickleClock(uint32_t trickleTime, uint8_t frameType)
  */
 void Csf_setJoinPermitClock(uint32_t joinDuration)
 {
-    /* Always stop the join timer */
-    TIMER_CB_destroy(joinClkHandle);
-    joinClkHandle = 0;
-
-    /* Setup timer */
-    if(joinDuration != 0)
-    {
-        joinClkHandle =
-            TIMER_CB_create("joinTimer",
-                processJoinTimeoutCallback_WRAPPER,
-                0,
-                joinDuration, false);
-    }
+    setWheelTimer(&joinTimer, joinDuration);
 }
 
 /*!
@@ -1777,18 +1919,7 @@ void Csf_setJoinPermitClock(uint32_t joinDuration)
  */
 void Csf_setConfigClock(uint32_t delay)
 {
-    /* Always destroy */
-    TIMER_CB_destroy( configClkHandle );
-    configClkHandle = 0;
-    /* and create if needed */
-    if( delay != 0 ){
-        configClkHandle =
-            TIMER_CB_create( "configClk",
-                             processConfigTimeoutCallback_WRAPPER,
-                             0,
-                             delay,
-                             false );
-    }
+    setWheelTimer(&configTimer, delay);
 }
 
 /*!
@@ -1800,22 +1931,11 @@ uint16_t Csf_getNumDeviceListEntries(void)
 {
     uint16_t numEntries = 0;
 
-    if(pNV != NULL)
+    if(devCache != NULL)
     {
-        NVINTF_itemID_t id;
-        uint8_t stat;
-
-        /* Setup NV ID for the number of entries in the device list */
-        id.systemID = NVINTF_SYSID_APP;
-        id.itemID = CSF_NV_DEVICELIST_ENTRIES_ID;
-        id.subID = 0;
-
-        /* Read the number of device list items from NV */
-        stat = pNV->readItem(id, 0, sizeof(uint16_t), &numEntries);
-        if(stat != NVINTF_SUCCESS)
-        {
-            numEntries = 0;
-        }
+        MUTEX_lock(devCacheMutex, -1);
+        numEntries = devCacheNumEntries;
+        MUTEX_unLock(devCacheMutex);
     }
     return (numEntries);
 }
@@ -1873,44 +1993,30 @@ bool Csf_getDeviceExtended(uint16_t shortAddr, ApiMac_sAddrExt_t *pExtAddr)
  */
 bool Csf_getDevice(ApiMac_sAddr_t *pDevAddr, Llc_deviceListItem_t *pItem)
 {
-    if((pNV != NULL) && (pItem != NULL))
-    {
-        uint16_t numEntries;
+    bool found = false;
 
-        numEntries = Csf_getNumDeviceListEntries();
+    if((devCache != NULL) && (pItem != NULL))
+    {
+        int subId;
 
-        if(numEntries > 0)
+        MUTEX_lock(devCacheMutex, -1);
+        if(pDevAddr->addrMode == ApiMac_addrType_short)
         {
-            NVINTF_itemID_t id;
-
-            /* Setup NV ID for the device list records */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
-            id.subID = 0;
-            /* Read Network Information from NV */
-            if(pDevAddr->addrMode == ApiMac_addrType_short)
-            {
-                pNV->readContItem(id, 0, sizeof(Llc_deviceListItem_t), pItem,
-                                      sizeof(uint16_t),
-                                      (uint16_t)((unsigned long)&pItem->devInfo.shortAddress-(unsigned long)&pItem->devInfo.panID),
-                                      &pDevAddr->addr.shortAddr, &id.subID);
-            }
-            else
-            {
-                pNV->readContItem(id, 0, sizeof(Llc_deviceListItem_t), pItem,
-                                      APIMAC_SADDR_EXT_LEN,
-                                      (uint16_t)((unsigned long)&pItem->devInfo.extAddress-(unsigned long)&pItem->devInfo.panID),
-                                      &pDevAddr->addr.extAddr, &id.subID);
-            }
-
+            subId = devCacheFindShort(pDevAddr->addr.shortAddr);
+        }
+        else
+        {
+            subId = devCacheFindExt(&pDevAddr->addr.extAddr);
+        }
 
-            if(id.subID != CSF_INVALID_SUBID)
-            {
-                return(true);
-            }
+        if(subId != DEVICE_INDEX_NOT_FOUND)
+        {
+            memcpy(pItem, &devCache[subId].item, sizeof(Llc_deviceListItem_t));
+            found = true;
         }
+        MUTEX_unLock(devCacheMutex);
     }
-    return (false);
+    return (found);
 }
 
 /*!
@@ -1920,48 +2026,63 @@ bool Csf_getDevice(ApiMac_sAddr_t *pDevAddr, Llc_deviceListItem_t *pItem)
  */
 bool Csf_getDeviceItem(uint16_t devIndex, Llc_deviceListItem_t *pItem)
 {
-    if((pNV != NULL) && (pItem != NULL))
-    {
-        uint16_t numEntries;
+    bool found = false;
 
-        numEntries = Csf_getNumDeviceListEntries();
+    if((devCache != NULL) && (pItem != NULL))
+    {
+        int subId;
+        int readItems = 0;
 
-        if(numEntries > 0)
+        MUTEX_lock(devCacheMutex, -1);
+        for(subId = 0; (readItems < devCacheNumEntries)
+                        && (subId < CSF_MAX_DEVICELIST_IDS); subId++)
         {
-            NVINTF_itemID_t id;
-            uint8_t stat;
-            int subId = 0;
-            int readItems = 0;
+            if(devCache[subId].inUse)
+            {
+                if(readItems == devIndex)
+                {
+                    memcpy(pItem, &devCache[subId].item,
+                           sizeof(Llc_deviceListItem_t));
+                    found = true;
+                    break;
+                }
+                readItems++;
+            }
+        }
+        MUTEX_unLock(devCacheMutex);
+    }
 
-            /* Setup NV ID for the device list records */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
+    return (found);
+}
 
-            while((readItems < numEntries) && (subId
-                                               < CSF_MAX_DEVICELIST_IDS))
-            {
-                Llc_deviceListItem_t item;
+/*!
+ Walk the device list
 
-                id.subID = (uint16_t)subId;
+ Public function defined in csf.h
+ */
+int Csf_getNextDeviceItem(int cursor, Llc_deviceListItem_t *pItem)
+{
+    int next = DEVICE_INDEX_NOT_FOUND;
 
-                /* Read Network Information from NV */
-                stat = pNV->readItem(id, 0, sizeof(Llc_deviceListItem_t),
-                                     &item);
-                if(stat == NVINTF_SUCCESS)
-                {
-                    if(readItems == devIndex)
-                    {
-                        memcpy(pItem, &item, sizeof(Llc_deviceListItem_t));
-                        return (true);
-                    }
-                    readItems++;
-                }
-                subId++;
+    if((devCache != NULL) && (pItem != NULL) && (cursor >= 0))
+    {
+        int subId;
+
+        MUTEX_lock(devCacheMutex, -1);
+        for(subId = cursor; subId < CSF_MAX_DEVICELIST_IDS; subId++)
+        {
+            if(devCache[subId].inUse)
+            {
+                memcpy(pItem, &devCache[subId].item,
+                       sizeof(Llc_deviceListItem_t));
+                next = subId + 1;
+                break;
             }
         }
+        MUTEX_unLock(devCacheMutex);
     }
 
-    return (false);
+    return (next);
 }
 
 /*!
@@ -1991,86 +2112,234 @@ void Csf_free(void *ptr)
  */
 void Csf_updateFrameCounter(ApiMac_sAddr_t *pDevAddr, uint32_t frameCntr)
 {
-    if((pNV != NULL) && (pNV->writeItem != NULL))
+    bool flushNow = false;
+    bool armClock = false;
+
+    if((pNV == NULL) || (pNV->writeItem == NULL) || (devCache == NULL))
     {
-        if(pDevAddr == NULL)
+        return;
+    }
+
+    MUTEX_lock(devCacheMutex, -1);
+    if(pDevAddr == NULL)
+    {
+        /* Update this device's frame counter */
+        if(frameCntr > journalFrameCounter)
         {
-            /* Update this device's frame counter */
-            if((frameCntr >=
-                (lastSavedCoordinatorFrameCounter + FRAME_COUNTER_SAVE_WINDOW)))
+            journalFrameCounter = frameCntr;
+            if(journalFrameCounterDirty == false)
             {
-                NVINTF_itemID_t id;
-
-                /* Setup NV ID */
-                id.systemID = NVINTF_SYSID_APP;
-                id.itemID = CSF_NV_FRAMECOUNTER_ID;
-                id.subID = 0;
+                journalFrameCounterDirty = true;
+                journalPending++;
+            }
 
-                /* Write the NV item */
-                if(pNV->writeItem(id, sizeof(uint32_t), &frameCntr)
-                                == NVINTF_SUCCESS)
-                {
-                    lastSavedCoordinatorFrameCounter = frameCntr;
-                }
+            /* NV must never fall a whole window behind */
+            if(frameCntr >=
+               (lastSavedCoordinatorFrameCounter + FRAME_COUNTER_SAVE_WINDOW))
+            {
+                flushNow = true;
             }
         }
+    }
+    else
+    {
+        /* Child frame counter update, is the device in our database? */
+        int subId;
+
+        if(pDevAddr->addrMode == ApiMac_addrType_short)
+        {
+            subId = devCacheFindShort(pDevAddr->addr.shortAddr);
+        }
         else
         {
-            /* Child frame counter update */
-            Llc_deviceListItem_t devItem;
+            subId = devCacheFindExt(&pDevAddr->addr.extAddr);
+        }
+
+        if((subId != DEVICE_INDEX_NOT_FOUND)
+           && (frameCntr > devCache[subId].item.rxFrameCounter))
+        {
+            devCache[subId].item.rxFrameCounter = frameCntr;
+            journalMark(subId);
 
-            /* Is the device in our database? */
-            if(Csf_getDevice(pDevAddr, &devItem))
+            if(frameCntr >= (devCache[subId].savedRxFrameCounter
+                             + RX_FRAME_COUNTER_SAVE_WINDOW))
             {
-                /*
-                 Don't save every update, only save if the new frame
-                 counter falls outside the save window.
-                 */
-                if((devItem.rxFrameCounter + FRAME_COUNTER_SAVE_WINDOW)
-                                <= frameCntr)
-                {
-                    /* Update the frame counter */
-                    devItem.rxFrameCounter = frameCntr;
-                    updateDeviceListItem(&devItem);
-                }
+                flushNow = true;
             }
         }
     }
+
+    if((Csf_journalFlush_mSecs == 0) || journalClosed
+       || (journalPending >= Csf_journalFlushCount))
+    {
+        flushNow = true;
+    }
+    else if((journalPending > 0) && (journalClockArmed == false))
+    {
+        journalClockArmed = true;
+        armClock = true;
+    }
+    MUTEX_unLock(devCacheMutex);
+
+    if(flushNow)
+    {
+        Csf_flushJournal();
+    }
+    else if(armClock)
+    {
+        setJournalClock(Csf_journalFlush_mSecs);
+    }
 }
 
 /*!
- Get the Frame Counter
+ Write the journal to NV
 
- Public function defined in csf.h
+ Public function defined in csf_linux.h
  */
-bool Csf_getFrameCounter(ApiMac_sAddr_t *pDevAddr, uint32_t *pFrameCntr)
+void Csf_flushJournal(void)
 {
-    /* Check for valid pointer */
-    if(pFrameCntr != NULL)
+    NVINTF_itemID_t id;
+    uint32_t written = 0;
+
+    if((pNV == NULL) || (pNV->writeItem == NULL) || (devCache == NULL))
     {
-        /*
-         A pDevAddr that is null means to get the frame counter for this device
-         */
-        if(pDevAddr == NULL)
+        return;
+    }
+
+    id.systemID = NVINTF_SYSID_APP;
+
+    MUTEX_lock(devCacheMutex, -1);
+    /* a clock that fires later finds nothing to do */
+    journalClockArmed = false;
+    for(;;)
+    {
+        if(journalFrameCounterDirty)
         {
-            if((pNV != NULL) && (pNV->readItem != NULL))
+            uint32_t frameCntr = journalFrameCounter;
+
+            journalFrameCounterDirty = false;
+            journalPending--;
+            MUTEX_unLock(devCacheMutex);
+
+            id.itemID = CSF_NV_FRAMECOUNTER_ID;
+            id.subID = 0;
+            if(pNV->writeItem(id, sizeof(uint32_t), &frameCntr)
+                            == NVINTF_SUCCESS)
             {
-                NVINTF_itemID_t id;
+                MUTEX_lock(devCacheMutex, -1);
+                lastSavedCoordinatorFrameCounter = frameCntr;
+            }
+            else
+            {
+                LOG_printf(LOG_ERROR, "journal: frame counter not saved\n");
+                MUTEX_lock(devCacheMutex, -1);
+            }
+        }
+        else if(journalHead != DEVICE_INDEX_NOT_FOUND)
+        {
+            devCacheEntry_t *pEntry = &devCache[journalHead];
+            Llc_deviceListItem_t item;
 
-                /* Setup NV ID */
-                id.systemID = NVINTF_SYSID_APP;
-                id.itemID = CSF_NV_FRAMECOUNTER_ID;
-                id.subID = 0;
+            id.subID = (uint16_t)journalHead;
+            journalHead = pEntry->nextDirty;
+            pEntry->dirty = false;
+            journalPending--;
+            memcpy(&item, &pEntry->item, sizeof(Llc_deviceListItem_t));
+            MUTEX_unLock(devCacheMutex);
 
-                /* Read Network Information from NV */
-                if(pNV->readItem(id, 0, sizeof(uint32_t), pFrameCntr)
-                                == NVINTF_SUCCESS)
+            /* write the device list record */
+            id.itemID = CSF_NV_DEVICELIST_ID;
+            if(pNV->writeItem(id, sizeof(Llc_deviceListItem_t), &item)
+                            == NVINTF_SUCCESS)
+            {
+                MUTEX_lock(devCacheMutex, -1);
+                if(pEntry->inUse
+                   && (memcmp(pEntry->item.devInfo.extAddress,
+                              item.devInfo.extAddress,
+                              APIMAC_SADDR_EXT_LEN) == 0))
                 {
-                    /* Set to the next window */
-                    *pFrameCntr += FRAME_COUNTER_SAVE_WINDOW;
-                    return(true);
+                    pEntry->savedRxFrameCounter = item.rxFrameCounter;
                 }
-                else
+            }
+            else
+            {
+                LOG_printf(LOG_ERROR, "journal: device 0x%04x not saved\n",
+                           item.devInfo.shortAddress);
+                MUTEX_lock(devCacheMutex, -1);
+            }
+        }
+        else
+        {
+            break;
+        }
+        written++;
+    }
+    MUTEX_unLock(devCacheMutex);
+
+    if(written > 0)
+    {
+        LOG_printf(LOG_DBG_COLLECTOR, "journal: %u NV writes\n",
+                   (unsigned)written);
+    }
+}
+
+/*!
+ Close the journal before the process exits
+
+ Public function defined in csf_linux.h
+ */
+void Csf_shutdown(void)
+{
+    if(shutdownSem == 0)
+    {
+        /* Csf_init() did not run, there is nothing to write */
+        return;
+    }
+
+    Util_setEvent(&Csf_events, CSF_SHUTDOWN_EVENT);
+    Semaphore_post(collectorSem);
+    if(SEMAPHORE_waitWithTimeout(shutdownSem, CSF_SHUTDOWN_WAIT) <= 0)
+    {
+        /* The collector thread is gone, nobody else writes the journal */
+        LOG_printf(LOG_ERROR, "collector thread did not stop, "
+                   "closing the journal here\n");
+        journalShutdown();
+    }
+}
+
+/*!
+ Get the Frame Counter
+
+ Public function defined in csf.h
+ */
+bool Csf_getFrameCounter(ApiMac_sAddr_t *pDevAddr, uint32_t *pFrameCntr)
+{
+    /* Check for valid pointer */
+    if(pFrameCntr != NULL)
+    {
+        /*
+         A pDevAddr that is null means to get the frame counter for this device
+         */
+        if(pDevAddr == NULL)
+        {
+            if((pNV != NULL) && (pNV->readItem != NULL))
+            {
+                NVINTF_itemID_t id;
+
+                /* Setup NV ID */
+                id.systemID = NVINTF_SYSID_APP;
+                id.itemID = CSF_NV_FRAMECOUNTER_ID;
+                id.subID = 0;
+
+                /* Read Network Information from NV */
+                if(pNV->readItem(id, 0, sizeof(uint32_t), pFrameCntr)
+                                == NVINTF_SUCCESS)
+                {
+                    /* Set to the next window */
+                    *pFrameCntr += FRAME_COUNTER_SAVE_WINDOW;
+                    return(true);
+                }
+                else
                 {
                     /*
                      Wasn't found, so write 0, so the next time it will be
@@ -2121,6 +2390,8 @@ void Csf_removeDeviceListItem(ApiMac_sAddrExt_t *pAddr)
             stat = pNV->deleteItem(id);
             if(stat == NVINTF_SUCCESS)
             {
+                devCacheRemove(index);
+
                 /* Update the number of entries */
                 uint16_t numEntries = Csf_getNumDeviceListEntries();
                 if(numEntries > 0)
@@ -2128,6 +2399,8 @@ void Csf_removeDeviceListItem(ApiMac_sAddrExt_t *pAddr)
                     numEntries--;
                     saveNumDeviceListEntries(numEntries);
                 }
+                /* keep the gateway's device table in step */
+                appsrv_deviceRemoved(pAddr);
             }
         }
     }
@@ -2193,6 +2466,10 @@ void Csf_clearAllNVItems(void)
         id.itemID = CSF_NV_FRAMECOUNTER_ID;
         id.subID = 0;
         pNV->deleteItem(id);
+
+        devCacheClear();
+
+        appsrv_deviceListCleared();
     }
 }
 
@@ -2204,21 +2481,7 @@ void Csf_clearAllNVItems(void)
  */
 bool Csf_isConfigTimerActive(void)
 {
-    bool b;
-    int r;
-    /*
-     * If the timer is not valid (ie: handle=0)
-     * the 'getRemain()' will return negative
-     * which is the same as expired.
-     */
-    r = TIMER_CB_getRemain(configClkHandle);
-    if( r < 0 ){
-        b = false;
-    } else {
-        b = true;
-    }
-
-    return b;
+    return (TimerWheel_isArmed(&configTimer));
 }
 
 /*!
@@ -2228,16 +2491,7 @@ bool Csf_isConfigTimerActive(void)
 */
 bool Csf_isTrackingTimerActive(void)
 {
-    bool b;
-    int r;
-    r = TIMER_CB_getRemain(trackingClkHandle);
-    if( r < 0 ){
-        b = false;
-    } else {
-        b = true;
-    }
-
-    return b;
+    return (TimerWheel_isArmed(&trackingTimer));
 }
 
 /*!
@@ -2282,48 +2536,22 @@ void Csf_closeNwk(void)
 int Csf_sendDisassociateMsg(uint16_t deviceShortAddr)
 {
     int status = -1;
+    Llc_deviceListItem_t item;
+    ApiMac_sAddr_t devAddr;
 
-    if(pNV != NULL)
-    {
-        uint16_t numEntries;
-
-        numEntries = Csf_getNumDeviceListEntries();
-
-        if(numEntries > 0)
-        {
-            NVINTF_itemID_t id;
-            uint16_t subId = 0;
-
-            /* Setup NV ID for the device list records */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
-
-            while(subId < CSF_MAX_DEVICELIST_IDS)
-            {
-                Llc_deviceListItem_t item;
-                uint8_t stat;
-
-                id.subID = (uint16_t)subId;
-
-                /* Read Network Information from NV */
-                stat = pNV->readItem(id, 0, sizeof(Llc_deviceListItem_t),
-                                     &item);
+    devAddr.addrMode = ApiMac_addrType_short;
+    devAddr.addr.shortAddr = deviceShortAddr;
 
-                if( (stat == NVINTF_SUCCESS) && (deviceShortAddr == item.devInfo.shortAddress))
-                {
-                    /* Send a disassociate to the device */
-                    Cllc_sendDisassociationRequest(item.devInfo.shortAddress,
-                                                   item.capInfo.rxOnWhenIdle);
+    if(Csf_getDevice(&devAddr, &item))
+    {
+        /* Send a disassociate to the device */
+        Cllc_sendDisassociationRequest(item.devInfo.shortAddress,
+                                       item.capInfo.rxOnWhenIdle);
 
-                    /* Remove it from the Device list */
-                    Csf_removeDeviceListItem(&item.devInfo.extAddress);
+        /* Remove it from the Device list */
+        Csf_removeDeviceListItem(&item.devInfo.extAddress);
 
-                    status = 0;
-                    break;
-                }
-                subId++;
-            }
-        }
+        status = 0;
     }
 
     return status;
@@ -2338,41 +2566,9 @@ int Csf_getDeviceExtAdd(uint16_t deviceShortAddr, ApiMac_sAddrExt_t * extAddr)
 {
     int status = -1;
 
-    if(pNV != NULL)
+    if(Csf_getDeviceExtended(deviceShortAddr, extAddr))
     {
-        uint16_t numEntries;
-
-        numEntries = Csf_getNumDeviceListEntries();
-
-        if(numEntries > 0)
-        {
-            NVINTF_itemID_t id;
-            uint16_t subId = 0;
-
-            /* Setup NV ID for the device list records */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
-
-            while(subId < CSF_MAX_DEVICELIST_IDS)
-            {
-                Llc_deviceListItem_t item;
-                uint8_t stat;
-
-                id.subID = (uint16_t)subId;
-
-                /* Read Network Information from NV */
-                stat = pNV->readItem(id, 0, sizeof(Llc_deviceListItem_t),
-                                     &item);
-
-                if( (stat == NVINTF_SUCCESS) && (deviceShortAddr == item.devInfo.shortAddress))
-                {
-                    memcpy(extAddr, &item.devInfo.extAddress, sizeof(ApiMac_sAddrExt_t));
-                    status = 0;
-                    break;
-                }
-                subId++;
-            }
-        }
+        status = 0;
     }
 
     return status;
@@ -2393,6 +2589,21 @@ void Csf_processCoPReset(void)
  Local Functions
  *****************************************************************************/
 
+/*!
+ * @brief       Timer wheel clock handler function.
+ *
+ * @param       a0 - ignored
+ */
+static void processWheelTimeoutCallback(UArg a0)
+{
+    (void)a0; /* Parameter is not used */
+
+    Util_setEvent(&Collector_events, COLLECTOR_WHEEL_EVT);
+
+    /* Wake up the application thread when it waits for clock event */
+    Semaphore_post(collectorSem);
+}
+
 /*!
  * @brief       Tracking timeout handler function.
  *
@@ -2423,6 +2634,51 @@ static void processBroadcastTimeoutCallback(UArg a0)
     Semaphore_post(collectorSem);
 }
 
+/*!
+ * @brief       Custom command fragmentation timeout handler function.
+ *
+ * @param       a0 - ignored
+ */
+static void processFragTimeoutCallback(UArg a0)
+{
+    (void)a0; /* Parameter is not used */
+
+    Util_setEvent(&Collector_events, COLLECTOR_FRAG_EVT);
+
+    /* Wake up the application thread when it waits for clock event */
+    Semaphore_post(collectorSem);
+}
+
+/*!
+ * @brief       Config rollout timeout handler function.
+ *
+ * @param       a0 - ignored
+ */
+static void processRolloutTimeoutCallback(UArg a0)
+{
+    (void)a0; /* Parameter is not used */
+
+    Util_setEvent(&Collector_events, COLLECTOR_ROLLOUT_EVT);
+
+    /* Wake up the application thread when it waits for clock event */
+    Semaphore_post(collectorSem);
+}
+
+/*!
+ * @brief       NV journal flush timeout handler function.
+ *
+ * @param       a0 - ignored
+ */
+static void processJournalTimeoutCallback(UArg a0)
+{
+    (void)a0; /* Parameter is not used */
+
+    Util_setEvent(&Csf_events, CSF_JOURNAL_EVENT);
+
+    /* Wake up the application thread when it waits for clock event */
+    Semaphore_post(collectorSem);
+}
+
 /*!
  * @brief       Join permit timeout handler function.
  *
@@ -2564,6 +2820,8 @@ static bool addDeviceListItem(Llc_deviceListItem_t *pItem, bool *pNewDevice)
                     stat = pNV->writeItem(id, sizeof(Llc_deviceListItem_t), pItem);
                     if(stat == NVINTF_SUCCESS)
                     {
+                        devCacheStore(id.subID, pItem);
+
                         /* Update the number of entries */
                         numEntries++;
                         saveNumDeviceListEntries(numEntries);
@@ -2577,33 +2835,6 @@ static bool addDeviceListItem(Llc_deviceListItem_t *pItem, bool *pNewDevice)
     return (retVal);
 }
 
-/*!
- * @brief       Update an entry in the device list
- *
- * @param       pItem - pointer to the device list entry
- */
-static void updateDeviceListItem(Llc_deviceListItem_t *pItem)
-{
-    if((pNV != NULL) && (pItem != NULL))
-    {
-        int idx;
-
-        idx = findDeviceListIndex(&pItem->devInfo.extAddress);
-        if(idx != DEVICE_INDEX_NOT_FOUND)
-        {
-            NVINTF_itemID_t id;
-
-            /* Setup NV ID for the device list record */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
-            id.subID = (uint16_t)idx;
-
-            /* write the device list record */
-            pNV->writeItem(id, sizeof(Llc_deviceListItem_t), pItem);
-        }
-    }
-}
-
 /*!
  * @brief       Find entry in device list
  *
@@ -2614,34 +2845,15 @@ static void updateDeviceListItem(Llc_deviceListItem_t *pItem)
  */
 static int findDeviceListIndex(ApiMac_sAddrExt_t *pAddr)
 {
-    if((pNV != NULL) && (pAddr != NULL))
-    {
-        uint16_t numEntries;
-
-        numEntries = Csf_getNumDeviceListEntries();
-
-        if(numEntries > 0)
-        {
-            NVINTF_itemID_t id;
-            Llc_deviceListItem_t item;
-
-            /* Setup NV ID for the device list records */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
-            id.subID = 0;
-
-            /* Read Network Information from NV */
-            pNV->readContItem(id, 0, sizeof(Llc_deviceListItem_t), &item,
-                                  APIMAC_SADDR_EXT_LEN,
-                                  (uint16_t)((unsigned long)&item.devInfo.extAddress-(unsigned long)&item), pAddr, &id.subID);
+    int subId = DEVICE_INDEX_NOT_FOUND;
 
-            if(id.subID != CSF_INVALID_SUBID)
-            {
-                return(id.subID);
-            }
-        }
+    if((devCache != NULL) && (pAddr != NULL))
+    {
+        MUTEX_lock(devCacheMutex, -1);
+        subId = devCacheFindExt(pAddr);
+        MUTEX_unLock(devCacheMutex);
     }
-    return (DEVICE_INDEX_NOT_FOUND);
+    return (subId);
 }
 
 /*!
@@ -2680,9 +2892,360 @@ static void saveNumDeviceListEntries(uint16_t numEntries)
         id.itemID = CSF_NV_DEVICELIST_ENTRIES_ID;
         id.subID = 0;
 
-        /* Read the number of device list items from NV */
-        pNV->writeItem(id, sizeof(uint16_t), &numEntries);
+        /* Write the number of device list items to NV */
+        if(pNV->writeItem(id, sizeof(uint16_t), &numEntries)
+                        == NVINTF_SUCCESS)
+        {
+            MUTEX_lock(devCacheMutex, -1);
+            devCacheNumEntries = numEntries;
+            MUTEX_unLock(devCacheMutex);
+        }
+    }
+}
+
+/*!
+ * @brief       Short address hash bucket
+ */
+static uint32_t devHashShort(uint16_t shortAddr)
+{
+    return (shortAddr & devHashMask);
+}
+
+/*!
+ * @brief       Extended address hash bucket
+ */
+static uint32_t devHashExt(ApiMac_sAddrExt_t *pAddr)
+{
+    uint32_t hash = 2166136261u;
+    int x;
+
+    /* FNV-1a */
+    for(x = 0; x < APIMAC_SADDR_EXT_LEN; x++)
+    {
+        hash = (hash ^ (*pAddr)[x]) * 16777619u;
     }
+    return (hash & devHashMask);
+}
+
+/*!
+ * @brief       Allocate the RAM device list and read it from NV,
+ *              one readItem() per sub ID
+ */
+static void devCacheInit(void)
+{
+    uint32_t buckets = 1;
+    uint8_t clean = 0;
+    int subId;
+
+    devCacheMutex = MUTEX_create("device-list");
+    if(devCacheMutex == 0)
+    {
+        BUG_HERE("cannot create device list mutex\n");
+    }
+
+    /* about one device per bucket */
+    while(buckets < (uint32_t)CSF_MAX_DEVICELIST_ENTRIES)
+    {
+        buckets <<= 1;
+    }
+    devHashMask = buckets - 1;
+
+    devCache = calloc(CSF_MAX_DEVICELIST_IDS, sizeof(devCacheEntry_t));
+    devShortHash = malloc(buckets * sizeof(int32_t));
+    devExtHash = malloc(buckets * sizeof(int32_t));
+    if((devCache == NULL) || (devShortHash == NULL) || (devExtHash == NULL))
+    {
+        BUG_HERE("No memory\n");
+    }
+    devCacheClear();
+
+    if((pNV != NULL) && (pNV->readItem != NULL))
+    {
+        NVINTF_itemID_t id;
+        Llc_deviceListItem_t item;
+
+        id.systemID = NVINTF_SYSID_APP;
+        id.itemID = CSF_NV_DEVICELIST_ENTRIES_ID;
+        id.subID = 0;
+        if(pNV->readItem(id, 0, sizeof(uint16_t), &devCacheNumEntries)
+                        != NVINTF_SUCCESS)
+        {
+            devCacheNumEntries = 0;
+        }
+
+        /* Was the journal flushed when we stopped? */
+        id.itemID = CSF_NV_CLEAN_SHUTDOWN_ID;
+        if(pNV->readItem(id, 0, sizeof(uint8_t), &clean) != NVINTF_SUCCESS)
+        {
+            clean = 0;
+        }
+        if(clean != 0)
+        {
+            /* until the next clean exit */
+            uint8_t dirty = 0;
+
+            if((pNV->writeItem == NULL)
+               || (pNV->writeItem(id, sizeof(uint8_t), &dirty)
+                   != NVINTF_SUCCESS))
+            {
+                clean = 0;
+            }
+        }
+        else
+        {
+            LOG_printf(LOG_ALWAYS,
+                       "No clean shutdown, rounding up frame counters\n");
+        }
+
+        id.itemID = CSF_NV_DEVICELIST_ID;
+        for(subId = 0; subId < CSF_MAX_DEVICELIST_IDS; subId++)
+        {
+            id.subID = (uint16_t)subId;
+            if(pNV->readItem(id, 0, sizeof(Llc_deviceListItem_t), &item)
+                            == NVINTF_SUCCESS)
+            {
+                devCacheStore(subId, &item);
+                if(clean == 0)
+                {
+                    /* frames after the last save may have been accepted */
+                    devCache[subId].item.rxFrameCounter +=
+                        RX_FRAME_COUNTER_SAVE_WINDOW;
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * @brief       Put a changed device record in the journal, lock held
+ */
+static void journalMark(int subId)
+{
+    devCacheEntry_t *pEntry = &devCache[subId];
+
+    if(pEntry->dirty == false)
+    {
+        pEntry->dirty = true;
+        pEntry->nextDirty = journalHead;
+        journalHead = subId;
+        journalPending++;
+    }
+}
+
+/*!
+ * @brief       Flush the journal and mark NV clean, updates after this
+ *              are written at once
+ */
+static void journalShutdown(void)
+{
+    if(devCache != NULL)
+    {
+        MUTEX_lock(devCacheMutex, -1);
+        journalClosed = true;
+        MUTEX_unLock(devCacheMutex);
+    }
+    Csf_flushJournal();
+
+    if((pNV != NULL) && (pNV->writeItem != NULL) && (devCache != NULL))
+    {
+        NVINTF_itemID_t id;
+        uint8_t clean = 1;
+
+        id.systemID = NVINTF_SYSID_APP;
+        id.itemID = CSF_NV_CLEAN_SHUTDOWN_ID;
+        id.subID = 0;
+        pNV->writeItem(id, sizeof(uint8_t), &clean);
+    }
+}
+
+/*!
+ * @brief       Start the journal flush clock
+ *
+ * @param       journalTime - milliseconds until the flush
+ */
+static void setJournalClock(uint32_t journalTime)
+{
+    TimerWheel_arm(&journalTimer, journalTime);
+}
+
+/*!
+ * @brief       Arm a timer of the wheel, or stop it
+ *
+ * @param       pTimer - the timer
+ * @param       ms - from now, 0 stops it
+ */
+static void setWheelTimer(TimerWheel_timer_t *pTimer, uint32_t ms)
+{
+    if(ms != 0)
+    {
+        TimerWheel_arm(pTimer, ms);
+    }
+    else
+    {
+        TimerWheel_cancel(pTimer);
+    }
+}
+
+/*!
+ * @brief       Empty the RAM device list
+ */
+static void devCacheClear(void)
+{
+    uint32_t x;
+
+    if(devCache == NULL)
+    {
+        return;
+    }
+
+    MUTEX_lock(devCacheMutex, -1);
+    memset(devCache, 0, CSF_MAX_DEVICELIST_IDS * sizeof(devCacheEntry_t));
+    for(x = 0; x <= devHashMask; x++)
+    {
+        devShortHash[x] = DEVICE_INDEX_NOT_FOUND;
+        devExtHash[x] = DEVICE_INDEX_NOT_FOUND;
+    }
+    devCacheNumEntries = 0;
+    journalHead = DEVICE_INDEX_NOT_FOUND;
+    journalPending = journalFrameCounterDirty ? 1 : 0;
+    MUTEX_unLock(devCacheMutex);
+}
+
+/*!
+ * @brief       Take a sub ID off its hash chains, lock held
+ */
+static void devCacheUnlink(int subId)
+{
+    devCacheEntry_t *pEntry = &devCache[subId];
+    int32_t *pLink;
+
+    pLink = &devShortHash[devHashShort(pEntry->item.devInfo.shortAddress)];
+    while(*pLink != DEVICE_INDEX_NOT_FOUND)
+    {
+        if(*pLink == subId)
+        {
+            *pLink = pEntry->nextShort;
+            break;
+        }
+        pLink = &devCache[*pLink].nextShort;
+    }
+
+    pLink = &devExtHash[devHashExt(&pEntry->item.devInfo.extAddress)];
+    while(*pLink != DEVICE_INDEX_NOT_FOUND)
+    {
+        if(*pLink == subId)
+        {
+            *pLink = pEntry->nextExt;
+            break;
+        }
+        pLink = &devCache[*pLink].nextExt;
+    }
+
+    pEntry->inUse = false;
+}
+
+/*!
+ * @brief       Record what was written to NV for a sub ID
+ *
+ * @param       subId - NV sub ID of the record
+ * @param       pItem - the record
+ */
+static void devCacheStore(int subId, Llc_deviceListItem_t *pItem)
+{
+    devCacheEntry_t *pEntry;
+    uint32_t bucket;
+
+    if((devCache == NULL) || (subId < 0) || (subId >= CSF_MAX_DEVICELIST_IDS))
+    {
+        return;
+    }
+
+    MUTEX_lock(devCacheMutex, -1);
+    pEntry = &devCache[subId];
+    if(pEntry->inUse)
+    {
+        /* the addresses may have changed */
+        devCacheUnlink(subId);
+    }
+
+    memcpy(&pEntry->item, pItem, sizeof(Llc_deviceListItem_t));
+    pEntry->savedRxFrameCounter = pItem->rxFrameCounter;
+    pEntry->inUse = true;
+
+    bucket = devHashShort(pItem->devInfo.shortAddress);
+    pEntry->nextShort = devShortHash[bucket];
+    devShortHash[bucket] = subId;
+
+    bucket = devHashExt(&pItem->devInfo.extAddress);
+    pEntry->nextExt = devExtHash[bucket];
+    devExtHash[bucket] = subId;
+    MUTEX_unLock(devCacheMutex);
+}
+
+/*!
+ * @brief       Forget a sub ID deleted from NV
+ */
+static void devCacheRemove(int subId)
+{
+    if((devCache == NULL) || (subId < 0) || (subId >= CSF_MAX_DEVICELIST_IDS))
+    {
+        return;
+    }
+
+    MUTEX_lock(devCacheMutex, -1);
+    if(devCache[subId].dirty)
+    {
+        int32_t *pLink = &journalHead;
+
+        /* nothing left to write */
+        while(*pLink != subId)
+        {
+            pLink = &devCache[*pLink].nextDirty;
+        }
+        *pLink = devCache[subId].nextDirty;
+        devCache[subId].dirty = false;
+        journalPending--;
+    }
+    if(devCache[subId].inUse)
+    {
+        devCacheUnlink(subId);
+    }
+    MUTEX_unLock(devCacheMutex);
+}
+
+/*!
+ * @brief       Find a device by short address, lock held
+ *
+ * @return      sub ID, DEVICE_INDEX_NOT_FOUND if not found
+ */
+static int devCacheFindShort(uint16_t shortAddr)
+{
+    int32_t subId = devShortHash[devHashShort(shortAddr)];
+
+    while((subId != DEVICE_INDEX_NOT_FOUND)
+          && (devCache[subId].item.devInfo.shortAddress != shortAddr))
+    {
+        subId = devCache[subId].nextShort;
+    }
+    return ((int)subId);
+}
+
+/*!
+ * @brief       Find a device by extended address, lock held
+ *
+ * @return      sub ID, DEVICE_INDEX_NOT_FOUND if not found
+ */
+static int devCacheFindExt(ApiMac_sAddrExt_t *pAddr)
+{
+    int32_t subId = devExtHash[devHashExt(pAddr)];
+
+    while((subId != DEVICE_INDEX_NOT_FOUND)
+          && (memcmp(devCache[subId].item.devInfo.extAddress, *pAddr,
+                     APIMAC_SADDR_EXT_LEN) != 0))
+    {
+        subId = devCache[subId].nextExt;
+    }
+    return ((int)subId);
 }
 
 
@@ -2717,49 +3280,18 @@ static bool removeDevice(ApiMac_sAddr_t addr)
  */
 static void removeTheFirstDevice(void)
 {
-    if(pNV != NULL)
-    {
-        uint16_t numEntries;
-
-        numEntries = Csf_getNumDeviceListEntries();
-
-        if(numEntries > 0)
-        {
-            NVINTF_itemID_t id;
-            uint16_t subId = 0;
-
-            /* Setup NV ID for the device list records */
-            id.systemID = NVINTF_SYSID_APP;
-            id.itemID = CSF_NV_DEVICELIST_ID;
-
-            while(subId < CSF_MAX_DEVICELIST_IDS)
-            {
-                Llc_deviceListItem_t item;
-                uint8_t stat;
-
-                id.subID = (uint16_t)subId;
-
-                /* Read Network Information from NV */
-                stat = pNV->readItem(id, 0, sizeof(Llc_deviceListItem_t),
-                                     &item);
-                if(stat == NVINTF_SUCCESS)
-                {
-                    /* Found the first device in the list */
-                    ApiMac_sAddr_t addr;
-
-                    /* Send a disassociate to the device */
-                    Cllc_sendDisassociationRequest(item.devInfo.shortAddress,
-                                                   item.capInfo.rxOnWhenIdle);
-                    /* Remove device from the NV list */
-                    Cllc_removeDevice(&item.devInfo.extAddress);
+    Llc_deviceListItem_t item;
 
-                    /* Remove it from the Device list */
-                    Csf_removeDeviceListItem(&item.devInfo.extAddress);
-                    break;
-                }
-                subId++;
-            }
-        }
+    if(Csf_getDeviceItem(0, &item))
+    {
+        /* Send a disassociate to the device */
+        Cllc_sendDisassociationRequest(item.devInfo.shortAddress,
+                                       item.capInfo.rxOnWhenIdle);
+        /* Remove device from the NV list */
+        Cllc_removeDevice(&item.devInfo.extAddress);
+
+        /* Remove it from the Device list */
+        Csf_removeDeviceListItem(&item.devInfo.extAddress);
     }
 }
 #endif
@@ -2787,11 +3319,9 @@ void Csf_freeDeviceInformationList(size_t n, Csf_deviceInformation_t *p)
 int Csf_getDeviceInformationList(Csf_deviceInformation_t **ppDeviceInfo)
 {
     Csf_deviceInformation_t *pThis;
-    Llc_deviceListItem_t    tmp;
     uint16_t actual;
-    uint16_t subId;
+    int subId;
     int n;
-    NVINTF_itemID_t id;
 
     /* get number of connected devices */
     n = Csf_getNumDeviceListEntries();
@@ -2804,31 +3334,25 @@ int Csf_getDeviceInformationList(Csf_deviceInformation_t **ppDeviceInfo)
         LOG_printf(LOG_ERROR, "No memory for device list\n");
         return 0;
     }
+    if(devCache == NULL)
+    {
+        return 0;
+    }
 
-    /* Setup NV ID for the device list records */
-    id.systemID = NVINTF_SYSID_APP;
-    id.itemID = CSF_NV_DEVICELIST_ID;
-    subId = 0;
     actual = 0;
     /* Read the Entries */
-    while((subId < CSF_MAX_DEVICELIST_IDS) && (actual < n))
+    MUTEX_lock(devCacheMutex, -1);
+    for(subId = 0; (subId < CSF_MAX_DEVICELIST_IDS) && (actual < n); subId++)
     {
-        uint8_t stat;
-
-        id.subID = subId;
-        /* Read Device Information from NV */
-        stat = pNV->readItem(id, 0,
-                             sizeof(tmp),
-                             &tmp);
-        if(stat == NVINTF_SUCCESS)
+        if(devCache[subId].inUse)
         {
-            pThis->devInfo = tmp.devInfo;
-            pThis->capInfo = tmp.capInfo;
+            pThis->devInfo = devCache[subId].item.devInfo;
+            pThis->capInfo = devCache[subId].item.capInfo;
             actual++;
             pThis++;
         }
-        subId++;
-     }
+    }
+    MUTEX_unLock(devCacheMutex);
 
     /* return actual number of devices connected */
     return actual;
@@ -2887,12 +3411,16 @@ const char *CSF_cllc_statename(Cllc_states_t s)
 extern uint8_t Csf_sendConfigRequest( ApiMac_sAddr_t *pDstAddr,
                 uint16_t frameControl,
                 uint32_t reportingInterval,
-                uint32_t pollingInterval)
+                uint32_t pollingInterval,
+                const uint32_t *pCorrId,
+                int connId)
 {
     return Collector_sendConfigRequest( pDstAddr,
                 frameControl,
                 reportingInterval,
-                pollingInterval);
+                pollingInterval,
+                pCorrId,
+                connId);
 }
 
 /*!
@@ -2907,12 +3435,80 @@ extern uint8_t Csf_sendToggleLedRequest(
     return Collector_sendToggleLedRequest(pDstAddr);
 }
 
+/*!
+ The appsrv module calls this function to send a custom command
+ to a device over the air
+
+ Public function defined in csf_linux.h
+ */
 extern uint8_t Csf_customCommand(
                 ApiMac_sAddr_t *pDstAddr,
                 uint8_t *state,
-                uint16_t length)
+                uint16_t length,
+                const uint32_t *pCorrId,
+                int connId)
+{
+    return Collector_sendCustomCommand(pDstAddr, state, length, pCorrId,
+                                       connId);
+}
+
+/*!
+ The appsrv module calls this function to send a config to a set
+ of devices
+
+ Public function defined in csf_linux.h
+ */
+extern uint8_t Csf_startConfigRollout(const Collector_rolloutCfg_t *pCfg,
+                                      const uint16_t *pShortAddrs,
+                                      uint16_t n)
+{
+    return Collector_startConfigRollout(pCfg, pShortAddrs, n);
+}
+
+/*!
+ The appsrv module calls this function for the config rollout progress
+
+ Public function defined in csf_linux.h
+ */
+extern void Csf_getConfigRolloutProgress(
+                Collector_rolloutProgress_t *pProgress)
+{
+    Collector_getConfigRolloutProgress(pProgress);
+}
+
+/*!
+ The appsrv module calls this function for the downlink queue statistics
+ of a device
+
+ Public function defined in csf_linux.h
+ */
+extern uint8_t Csf_getDownlinkQueueStats(uint16_t shortAddr,
+                                         Collector_dlqStats_t *pStats)
+{
+    return Collector_getDownlinkQueueStats(shortAddr, pStats);
+}
+
+/*!
+ The appsrv module calls this function for the fragmentation statistics
+
+ Public function defined in csf_linux.h
+ */
+extern void Csf_getFragStatistics(Frag_statistics_t *pStats)
+{
+    Frag_getStatistics(pStats);
+}
+
+/*!
+ The application calls this function when a tracked data request was
+ confirmed.
+
+ Public function defined in csf_linux.h
+ */
+void Csf_txDataCnf(int connId, uint32_t corrId, int status,
+                   uint32_t latencyMs)
 {
-	return Collector_sendCustomCommand(pDstAddr, state, length);
+    /* tell the appClient that sent it */
+    appsrv_txDataCnf(connId, corrId, status, latencyMs);
 }
 /*
  * Public function in csf_linux.h
@@ -2939,13 +3535,7 @@ static double getUnixTime(void)
  */
 static void startOADResetReqRetryTimer(void)
 {
-    stopOADResetReqRetryTimer();
-
-    oadResetReqRetryClkHandle = TIMER_CB_create("oadResetReqRetryTimer",
-        processOadResetReqRetryTimeoutCallback_WRAPPER,
-        0,
-        OAD_RESET_REQ_RETRY_TIMEOUT_VALUE,
-        true);
+    TimerWheel_arm(&oadResetReqRetryTimer, OAD_RESET_REQ_RETRY_TIMEOUT_VALUE);
 }
 
 /*!
@@ -2953,11 +3543,7 @@ static void startOADResetReqRetryTimer(void)
  */
 static void stopOADResetReqRetryTimer(void)
 {
-    if (oadResetReqRetryClkHandle != 0)
-    {
-        TIMER_CB_destroy(oadResetReqRetryClkHandle);
-        oadResetReqRetryClkHandle = 0;
-    }
+    TimerWheel_cancel(&oadResetReqRetryTimer);
 }
 #endif
 
@@ -2974,6 +3560,18 @@ void Csf_deviceRawDataUpdate(ApiMac_mcpsDataInd_t *pDataInd)
     Board_Led_toggle(board_led_type_LED2);
 }
 
+/*!
+ The application calls this function when a fragmented custom command
+ ended.
+
+ Public function defined in csf_linux.h
+ */
+void Csf_customFragTxDone(const Frag_txResult_t *pResult)
+{
+    /* tell the appClient */
+    appsrv_fragTxDone(pResult);
+}
+
 /*!
  * @brief       Handles printing that the orphaned device joined back
  *
@@ -18,6 +18,19 @@
 
 typedef uint8_t UArg;
 
+/* NV Item ID - the device's network information */
+#define CSF_NV_NETWORK_INFO_ID 0x0001
+/* NV Item ID - the number of device list entries */
+#define CSF_NV_DEVICELIST_ENTRIES_ID 0x0004
+/* NV Item ID - the device list, use sub ID for each record in the list */
+#define CSF_NV_DEVICELIST_ID 0x0005
+/* NV Item ID - this devices frame counter */
+#define CSF_NV_FRAMECOUNTER_ID 0x0006
+/* NV Item ID - reset reason */
+#define CSF_NV_RESET_REASON_ID 0x0007
+/* NV Item ID - 1 while the journal is known to be flushed (clean exit) */
+#define CSF_NV_CLEAN_SHUTDOWN_ID 0x0008
+
 /*!
  * Network parameters for a non-frequency hopping coordinator.
  */
@@ -125,6 +138,37 @@ const char *CSF_cllc_statename(Cllc_states_t s);
  */
 Cllc_states_t Csf_getCllcState(void);
 
+/*! Default for Csf_journalFlush_mSecs */
+#define CSF_JOURNAL_FLUSH_INTERVAL 5000
+/*! Default for Csf_journalFlushCount */
+#define CSF_JOURNAL_FLUSH_COUNT 64
+
+/*!
+ Frame counter updates are kept in RAM and written to NV this long after
+ the first one, 0 writes every update at once (ini setting)
+ */
+extern uint32_t Csf_journalFlush_mSecs;
+/*! ... or as soon as this many are waiting (ini setting) */
+extern uint32_t Csf_journalFlushCount;
+
+/*!
+ * @brief Write all frame counter and device record updates waiting in
+ *        the journal to NV. Also runs from the flush clock, when
+ *        Csf_journalFlushCount updates are waiting and at shutdown.
+ */
+extern void Csf_flushJournal(void);
+
+/*! How long Csf_shutdown() waits for the collector thread, in ms */
+#define CSF_SHUTDOWN_WAIT 5000
+
+/*!
+ * @brief Have the collector thread write the journal to NV and mark NV
+ *        as cleanly shut down, so the next start trusts the saved frame
+ *        counters. From then on every update is written at once. Call
+ *        before exit(), from any thread but the collector thread.
+ */
+extern void Csf_shutdown(void);
+
 /*!
  * @brief Send the configuration message to a collector module to be
  *        sent OTA.
@@ -140,12 +184,18 @@ Cllc_states_t Csf_getCllcState(void);
  *                          poll its parent for data (for sleeping devices
  *                          only.
  *
+ * @param pCorrId - if not NULL, the MAC data confirm is reported with
+ *                  this correlation id, see Csf_txDataCnf()
+ * @param connId - gateway connection the confirm goes back to
+ *
  * @return status(uint8_t) - Success (0), Failure (1)
  */
 extern uint8_t Csf_sendConfigRequest( ApiMac_sAddr_t *pDstAddr,
                 uint16_t frameControl,
                 uint32_t reportingInterval,
-                uint32_t pollingInterval);
+                uint32_t pollingInterval,
+                const uint32_t *pCorrId,
+                int connId);
 /*!
  * @brief Build and send the toggle led message to a device.
  *
@@ -157,10 +207,78 @@ extern uint8_t Csf_sendConfigRequest( ApiMac_sAddr_t *pDstAddr,
 extern uint8_t Csf_sendToggleLedRequest(
                 ApiMac_sAddr_t *pDstAddr);
 
+/*!
+ * @brief Send a custom command to a device.
+ *
+ * @param pDstAddr - destination address of the device
+ * @param state - the command
+ * @param length - command length
+ * @param pCorrId - if not NULL, the outcome is reported with this
+ *                  correlation id, see Csf_txDataCnf()
+ * @param connId - gateway connection the outcome goes back to
+ *
+ * @return Collector_status_t value
+ */
 extern uint8_t Csf_customCommand(
                 ApiMac_sAddr_t *pDstAddr,
                 uint8_t *state,
-                uint16_t length);
+                uint16_t length,
+                const uint32_t *pCorrId,
+                int connId);
+
+/*!
+ * @brief       The application calls this function when a data request
+ *              sent with a correlation id was confirmed by the MAC.
+ *
+ * @param       connId - gateway connection the request came in on
+ * @param       corrId - correlation id from the gateway
+ * @param       status - ApiMac_status_t from the data confirm
+ * @param       latencyMs - time from the request to the confirm
+ */
+extern void Csf_txDataCnf(int connId, uint32_t corrId, int status,
+                          uint32_t latencyMs);
+
+/*!
+ * @brief Start sending a config to a set of devices, see
+ *        Collector_startConfigRollout()
+ *
+ * @param pCfg - the config and the pacing
+ * @param pShortAddrs - the devices
+ * @param n - number of devices, 0: all devices that are alive
+ *
+ * @return Collector_status_t value
+ */
+extern uint8_t Csf_startConfigRollout(const Collector_rolloutCfg_t *pCfg,
+                                      const uint16_t *pShortAddrs,
+                                      uint16_t n);
+
+/*!
+ * @brief Get the progress of the last config rollout
+ *
+ * @param pProgress - filled in
+ */
+extern void Csf_getConfigRolloutProgress(
+                Collector_rolloutProgress_t *pProgress);
+
+/*!
+ * @brief Get the downlink queue statistics of a sleepy device, see
+ *        Collector_getDownlinkQueueStats()
+ *
+ * @param shortAddr - the device
+ * @param pStats - filled in
+ *
+ * @return Collector_status_t value
+ */
+extern uint8_t Csf_getDownlinkQueueStats(uint16_t shortAddr,
+                                         Collector_dlqStats_t *pStats);
+
+/*!
+ * @brief Get the fragmentation statistics, see Frag_getStatistics()
+ *
+ * @param pStats - filled in
+ */
+extern void Csf_getFragStatistics(Frag_statistics_t *pStats);
+
 /*!
  * @brief       The application calls this function to indicate that a device
  *              disassociated.
@@ -190,9 +308,12 @@ extern void Csf_deviceSensorDeviceTypeResponseUpdate(ApiMac_sAddr_t *pSrcAddr, u
 /*!
  * @brief       Display Sensor device and data
  *
- * @param       pDataInd - pointer to the data indication information
+ * @param       pSrcAddr - short address of the device that sent the message
+ * @param       rssi - the received packet's signal strength
+ * @param       pMsg - decoded sensor data message
  */
-extern void Csf_deviceSensorDisplay(ApiMac_mcpsDataInd_t *pDataInd);
+extern void Csf_deviceSensorDisplay(ApiMac_sAddr_t *pSrcAddr, int8_t rssi,
+                                    const Smsgs_sensorMsg_t *pMsg);
 
 /*!
  The application calls this function to indicate that a device
@@ -276,6 +397,14 @@ bool Csf_getDeviceExtended(uint16_t shortAddr, ApiMac_sAddrExt_t *pExtAddr);
  */
 extern void Csf_deviceRawDataUpdate(ApiMac_mcpsDataInd_t *pDataInd);
 
+/*!
+ * @brief       The application calls this function when a fragmented
+ *              custom command was acked completely or given up on.
+ *
+ * @param       pResult - outcome and statistics of the transfer
+ */
+extern void Csf_customFragTxDone(const Frag_txResult_t *pResult);
+
 /*!
  * @brief       Handles printing that the orphaned device joined back
  *
@@ -0,0 +1,847 @@
+/******************************************************************************
+
+ @file frag.c
+
+ @brief Custom command fragmentation
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "frag.h"
+#include "smsgs.h"
+#include "log.h"
+#include "mutex.h"
+#include "fatal.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! One downlink transfer */
+typedef struct
+{
+    /*! Slot is in use */
+    bool inUse;
+    /*! Destination */
+    uint16_t dstShortAddr;
+    bool rxOnIdle;
+    /*! Message id on the air */
+    uint8_t msgId;
+    /*! Message length and number of fragments */
+    uint16_t len;
+    uint16_t numFrags;
+    /*! No ack for this long: everything in flight is lost */
+    uint32_t ackTimeout;
+    /*! Times each fragment was sent */
+    uint8_t tries[FRAG_MAX_FRAGS];
+    /*! Fragments the receiver has */
+    uint8_t acked[FRAG_BITMAP_LEN];
+    /*! Fragments to send again */
+    uint8_t lost[FRAG_BITMAP_LEN];
+    uint16_t numAcked;
+    /*! First fragment never sent */
+    uint16_t nextNew;
+    /*! Start of the transfer, and last send or ack */
+    uint32_t startMs;
+    uint32_t lastMs;
+    /*! Counters for the result */
+    uint16_t fragsSent;
+    uint16_t retransmits;
+    /*! Correlation id and connection for the result */
+    bool hasCorrId;
+    uint32_t corrId;
+    int connId;
+    /*! The message, FRAG_MAX_LEN bytes of the pool */
+    uint8_t *pBuf;
+} fragTx_t;
+
+/*! Reassembly slot states */
+#define FRAG_RX_FREE 0
+/*! Collecting fragments */
+#define FRAG_RX_BUSY 1
+/*! Complete, the application has it */
+#define FRAG_RX_DELIVERING 2
+
+/*! One uplink message being reassembled */
+typedef struct
+{
+    uint8_t state;
+    /*! Key: source and message id */
+    uint16_t srcShortAddr;
+    uint8_t msgId;
+    /*! Message length and number of fragments */
+    uint16_t len;
+    uint16_t numFrags;
+    /*! Fragments received */
+    uint8_t rcvd[FRAG_BITMAP_LEN];
+    uint16_t numRcvd;
+    /*! Previous fragment received, for the out of order counter */
+    int lastIdx;
+    /*! Last fragment received */
+    uint32_t lastMs;
+    /*! The message, FRAG_MAX_LEN bytes of the arena */
+    uint8_t *pBuf;
+} fragRx_t;
+
+/*! Recently completed uplink message, to ack late duplicates */
+typedef struct
+{
+    bool valid;
+    uint16_t srcShortAddr;
+    uint8_t msgId;
+    uint16_t numFrags;
+} fragRxDone_t;
+
+/******************************************************************************
+ Global variables
+ *****************************************************************************/
+
+/*! Fragmentation statistics */
+Frag_statistics_t Frag_statistics;
+
+/*! Partial uplink messages are dropped after this long */
+uint32_t Frag_reassemblyTimeout_mSecs = FRAG_REASSEMBLY_TIMEOUT;
+
+/******************************************************************************
+ Local variables
+ *****************************************************************************/
+
+static const Frag_fxns_t *pFragFxns;
+static intptr_t fragMutex;
+static fragTx_t fragTx[FRAG_TX_SLOTS];
+static uint8_t *pFragPool;
+static fragRx_t fragRx[FRAG_RX_SLOTS];
+static uint8_t *pFragArena;
+static fragRxDone_t fragRxDone[FRAG_RX_SLOTS];
+static int fragRxDoneNext;
+static uint8_t nextMsgId;
+/*! The one shot clock is armed */
+static bool fragClockRunning;
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief monotonic milliseconds
+ */
+static uint32_t nowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+static bool bitGet(const uint8_t *pMap, int n)
+{
+    return (pMap[n / 8] & (1 << (n % 8))) != 0;
+}
+
+static void bitSet(uint8_t *pMap, int n)
+{
+    pMap[n / 8] |= (uint8_t)(1 << (n % 8));
+}
+
+static void bitClr(uint8_t *pMap, int n)
+{
+    pMap[n / 8] &= (uint8_t)~(1 << (n % 8));
+}
+
+/*!
+ * @brief number of fragments sent and neither acked nor known lost
+ */
+static int inFlight(fragTx_t *pTx)
+{
+    int n;
+    int x;
+
+    n = 0;
+    for(x = 0; x < pTx->nextNew; x++)
+    {
+        if(!bitGet(pTx->acked, x) && !bitGet(pTx->lost, x))
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*!
+ * @brief next fragment to send: lost ones first, then new ones
+ * @return fragment index or -1
+ */
+static int nextToSend(fragTx_t *pTx)
+{
+    int x;
+
+    for(x = 0; x < pTx->nextNew; x++)
+    {
+        if(bitGet(pTx->lost, x))
+        {
+            return x;
+        }
+    }
+    if(pTx->nextNew < pTx->numFrags)
+    {
+        return pTx->nextNew;
+    }
+    return -1;
+}
+
+/*!
+ * @brief end a transfer and free its slot
+ * @param pTx - the transfer
+ * @param status - how it ended
+ * @param pResult - filled in for the done callback
+ */
+static void finish(fragTx_t *pTx, Frag_status_t status,
+                   Frag_txResult_t *pResult)
+{
+    pResult->dstShortAddr = pTx->dstShortAddr;
+    pResult->msgId = pTx->msgId;
+    pResult->status = status;
+    pResult->len = pTx->len;
+    pResult->numFrags = (uint8_t)pTx->numFrags;
+    pResult->fragsSent = pTx->fragsSent;
+    pResult->retransmits = pTx->retransmits;
+    pResult->durationMs = nowMs() - pTx->startMs;
+    pResult->hasCorrId = pTx->hasCorrId;
+    pResult->corrId = pTx->corrId;
+    pResult->connId = pTx->connId;
+
+    if(status == Frag_status_success)
+    {
+        Frag_statistics.txCompleted++;
+        Frag_statistics.txBytesAcked += pTx->len;
+        Frag_statistics.txMsAcked += pResult->durationMs;
+    }
+    else
+    {
+        Frag_statistics.txFailed++;
+    }
+    LOG_printf(LOG_DBG_COLLECTOR,
+               "frag: 0x%04x msg %d status %d, %d bytes in %d frags, "
+               "%d sent, %d retransmits, %u ms (%u bytes/s)\n",
+               pTx->dstShortAddr, pTx->msgId, (int)status, pTx->len,
+               pTx->numFrags, pTx->fragsSent, pTx->retransmits,
+               (unsigned)(pResult->durationMs),
+               (unsigned)(pResult->durationMs ?
+                          ((pTx->len * 1000UL) / pResult->durationMs) : 0));
+    pTx->inUse = false;
+}
+
+/*!
+ * @brief keep the window of a transfer full
+ * @param pTx - the transfer
+ * @param pResult - filled in if the transfer ended
+ * @return true if the transfer ended
+ */
+static bool pump(fragTx_t *pTx, Frag_txResult_t *pResult)
+{
+    uint8_t msg[SMSGS_CUSTOM_FRAG_HDR_LEN + FRAG_PAYLOAD_LEN];
+    uint16_t offset;
+    uint16_t len;
+    int n;
+    int idx;
+
+    n = inFlight(pTx);
+    while(n < FRAG_WINDOW)
+    {
+        idx = nextToSend(pTx);
+        if(idx < 0)
+        {
+            break;
+        }
+        if(pTx->tries[idx] >= FRAG_MAX_TRIES)
+        {
+            finish(pTx, Frag_status_timeout, pResult);
+            return true;
+        }
+
+        /* it is in flight now */
+        if(idx == pTx->nextNew)
+        {
+            pTx->nextNew++;
+        }
+        else
+        {
+            bitClr(pTx->lost, idx);
+            pTx->retransmits++;
+            Frag_statistics.txRetransmits++;
+        }
+        pTx->tries[idx]++;
+        n++;
+
+        offset = (uint16_t)(idx * FRAG_PAYLOAD_LEN);
+        len = pTx->len - offset;
+        if(len > FRAG_PAYLOAD_LEN)
+        {
+            len = FRAG_PAYLOAD_LEN;
+        }
+        msg[0] = (uint8_t)Smsgs_cmdIds_customFrag;
+        msg[1] = pTx->msgId;
+        /* ask for an ack when the window is full or nothing is left */
+        msg[2] = ((n == FRAG_WINDOW) || (nextToSend(pTx) < 0)) ?
+                 FRAG_FLAG_ACK_REQ : 0;
+        msg[3] = (uint8_t)idx;
+        msg[4] = (uint8_t)pTx->numFrags;
+        msg[5] = (uint8_t)(pTx->len & 0xFF);
+        msg[6] = (uint8_t)((pTx->len >> 8) & 0xFF);
+        memcpy(&msg[SMSGS_CUSTOM_FRAG_HDR_LEN], pTx->pBuf + offset, len);
+
+        pTx->lastMs = nowMs();
+        if(!pFragFxns->pSendFxn(pTx->dstShortAddr, pTx->rxOnIdle, msg,
+                                (uint16_t)(SMSGS_CUSTOM_FRAG_HDR_LEN + len)))
+        {
+            /* MAC queue full, try again on the next tick */
+            bitSet(pTx->lost, idx);
+            if(pTx->tries[idx] >= FRAG_MAX_TRIES)
+            {
+                finish(pTx, Frag_status_sendFailed, pResult);
+                return true;
+            }
+            break;
+        }
+        pTx->fragsSent++;
+        Frag_statistics.txFragments++;
+    }
+    return false;
+}
+
+/*!
+ * @brief ack an uplink message
+ * @param dstShortAddr - the sensor
+ * @param rxOnIdle - false if the sensor is sleepy
+ * @param msgId - its message id
+ * @param complete - all fragments are in
+ * @param pRcvd - fragments received
+ */
+static void sendAck(uint16_t dstShortAddr, bool rxOnIdle, uint8_t msgId,
+                    bool complete, const uint8_t *pRcvd)
+{
+    uint8_t msg[SMSGS_CUSTOM_FRAG_ACK_LEN];
+
+    msg[0] = (uint8_t)Smsgs_cmdIds_customFragAck;
+    msg[1] = msgId;
+    msg[2] = complete ? FRAG_ACK_COMPLETE : 0;
+    memcpy(&msg[3], pRcvd, FRAG_BITMAP_LEN);
+
+    /* a lost ack is recovered by the sender's retransmit */
+    pFragFxns->pSendFxn(dstShortAddr, rxOnIdle, msg, sizeof(msg));
+}
+
+/*!
+ * @brief keep the clock running while there are transfers
+ */
+static void updateClock(void)
+{
+    bool active;
+    int x;
+
+    active = false;
+    for(x = 0; x < FRAG_TX_SLOTS; x++)
+    {
+        if(fragTx[x].inUse)
+        {
+            active = true;
+            break;
+        }
+    }
+    for(x = 0; x < FRAG_RX_SLOTS; x++)
+    {
+        if(fragRx[x].state == FRAG_RX_BUSY)
+        {
+            active = true;
+            break;
+        }
+    }
+    /* don't restart a running clock, acks would keep pushing it out */
+    if(active != fragClockRunning)
+    {
+        pFragFxns->pSetClockFxn(active ? FRAG_TICK : 0);
+        fragClockRunning = active;
+    }
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+/*!
+ Initialize the fragmentation module.
+
+ Public function defined in frag.h
+ */
+void Frag_init(const Frag_fxns_t *pFxns)
+{
+    int x;
+
+    pFragFxns = pFxns;
+    memset(&Frag_statistics, 0, sizeof(Frag_statistics));
+    memset(fragTx, 0, sizeof(fragTx));
+
+    fragMutex = MUTEX_create("frag");
+    if(fragMutex == 0)
+    {
+        BUG_HERE("cannot create frag mutex\n");
+    }
+
+    /* all buffers up front, transfers never allocate */
+    pFragPool = malloc(FRAG_TX_SLOTS * FRAG_MAX_LEN);
+    if(pFragPool == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    for(x = 0; x < FRAG_TX_SLOTS; x++)
+    {
+        fragTx[x].pBuf = pFragPool + (x * FRAG_MAX_LEN);
+    }
+
+    memset(fragRx, 0, sizeof(fragRx));
+    memset(fragRxDone, 0, sizeof(fragRxDone));
+    pFragArena = malloc(FRAG_RX_SLOTS * FRAG_MAX_LEN);
+    if(pFragArena == NULL)
+    {
+        BUG_HERE("No memory\n");
+    }
+    for(x = 0; x < FRAG_RX_SLOTS; x++)
+    {
+        fragRx[x].pBuf = pFragArena + (x * FRAG_MAX_LEN);
+    }
+}
+
+/*!
+ Copy the statistics.
+
+ Public function defined in frag.h
+ */
+void Frag_getStatistics(Frag_statistics_t *pStats)
+{
+    MUTEX_lock(fragMutex, -1);
+    *pStats = Frag_statistics;
+    MUTEX_unLock(fragMutex);
+}
+
+/*!
+ Start sending a message in fragments.
+
+ Public function defined in frag.h
+ */
+Frag_status_t Frag_send(uint16_t dstShortAddr, bool rxOnIdle,
+                        uint32_t pollInterval,
+                        const uint8_t *pData, uint16_t len,
+                        const uint32_t *pCorrId, int connId)
+{
+    Frag_txResult_t result;
+    fragTx_t *pTx;
+    uint8_t *pBuf;
+    bool done;
+    int x;
+
+    if((len == 0) || (len > FRAG_MAX_LEN))
+    {
+        return Frag_status_tooLong;
+    }
+
+    MUTEX_lock(fragMutex, -1);
+    pTx = NULL;
+    for(x = 0; x < FRAG_TX_SLOTS; x++)
+    {
+        if(!fragTx[x].inUse)
+        {
+            pTx = &fragTx[x];
+            break;
+        }
+    }
+    if(pTx == NULL)
+    {
+        Frag_statistics.txBusy++;
+        MUTEX_unLock(fragMutex);
+        return Frag_status_busy;
+    }
+
+    pBuf = pTx->pBuf;
+    memset(pTx, 0, sizeof(*pTx));
+    pTx->pBuf = pBuf;
+    pTx->inUse = true;
+    pTx->dstShortAddr = dstShortAddr;
+    pTx->rxOnIdle = rxOnIdle;
+    pTx->msgId = nextMsgId++;
+    pTx->len = len;
+    pTx->numFrags = (uint16_t)((len + FRAG_PAYLOAD_LEN - 1) / FRAG_PAYLOAD_LEN);
+    /* a sleepy device picks up one fragment per poll */
+    pTx->ackTimeout = FRAG_ACK_TIMEOUT;
+    if(!rxOnIdle)
+    {
+        pTx->ackTimeout += pollInterval * (FRAG_WINDOW + 1);
+    }
+    pTx->startMs = nowMs();
+    if(pCorrId)
+    {
+        pTx->hasCorrId = true;
+        pTx->corrId = *pCorrId;
+        pTx->connId = connId;
+    }
+    memcpy(pTx->pBuf, pData, len);
+    Frag_statistics.txMessages++;
+
+    done = pump(pTx, &result);
+    updateClock();
+    MUTEX_unLock(fragMutex);
+
+    if(done && pFragFxns->pTxDoneFxn)
+    {
+        pFragFxns->pTxDoneFxn(&result);
+    }
+    return Frag_status_success;
+}
+
+/*!
+ Process a fragment ack.
+
+ Public function defined in frag.h
+ */
+void Frag_processAck(ApiMac_mcpsDataInd_t *pDataInd)
+{
+    Frag_txResult_t result;
+    fragTx_t *pTx;
+    uint8_t *pMsg;
+    bool done;
+    int highest;
+    int x;
+
+    if((pDataInd->msdu.len < SMSGS_CUSTOM_FRAG_ACK_LEN) ||
+       (pDataInd->srcAddr.addrMode != ApiMac_addrType_short))
+    {
+        return;
+    }
+    pMsg = pDataInd->msdu.p;
+
+    MUTEX_lock(fragMutex, -1);
+    pTx = NULL;
+    for(x = 0; x < FRAG_TX_SLOTS; x++)
+    {
+        if(fragTx[x].inUse &&
+           (fragTx[x].dstShortAddr == pDataInd->srcAddr.addr.shortAddr) &&
+           (fragTx[x].msgId == pMsg[1]))
+        {
+            pTx = &fragTx[x];
+            break;
+        }
+    }
+    if(pTx == NULL)
+    {
+        /* late ack for a transfer that already ended */
+        MUTEX_unLock(fragMutex);
+        return;
+    }
+
+    highest = -1;
+    for(x = 0; x < pTx->numFrags; x++)
+    {
+        if(bitGet(&pMsg[3], x))
+        {
+            highest = x;
+            if(!bitGet(pTx->acked, x))
+            {
+                bitSet(pTx->acked, x);
+                bitClr(pTx->lost, x);
+                pTx->numAcked++;
+            }
+        }
+    }
+    /* anything sent before the newest one received is lost */
+    for(x = 0; x < highest; x++)
+    {
+        if(!bitGet(pTx->acked, x))
+        {
+            bitSet(pTx->lost, x);
+        }
+    }
+    pTx->lastMs = nowMs();
+
+    done = true;
+    if((pTx->numAcked == pTx->numFrags) || (pMsg[2] & FRAG_ACK_COMPLETE))
+    {
+        finish(pTx, Frag_status_success, &result);
+    }
+    else
+    {
+        done = pump(pTx, &result);
+    }
+    updateClock();
+    MUTEX_unLock(fragMutex);
+
+    if(done && pFragFxns->pTxDoneFxn)
+    {
+        pFragFxns->pTxDoneFxn(&result);
+    }
+}
+
+/*!
+ Process a fragment from a sensor.
+
+ Public function defined in frag.h
+ */
+void Frag_processFragment(ApiMac_mcpsDataInd_t *pDataInd, bool rxOnIdle)
+{
+    ApiMac_mcpsDataInd_t dataInd;
+    fragRx_t *pRx;
+    uint8_t *pMsg;
+    uint8_t *pBuf;
+    uint16_t src;
+    uint16_t total;
+    uint16_t fragLen;
+    uint8_t msgId;
+    int idx;
+    int count;
+    int x;
+
+    MUTEX_lock(fragMutex, -1);
+    Frag_statistics.rxFragments++;
+
+    pMsg = pDataInd->msdu.p;
+    if((pDataInd->msdu.len < SMSGS_CUSTOM_FRAG_HDR_LEN) ||
+       (pDataInd->srcAddr.addrMode != ApiMac_addrType_short))
+    {
+        Frag_statistics.rxDropped++;
+        MUTEX_unLock(fragMutex);
+        return;
+    }
+    src = pDataInd->srcAddr.addr.shortAddr;
+    msgId = pMsg[1];
+    idx = pMsg[3];
+    count = pMsg[4];
+    total = (uint16_t)(pMsg[5]) | (pMsg[6] << 8);
+    fragLen = pDataInd->msdu.len - SMSGS_CUSTOM_FRAG_HDR_LEN;
+
+    /* the header must describe the message the same way every time */
+    if((count == 0) || (idx >= count) || (total > FRAG_MAX_LEN) ||
+       (count != ((total + FRAG_PAYLOAD_LEN - 1) / FRAG_PAYLOAD_LEN)) ||
+       (fragLen != ((idx == (count - 1)) ?
+                    (total - (idx * FRAG_PAYLOAD_LEN)) : FRAG_PAYLOAD_LEN)))
+    {
+        Frag_statistics.rxDropped++;
+        MUTEX_unLock(fragMutex);
+        return;
+    }
+
+    pRx = NULL;
+    for(x = 0; x < FRAG_RX_SLOTS; x++)
+    {
+        if((fragRx[x].state != FRAG_RX_FREE) &&
+           (fragRx[x].srcShortAddr == src) && (fragRx[x].msgId == msgId))
+        {
+            pRx = &fragRx[x];
+            break;
+        }
+    }
+
+    if(pRx == NULL)
+    {
+        /* the sender missed our last ack? */
+        for(x = 0; x < FRAG_RX_SLOTS; x++)
+        {
+            if(fragRxDone[x].valid && (fragRxDone[x].srcShortAddr == src) &&
+               (fragRxDone[x].msgId == msgId) &&
+               (fragRxDone[x].numFrags == count))
+            {
+                uint8_t all[FRAG_BITMAP_LEN];
+                int y;
+
+                memset(all, 0, sizeof(all));
+                for(y = 0; y < count; y++)
+                {
+                    bitSet(all, y);
+                }
+                Frag_statistics.rxDuplicates++;
+                sendAck(src, rxOnIdle, msgId, true, all);
+                MUTEX_unLock(fragMutex);
+                return;
+            }
+        }
+
+        for(x = 0; x < FRAG_RX_SLOTS; x++)
+        {
+            if(fragRx[x].state == FRAG_RX_FREE)
+            {
+                pRx = &fragRx[x];
+                break;
+            }
+        }
+        if(pRx == NULL)
+        {
+            /* arena full, the sender will try again */
+            Frag_statistics.rxDropped++;
+            MUTEX_unLock(fragMutex);
+            return;
+        }
+
+        pBuf = pRx->pBuf;
+        memset(pRx, 0, sizeof(*pRx));
+        pRx->pBuf = pBuf;
+        pRx->state = FRAG_RX_BUSY;
+        pRx->srcShortAddr = src;
+        pRx->msgId = msgId;
+        pRx->len = total;
+        pRx->numFrags = (uint16_t)count;
+        pRx->lastIdx = -1;
+    }
+    else if((pRx->state != FRAG_RX_BUSY) || (pRx->len != total))
+    {
+        /* being delivered, or a different message reusing the id */
+        Frag_statistics.rxDropped++;
+        MUTEX_unLock(fragMutex);
+        return;
+    }
+
+    if(bitGet(pRx->rcvd, idx))
+    {
+        Frag_statistics.rxDuplicates++;
+    }
+    else
+    {
+        if(idx != (pRx->lastIdx + 1))
+        {
+            Frag_statistics.rxOutOfOrder++;
+        }
+        memcpy(pRx->pBuf + (idx * FRAG_PAYLOAD_LEN),
+               &pMsg[SMSGS_CUSTOM_FRAG_HDR_LEN], fragLen);
+        bitSet(pRx->rcvd, idx);
+        pRx->numRcvd++;
+    }
+    pRx->lastIdx = idx;
+    pRx->lastMs = nowMs();
+
+    if(pRx->numRcvd < pRx->numFrags)
+    {
+        if(pMsg[2] & FRAG_FLAG_ACK_REQ)
+        {
+            sendAck(src, rxOnIdle, msgId, false, pRx->rcvd);
+        }
+        updateClock();
+        MUTEX_unLock(fragMutex);
+        return;
+    }
+
+    /* complete: remember it for late duplicates, ack, deliver */
+    fragRxDone[fragRxDoneNext].valid = true;
+    fragRxDone[fragRxDoneNext].srcShortAddr = src;
+    fragRxDone[fragRxDoneNext].msgId = msgId;
+    fragRxDone[fragRxDoneNext].numFrags = pRx->numFrags;
+    fragRxDoneNext = (fragRxDoneNext + 1) % FRAG_RX_SLOTS;
+
+    sendAck(src, rxOnIdle, msgId, true, pRx->rcvd);
+    pRx->state = FRAG_RX_DELIVERING;
+    updateClock();
+    MUTEX_unLock(fragMutex);
+
+    /* one indication for the whole message */
+    dataInd = *pDataInd;
+    dataInd.msdu.p = pRx->pBuf;
+    dataInd.msdu.len = pRx->len;
+    if(pFragFxns->pRxDoneFxn)
+    {
+        pFragFxns->pRxDoneFxn(&dataInd);
+    }
+
+    MUTEX_lock(fragMutex, -1);
+    pRx->state = FRAG_RX_FREE;
+    Frag_statistics.rxCompleted++;
+    MUTEX_unLock(fragMutex);
+}
+
+/*!
+ Clock event.
+
+ Public function defined in frag.h
+ */
+void Frag_process(void)
+{
+    Frag_txResult_t results[FRAG_TX_SLOTS];
+    fragTx_t *pTx;
+    uint32_t now;
+    int nDone;
+    int x;
+    int y;
+
+    nDone = 0;
+    now = nowMs();
+
+    MUTEX_lock(fragMutex, -1);
+    /* the clock fired, it is not running anymore */
+    fragClockRunning = false;
+    for(x = 0; x < FRAG_TX_SLOTS; x++)
+    {
+        pTx = &fragTx[x];
+        if(!pTx->inUse)
+        {
+            continue;
+        }
+        if((now - pTx->lastMs) >= pTx->ackTimeout)
+        {
+            /* no ack in time, send everything in flight again */
+            for(y = 0; y < pTx->nextNew; y++)
+            {
+                if(!bitGet(pTx->acked, y))
+                {
+                    bitSet(pTx->lost, y);
+                }
+            }
+        }
+        if(pump(pTx, &results[nDone]))
+        {
+            nDone++;
+        }
+    }
+    for(x = 0; x < FRAG_RX_SLOTS; x++)
+    {
+        if((fragRx[x].state == FRAG_RX_BUSY) &&
+           ((now - fragRx[x].lastMs) >= Frag_reassemblyTimeout_mSecs))
+        {
+            LOG_printf(LOG_DBG_COLLECTOR,
+                       "frag: 0x%04x msg %d expired, %d of %d frags\n",
+                       fragRx[x].srcShortAddr, fragRx[x].msgId,
+                       fragRx[x].numRcvd, fragRx[x].numFrags);
+            Frag_statistics.rxExpired++;
+            fragRx[x].state = FRAG_RX_FREE;
+        }
+    }
+    updateClock();
+    MUTEX_unLock(fragMutex);
+
+    for(x = 0; (x < nDone) && pFragFxns->pTxDoneFxn; x++)
+    {
+        pFragFxns->pTxDoneFxn(&results[x]);
+    }
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -0,0 +1,275 @@
+/******************************************************************************
+
+ @file frag.h
+
+ @brief Custom command fragmentation
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+/*!*****************************************************************************
+ *  @file       frag.h
+ *
+ *  @brief      Segmentation of custom command payloads
+ *
+ *  Custom commands that do not fit in one MSDU are cut into fragments
+ *  (Smsgs_cmdIds_customFrag) and sent with a sliding window. The
+ *  receiver answers with a selective ack (Smsgs_cmdIds_customFragAck)
+ *  whenever a fragment asks for one and when the message is complete.
+ *  Fragments the ack shows as missing are sent again, and so is
+ *  everything unacked when no ack arrives in time.
+ *
+ *  The message flow for a 5 fragment message with a window of 4:
+ *
+ *  Collector                          Device
+ *
+ *   FRAG(0) ------------------------------>
+ *   FRAG(1) ------------------------X
+ *   FRAG(2) ------------------------------>
+ *   FRAG(3, ack req) --------------------->
+ *       <--------------------------- ACK(0,2,3)
+ *   FRAG(1) ------------------------------>
+ *   FRAG(4, ack req) --------------------->
+ *       <--------------------------- ACK(all, complete)
+ *
+ *  The receiver throws away a partial message when no fragment of it
+ *  arrived for FRAG_REASSEMBLY_TIMEOUT.
+ *
+ *  Sensors use the same messages the other way round: the collector
+ *  reassembles fragments keyed by (source, msgId), acks them and hands
+ *  one data indication with the whole message (which starts with its
+ *  own cmdId) to the application.
+ *
+ *  Transfers use a fixed pool of FRAG_TX_SLOTS buffers, reassembly a
+ *  fixed arena of FRAG_RX_SLOTS buffers, both allocated by Frag_init();
+ *  nothing is allocated per message.
+ *
+ *******************************************************************************
+ */
+#ifndef FRAG_H
+#define FRAG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "api_mac.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Payload bytes carried by one fragment */
+#define FRAG_PAYLOAD_LEN 80
+/*! Most fragments in one message */
+#define FRAG_MAX_FRAGS 255
+/*! Largest message */
+#define FRAG_MAX_LEN (FRAG_MAX_FRAGS * FRAG_PAYLOAD_LEN)
+/*! Bytes in a fragment bitmap */
+#define FRAG_BITMAP_LEN ((FRAG_MAX_FRAGS + 7) / 8)
+
+/*! Downlink transfers in flight at the same time (pooled buffers) */
+#define FRAG_TX_SLOTS 8
+/*! Uplink messages reassembled at the same time (arena buffers) */
+#define FRAG_RX_SLOTS 16
+/*! Fragments sent but not acked, per transfer */
+#define FRAG_WINDOW 4
+/*! Times one fragment is sent before the transfer fails */
+#define FRAG_MAX_TRIES 4
+/*! Ack timeout for devices that are always on, in milliseconds */
+#define FRAG_ACK_TIMEOUT 1000
+/*! Receiver drops a partial message after this long, in milliseconds,
+    default for Frag_reassemblyTimeout_mSecs */
+#define FRAG_REASSEMBLY_TIMEOUT 30000
+/*! Timer tick while transfers are active, in milliseconds */
+#define FRAG_TICK 250
+
+/*! Fragment flags */
+#define FRAG_FLAG_ACK_REQ 0x01
+/*! Ack flags */
+#define FRAG_ACK_COMPLETE 0x01
+
+/*! Fragmentation status values */
+typedef enum
+{
+    /*! Success */
+    Frag_status_success = 0,
+    /*! All transfer slots are in use */
+    Frag_status_busy = 1,
+    /*! Message too long */
+    Frag_status_tooLong = 2,
+    /*! A fragment was sent FRAG_MAX_TRIES times without an ack */
+    Frag_status_timeout = 3,
+    /*! Could not hand a fragment to the MAC */
+    Frag_status_sendFailed = 4
+} Frag_status_t;
+
+/*! Outcome of one downlink transfer */
+typedef struct
+{
+    /*! Destination */
+    uint16_t dstShortAddr;
+    /*! Message id used on the air */
+    uint8_t msgId;
+    /*! How it ended */
+    Frag_status_t status;
+    /*! Message length and number of fragments */
+    uint16_t len;
+    uint8_t numFrags;
+    /*! Fragments sent, including the retransmits */
+    uint16_t fragsSent;
+    uint16_t retransmits;
+    /*! Time from Frag_send() until the last ack (or failure) */
+    uint32_t durationMs;
+    /*! Correlation id and connection passed to Frag_send(), if any */
+    bool hasCorrId;
+    uint32_t corrId;
+    int connId;
+} Frag_txResult_t;
+
+/*! Fragmentation statistics */
+typedef struct
+{
+    /*! Messages accepted by Frag_send() */
+    uint32_t txMessages;
+    /*! Messages completely acked */
+    uint32_t txCompleted;
+    /*! Messages given up on */
+    uint32_t txFailed;
+    /*! Messages refused because all slots were in use */
+    uint32_t txBusy;
+    /*! Fragments sent, including retransmits */
+    uint32_t txFragments;
+    /*! Fragments sent again */
+    uint32_t txRetransmits;
+    /*! Bytes of completed messages */
+    uint32_t txBytesAcked;
+    /*! Time spent on completed messages, in milliseconds */
+    uint32_t txMsAcked;
+    /*! Uplink fragments received */
+    uint32_t rxFragments;
+    /*! Uplink fragments not following the previous one of the message */
+    uint32_t rxOutOfOrder;
+    /*! Uplink fragments received again */
+    uint32_t rxDuplicates;
+    /*! Uplink fragments thrown away: bad header or no free buffer */
+    uint32_t rxDropped;
+    /*! Uplink messages reassembled and delivered */
+    uint32_t rxCompleted;
+    /*! Partial uplink messages dropped after the reassembly timeout */
+    uint32_t rxExpired;
+} Frag_statistics_t;
+
+/*!
+ * Radio access and event functions, provided by the application
+ */
+typedef struct
+{
+    /*! Send one fragment (a complete MSDU), true if the MAC took it */
+    bool (*pSendFxn)(uint16_t dstShortAddr, bool rxOnIdle,
+                     uint8_t *pMsg, uint16_t len);
+    /*! A transfer ended */
+    void (*pTxDoneFxn)(const Frag_txResult_t *pResult);
+    /*! Start (ms > 0) or stop (0) the clock that calls Frag_process() */
+    void (*pSetClockFxn)(uint32_t ms);
+    /*! A reassembled uplink message, valid during the call only */
+    void (*pRxDoneFxn)(ApiMac_mcpsDataInd_t *pDataInd);
+} Frag_fxns_t;
+
+/******************************************************************************
+ Global Variables
+ *****************************************************************************/
+
+/*! Fragmentation statistics */
+extern Frag_statistics_t Frag_statistics;
+
+/*! Partial uplink messages are dropped after this long (ini setting) */
+extern uint32_t Frag_reassemblyTimeout_mSecs;
+
+/******************************************************************************
+ Function Prototypes
+ *****************************************************************************/
+
+/*!
+ * @brief Initialize the fragmentation module and its buffer pool
+ *
+ * @param pFxns - radio access and event functions
+ */
+extern void Frag_init(const Frag_fxns_t *pFxns);
+
+/*!
+ * @brief Copy the statistics, all counters from the same moment
+ *
+ * @param pStats - where to put them
+ */
+extern void Frag_getStatistics(Frag_statistics_t *pStats);
+
+/*!
+ * @brief Start sending a message in fragments
+ *
+ * @param dstShortAddr - destination device
+ * @param rxOnIdle - false for sleepy devices (indirect)
+ * @param pollInterval - for sleepy devices, its polling interval in ms
+ * @param pData - the message, copied into a pool buffer
+ * @param len - message length
+ * @param pCorrId - correlation id echoed in the result, NULL: none
+ * @param connId - echoed in the result with the correlation id
+ *
+ * @return Frag_status_success, Frag_status_busy or Frag_status_tooLong
+ */
+extern Frag_status_t Frag_send(uint16_t dstShortAddr, bool rxOnIdle,
+                               uint32_t pollInterval,
+                               const uint8_t *pData, uint16_t len,
+                               const uint32_t *pCorrId, int connId);
+
+/*!
+ * @brief Process a Smsgs_cmdIds_customFragAck message
+ *
+ * @param pDataInd - the data indication, source is a short address
+ */
+extern void Frag_processAck(ApiMac_mcpsDataInd_t *pDataInd);
+
+/*!
+ * @brief Process a Smsgs_cmdIds_customFrag message from a sensor
+ *
+ * @param pDataInd - the data indication, source is a short address
+ * @param rxOnIdle - false if the sensor is sleepy (acks go indirect)
+ */
+extern void Frag_processFragment(ApiMac_mcpsDataInd_t *pDataInd,
+                                 bool rxOnIdle);
+
+/*!
+ * @brief Clock event: handle ack timeouts, keep the windows full and
+ *        drop stale partial messages
+ */
+extern void Frag_process(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAG_H */
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
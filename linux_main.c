@@ -21,6 +21,7 @@
 #include "ini_file.h"       /* This reads our ini file */
 #include "log.h"            /* Our logging scheme */
 #include "timer.h"
+#include "threads.h"
 #include "fatal.h"
 #include "stream.h"
 #include "stream_socket.h"  /* We use a socket in our app */
@@ -29,10 +30,15 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "cllc.h"
+#include "collector.h"
+#include "frag.h"
 #include "nvintf.h"
 #include "nv_linux.h"
+#include "nv_mmap.h"
 #include "ti_154stack_config.h"
 
 
@@ -58,6 +64,7 @@ int linux_FH_BROADCAST_DWELL_TIME = FH_BROADCAST_DWELL_TIME_DEFAULT;
 int linux_CONFIG_TRICKLE_MIN_CLK_DURATION = CONFIG_TRICKLE_MIN_CLK_DURATION_DEFAULT;
 int linux_CONFIG_TRICKLE_MAX_CLK_DURATION = CONFIG_TRICKLE_MAX_CLK_DURATION_DEFAULT;
 bool linux_CONFIG_DOUBLE_TRICKLE_TIMER = CONFIG_DOUBLE_TRICKLE_TIMER_DEFAULT;
+bool linux_CONFIG_CUSTOM_FRAG = CONFIG_CUSTOM_FRAG_DEFAULT;
 bool linux_CONFIG_AUTO_START = CONFIG_AUTO_START_DEFAULT;
 bool linux_CONFIG_SECURE = CONFIG_SECURE_DEFAULT;
 int  linux_CONFIG_PAN_ID = CONFIG_PAN_ID_DEFAULT;
@@ -69,6 +76,7 @@ int linux_CONFIG_MIN_BE = CONFIG_MIN_BE_DEFAULT;
 int linux_CONFIG_MAX_BE = CONFIG_MAX_BE_DEFAULT;
 int linux_CONFIG_MAC_MAX_CSMA_BACKOFFS = CONFIG_MAC_MAX_CSMA_BACKOFFS_DEFAULT;
 int linux_CONFIG_MAX_RETRIES = CONFIG_MAX_RETRIES_DEFAULT;
+int linux_CONFIG_MAX_DEVICES = CONFIG_MAX_DEVICES_DEFAULT;
 
 /*!
  * Called from the linux config file parser as each channel mask is parsed
@@ -175,6 +183,151 @@ static int my_UART_INI_settings(struct ini_parser *pINI, bool *handled)
     return r;
 }
 
+/*
+ * @brief Handle application server items in the gateway socket section.
+ *
+ * @param pINI - ini file parse info
+ * @param handled - set to true if the item was handled
+ * @return 0 success, -1 error
+ */
+static int my_APPSRV_INI_settings(struct ini_parser *pINI, bool *handled)
+{
+    if(pINI->item_name == NULL)
+    {
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "server-mode"))
+    {
+        *handled = true;
+        if(0 == strcmp("threads", pINI->item_value))
+        {
+            appsrv_cfg.server_mode = APPSRV_SERVER_THREADS;
+            return 0;
+        }
+        if(0 == strcmp("epoll", pINI->item_value))
+        {
+            appsrv_cfg.server_mode = APPSRV_SERVER_EPOLL;
+            return 0;
+        }
+        INI_syntaxError(pINI, "unknown server-mode: %s\n", pINI->item_value);
+        return -1;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "rx-batch-window"))
+    {
+        *handled = true;
+        appsrv_cfg.rx_batch_window_mSecs = INI_valueAsInt(pINI);
+        if(appsrv_cfg.rx_batch_window_mSecs < 0)
+        {
+            INI_syntaxError(pINI, "rx-batch-window must be 0 or more\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "rx-batch-max-bytes"))
+    {
+        *handled = true;
+        appsrv_cfg.rx_batch_max_bytes = INI_valueAsInt(pINI);
+        /* the batch has to fit in one MT frame */
+        if((appsrv_cfg.rx_batch_max_bytes < 64) ||
+           (appsrv_cfg.rx_batch_max_bytes > 60000))
+        {
+            INI_syntaxError(pINI, "rx-batch-max-bytes must be 64..60000\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "unix-path"))
+    {
+        *handled = true;
+        INI_dequote(pINI);
+        free((void *)(appsrv_cfg.unix_path));
+        appsrv_cfg.unix_path = NULL;
+        if(pINI->item_value[0])
+        {
+            appsrv_cfg.unix_path = strdup(pINI->item_value);
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "shm-ring"))
+    {
+        *handled = true;
+        INI_dequote(pINI);
+        free((void *)(appsrv_cfg.shm_ring_path));
+        appsrv_cfg.shm_ring_path = NULL;
+        if(pINI->item_value[0])
+        {
+            appsrv_cfg.shm_ring_path = strdup(pINI->item_value);
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "shm-ring-size"))
+    {
+        *handled = true;
+        appsrv_cfg.shm_ring_size = INI_valueAsInt(pINI);
+        if((appsrv_cfg.shm_ring_size < 4096) ||
+           (appsrv_cfg.shm_ring_size & (appsrv_cfg.shm_ring_size - 1)))
+        {
+            INI_syntaxError(pINI, "shm-ring-size must be a power of 2, at least 4096\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "replay-depth"))
+    {
+        *handled = true;
+        appsrv_cfg.replay_depth = INI_valueAsInt(pINI);
+        if((appsrv_cfg.replay_depth < 0) || (appsrv_cfg.replay_depth > 1024))
+        {
+            INI_syntaxError(pINI, "replay-depth must be 0..1024\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "tx-queue-depth"))
+    {
+        *handled = true;
+        appsrv_cfg.txq_depth = INI_valueAsInt(pINI);
+        if(appsrv_cfg.txq_depth < 1)
+        {
+            INI_syntaxError(pINI, "tx-queue-depth must be at least 1\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "tx-queue-overflow"))
+    {
+        *handled = true;
+        if(0 == strcmp("drop-oldest", pINI->item_value))
+        {
+            appsrv_cfg.txq_overflow = APPSRV_TXQ_DROP_OLDEST;
+            return 0;
+        }
+        if(0 == strcmp("drop-newest", pINI->item_value))
+        {
+            appsrv_cfg.txq_overflow = APPSRV_TXQ_DROP_NEWEST;
+            return 0;
+        }
+        if(0 == strcmp("disconnect", pINI->item_value))
+        {
+            appsrv_cfg.txq_overflow = APPSRV_TXQ_DISCONNECT;
+            return 0;
+        }
+        INI_syntaxError(pINI, "unknown tx-queue-overflow: %s\n",
+                        pINI->item_value);
+        return -1;
+    }
+    return 0;
+}
+
 /*
  * @brief Handle socket settings for our two sockets.
  *
@@ -193,6 +346,11 @@ static int my_SOCKET_INI_settings(struct ini_parser *pINI, bool *handled)
     }
     if(INI_itemMatches(pINI, "appClient-socket-cfg", NULL))
     {
+        r = my_APPSRV_INI_settings(pINI, handled);
+        if(*handled)
+        {
+            return r;
+        }
         r = SOCKET_INI_settingsOne(pINI, handled, &appClient_socket_cfg);
     }
     return r;
@@ -282,6 +440,81 @@ static int my_APP_settings(struct ini_parser *pINI, bool *handled)
         return 0;
     }
 
+    if(INI_itemMatches(pINI, NULL, "frag-reassembly-timeout"))
+    {
+        *handled = true;
+        if(INI_valueAsInt(pINI) <= 0)
+        {
+            INI_syntaxError(pINI, "frag-reassembly-timeout must be 1 or more\n");
+            return -1;
+        }
+        Frag_reassemblyTimeout_mSecs = INI_valueAsInt(pINI);
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "tracking-window"))
+    {
+        *handled = true;
+        Collector_trackingWindow = INI_valueAsInt(pINI);
+        if((Collector_trackingWindow < 1) ||
+           (Collector_trackingWindow > COLLECTOR_TRACKING_WINDOW_MAX))
+        {
+            INI_syntaxError(pINI, "tracking-window must be 1..%d\n",
+                            COLLECTOR_TRACKING_WINDOW_MAX);
+            return -1;
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "nv-flush-interval"))
+    {
+        *handled = true;
+        if(INI_valueAsInt(pINI) < 0)
+        {
+            INI_syntaxError(pINI, "nv-flush-interval must be 0 or more\n");
+            return -1;
+        }
+        Csf_journalFlush_mSecs = INI_valueAsInt(pINI);
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "nv-flush-count"))
+    {
+        *handled = true;
+        if(INI_valueAsInt(pINI) < 1)
+        {
+            INI_syntaxError(pINI, "nv-flush-count must be at least 1\n");
+            return -1;
+        }
+        Csf_journalFlushCount = INI_valueAsInt(pINI);
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "nv-log-file"))
+    {
+        *handled = true;
+        INI_dequote(pINI);
+        free(NVMMAP_fileName);
+        NVMMAP_fileName = NULL;
+        if(pINI->item_value[0])
+        {
+            NVMMAP_fileName = strdup(pINI->item_value);
+        }
+        return 0;
+    }
+
+    if(INI_itemMatches(pINI, NULL, "nv-log-size"))
+    {
+        *handled = true;
+        if(INI_valueAsInt(pINI) < NVMMAP_FILE_SIZE_MIN)
+        {
+            INI_syntaxError(pINI, "nv-log-size must be at least 65536\n");
+            return -1;
+        }
+        NVMMAP_fileSize = INI_valueAsInt(pINI);
+        return 0;
+    }
+
     if(INI_itemMatches(pINI, NULL, "config-reporting-interval")){
         linux_CONFIG_REPORTING_INTERVAL = INI_valueAsInt(pINI);
         *handled = true;
@@ -341,6 +574,20 @@ static int my_APP_settings(struct ini_parser *pINI, bool *handled)
 		return 0;
 	}
 
+	if(INI_itemMatches(pINI, NULL, "config-max-devices"))
+	{
+		*handled = true;
+		linux_CONFIG_MAX_DEVICES = INI_valueAsInt(pINI);
+		if((linux_CONFIG_MAX_DEVICES < 1) ||
+		   (linux_CONFIG_MAX_DEVICES > CONFIG_MAX_DEVICES_LIMIT))
+		{
+			INI_syntaxError(pINI, "config-max-devices must be 1..%d\n",
+			                CONFIG_MAX_DEVICES_LIMIT);
+			return -1;
+		}
+		return 0;
+	}
+
 	if(INI_itemMatches(pINI, NULL, "config-reporting-interval "))
     {
         linux_CONFIG_REPORTING_INTERVAL = INI_valueAsInt(pINI);
@@ -446,6 +693,13 @@ static int my_APP_settings(struct ini_parser *pINI, bool *handled)
         return 0;
     }
 
+    if(INI_itemMatches(pINI, NULL, "config-custom-frag"))
+    {
+        linux_CONFIG_CUSTOM_FRAG = INI_valueAsBool(pINI);
+        *handled = true;
+        return 0;
+    }
+
     if(INI_itemMatches(pINI, NULL, "config-secure"))
     {
         linux_CONFIG_SECURE = INI_valueAsBool(pINI);
@@ -567,12 +821,40 @@ static int cfg_callback(struct ini_parser *pINI, bool *handled)
     return 0;
 }
 
+/*
+ * @brief Wait for SIGINT or SIGTERM, then stop the way the NV journal
+ *        needs, see Csf_shutdown(). The signals are blocked in every
+ *        other thread.
+ */
+static intptr_t signal_thread(intptr_t dummy)
+{
+    sigset_t stop_signals;
+    int sig;
+
+    (void)(dummy);
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    if(sigwait(&stop_signals, &sig) != 0)
+    {
+        return 0;
+    }
+
+    LOG_printf(LOG_ALWAYS, "Signal %d, stopping\n", sig);
+    Csf_shutdown();
+    exit(0);
+#if defined(__linux__)
+    return 0;
+#endif
+}
+
 /* Our main */
 int main(int argc, char **argv)
 {
     int r;
     int x;
     char *cfg_filenames[3];
+    sigset_t stop_signals;
 
     if( argc == 1 )
     {
@@ -605,9 +887,19 @@ int main(int argc, char **argv)
         }
     }
 
+    /* Threads created from here on leave these to signal_thread() */
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+    (void)THREAD_create("signal-thread", signal_thread, 0,
+                        THREAD_FLAGS_DEFAULT);
+
     /* Begin application */
     APP_main();
 
+    /* A thread died, still leave NV clean if we can */
+    Csf_shutdown();
     exit(0);
 }
 
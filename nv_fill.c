@@ -0,0 +1,171 @@
+/******************************************************************************
+
+ @file nv_fill.c
+
+ @brief Fill an NV log with a network of synthetic devices
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/*
+ * Writes the items a collector leaves in NV (network information,
+ * frame counter, device list) to a new nv-log-file, for a network of
+ * any number of devices. A collector started on that log restores the
+ * network and logs how long reading the device list and restoring the
+ * network took, so cold start times can be checked without that many
+ * sensors:
+ *
+ *   make nv_fill
+ *   ./nv_fill collector-nv.log 1000
+ *   (nv-log-file = collector-nv.log in collector.cfg, config-max-devices
+ *    at least 1000)
+ */
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvintf.h"
+#include "nv_mmap.h"
+#include "log.h"
+#include "api_mac.h"
+#include "llc.h"
+#include "collector.h"
+#include "csf.h"
+#include "csf_linux.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! PAN of the synthetic network */
+#define NV_FILL_PAN_ID 0xACDC
+/*! Short address of the first device, the others follow */
+#define NV_FILL_FIRST_SHORT 0x0001
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief write one item, give up on failure
+ */
+static void fillItem(NVINTF_nvFuncts_t *pNV, uint16_t itemID, uint16_t subID,
+                     uint16_t len, void *pBuf)
+{
+    NVINTF_itemID_t id;
+
+    id.systemID = NVINTF_SYSID_APP;
+    id.itemID = itemID;
+    id.subID = subID;
+    if(pNV->writeItem(id, len, pBuf) != NVINTF_SUCCESS)
+    {
+        fprintf(stderr, "nv_fill: cannot write item %d/%d\n", itemID,
+                subID);
+        exit(1);
+    }
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    NVINTF_nvFuncts_t nv;
+    Llc_netInfo_t netInfo;
+    Llc_deviceListItem_t item;
+    uint32_t frameCounter = 0;
+    uint16_t numDevices;
+    uint8_t clean = 1;
+    int n;
+    int x;
+
+    if((argc < 3) || (argc > 4))
+    {
+        fprintf(stderr, "usage: %s NV-LOG-FILE DEVICES [LOG-SIZE]\n",
+                argv[0]);
+        return (1);
+    }
+    n = atoi(argv[2]);
+    if((n < 0) || (n > 0xFFFE))
+    {
+        fprintf(stderr, "nv_fill: DEVICES must be 0..65534\n");
+        return (1);
+    }
+    if(argc == 4)
+    {
+        NVMMAP_fileSize = (uint32_t)strtoul(argv[3], NULL, 0);
+    }
+
+    LOG_init("/dev/stderr");
+
+    /* a fresh log, not items on top of an old network */
+    unlink(argv[1]);
+    NVMMAP_loadApiPtrs(&nv);
+    if(nv.initNV(argv[1]) != NVINTF_SUCCESS)
+    {
+        fprintf(stderr, "nv_fill: cannot open %s\n", argv[1]);
+        return (1);
+    }
+
+    memset(&netInfo, 0, sizeof(netInfo));
+    netInfo.devInfo.panID = NV_FILL_PAN_ID;
+    netInfo.devInfo.shortAddress = 0xAABB;
+    netInfo.channel = 0;
+    netInfo.fh = false;
+    fillItem(&nv, CSF_NV_NETWORK_INFO_ID, 0, sizeof(netInfo), &netInfo);
+    fillItem(&nv, CSF_NV_FRAMECOUNTER_ID, 0, sizeof(frameCounter),
+             &frameCounter);
+
+    /* sleepy devices, as most of a large network is */
+    for(x = 0; x < n; x++)
+    {
+        memset(&item, 0, sizeof(item));
+        item.devInfo.panID = NV_FILL_PAN_ID;
+        item.devInfo.shortAddress = (uint16_t)(NV_FILL_FIRST_SHORT + x);
+        item.devInfo.extAddress[0] = (uint8_t)(x & 0xFF);
+        item.devInfo.extAddress[1] = (uint8_t)((x >> 8) & 0xFF);
+        item.devInfo.extAddress[6] = 0x4B;
+        item.devInfo.extAddress[7] = 0x12;
+        item.capInfo.rxOnWhenIdle = false;
+        item.rxFrameCounter = 0;
+        fillItem(&nv, CSF_NV_DEVICELIST_ID, (uint16_t)x, sizeof(item),
+                 &item);
+    }
+    numDevices = (uint16_t)n;
+    fillItem(&nv, CSF_NV_DEVICELIST_ENTRIES_ID, 0, sizeof(numDevices),
+             &numDevices);
+
+    /* as if the collector stopped cleanly */
+    fillItem(&nv, CSF_NV_CLEAN_SHUTDOWN_ID, 0, sizeof(clean), &clean);
+
+    printf("%s: network of %d devices\n", argv[1], n);
+    return (0);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
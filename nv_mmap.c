@@ -0,0 +1,1054 @@
+/******************************************************************************
+
+ @file nv_mmap.c
+
+ @brief Log structured NV driver on a memory mapped file
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nv_mmap.h"
+#include "log.h"
+#include "mutex.h"
+#include "threads.h"
+#include "ti_semaphore.h"
+#include "fatal.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! "NVLG", start of the file */
+#define NVMMAP_FILE_MAGIC 0x474c564e
+#define NVMMAP_FILE_VERSION 1
+/*! "NVRC", start of every record, written last */
+#define NVMMAP_REC_MAGIC 0x4352564e
+
+/*! Record flag: the item was deleted (no data) */
+#define NVMMAP_REC_DELETED 0x01
+
+/*! Index hash buckets */
+#define NVMMAP_BUCKETS 4096
+
+/*! Returned in *pSubId by readContItem() when nothing matched */
+#define NVMMAP_INVALID_SUBID 0xFFFF
+
+/*! Compact in the background when the log is this full (percent) ... */
+#define NVMMAP_COMPACT_FILL 75
+/*! ... and at most this much of it is still live (percent) */
+#define NVMMAP_COMPACT_LIVE 50
+
+/*! New file of a background compaction ... */
+#define NVMMAP_TMP_SUFFIX ".tmp"
+/*! ... and of one for room, which may run while the other syncs */
+#define NVMMAP_ROOM_SUFFIX ".room"
+
+/*! Records are 4 byte aligned in the file */
+#define NVMMAP_ALIGN(n) (((n) + 3) & ~3u)
+#define NVMMAP_REC_SIZE(len) NVMMAP_ALIGN(sizeof(nvRecHdr_t) + (len))
+
+/*! Start of the file */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    /*! File size when it was created */
+    uint32_t size;
+    uint32_t reserved;
+} nvFileHdr_t;
+
+/*! Start of every record, the data follows */
+typedef struct
+{
+    uint32_t magic;
+    /*! CRC-32 of the rest of this header and the data */
+    uint32_t crc;
+    uint16_t itemID;
+    uint16_t subID;
+    uint16_t len;
+    uint8_t systemID;
+    uint8_t flags;
+} nvRecHdr_t;
+
+/*! Index entry: where the newest record of an item is */
+typedef struct
+{
+    bool inUse;
+    uint8_t systemID;
+    uint16_t itemID;
+    uint16_t subID;
+    /*! Record offset in the file */
+    uint32_t offset;
+    /*! Next entry in the bucket (or the free list), -1: none */
+    int32_t next;
+} nvIdx_t;
+
+/*! Where a compaction put a record */
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+} nvMove_t;
+
+/*! A compaction in progress */
+typedef struct
+{
+    /*! The new file and its mapping */
+    char *pTmp;
+    uint8_t *pMap;
+    uint32_t size;
+    /*! Where the next record goes in it */
+    uint32_t pos;
+    /*! The copied records, sorted by their old offset */
+    nvMove_t *pMoves;
+    uint32_t nMoves;
+    /*! The log was copied up to here ... */
+    uint32_t copiedTail;
+    /*! ... and had been replaced this often */
+    uint32_t gen;
+} nvCompact_t;
+
+/******************************************************************************
+ Global variables
+ *****************************************************************************/
+
+/*! The log file, NULL: not used */
+char *NVMMAP_fileName = NULL;
+
+/*! Size of the log file */
+uint32_t NVMMAP_fileSize = NVMMAP_FILE_SIZE;
+
+/******************************************************************************
+ Local variables
+ *****************************************************************************/
+
+static intptr_t nvMutex;
+static intptr_t nvCompactSem;
+static char *pNvPath;
+/*! The mapping, NULL until initNV() succeeded */
+static uint8_t *pNvMap;
+static uint32_t nvMapSize;
+/*! Where the next record goes */
+static uint32_t nvTail;
+/*! Bytes of records the index points at */
+static uint32_t nvLiveBytes;
+/*! The compaction thread has been woken up */
+static bool nvCompactPending;
+/*! Times the log was replaced by a compaction */
+static uint32_t nvGen;
+
+static int32_t nvBuckets[NVMMAP_BUCKETS];
+static nvIdx_t *pNvIdx;
+static int32_t nvIdxSize;
+static int32_t nvIdxFree = -1;
+
+static uint32_t crcTable[256];
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+static void crcInit(void)
+{
+    uint32_t c;
+    int x;
+    int y;
+
+    for(x = 0; x < 256; x++)
+    {
+        c = (uint32_t)x;
+        for(y = 0; y < 8; y++)
+        {
+            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        }
+        crcTable[x] = c;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *pBuf, uint32_t len)
+{
+    crc = ~crc;
+    while(len--)
+    {
+        crc = crcTable[(crc ^ *pBuf++) & 0xFF] ^ (crc >> 8);
+    }
+    return (~crc);
+}
+
+/*!
+ * @brief CRC of a record, everything after the crc field
+ */
+static uint32_t recCrc(const nvRecHdr_t *pHdr)
+{
+    uint32_t crc;
+
+    crc = crc32(0, (const uint8_t *)&pHdr->itemID,
+                sizeof(nvRecHdr_t) - offsetof(nvRecHdr_t, itemID));
+    return (crc32(crc, (const uint8_t *)(pHdr + 1), pHdr->len));
+}
+
+static uint32_t hashId(uint8_t systemID, uint16_t itemID, uint16_t subID)
+{
+    uint32_t h;
+
+    h = ((uint32_t)systemID << 24) ^ ((uint32_t)itemID << 12) ^ subID;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    return (h % NVMMAP_BUCKETS);
+}
+
+/*!
+ * @brief find an item in the index
+ *
+ * @return index entry, -1 if not found
+ */
+static int32_t idxFind(NVINTF_itemID_t id)
+{
+    int32_t x;
+
+    x = nvBuckets[hashId(id.systemID, id.itemID, id.subID)];
+    while(x >= 0)
+    {
+        nvIdx_t *pIdx = &pNvIdx[x];
+
+        if((pIdx->systemID == id.systemID) && (pIdx->itemID == id.itemID)
+           && (pIdx->subID == id.subID))
+        {
+            break;
+        }
+        x = pIdx->next;
+    }
+    return (x);
+}
+
+/*!
+ * @brief point an item at a new record
+ *
+ * @return false if out of memory
+ */
+static bool idxSet(NVINTF_itemID_t id, uint32_t offset, uint16_t len)
+{
+    int32_t x = idxFind(id);
+    uint32_t bucket;
+
+    if(x >= 0)
+    {
+        nvRecHdr_t *pOld = (nvRecHdr_t *)(pNvMap + pNvIdx[x].offset);
+
+        nvLiveBytes -= NVMMAP_REC_SIZE(pOld->len);
+        pNvIdx[x].offset = offset;
+        nvLiveBytes += NVMMAP_REC_SIZE(len);
+        return (true);
+    }
+
+    if(nvIdxFree < 0)
+    {
+        int32_t newSize = nvIdxSize ? (nvIdxSize * 2) : 256;
+        nvIdx_t *pNew;
+
+        pNew = realloc(pNvIdx, newSize * sizeof(nvIdx_t));
+        if(pNew == NULL)
+        {
+            return (false);
+        }
+        pNvIdx = pNew;
+        for(x = newSize - 1; x >= nvIdxSize; x--)
+        {
+            pNvIdx[x].inUse = false;
+            pNvIdx[x].next = nvIdxFree;
+            nvIdxFree = x;
+        }
+        nvIdxSize = newSize;
+    }
+
+    x = nvIdxFree;
+    nvIdxFree = pNvIdx[x].next;
+
+    bucket = hashId(id.systemID, id.itemID, id.subID);
+    pNvIdx[x].inUse = true;
+    pNvIdx[x].systemID = id.systemID;
+    pNvIdx[x].itemID = id.itemID;
+    pNvIdx[x].subID = id.subID;
+    pNvIdx[x].offset = offset;
+    pNvIdx[x].next = nvBuckets[bucket];
+    nvBuckets[bucket] = x;
+    nvLiveBytes += NVMMAP_REC_SIZE(len);
+    return (true);
+}
+
+/*!
+ * @brief take an item out of the index
+ */
+static void idxRemove(NVINTF_itemID_t id)
+{
+    int32_t *pLink = &nvBuckets[hashId(id.systemID, id.itemID, id.subID)];
+
+    while(*pLink >= 0)
+    {
+        nvIdx_t *pIdx = &pNvIdx[*pLink];
+
+        if((pIdx->systemID == id.systemID) && (pIdx->itemID == id.itemID)
+           && (pIdx->subID == id.subID))
+        {
+            int32_t x = *pLink;
+            nvRecHdr_t *pOld = (nvRecHdr_t *)(pNvMap + pIdx->offset);
+
+            nvLiveBytes -= NVMMAP_REC_SIZE(pOld->len);
+            *pLink = pIdx->next;
+            pIdx->inUse = false;
+            pIdx->next = nvIdxFree;
+            nvIdxFree = x;
+            return;
+        }
+        pLink = &pIdx->next;
+    }
+}
+
+/*!
+ * @brief map a log file, creating or growing it to at least size bytes
+ *
+ * @return the mapping, NULL on error; *pSize is the mapped size
+ */
+static uint8_t *mapFile(const char *pPath, int flags, uint32_t size,
+                        uint32_t *pSize)
+{
+    struct stat st;
+    uint8_t *pMap;
+    int fd;
+
+    fd = open(pPath, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0644);
+    if(fd < 0)
+    {
+        LOG_printf(LOG_ERROR, "nv: cannot open %s: %s\n", pPath,
+                   strerror(errno));
+        return (NULL);
+    }
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return (NULL);
+    }
+
+    /* never cut an existing log short */
+    if((uint64_t)st.st_size > size)
+    {
+        size = (uint32_t)st.st_size;
+    }
+    if(((uint64_t)st.st_size < size) && (ftruncate(fd, (off_t)size) != 0))
+    {
+        LOG_printf(LOG_ERROR, "nv: cannot size %s: %s\n", pPath,
+                   strerror(errno));
+        close(fd);
+        return (NULL);
+    }
+
+    pMap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pMap == MAP_FAILED)
+    {
+        LOG_printf(LOG_ERROR, "nv: cannot map %s: %s\n", pPath,
+                   strerror(errno));
+        return (NULL);
+    }
+    *pSize = size;
+    return (pMap);
+}
+
+/*!
+ * @brief build the index from the log, find its end
+ */
+static void scanLog(void)
+{
+    uint32_t pos = sizeof(nvFileHdr_t);
+    uint32_t records = 0;
+    uint32_t end;
+
+    while((pos + sizeof(nvRecHdr_t)) <= nvMapSize)
+    {
+        nvRecHdr_t *pHdr = (nvRecHdr_t *)(pNvMap + pos);
+        NVINTF_itemID_t id;
+
+        if((pHdr->magic != NVMMAP_REC_MAGIC)
+           || ((pos + NVMMAP_REC_SIZE(pHdr->len)) > nvMapSize)
+           || (recCrc(pHdr) != pHdr->crc))
+        {
+            break;
+        }
+
+        id.systemID = pHdr->systemID;
+        id.itemID = pHdr->itemID;
+        id.subID = pHdr->subID;
+        if(pHdr->flags & NVMMAP_REC_DELETED)
+        {
+            idxRemove(id);
+        }
+        else if(idxSet(id, pos, pHdr->len) == false)
+        {
+            BUG_HERE("No memory\n");
+        }
+        records++;
+        pos += NVMMAP_REC_SIZE(pHdr->len);
+    }
+    nvTail = pos;
+
+    /* whatever a cut short write left behind */
+    end = pos + NVMMAP_REC_SIZE(0xFFFF);
+    if(end > nvMapSize)
+    {
+        end = nvMapSize;
+    }
+    memset(pNvMap + pos, 0, end - pos);
+
+    LOG_printf(LOG_ALWAYS, "nv: %s: %u records, %u of %u bytes used\n",
+               pNvPath, (unsigned)records, (unsigned)nvTail,
+               (unsigned)nvMapSize);
+}
+
+/*!
+ * @brief sync the directory of the log, so a rename in it is on disk
+ */
+static void syncDir(void)
+{
+    char *pDir;
+    char *pSlash;
+    int fd;
+
+    pDir = strdup(pNvPath);
+    if(pDir == NULL)
+    {
+        return;
+    }
+    pSlash = strrchr(pDir, '/');
+    if(pSlash == NULL)
+    {
+        strcpy(pDir, ".");
+    }
+    else if(pSlash == pDir)
+    {
+        pSlash[1] = 0;
+    }
+    else
+    {
+        *pSlash = 0;
+    }
+
+    fd = open(pDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if((fd < 0) || (fsync(fd) != 0))
+    {
+        LOG_printf(LOG_ERROR, "nv: cannot sync %s: %s\n", pDir,
+                   strerror(errno));
+    }
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    free(pDir);
+}
+
+static int cmpMove(const void *pA, const void *pB)
+{
+    uint32_t a = ((const nvMove_t *)pA)->from;
+    uint32_t b = ((const nvMove_t *)pB)->from;
+
+    return ((a > b) - (a < b));
+}
+
+/*!
+ * @brief throw a compaction away, the log stays as it is
+ */
+static void compactAbort(nvCompact_t *pC)
+{
+    if(pC->pMap != NULL)
+    {
+        munmap(pC->pMap, pC->size);
+        unlink(pC->pTmp);
+    }
+    free(pC->pTmp);
+    free(pC->pMoves);
+    memset(pC, 0, sizeof(*pC));
+}
+
+/*!
+ * @brief first step of a compaction: copy the live records to a new
+ *        file, lock held
+ *
+ * @param pC - the compaction
+ * @param pSuffix - of the new file, the two kinds of compaction may
+ *                  overlap and must not share it
+ *
+ * @return false on error
+ */
+static bool compactCopy(nvCompact_t *pC, const char *pSuffix)
+{
+    nvFileHdr_t *pFileHdr;
+    int32_t x;
+
+    memset(pC, 0, sizeof(*pC));
+    pC->pTmp = malloc(strlen(pNvPath) + strlen(pSuffix) + 1);
+    pC->pMoves = malloc((nvIdxSize ? nvIdxSize : 1) * sizeof(nvMove_t));
+    if((pC->pTmp == NULL) || (pC->pMoves == NULL))
+    {
+        compactAbort(pC);
+        return (false);
+    }
+    sprintf(pC->pTmp, "%s%s", pNvPath, pSuffix);
+
+    pC->pMap = mapFile(pC->pTmp, O_TRUNC, nvMapSize, &pC->size);
+    if(pC->pMap == NULL)
+    {
+        compactAbort(pC);
+        return (false);
+    }
+
+    pFileHdr = (nvFileHdr_t *)pC->pMap;
+    pFileHdr->magic = NVMMAP_FILE_MAGIC;
+    pFileHdr->version = NVMMAP_FILE_VERSION;
+    pFileHdr->size = pC->size;
+    pFileHdr->reserved = 0;
+
+    pC->pos = sizeof(nvFileHdr_t);
+    for(x = 0; x < nvIdxSize; x++)
+    {
+        if(pNvIdx[x].inUse)
+        {
+            nvRecHdr_t *pHdr = (nvRecHdr_t *)(pNvMap + pNvIdx[x].offset);
+            uint32_t size = NVMMAP_REC_SIZE(pHdr->len);
+
+            /* the record moves as is, magic and CRC included */
+            memcpy(pC->pMap + pC->pos, pHdr, size);
+            pC->pMoves[pC->nMoves].from = pNvIdx[x].offset;
+            pC->pMoves[pC->nMoves].to = pC->pos;
+            pC->nMoves++;
+            pC->pos += size;
+        }
+    }
+    qsort(pC->pMoves, pC->nMoves, sizeof(nvMove_t), cmpMove);
+
+    pC->copiedTail = nvTail;
+    pC->gen = nvGen;
+    return (true);
+}
+
+/*!
+ * @brief second step of a compaction: get the new file on disk, needs
+ *        no lock
+ *
+ * @return false on error
+ */
+static bool compactSync(nvCompact_t *pC)
+{
+    int fd;
+
+    fd = open(pC->pTmp, O_RDWR | O_CLOEXEC);
+    if((msync(pC->pMap, pC->size, MS_SYNC) != 0) || (fd < 0)
+       || (fsync(fd) != 0))
+    {
+        LOG_printf(LOG_ERROR, "nv: compaction of %s failed: %s\n", pNvPath,
+                   strerror(errno));
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return (false);
+    }
+    close(fd);
+    return (true);
+}
+
+/*!
+ * @brief last step of a compaction: copy what was written since the
+ *        first step and replace the log with the new file, lock held.
+ *        The directory still needs a syncDir() afterwards.
+ *
+ * @return false if the log was not replaced
+ */
+static bool compactSwap(nvCompact_t *pC)
+{
+    uint32_t more;
+    uint32_t from;
+    nvMove_t key;
+    nvMove_t *pMove;
+    int32_t x;
+
+    /* another compaction replaced the log meanwhile */
+    if(pC->gen != nvGen)
+    {
+        return (false);
+    }
+
+    /* the records written since are copied as they are, in order */
+    more = nvTail - pC->copiedTail;
+    if((pC->pos + more) > pC->size)
+    {
+        return (false);
+    }
+    from = pC->pos;
+    memcpy(pC->pMap + from, pNvMap + pC->copiedTail, more);
+    pC->pos += more;
+    if(more != 0)
+    {
+        (void)msync(pC->pMap, pC->size, MS_ASYNC);
+    }
+
+    if(rename(pC->pTmp, pNvPath) != 0)
+    {
+        LOG_printf(LOG_ERROR, "nv: compaction of %s failed: %s\n", pNvPath,
+                   strerror(errno));
+        return (false);
+    }
+
+    LOG_printf(LOG_ALWAYS, "nv: compacted %s, %u -> %u bytes\n", pNvPath,
+               (unsigned)nvTail, (unsigned)pC->pos);
+
+    for(x = 0; x < nvIdxSize; x++)
+    {
+        if(pNvIdx[x].inUse == false)
+        {
+            continue;
+        }
+        if(pNvIdx[x].offset >= pC->copiedTail)
+        {
+            pNvIdx[x].offset = from + (pNvIdx[x].offset - pC->copiedTail);
+            continue;
+        }
+        key.from = pNvIdx[x].offset;
+        pMove = bsearch(&key, pC->pMoves, pC->nMoves, sizeof(nvMove_t),
+                        cmpMove);
+        if(pMove == NULL)
+        {
+            BUG_HERE("nv: record at %u lost in compaction\n",
+                     (unsigned)key.from);
+        }
+        pNvIdx[x].offset = pMove->to;
+    }
+
+    munmap(pNvMap, nvMapSize);
+    pNvMap = pC->pMap;
+    nvMapSize = pC->size;
+    nvTail = pC->pos;
+    nvGen++;
+
+    /* the mapping is the log now */
+    pC->pMap = NULL;
+    compactAbort(pC);
+    return (true);
+}
+
+/*!
+ * @brief compact the log right away, lock held: a write needs the room
+ *
+ * @return true if the log was replaced
+ */
+static bool compact(void)
+{
+    nvCompact_t c;
+
+    if(compactCopy(&c, NVMMAP_ROOM_SUFFIX) == false)
+    {
+        return (false);
+    }
+    if((compactSync(&c) == false) || (compactSwap(&c) == false))
+    {
+        compactAbort(&c);
+        return (false);
+    }
+    syncDir();
+    return (true);
+}
+
+/*!
+ * @brief the log is mostly dead records
+ */
+static bool compactWanted(void)
+{
+    uint64_t used = nvTail - sizeof(nvFileHdr_t);
+
+    return (((uint64_t)nvTail * 100 >= (uint64_t)nvMapSize * NVMMAP_COMPACT_FILL)
+            && ((uint64_t)nvLiveBytes * 100 <= used * NVMMAP_COMPACT_LIVE));
+}
+
+/*!
+ * @brief compacts the log when a write asks for it
+ */
+static intptr_t compactThread(intptr_t dummy)
+{
+    nvCompact_t c;
+    bool copied;
+    bool synced;
+    bool swapped;
+
+    (void)(dummy);
+    for(;;)
+    {
+        if(SEMAPHORE_waitWithTimeout(nvCompactSem, 1000) <= 0)
+        {
+            continue;
+        }
+        /* the slow part, getting the copy on disk, runs unlocked */
+        MUTEX_lock(nvMutex, -1);
+        copied = compactWanted() && compactCopy(&c, NVMMAP_TMP_SUFFIX);
+        MUTEX_unLock(nvMutex);
+        if(copied == false)
+        {
+            MUTEX_lock(nvMutex, -1);
+            nvCompactPending = false;
+            MUTEX_unLock(nvMutex);
+            continue;
+        }
+
+        synced = compactSync(&c);
+
+        MUTEX_lock(nvMutex, -1);
+        swapped = synced && compactSwap(&c);
+        if(swapped == false)
+        {
+            compactAbort(&c);
+        }
+        nvCompactPending = false;
+        MUTEX_unLock(nvMutex);
+
+        if(swapped)
+        {
+            syncDir();
+        }
+    }
+#if defined(__linux__)
+    return 0;
+#endif
+}
+
+/*!
+ * @brief append a record, lock held
+ *
+ * @return offset of the record, 0 if the log is full
+ */
+static uint32_t appendRec(NVINTF_itemID_t id, uint8_t flags, uint16_t len,
+                          const void *pBuf)
+{
+    uint32_t size = NVMMAP_REC_SIZE(len);
+    nvRecHdr_t *pHdr;
+    uint32_t offset;
+    uintptr_t start;
+    long page;
+
+    if((nvTail + size) > nvMapSize)
+    {
+        /* no room: compact now rather than fail */
+        if((compact() == false) || ((nvTail + size) > nvMapSize))
+        {
+            return (0);
+        }
+    }
+
+    offset = nvTail;
+    pHdr = (nvRecHdr_t *)(pNvMap + offset);
+    pHdr->itemID = id.itemID;
+    pHdr->subID = id.subID;
+    pHdr->len = len;
+    pHdr->systemID = id.systemID;
+    pHdr->flags = flags;
+    if(len > 0)
+    {
+        memcpy(pHdr + 1, pBuf, len);
+    }
+    pHdr->crc = recCrc(pHdr);
+    /* a record counts once its magic is there */
+    __atomic_store_n(&(pHdr->magic), NVMMAP_REC_MAGIC, __ATOMIC_RELEASE);
+    nvTail += size;
+
+    /* start the write back, do not wait for it */
+    page = sysconf(_SC_PAGESIZE);
+    start = (uintptr_t)pHdr & ~((uintptr_t)page - 1);
+    (void)msync((void *)start, ((uintptr_t)pHdr + size) - start, MS_ASYNC);
+
+    if(compactWanted() && (nvCompactPending == false))
+    {
+        nvCompactPending = true;
+        SEMAPHORE_put(nvCompactSem);
+    }
+    return (offset);
+}
+
+/*!
+ * @brief NVINTF initNV
+ */
+static uint8_t nvInitNV(void *param)
+{
+    const char *pPath = param ? (const char *)param : NVMMAP_fileName;
+    nvFileHdr_t *pFileHdr;
+    char *pTmp;
+    int x;
+
+    if(pPath == NULL)
+    {
+        return (NVINTF_BADPARAM);
+    }
+
+    crcInit();
+    for(x = 0; x < NVMMAP_BUCKETS; x++)
+    {
+        nvBuckets[x] = -1;
+    }
+
+    nvMutex = MUTEX_create("nv-mmap");
+    nvCompactSem = SEMAPHORE_create("nv-compact", 0);
+    pNvPath = strdup(pPath);
+    pTmp = malloc(strlen(pPath) + sizeof(NVMMAP_ROOM_SUFFIX));
+    if((nvMutex == 0) || (nvCompactSem == 0) || (pNvPath == NULL)
+       || (pTmp == NULL))
+    {
+        BUG_HERE("cannot create nv-mmap resources\n");
+    }
+
+    /* an unfinished compaction, the old log is still complete */
+    sprintf(pTmp, "%s%s", pPath, NVMMAP_TMP_SUFFIX);
+    unlink(pTmp);
+    sprintf(pTmp, "%s%s", pPath, NVMMAP_ROOM_SUFFIX);
+    unlink(pTmp);
+    free(pTmp);
+
+    pNvMap = mapFile(pPath, 0, NVMMAP_fileSize, &nvMapSize);
+    if(pNvMap == NULL)
+    {
+        return (NVINTF_FAILURE);
+    }
+
+    pFileHdr = (nvFileHdr_t *)pNvMap;
+    if((pFileHdr->magic != NVMMAP_FILE_MAGIC)
+       || (pFileHdr->version != NVMMAP_FILE_VERSION))
+    {
+        if(pFileHdr->magic != 0)
+        {
+            LOG_printf(LOG_ERROR, "nv: %s is not an nv log, starting empty\n",
+                       pPath);
+        }
+        memset(pNvMap, 0, nvMapSize);
+        pFileHdr->version = NVMMAP_FILE_VERSION;
+        pFileHdr->size = nvMapSize;
+        pFileHdr->reserved = 0;
+        pFileHdr->magic = NVMMAP_FILE_MAGIC;
+    }
+
+    scanLog();
+
+    (void)THREAD_create("nv-compact", compactThread, 0, THREAD_FLAGS_DEFAULT);
+
+    /* lots of dead records from the last run */
+    if(compactWanted())
+    {
+        nvCompactPending = true;
+        SEMAPHORE_put(nvCompactSem);
+    }
+    return (NVINTF_SUCCESS);
+}
+
+/*!
+ * @brief NVINTF readItem
+ */
+static uint8_t nvReadItem(NVINTF_itemID_t id, uint16_t offset,
+                          uint16_t length, void *pBuf)
+{
+    uint8_t status = NVINTF_NOTFOUND;
+    int32_t x;
+
+    if(pNvMap == NULL)
+    {
+        return (NVINTF_NOTREADY);
+    }
+
+    MUTEX_lock(nvMutex, -1);
+    x = idxFind(id);
+    if(x >= 0)
+    {
+        nvRecHdr_t *pHdr = (nvRecHdr_t *)(pNvMap + pNvIdx[x].offset);
+
+        if(((uint32_t)offset + length) > pHdr->len)
+        {
+            status = NVINTF_BADLENGTH;
+        }
+        else
+        {
+            memcpy(pBuf, (uint8_t *)(pHdr + 1) + offset, length);
+            status = NVINTF_SUCCESS;
+        }
+    }
+    MUTEX_unLock(nvMutex);
+
+    return (status);
+}
+
+/*!
+ * @brief NVINTF readContItem: the item with the lowest subID, from
+ *        id.subID on, whose bytes at coffset equal cbuffer
+ */
+static uint8_t nvReadContItem(NVINTF_itemID_t id, uint16_t offset,
+                              uint16_t rlength, void *rbuffer,
+                              uint16_t clength, uint16_t coffset,
+                              void *cbuffer, uint16_t *pSubId)
+{
+    nvRecHdr_t *pFound = NULL;
+    int32_t x;
+
+    if(pSubId != NULL)
+    {
+        *pSubId = NVMMAP_INVALID_SUBID;
+    }
+    if(pNvMap == NULL)
+    {
+        return (NVINTF_NOTREADY);
+    }
+
+    MUTEX_lock(nvMutex, -1);
+    for(x = 0; x < nvIdxSize; x++)
+    {
+        nvIdx_t *pIdx = &pNvIdx[x];
+        nvRecHdr_t *pHdr;
+
+        if((pIdx->inUse == false) || (pIdx->systemID != id.systemID)
+           || (pIdx->itemID != id.itemID) || (pIdx->subID < id.subID))
+        {
+            continue;
+        }
+        if((pFound != NULL) && (pIdx->subID >= pFound->subID))
+        {
+            continue;
+        }
+
+        pHdr = (nvRecHdr_t *)(pNvMap + pIdx->offset);
+        if((((uint32_t)coffset + clength) <= pHdr->len)
+           && (((uint32_t)offset + rlength) <= pHdr->len)
+           && (memcmp((uint8_t *)(pHdr + 1) + coffset, cbuffer,
+                      clength) == 0))
+        {
+            pFound = pHdr;
+        }
+    }
+
+    if(pFound != NULL)
+    {
+        memcpy(rbuffer, (uint8_t *)(pFound + 1) + offset, rlength);
+        if(pSubId != NULL)
+        {
+            *pSubId = pFound->subID;
+        }
+    }
+    MUTEX_unLock(nvMutex);
+
+    return ((pFound != NULL) ? NVINTF_SUCCESS : NVINTF_NOTFOUND);
+}
+
+/*!
+ * @brief NVINTF writeItem, creates the item if needed
+ */
+static uint8_t nvWriteItem(NVINTF_itemID_t id, uint16_t length, void *pBuf)
+{
+    uint8_t status = NVINTF_FAILURE;
+    uint32_t offset;
+
+    if(pNvMap == NULL)
+    {
+        return (NVINTF_NOTREADY);
+    }
+
+    MUTEX_lock(nvMutex, -1);
+    offset = appendRec(id, 0, length, pBuf);
+    if((offset != 0) && idxSet(id, offset, length))
+    {
+        status = NVINTF_SUCCESS;
+    }
+    MUTEX_unLock(nvMutex);
+
+    if(status != NVINTF_SUCCESS)
+    {
+        LOG_printf(LOG_ERROR, "nv: %s full, item %d/%d/%d not written\n",
+                   pNvPath, id.systemID, id.itemID, id.subID);
+    }
+    return (status);
+}
+
+/*!
+ * @brief NVINTF deleteItem
+ */
+static uint8_t nvDeleteItem(NVINTF_itemID_t id)
+{
+    uint8_t status = NVINTF_NOTFOUND;
+
+    if(pNvMap == NULL)
+    {
+        return (NVINTF_NOTREADY);
+    }
+
+    MUTEX_lock(nvMutex, -1);
+    if(idxFind(id) >= 0)
+    {
+        /* the item stays until its tombstone is in the log */
+        if(appendRec(id, NVMMAP_REC_DELETED, 0, NULL) != 0)
+        {
+            idxRemove(id);
+            status = NVINTF_SUCCESS;
+        }
+        else
+        {
+            status = NVINTF_FAILURE;
+        }
+    }
+    MUTEX_unLock(nvMutex);
+
+    return (status);
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+/*!
+ Fill in the NV function table.
+
+ Public function defined in nv_mmap.h
+ */
+void NVMMAP_loadApiPtrs(NVINTF_nvFuncts_t *pfn)
+{
+    memset(pfn, 0, sizeof(*pfn));
+    pfn->initNV = nvInitNV;
+    pfn->readItem = nvReadItem;
+    pfn->readContItem = nvReadContItem;
+    pfn->writeItem = nvWriteItem;
+    pfn->deleteItem = nvDeleteItem;
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
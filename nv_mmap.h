@@ -0,0 +1,104 @@
+/******************************************************************************
+
+ @file nv_mmap.h
+
+ @brief Log structured NV driver on a memory mapped file
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+/*!*****************************************************************************
+ *  @file       nv_mmap.h
+ *
+ *  @brief      NVINTF_nvFuncts_t driver on an append only log
+ *
+ *  An alternative to the NV simulation. Items live in one file that is
+ *  mapped into memory. Every write or delete appends a record
+ *  (header, data, CRC-32) at the end of the log, and an in-memory index
+ *  keyed on (systemID, itemID, subID) points at the newest record of
+ *  each item. Reads are copies out of the mapping, writes are appends.
+ *
+ *  At start the log is scanned once to build the index; the scan stops
+ *  at the first record with a bad magic or CRC, which is where a write
+ *  was cut short, and new records go there.
+ *
+ *  When the log is mostly dead records a background thread copies the
+ *  live ones to a new file and renames it over the old one, so a crash
+ *  during compaction leaves the old log intact. Reads and writes go on
+ *  while the new file is synced to disk; the records written meanwhile
+ *  are copied over before the rename. A write that does not fit
+ *  compacts right away.
+ *
+ *******************************************************************************
+ */
+#ifndef NV_MMAP_H
+#define NV_MMAP_H
+
+#include <stdint.h>
+
+#include "nvintf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Default for NVMMAP_fileSize */
+#define NVMMAP_FILE_SIZE (1024 * 1024)
+/*! Smallest file */
+#define NVMMAP_FILE_SIZE_MIN (64 * 1024)
+
+/******************************************************************************
+ Global Variables
+ *****************************************************************************/
+
+/*! The log file, NULL: use the NV simulation instead (ini setting) */
+extern char *NVMMAP_fileName;
+
+/*! Size of the log file in bytes (ini setting) */
+extern uint32_t NVMMAP_fileSize;
+
+/******************************************************************************
+ Function Prototypes
+ *****************************************************************************/
+
+/*!
+ * @brief Fill in the NV function table with this driver
+ *
+ * Sets initNV, readItem, readContItem, writeItem and deleteItem, the
+ * rest of the table is cleared. initNV() takes the file name as its
+ * parameter, NULL means NVMMAP_fileName.
+ *
+ * @param pfn - the function table
+ */
+extern void NVMMAP_loadApiPtrs(NVINTF_nvFuncts_t *pfn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NV_MMAP_H */
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -0,0 +1,256 @@
+/******************************************************************************
+
+ @file sensor_decode.c
+
+ @brief Sensor data message decoder
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_decode.h"
+#include "smsgs.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Frame control combinations of the fixed length fields */
+#define DECODE_MASKS (1 << SENSOR_DECODE_FIELDS)
+
+/*! Number of counters in the message statistics field */
+#define MSG_STATS_COUNT (sizeof(Smsgs_msgStatsField_t) / sizeof(uint16_t))
+
+/*! Copies one field from the air into the message */
+typedef void (*decodeFxn_t)(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+
+/*! One fixed length field */
+typedef struct
+{
+    /*! Length on the air */
+    uint8_t len;
+    /*! Decoder, NULL: skipped (not built into this collector) */
+    decodeFxn_t pFxn;
+} fieldDesc_t;
+
+/******************************************************************************
+ Local Function Prototypes
+ *****************************************************************************/
+
+static void decodeTemp(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+static void decodeLight(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+static void decodeHumidity(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+static void decodeMsgStats(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+static void decodeConfigSettings(Smsgs_sensorMsg_t *pMsg,
+                                 const uint8_t *pBuf);
+#ifdef LPSTK
+static void decodeHallEffect(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+static void decodeAccel(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf);
+#endif
+
+/******************************************************************************
+ Local variables
+ *****************************************************************************/
+
+/*! The fixed length fields in frame control bit order */
+static const fieldDesc_t fields[SENSOR_DECODE_FIELDS] =
+{
+    { 2, decodeTemp },              /* Smsgs_dataFields_tempSensor */
+    { 2, decodeLight },             /* Smsgs_dataFields_lightSensor */
+    { 4, decodeHumidity },          /* Smsgs_dataFields_humiditySensor */
+    { 2 * MSG_STATS_COUNT, decodeMsgStats }, /* Smsgs_dataFields_msgStats */
+    { 8, decodeConfigSettings },    /* Smsgs_dataFields_configSettings */
+#ifdef LPSTK
+    { 4, decodeHallEffect },        /* Smsgs_dataFields_hallEffectSensor */
+    { 8, decodeAccel }              /* Smsgs_dataFields_accelSensor */
+#else
+    /* still skipped over, they come before the variable fields */
+    { 4, NULL },
+    { 8, NULL }
+#endif
+};
+
+/*!
+ For each combination of fixed fields: offset of every field from the
+ end of the header, and in the last column the length of all of them.
+ */
+static uint8_t fieldOffsets[DECODE_MASKS][SENSOR_DECODE_FIELDS + 1];
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief little endian loads, the buffer need not be aligned
+ */
+static inline uint16_t load16(const uint8_t *pBuf)
+{
+    return (uint16_t)(pBuf[0] | (pBuf[1] << 8));
+}
+
+static inline uint32_t load32(const uint8_t *pBuf)
+{
+    return ((uint32_t)pBuf[0] | ((uint32_t)pBuf[1] << 8)
+            | ((uint32_t)pBuf[2] << 16) | ((uint32_t)pBuf[3] << 24));
+}
+
+static void decodeTemp(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf)
+{
+    pMsg->tempSensor.temp = (int16_t)load16(pBuf);
+}
+
+static void decodeLight(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf)
+{
+    pMsg->lightSensor.rawData = load16(pBuf);
+}
+
+static void decodeHumidity(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf)
+{
+    pMsg->humiditySensor.temp = load16(pBuf);
+    pMsg->humiditySensor.humidity = load16(pBuf + 2);
+}
+
+static void decodeMsgStats(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf)
+{
+    /* all members are uint16_t in the order they are sent */
+    uint16_t *pStat = &pMsg->msgStats.joinAttempts;
+    unsigned int x;
+
+    for(x = 0; x < MSG_STATS_COUNT; x++)
+    {
+        pStat[x] = load16(pBuf + (x * 2));
+    }
+}
+
+static void decodeConfigSettings(Smsgs_sensorMsg_t *pMsg,
+                                 const uint8_t *pBuf)
+{
+    pMsg->configSettings.reportingInterval = load32(pBuf);
+    pMsg->configSettings.pollingInterval = load32(pBuf + 4);
+}
+
+#ifdef LPSTK
+static void decodeHallEffect(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf)
+{
+    pMsg->hallEffectSensor.flux = (float)load32(pBuf);
+}
+
+static void decodeAccel(Smsgs_sensorMsg_t *pMsg, const uint8_t *pBuf)
+{
+    pMsg->accelerometerSensor.xAxis = (int16_t)load16(pBuf);
+    pMsg->accelerometerSensor.yAxis = (int16_t)load16(pBuf + 2);
+    pMsg->accelerometerSensor.zAxis = (int16_t)load16(pBuf + 4);
+    pMsg->accelerometerSensor.xTiltDet = pBuf[6];
+    pMsg->accelerometerSensor.yTiltDet = pBuf[7];
+}
+#endif
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+/*!
+ Build the field offset table.
+
+ Public function defined in sensor_decode.h
+ */
+void SensorDecode_init(void)
+{
+    int mask;
+    int x;
+
+    for(mask = 0; mask < DECODE_MASKS; mask++)
+    {
+        uint8_t offset = 0;
+
+        for(x = 0; x < SENSOR_DECODE_FIELDS; x++)
+        {
+            fieldOffsets[mask][x] = offset;
+            if(mask & (1 << x))
+            {
+                offset += fields[x].len;
+            }
+        }
+        fieldOffsets[mask][SENSOR_DECODE_FIELDS] = offset;
+    }
+}
+
+/*!
+ Decode a sensor data message.
+
+ Public function defined in sensor_decode.h
+ */
+SensorDecode_status_t SensorDecode_decode(const uint8_t *pBuf, uint16_t len,
+                                          Smsgs_sensorMsg_t *pMsg,
+                                          uint16_t *pVarOffset)
+{
+    const uint8_t *pData = pBuf + SENSOR_DECODE_HDR_LEN;
+    const uint8_t *pOffsets;
+    int fixed;
+    int x;
+
+    if(len < SENSOR_DECODE_HDR_LEN)
+    {
+        return(SensorDecode_status_tooShort);
+    }
+    if(pBuf[0] != Smsgs_cmdIds_sensorData)
+    {
+        return(SensorDecode_status_badCmdId);
+    }
+
+    /* everything in front of the variable length fields */
+    memset(pMsg, 0, offsetof(Smsgs_sensorMsg_t, bleSensor));
+
+    pMsg->cmdId = Smsgs_cmdIds_sensorData;
+    memcpy(pMsg->extAddress, pBuf + 1, SMGS_SENSOR_EXTADDR_LEN);
+    pMsg->frameControl = load16(pBuf + 1 + SMGS_SENSOR_EXTADDR_LEN);
+
+    fixed = pMsg->frameControl & SENSOR_DECODE_FIXED_MASK;
+    pOffsets = fieldOffsets[fixed];
+    if(len < (SENSOR_DECODE_HDR_LEN + pOffsets[SENSOR_DECODE_FIELDS]))
+    {
+        return(SensorDecode_status_tooShort);
+    }
+
+    for(x = 0; fixed != 0; x++, fixed >>= 1)
+    {
+        if((fixed & 1) && (fields[x].pFxn != NULL))
+        {
+            fields[x].pFxn(pMsg, pData + pOffsets[x]);
+        }
+    }
+
+    if(pVarOffset != NULL)
+    {
+        *pVarOffset = SENSOR_DECODE_HDR_LEN + pOffsets[SENSOR_DECODE_FIELDS];
+    }
+
+    return(SensorDecode_status_success);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -0,0 +1,118 @@
+/******************************************************************************
+
+ @file sensor_decode.h
+
+ @brief Sensor data message decoder
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+/*!*****************************************************************************
+ *  @file       sensor_decode.h
+ *
+ *  @brief      Table driven decoding of Smsgs_cmdIds_sensorData messages
+ *
+ *  The data fields of a sensor data message follow the frame control
+ *  word in bit order, low bit first, and all fields up to and including
+ *  the accelerometer have a fixed length on the air. SensorDecode_init()
+ *  builds a table holding, for every combination of those fixed fields,
+ *  the offset of each field (a prefix sum of the lengths of the fields
+ *  before it) and the total length. Decoding a message is then one
+ *  lookup, one length check and one load per present field; nothing
+ *  walks the buffer field by field.
+ *
+ *  The decoder only reads the message, so the same data indication can
+ *  still be forwarded raw afterwards.
+ *
+ *  The variable length fields (BLE and custom) are not decoded, the
+ *  offset where they start is returned for callers that want them.
+ *
+ *******************************************************************************
+ */
+#ifndef SENSOR_DECODE_H
+#define SENSOR_DECODE_H
+
+#include <stdint.h>
+
+#include "smsgs.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Command id, extended address and frame control */
+#define SENSOR_DECODE_HDR_LEN (1 + SMGS_SENSOR_EXTADDR_LEN + 2)
+/*! Fixed length fields, frame control bits 0 up to this count */
+#define SENSOR_DECODE_FIELDS 7
+/*! Frame control bits of the fixed length fields */
+#define SENSOR_DECODE_FIXED_MASK ((1 << SENSOR_DECODE_FIELDS) - 1)
+
+/*! Decoder status values */
+typedef enum
+{
+    /*! Success */
+    SensorDecode_status_success = 0,
+    /*! Not a sensor data message */
+    SensorDecode_status_badCmdId = 1,
+    /*! Shorter than its frame control says */
+    SensorDecode_status_tooShort = 2
+} SensorDecode_status_t;
+
+/******************************************************************************
+ Function Prototypes
+ *****************************************************************************/
+
+/*!
+ * @brief Build the field offset table
+ */
+extern void SensorDecode_init(void);
+
+/*!
+ * @brief Decode a sensor data message
+ *
+ * Fields not flagged in the frame control are zero, the BLE and custom
+ * fields are left untouched.
+ *
+ * @param pBuf - the message, starting with its command id
+ * @param len - message length
+ * @param pMsg - decoded message
+ * @param pVarOffset - where the variable length fields start, may be NULL
+ *
+ * @return SensorDecode_status_success, SensorDecode_status_badCmdId or
+ *         SensorDecode_status_tooShort
+ */
+extern SensorDecode_status_t SensorDecode_decode(const uint8_t *pBuf,
+                                                 uint16_t len,
+                                                 Smsgs_sensorMsg_t *pMsg,
+                                                 uint16_t *pVarOffset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_DECODE_H */
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
@@ -183,6 +183,16 @@ The <b>Sensor Ramp Data Message</b> is defined as:
 #define SMSGS_SENSOR_BLE_LEN 5 + B_ADDR_LEN
 /* Max BLE Data Length */
 #define MAX_BLE_DATA_LEN 20
+/*!
+ Custom command fragment header length (over-the-air length):
+ cmdId, msgId, flags, index, count, total length (2), then the payload
+ */
+#define SMSGS_CUSTOM_FRAG_HDR_LEN 7
+/*!
+ Custom command fragment ack length (over-the-air length):
+ cmdId, msgId, flags, then a bitmap of the fragments received
+ */
+#define SMSGS_CUSTOM_FRAG_ACK_LEN 35
 
 /*!
  Message IDs for Sensor data messages.  When sent over-the-air in a message,
@@ -224,7 +234,12 @@ The <b>Sensor Ramp Data Message</b> is defined as:
     Smsgs_cmdIds_DeviceTypeReq = 16,
     /* Device type response msg */
     Smsgs_cmdIds_DeviceTypeRsp = 17,
-    Smsgs_cmdIds_customCommand = 19
+    Smsgs_cmdIds_customCommand = 19,
+    /*! Fragment of a long message, sent from the collector to the
+        sensor and from the sensor to the collector (see frag.h) */
+    Smsgs_cmdIds_customFrag = 20,
+    /*! Fragment ack, sent back by the receiver of the fragments */
+    Smsgs_cmdIds_customFragAck = 21
  } Smsgs_cmdIds_t;
 
 /*!
@@ -70,7 +70,11 @@ extern bool linux_CONFIG_FH_ENABLE;
 #define CONFIG_MAX_BEACONS_RECD 200
 
 /*! maximum devices in association table */
-#define CONFIG_MAX_DEVICES           50
+extern int linux_CONFIG_MAX_DEVICES;
+#define CONFIG_MAX_DEVICES           linux_CONFIG_MAX_DEVICES
+#define CONFIG_MAX_DEVICES_DEFAULT   50
+/*! upper bound for config-max-devices, keeps the NV sub IDs in 16 bits */
+#define CONFIG_MAX_DEVICES_LIMIT     16384
 
 /*!
  Setting beacon order to 15 will disable the beacon, 8 is a good value for
@@ -354,6 +358,15 @@ extern bool linux_CONFIG_DOUBLE_TRICKLE_TIMER;
 #define CONFIG_DOUBLE_TRICKLE_TIMER    linux_CONFIG_DOUBLE_TRICKLE_TIMER
 #define CONFIG_DOUBLE_TRICKLE_TIMER_DEFAULT false
 
+/*!
+ Send custom commands that do not fit in one MSDU in fragments. Only
+ for networks whose devices reassemble them, otherwise long commands
+ go out in one MSDU as before.
+*/
+extern bool linux_CONFIG_CUSTOM_FRAG;
+#define CONFIG_CUSTOM_FRAG    linux_CONFIG_CUSTOM_FRAG
+#define CONFIG_CUSTOM_FRAG_DEFAULT false
+
 /*! value for ApiMac_FHAttribute_netName */
 extern char linux_CONFIG_FH_NETNAME[32];
 #define CONFIG_FH_NETNAME            linux_CONFIG_FH_NETNAME
@@ -0,0 +1,397 @@
+/******************************************************************************
+
+ @file timer_wheel.c
+
+ @brief Hierarchical timer wheel for the collector thread
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+
+/******************************************************************************
+ Includes
+ *****************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "mutex.h"
+#include "fatal.h"
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+#define SLOT_MASK (TIMERWHEEL_SLOTS - 1)
+
+/*! Slot of a deadline in a level */
+#define SLOT_OF(ticks, level) \
+    (((ticks) >> ((level) * TIMERWHEEL_SLOT_BITS)) & SLOT_MASK)
+
+/*! Farthest deadline the top level holds, in ticks */
+#define WHEEL_SPAN \
+    ((uint32_t)1 << (TIMERWHEEL_LEVELS * TIMERWHEEL_SLOT_BITS))
+
+/******************************************************************************
+ Local variables
+ *****************************************************************************/
+
+static intptr_t wheelMutex;
+static void (*pSetClock)(uint32_t ms);
+
+static TimerWheel_timer_t *wheel[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+/*! Last tick processed */
+static uint32_t wheelTicks;
+/*! Armed timers */
+static uint32_t wheelCount;
+
+/*! The OS clock is running, and the tick it goes off at */
+static bool clockArmed;
+static uint32_t clockTick;
+
+/******************************************************************************
+ Local Functions
+ *****************************************************************************/
+
+/*!
+ * @brief monotonic time in milliseconds
+ */
+static uint64_t nowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+/*!
+ * @brief hang a timer in the slot for its deadline, lock held
+ */
+static void wheelAdd(TimerWheel_timer_t *pTimer)
+{
+    uint32_t delta = pTimer->expires - wheelTicks;
+    uint32_t slotTicks = pTimer->expires;
+    TimerWheel_timer_t **ppHead;
+    int level;
+
+    if(delta >= WHEEL_SPAN)
+    {
+        /* out of reach, comes back here when the top level turns */
+        slotTicks = wheelTicks + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+
+    for(level = 0; level < (TIMERWHEEL_LEVELS - 1); level++)
+    {
+        if(delta < ((uint32_t)1 << ((level + 1) * TIMERWHEEL_SLOT_BITS)))
+        {
+            break;
+        }
+    }
+
+    ppHead = &wheel[level][SLOT_OF(slotTicks, level)];
+    pTimer->pNext = *ppHead;
+    if(*ppHead != NULL)
+    {
+        (*ppHead)->ppPrev = &pTimer->pNext;
+    }
+    *ppHead = pTimer;
+    pTimer->ppPrev = ppHead;
+}
+
+/*!
+ * @brief take a timer out of its slot, lock held
+ */
+static void wheelUnlink(TimerWheel_timer_t *pTimer)
+{
+    *(pTimer->ppPrev) = pTimer->pNext;
+    if(pTimer->pNext != NULL)
+    {
+        pTimer->pNext->ppPrev = pTimer->ppPrev;
+    }
+    pTimer->pNext = NULL;
+    pTimer->ppPrev = NULL;
+}
+
+/*!
+ * @brief move the timers of a slot down, lock held
+ */
+static void wheelCascade(int level, uint32_t slot)
+{
+    TimerWheel_timer_t *pTimer;
+
+    while((pTimer = wheel[level][slot]) != NULL)
+    {
+        wheelUnlink(pTimer);
+        wheelAdd(pTimer);
+    }
+}
+
+/*!
+ * @brief the tick to wake up at next, lock held. Timers above the
+ *        first level count from when their slot is moved down.
+ *
+ * @return false if no timer is armed
+ */
+static bool wheelNext(uint32_t *pTick)
+{
+    bool found = false;
+    uint32_t base;
+    uint32_t tick;
+    int level;
+    int d;
+
+    if(wheelCount == 0)
+    {
+        return (false);
+    }
+
+    for(level = 0; level < TIMERWHEEL_LEVELS; level++)
+    {
+        base = wheelTicks >> (level * TIMERWHEEL_SLOT_BITS);
+        for(d = 1; d <= TIMERWHEEL_SLOTS; d++)
+        {
+            if(wheel[level][(base + d) & SLOT_MASK] != NULL)
+            {
+                tick = (base + d) << (level * TIMERWHEEL_SLOT_BITS);
+                if((found == false) || ((int32_t)(tick - *pTick) < 0))
+                {
+                    *pTick = tick;
+                    found = true;
+                }
+                break;
+            }
+        }
+    }
+    return (found);
+}
+
+/*!
+ * @brief start the OS clock for a tick, lock held
+ */
+static void clockSet(uint32_t tick)
+{
+    uint64_t now = nowMs();
+    uint32_t ahead = tick - (uint32_t)(now / TIMERWHEEL_TICK);
+    uint64_t ms = 1;
+
+    if(((int32_t)ahead > 0))
+    {
+        ms = ((uint64_t)ahead * TIMERWHEEL_TICK) - (now % TIMERWHEEL_TICK);
+    }
+    clockArmed = true;
+    clockTick = tick;
+    pSetClock((uint32_t)ms);
+}
+
+/******************************************************************************
+ Public Functions
+ *****************************************************************************/
+
+/*!
+ Initialize the wheel
+
+ Public function defined in timer_wheel.h
+ */
+void TimerWheel_init(void (*pSetClockFxn)(uint32_t ms))
+{
+    wheelMutex = MUTEX_create("timer-wheel");
+    if(wheelMutex == 0)
+    {
+        BUG_HERE("cannot create timer wheel mutex\n");
+    }
+    pSetClock = pSetClockFxn;
+    wheelTicks = (uint32_t)(nowMs() / TIMERWHEEL_TICK);
+}
+
+/*!
+ Set up a timer
+
+ Public function defined in timer_wheel.h
+ */
+void TimerWheel_setup(TimerWheel_timer_t *pTimer, TimerWheel_fxn_t pFxn,
+                      intptr_t cookie)
+{
+    pTimer->pNext = NULL;
+    pTimer->ppPrev = NULL;
+    pTimer->expires = 0;
+    pTimer->pFxn = pFxn;
+    pTimer->cookie = cookie;
+}
+
+/*!
+ Arm a timer
+
+ Public function defined in timer_wheel.h
+ */
+void TimerWheel_arm(TimerWheel_timer_t *pTimer, uint32_t ms)
+{
+    uint64_t now = nowMs();
+    /* never early: round the deadline up to a tick */
+    uint32_t expires = (uint32_t)((now + ms + TIMERWHEEL_TICK - 1)
+                                  / TIMERWHEEL_TICK);
+
+    MUTEX_lock(wheelMutex, -1);
+    if(pTimer->ppPrev != NULL)
+    {
+        wheelUnlink(pTimer);
+        wheelCount--;
+    }
+    if(wheelCount == 0)
+    {
+        /* nothing to catch up on */
+        wheelTicks = (uint32_t)(now / TIMERWHEEL_TICK);
+    }
+
+    pTimer->expires = expires;
+    if((int32_t)(pTimer->expires - wheelTicks) <= 0)
+    {
+        pTimer->expires = wheelTicks + 1;
+    }
+    wheelAdd(pTimer);
+    wheelCount++;
+
+    if((clockArmed == false) || ((int32_t)(pTimer->expires - clockTick) < 0))
+    {
+        clockSet(pTimer->expires);
+    }
+    MUTEX_unLock(wheelMutex);
+}
+
+/*!
+ Disarm a timer
+
+ Public function defined in timer_wheel.h
+ */
+void TimerWheel_cancel(TimerWheel_timer_t *pTimer)
+{
+    MUTEX_lock(wheelMutex, -1);
+    if(pTimer->ppPrev != NULL)
+    {
+        /* the clock may go off for nothing, that is cheaper than
+           finding the next deadline now */
+        wheelUnlink(pTimer);
+        wheelCount--;
+    }
+    MUTEX_unLock(wheelMutex);
+}
+
+/*!
+ Is a timer armed
+
+ Public function defined in timer_wheel.h
+ */
+bool TimerWheel_isArmed(TimerWheel_timer_t *pTimer)
+{
+    bool armed;
+
+    MUTEX_lock(wheelMutex, -1);
+    armed = (pTimer->ppPrev != NULL);
+    MUTEX_unLock(wheelMutex);
+
+    return (armed);
+}
+
+/*!
+ Run the timers that are due
+
+ Public function defined in timer_wheel.h
+ */
+void TimerWheel_process(void)
+{
+    TimerWheel_timer_t *pTimer;
+    uint32_t now;
+    uint32_t next;
+    uint32_t slot;
+    int level;
+
+    MUTEX_lock(wheelMutex, -1);
+    /* the clock went off, or is about to */
+    clockArmed = false;
+
+    now = (uint32_t)(nowMs() / TIMERWHEEL_TICK);
+    if(wheelCount == 0)
+    {
+        wheelTicks = now;
+    }
+
+    while((int32_t)(now - wheelTicks) > 0)
+    {
+        wheelTicks++;
+
+        /* a lower level turned over, move the next slot above down */
+        if(SLOT_OF(wheelTicks, 0) == 0)
+        {
+            for(level = 1; level < TIMERWHEEL_LEVELS; level++)
+            {
+                slot = SLOT_OF(wheelTicks, level);
+                wheelCascade(level, slot);
+                if(slot != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        while((pTimer = wheel[0][SLOT_OF(wheelTicks, 0)]) != NULL)
+        {
+            TimerWheel_fxn_t pFxn = pTimer->pFxn;
+            intptr_t cookie = pTimer->cookie;
+
+            wheelUnlink(pTimer);
+            if((int32_t)(pTimer->expires - wheelTicks) > 0)
+            {
+                /* armed while the lock was dropped */
+                wheelAdd(pTimer);
+                continue;
+            }
+            wheelCount--;
+
+            /* the function may arm or cancel timers */
+            MUTEX_unLock(wheelMutex);
+            pFxn(cookie);
+            MUTEX_lock(wheelMutex, -1);
+        }
+
+        if(wheelCount == 0)
+        {
+            wheelTicks = now;
+        }
+    }
+
+    if(wheelNext(&next))
+    {
+        /* an arm while the lock was dropped may have set it already */
+        if((clockArmed == false) || (clockTick != next))
+        {
+            clockSet(next);
+        }
+    }
+    else if(clockArmed == false)
+    {
+        pSetClock(0);
+    }
+    MUTEX_unLock(wheelMutex);
+}
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */
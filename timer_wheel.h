@@ -0,0 +1,150 @@
+/******************************************************************************
+
+ @file timer_wheel.h
+
+ @brief Hierarchical timer wheel for the collector thread
+
+ Group: WCS LPC
+ $Target Device: DEVICES $
+
+ ******************************************************************************
+ $License: BSD3 2016 $
+ ******************************************************************************
+ $Release Name: PACKAGE NAME $
+ $Release Date: PACKAGE RELEASE DATE $
+ *****************************************************************************/
+/*!*****************************************************************************
+ *  @file       timer_wheel.h
+ *
+ *  @brief      Many software timers on one OS timer
+ *
+ *  Timers are TimerWheel_timer_t structures owned by the caller (one
+ *  per device if need be); arming or cancelling one does not allocate
+ *  and takes constant time. They hang in a wheel of
+ *  TIMERWHEEL_LEVELS levels of TIMERWHEEL_SLOTS slots, each level
+ *  TIMERWHEEL_SLOTS times coarser than the one below; a timer moves
+ *  down a level whenever the wheel gets close enough to its deadline.
+ *
+ *  One OS clock, set through the function given to TimerWheel_init(),
+ *  wakes the collector thread for the next deadline, and the collector
+ *  thread calls TimerWheel_process() to run the timers that are due.
+ *  Timers can be armed and cancelled from any thread, their functions
+ *  are only called from TimerWheel_process().
+ *
+ *******************************************************************************
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/******************************************************************************
+ Constants and definitions
+ *****************************************************************************/
+
+/*! Wheel resolution in milliseconds */
+#define TIMERWHEEL_TICK 10
+/*! Bits of the tick count per level */
+#define TIMERWHEEL_SLOT_BITS 6
+/*! Slots per level */
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+/*! Levels, the top one reaches about 46 hours ahead; timers further
+    out wait in the top level until they come into reach */
+#define TIMERWHEEL_LEVELS 4
+
+/*! Called when a timer is due, cookie as given to TimerWheel_setup() */
+typedef void (*TimerWheel_fxn_t)(intptr_t cookie);
+
+/*! A timer, owned by the caller. Set it up with TimerWheel_setup(),
+    the members are private to the wheel. */
+typedef struct TimerWheel_timer_s
+{
+    struct TimerWheel_timer_s *pNext;
+    /*! Link pointing at this timer, NULL: not armed */
+    struct TimerWheel_timer_s **ppPrev;
+    /*! Deadline in ticks */
+    uint32_t expires;
+    TimerWheel_fxn_t pFxn;
+    intptr_t cookie;
+} TimerWheel_timer_t;
+
+/******************************************************************************
+ Function Prototypes
+ *****************************************************************************/
+
+/*!
+ * @brief Initialize the wheel
+ *
+ * @param pSetClockFxn - start (ms > 0) or stop (0) the OS clock whose
+ *                       expiry gets TimerWheel_process() called
+ */
+extern void TimerWheel_init(void (*pSetClockFxn)(uint32_t ms));
+
+/*!
+ * @brief Set up a timer before it is first armed
+ *
+ * @param pTimer - the timer
+ * @param pFxn - called from TimerWheel_process() when it is due
+ * @param cookie - passed to pFxn
+ */
+extern void TimerWheel_setup(TimerWheel_timer_t *pTimer,
+                             TimerWheel_fxn_t pFxn, intptr_t cookie);
+
+/*!
+ * @brief Arm a timer, or move its deadline if it is armed
+ *
+ * @param pTimer - the timer
+ * @param ms - from now, in milliseconds, rounded up to TIMERWHEEL_TICK
+ */
+extern void TimerWheel_arm(TimerWheel_timer_t *pTimer, uint32_t ms);
+
+/*!
+ * @brief Disarm a timer, nothing happens if it is not armed
+ *
+ * A timer whose function TimerWheel_process() already started is not
+ * stopped.
+ *
+ * @param pTimer - the timer
+ */
+extern void TimerWheel_cancel(TimerWheel_timer_t *pTimer);
+
+/*!
+ * @brief Is a timer armed
+ *
+ * @param pTimer - the timer
+ *
+ * @return true if it is waiting for its deadline
+ */
+extern bool TimerWheel_isArmed(TimerWheel_timer_t *pTimer);
+
+/*!
+ * @brief Run the timers that are due and set the OS clock for the
+ *        next deadline. Collector thread only.
+ */
+extern void TimerWheel_process(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_WHEEL_H */
+
+/*
+ *  ========================================
+ *  Texas Instruments Micro Controller Style
+ *  ========================================
+ *  Local Variables:
+ *  mode: c
+ *  c-file-style: "bsd"
+ *  tab-width: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ *  End:
+ *  vim:set  filetype=c tabstop=4 shiftwidth=4 expandtab=true
+ */